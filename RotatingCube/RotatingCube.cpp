@@ -9,6 +9,12 @@ RotatingCube::RotatingCube( UINT width, UINT height, std::wstring name ) :
 HRESULT RotatingCube::OnInit()
 {
 	HRESULT hr;
+	if ( m_headless )
+	{
+		m_timer.SetFixedTimeStep( true );
+		m_timer.SetTargetElapsedSeconds( m_fixedTimeStep );
+		m_timer.SetManualClock( true );
+	}
 	VRET(LoadPipeline());
 	VRET(LoadAssets());
 	VRET(LoadSizeDependentResource());
@@ -70,24 +76,27 @@ HRESULT RotatingCube::LoadPipeline()
 	VRET( m_device->CreateCommandQueue( &queueDesc, IID_PPV_ARGS( &m_commandQueue ) ) );
 	DXDebugName( m_commandQueue );
 
-	// Describe and create the swap chain.
-	DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
-	swapChainDesc.BufferCount = FrameCount;
-	swapChainDesc.BufferDesc.Width = m_width;
-	swapChainDesc.BufferDesc.Height = m_height;
-	swapChainDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-	swapChainDesc.OutputWindow = m_hwnd;
-	swapChainDesc.SampleDesc.Count = 1;
-	swapChainDesc.Windowed = TRUE;
-
-	ComPtr<IDXGISwapChain> swapChain;
-	// Swap chain needs the queue so that it can force a flush on it.
-	VRET( factory->CreateSwapChain(m_commandQueue.Get(),&swapChainDesc,&swapChain) );
-	VRET( swapChain.As( &m_swapChain ) );
-	DXDebugName( m_swapChain );
-	m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	// Describe and create the swap chain, headless runs render offscreen.
+	if ( !m_headless )
+	{
+		DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
+		swapChainDesc.BufferCount = FrameCount;
+		swapChainDesc.BufferDesc.Width = m_width;
+		swapChainDesc.BufferDesc.Height = m_height;
+		swapChainDesc.BufferDesc.Format = BackBufferFormat;
+		swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+		swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		swapChainDesc.OutputWindow = m_hwnd;
+		swapChainDesc.SampleDesc.Count = 1;
+		swapChainDesc.Windowed = TRUE;
+
+		ComPtr<IDXGISwapChain> swapChain;
+		// Swap chain needs the queue so that it can force a flush on it.
+		VRET( factory->CreateSwapChain(m_commandQueue.Get(),&swapChainDesc,&swapChain) );
+		VRET( swapChain.As( &m_swapChain ) );
+		DXDebugName( m_swapChain );
+		m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	}
 
 	// Create descriptor heaps.
 	{
@@ -303,7 +312,7 @@ HRESULT RotatingCube::LoadSizeDependentResource()
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle( m_rtvHeap->GetCPUDescriptorHandleForHeapStart() );
 	for ( UINT i = 0; i < FrameCount; i++ )
 	{
-		VRET( m_swapChain->GetBuffer( i, IID_PPV_ARGS( &m_renderTargets[i] ) ) );
+		VRET( CreateBackBuffer( m_device.Get(), m_swapChain.Get(), i, BackBufferFormat, &m_renderTargets[i] ) );
 		DXDebugName( m_renderTargets[i] );
 		m_device->CreateRenderTargetView( m_renderTargets[i].Get(), nullptr, rtvHandle );
 		rtvHandle.Offset( 1, m_rtvDescriptorSize );
@@ -363,9 +372,11 @@ void RotatingCube::OnRender()
 	m_commandQueue->ExecuteCommandLists( _countof( ppCommandLists ), ppCommandLists );
 
 	// Present the frame.
-	V( m_swapChain->Present( 0, 0 ) );
+	if ( m_swapChain ) V( m_swapChain->Present( 0, 0 ) );
 
 	WaitForPreviousFrame();
+	// Ends the run loop, headless runs exit with an error
+	if ( FAILED( m_device->GetDeviceRemovedReason() ) ) _error = true;
 }
 
 HRESULT RotatingCube::OnSizeChanged()
@@ -476,11 +487,7 @@ void RotatingCube::WaitForPreviousFrame()
 	m_fenceValue++;
 
 	// Wait until the previous frame is finished.
-	if ( m_fence->GetCompletedValue() < fence )
-	{
-		V( m_fence->SetEventOnCompletion( fence, m_fenceEvent ) );
-		WaitForSingleObject( m_fenceEvent, INFINITE );
-	}
+	WaitForFence( m_fence.Get(), fence, m_fenceEvent );
 
-	m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	m_frameIndex = m_swapChain ? m_swapChain->GetCurrentBackBufferIndex() : ( m_frameIndex + 1 ) % FrameCount;
 }
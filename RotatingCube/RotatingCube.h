@@ -22,6 +22,8 @@ protected:
 
 private:
 	static const UINT FrameCount = 3;
+	// Of the swap chain and of the offscreen targets of headless runs
+	static const DXGI_FORMAT BackBufferFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
 
 	struct Vertex
 	{
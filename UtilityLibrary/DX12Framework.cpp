@@ -2,6 +2,7 @@
 #include "DX12Framework.h"
 #include "Utility.h"
 #include <shellapi.h>
+#include <algorithm>
 
 using namespace Microsoft::WRL;
 
@@ -9,17 +10,21 @@ CRITICAL_SECTION outputCS;
 
 DX12Framework::DX12Framework(UINT width, UINT height, std::wstring name):
 	_stopped(false),_error(false),m_width(width),m_height(height),
-	m_newWidth(width),m_newHeight(height),m_useWarpDevice(false)
+	m_newWidth(width),m_newHeight(height),m_useWarpDevice(false),
+	m_headless(false),m_headlessFrames(0),m_headlessSeconds(0.0),m_fixedTimeStep(1.0 / 60.0),m_cpuWaitSeconds(0.0)
 {
 	// Initialize output critical section
 	InitializeCriticalSection( &outputCS );
 
+	ParseCommandLineArgs();
+
+	// Debug builds and headless runs report on the console
 #ifdef _DEBUG
 	AttachConsole();
+#else
+	if ( m_headless ) AttachConsole();
 #endif
 
-	ParseCommandLineArgs();
-
 	m_title = name + (m_useWarpDevice ? L" (WARP)" : L"");
 	PRINTINFO( L"%s start", m_title.c_str() );
 	WCHAR assetsPath[512];
@@ -65,7 +70,7 @@ void DX12Framework::RenderLoop()
 		// Update GUI
 		{
 			wchar_t buffer[256];
-			swprintf( buffer, 256, L"%ls - %4.1f ms  %.0f fps", m_title.c_str(), 1000.f * frameTime, 1.0f / frameTime );
+			swprintf( buffer, 256, L"%ls - %4.1f ms  %.0f fps  %ls", m_title.c_str(), 1000.f * frameTime, 1.0f / frameTime, m_frameStats.c_str() );
 			SetWindowText( m_hwnd, buffer );
 		}
 
@@ -86,6 +91,9 @@ void DX12Framework::RenderLoop()
 
 int DX12Framework::Run(HINSTANCE hInstance, int nCmdShow)
 {
+	if ( m_headless )
+		return RunHeadless();
+
 	// Initialize the window class.
 	WNDCLASSEX windowClass = { 0 };
 	windowClass.cbSize = sizeof(WNDCLASSEX);
@@ -136,6 +144,103 @@ int DX12Framework::Run(HINSTANCE hInstance, int nCmdShow)
 	return static_cast<char>(msg.wParam);
 }
 
+int DX12Framework::RunHeadless()
+{
+	m_hwnd = nullptr;
+	if ( FAILED( OnInit() ) )
+	{
+		PRINTERROR( L"OnInit failed" );
+		return 1;
+	}
+	// The frames only, not the upload of OnInit
+	m_cpuWaitSeconds = 0.0;
+
+	UINT64 perfCounterFreq = 0;
+	UINT64 startCount = 0;
+	QueryPerformanceFrequency( ( LARGE_INTEGER* ) &perfCounterFreq );
+	QueryPerformanceCounter( ( LARGE_INTEGER* ) &startCount );
+
+	std::vector<double> frameSeconds;
+	frameSeconds.reserve( m_headlessFrames );
+	UINT64 lastCount = startCount;
+	while ( !_error )
+	{
+		if ( m_headlessFrames && frameSeconds.size() >= m_headlessFrames ) break;
+		if ( m_headlessSeconds > 0.0 && ( double ) ( lastCount - startCount ) / perfCounterFreq >= m_headlessSeconds ) break;
+
+		OnUpdate();
+		OnRender();
+
+		UINT64 count;
+		QueryPerformanceCounter( ( LARGE_INTEGER* ) &count );
+		frameSeconds.push_back( ( double ) ( count - lastCount ) / perfCounterFreq );
+		lastCount = count;
+	}
+	OnDestroy();
+
+	WriteHeadlessStats( frameSeconds, ( double ) ( lastCount - startCount ) / perfCounterFreq );
+	return _error ? 2 : 0;
+}
+
+void DX12Framework::WriteHeadlessStats( std::vector<double>& frameSeconds, double totalSeconds )
+{
+	if ( !m_statsPath.empty() )
+	{
+		FILE* file = nullptr;
+		if ( _wfopen_s( &file, m_statsPath.c_str(), L"w" ) == 0 && file )
+		{
+			fprintf( file, "frame,ms\n" );
+			for ( size_t i = 0; i < frameSeconds.size(); ++i )
+				fprintf( file, "%u,%.4f\n", static_cast< UINT >( i ), frameSeconds[i] * 1000.0 );
+			fclose( file );
+		}
+		else PRINTWARN( L"cannot write %s", m_statsPath.c_str() );
+	}
+
+	if ( frameSeconds.empty() )
+	{
+		PRINTWARN( L"%s: no frames rendered", m_title.c_str() );
+		return;
+	}
+	const size_t count = frameSeconds.size();
+	std::sort( frameSeconds.begin(), frameSeconds.end() );
+	auto percentile = [&]( double p ) { return 1000.0 * frameSeconds[std::min( count - 1, static_cast< size_t >( p * count ) )]; };
+	PRINTINFO( L"%s: %u frames in %.3f s, %.1f fps, %.2f ms simulated per frame", m_title.c_str(),
+			   static_cast< UINT >( count ), totalSeconds, count / totalSeconds, m_fixedTimeStep * 1000.0 );
+	PRINTINFO( L"frame ms  avg %.3f  min %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f",
+			   totalSeconds * 1000.0 / count, 1000.0 * frameSeconds.front(), percentile( 0.5 ), percentile( 0.95 ),
+			   percentile( 0.99 ), 1000.0 * frameSeconds.back() );
+	if ( m_cpuWaitSeconds > 0.0 )
+		PRINTINFO( L"cpu wait avg %.3f ms per frame, %.1f%% of the run", m_cpuWaitSeconds * 1000.0 / count,
+				   100.0 * m_cpuWaitSeconds / totalSeconds );
+	if ( !m_frameStats.empty() ) PRINTINFO( L"%s", m_frameStats.c_str() );
+}
+
+HRESULT DX12Framework::CreateBackBuffer( ID3D12Device* pDevice, IDXGISwapChain* pSwapChain, UINT index, DXGI_FORMAT format,
+										 ID3D12Resource** ppBuffer )
+{
+	if ( pSwapChain )
+		return pSwapChain->GetBuffer( index, IID_PPV_ARGS( ppBuffer ) );
+	// PRESENT is COMMON, so the samples' PRESENT <-> RENDER_TARGET transitions apply
+	return pDevice->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+											 &CD3DX12_RESOURCE_DESC::Tex2D( format, m_width, m_height, 1, 1, 1, 0,
+																			D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET ),
+											 D3D12_RESOURCE_STATE_PRESENT, nullptr, IID_PPV_ARGS( ppBuffer ) );
+}
+
+void DX12Framework::WaitForFence( ID3D12Fence* pFence, UINT64 value, HANDLE event )
+{
+	HRESULT hr;
+	if ( pFence->GetCompletedValue() >= value ) return;
+	UINT64 perfCounterFreq, startCount, endCount;
+	QueryPerformanceFrequency( ( LARGE_INTEGER* ) &perfCounterFreq );
+	QueryPerformanceCounter( ( LARGE_INTEGER* ) &startCount );
+	V( pFence->SetEventOnCompletion( value, event ) );
+	WaitForSingleObject( event, INFINITE );
+	QueryPerformanceCounter( ( LARGE_INTEGER* ) &endCount );
+	m_cpuWaitSeconds += ( double ) ( endCount - startCount ) / perfCounterFreq;
+}
+
 // Helper function for resolving the full path of assets.
 std::wstring DX12Framework::GetAssetFullPath(LPCWSTR assetName)
 {
@@ -194,8 +299,31 @@ void DX12Framework::ParseCommandLineArgs()
 		{
 			m_useWarpDevice = true;
 		}
+		if (_wcsicmp(argv[i], L"-headless") == 0 || _wcsicmp(argv[i], L"/headless") == 0)
+		{
+			m_headless = true;
+		}
+		if (i + 1 < argc && (_wcsicmp(argv[i], L"-frames") == 0 || _wcsicmp(argv[i], L"/frames") == 0))
+		{
+			m_headlessFrames = static_cast< UINT >( _wtoi(argv[++i]) );
+		}
+		else if (i + 1 < argc && (_wcsicmp(argv[i], L"-seconds") == 0 || _wcsicmp(argv[i], L"/seconds") == 0))
+		{
+			m_headlessSeconds = _wtof(argv[++i]);
+		}
+		else if (i + 1 < argc && (_wcsicmp(argv[i], L"-timestep") == 0 || _wcsicmp(argv[i], L"/timestep") == 0))
+		{
+			double milliseconds = _wtof(argv[++i]);
+			if (milliseconds > 0.0) m_fixedTimeStep = milliseconds / 1000.0;
+		}
+		else if (i + 1 < argc && (_wcsicmp(argv[i], L"-stats") == 0 || _wcsicmp(argv[i], L"/stats") == 0))
+		{
+			m_statsPath = argv[++i];
+		}
 	}
 	LocalFree(argv);
+	if (m_headless && !m_headlessFrames && m_headlessSeconds <= 0.0)
+		m_headlessFrames = 300;
 }
 
 // Main message handler for the sample.
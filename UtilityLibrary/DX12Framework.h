@@ -20,6 +20,8 @@
 
 #include "DXHelper.h"
 
+#include <vector>
+
 class DX12Framework
 {
 public:
@@ -43,6 +45,12 @@ protected:
 	std::wstring GetAssetFullPath(LPCWSTR assetName);
 
 	void GetHardwareAdapter( _In_ IDXGIFactory4* pFactory, _Outptr_result_maybenull_ IDXGIAdapter1** ppAdapter );
+	// Back buffer index of swapChain, or headless (no swap chain) an offscreen target of
+	// the window size in format, created in the PRESENT state like the swap chain's
+	HRESULT CreateBackBuffer( ID3D12Device* pDevice, IDXGISwapChain* pSwapChain, UINT index, DXGI_FORMAT format,
+							  ID3D12Resource** ppBuffer );
+	// Block until pFence reaches value, the time blocked is added to m_cpuWaitSeconds
+	void WaitForFence( ID3D12Fence* pFence, UINT64 value, HANDLE event );
 
 	static LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
 
@@ -65,8 +73,30 @@ protected:
 	// Adapter info.
 	bool m_useWarpDevice;
 
+	// Extra text appended to the frame time in the window title, set by the sample
+	std::wstring m_frameStats;
+
+	// -headless: Run creates no window (m_hwnd stays null) and instead of the message
+	// loop calls OnInit, then OnUpdate and OnRender for -frames N frames or -seconds T,
+	// whichever ends first (300 frames without either), then OnDestroy. The frame time
+	// statistics are printed and with -stats path written per frame as CSV. Samples
+	// render offscreen and put their StepTimer on a manual clock of m_fixedTimeStep,
+	// -timestep ms (1000/60 by default), so every run animates the same.
+	bool m_headless;
+	UINT m_headlessFrames;
+	double m_headlessSeconds;
+	double m_fixedTimeStep;
+	// CPU idle time of the frames, spent in WaitForFence; headless runs report it
+	double m_cpuWaitSeconds;
+
 private:
 	void ParseCommandLineArgs();
+	// 0 on success, 1 when OnInit fails, 2 when a frame set _error
+	int RunHeadless();
+	void WriteHeadlessStats( std::vector<double>& frameSeconds, double totalSeconds );
+
+	// -stats of a headless run
+	std::wstring m_statsPath;
 
 	// Root assets path.
 	std::wstring m_assetsPath;
@@ -24,6 +24,8 @@ public:
 		m_framesThisSecond(0),
 		m_qpcSecondCounter(0),
 		m_isFixedTimeStep(false),
+		m_isManualClock(false),
+		m_manualTicks(0),
 		m_targetElapsedTicks(TicksPerSecond / 60)
 	{
 		QueryPerformanceFrequency(&m_qpcFrequency);
@@ -50,6 +52,15 @@ public:
 	// Set whether to use fixed or variable timestep mode.
 	void SetFixedTimeStep(bool isFixedTimestep)			{ m_isFixedTimeStep = isFixedTimestep; }
 
+	// Count every Tick as exactly manualTicks, the target elapsed time when 0, instead
+	// of reading the clock, so runs advance the same whatever the frame time (headless
+	// benchmarks). A fixed timestep timer driven by another timer's step passes that.
+	void SetManualClock(bool isManualClock, UINT64 manualTicks = 0)
+	{
+		m_isManualClock = isManualClock;
+		m_manualTicks = manualTicks;
+	}
+
 	// Set how often to call Update when in fixed timestep mode.
 	void SetTargetElapsedTicks(UINT64 targetElapsed)	{ m_targetElapsedTicks = targetElapsed; }
 	void SetTargetElapsedSeconds(double targetElapsed)	{ m_targetElapsedTicks = SecondsToTicks(targetElapsed); }
@@ -99,6 +110,11 @@ public:
 		timeDelta *= TicksPerSecond;
 		timeDelta /= m_qpcFrequency.QuadPart;
 
+		if (m_isManualClock)
+		{
+			timeDelta = m_manualTicks ? m_manualTicks : m_targetElapsedTicks;
+		}
+
 		UINT32 lastFrameCount = m_frameCount;
 
 		if (m_isFixedTimeStep)
@@ -179,5 +195,7 @@ private:
 
 	// Members for configuring fixed timestep mode.
 	bool m_isFixedTimeStep;
+	bool m_isManualClock;
+	UINT64 m_manualTicks;
 	UINT64 m_targetElapsedTicks;
 };
@@ -0,0 +1,1547 @@
+// Console benchmark for the CPU volume engine. Runs the csmain step on the
+// default shell volume with every step kernel the CPU supports and reports
+// throughput, the bricks still active in the last frame and a checksum of the
+// final volume that can be compared between kernels, builds and machines.
+// Then the step and the psmain raymarch are timed for every voxel layout, with the
+// cache misses of the raymarch replayed through a simulated L1/L2 and, on Linux,
+// the hardware cache miss counter where perf events are available. Last the
+// scalar and BMI2 Morton encode/decode are timed against each other, and the
+// tiled VolumeRenderer renders the app's start up view on one and on all threads.
+// -out writes that image as an RGBA PAM file. The compositing modes are compared
+// by their cost and average samples per ray. Empty space skipping is measured on
+// the shell volume cut down to a ball in a uniform background. The mip chain is
+// checked against a rebuilt one and rendered with and without LOD from farther and
+// farther away. The parallel shell generator has to produce the bytes of the serial
+// init loop in every layout.
+// Every procedural scene is checked to not depend on the thread count or the layout
+// and then stepped and rendered like the shells, to show how the load differs.
+// A volume file written from every layout is mapped copy on write and stepped in
+// place, matching the generated volume without changing the file.
+// The paged volume steps and renders the shells through a brick cache holding an
+// eighth of them and has to match the in memory engine and renderer exactly.
+// Snapshots of the shells report their compression ratio, codec speed and codec
+// mix and have to decode, whole or a brick at a time, to the volume they came from.
+// A recording of the shells, keyframes and brick deltas, is played back in order
+// and by seeking and has to reproduce every frame.
+// Frame capture submits rendered frames faster than they can be written and
+// reports the submit cost, the frames written and dropped and the writer speed.
+// The null render device runs the frames of the app on the CPU, csmain as a CPU
+// kernel on the uploaded volume, which has to match the engine, and the cube draw
+// recorded into a cleared target that is read back. The same frames, with psmain's
+// raymarch as a CPU kernel on the graphics queue for the draw, run with one to
+// three of them in flight, reporting the frame time and the time the CPU waits on
+// fences; every stepped volume read back has to match the engine. With the volume
+// double buffered the step of a frame overlaps the graphics work of the one before,
+// the share of compute time the queues overlapped is reported.
+//
+// -size takes N for an N^3 volume or WxHxD for any other. -save writes the start
+// volume as a volume file in the linear layout, for -volumefile of the app.
+//
+// usage: VolumeBench [-size N|WxHxD] [-frames N] [-threads N] [-kernel scalar|sse4|avx2|avx512]
+//                    [-views N] [-image N] [-out file.pam] [-save file.vol]
+
+#include "FrameCapture.h"
+#include "RenderDevice.h"
+#include "TaskPool.h"
+#include "VolumeEngine.h"
+#include "VolumeFile.h"
+#include "VolumeGenerate.h"
+#include "VolumeMip.h"
+#include "VolumeMorton.h"
+#include "VolumePager.h"
+#include "VolumeRecord.h"
+#include "VolumeRenderer.h"
+#include "VolumeScene.h"
+#include "VolumeSnapshot.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ )
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct BenchArgs
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		// Largest of the three, the views and ray lengths scale with it
+		uint32_t size;
+		uint32_t frames;
+		uint32_t threads;
+		const char* kernel;
+		uint32_t views;
+		uint32_t image;
+		const char* out;
+		const char* save;
+	};
+
+	BenchArgs ParseArgs( int argc, char** argv )
+	{
+		BenchArgs args = { 256, 256, 256, 256, 100, 0, nullptr, 8, 256, nullptr, nullptr };
+		for ( int i = 1; i + 1 < argc; i += 2 )
+		{
+			uint32_t value = static_cast< uint32_t >( strtoul( argv[i + 1], nullptr, 10 ) );
+			if ( strcmp( argv[i], "-size" ) == 0 )
+			{
+				uint32_t size[3];
+				int count = sscanf( argv[i + 1], "%ux%ux%u", &size[0], &size[1], &size[2] );
+				if ( count == 1 ) size[1] = size[2] = size[0];
+				if ( ( count == 1 || count == 3 ) && VolumeSizeSupported( VOLUME_LAYOUT_LINEAR, size[0], size[1], size[2] ) )
+				{
+					args.width = size[0];
+					args.height = size[1];
+					args.depth = size[2];
+				}
+				else fprintf( stderr, "-size takes N or WxHxD, 1 to %u per axis\n", VOLUME_MAX_SIZE );
+			}
+			else if ( strcmp( argv[i], "-frames" ) == 0 ) args.frames = value;
+			else if ( strcmp( argv[i], "-threads" ) == 0 ) args.threads = value;
+			else if ( strcmp( argv[i], "-kernel" ) == 0 ) args.kernel = argv[i + 1];
+			else if ( strcmp( argv[i], "-views" ) == 0 ) args.views = value;
+			else if ( strcmp( argv[i], "-image" ) == 0 ) args.image = value;
+			else if ( strcmp( argv[i], "-out" ) == 0 ) args.out = argv[i + 1];
+			else if ( strcmp( argv[i], "-save" ) == 0 ) args.save = argv[i + 1];
+			else fprintf( stderr, "unknown argument %s\n", argv[i] );
+		}
+		args.size = std::max( args.width, std::max( args.height, args.depth ) );
+		return args;
+	}
+
+	// FNV-1a over the voxel words, enough to spot any divergence
+	uint64_t Checksum( const uint32_t* voxels, uint64_t count )
+	{
+		uint64_t hash = 1469598103934665603ull;
+		for ( uint64_t i = 0; i < count; i++ )
+		{
+			hash ^= voxels[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	uint64_t LinearChecksum( const VolumeEngine& engine )
+	{
+		std::vector<uint32_t> linear( engine.GetVoxelCount() );
+		engine.CopyToLinear( linear.data() );
+		return Checksum( linear.data(), linear.size() );
+	}
+
+	double Seconds( std::chrono::high_resolution_clock::time_point from )
+	{
+		return std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - from ).count();
+	}
+
+	// Set associative cache with LRU replacement, 64 byte lines
+	class CacheModel
+	{
+	public:
+		CacheModel( uint32_t sizeBytes, uint32_t ways ) :
+			m_ways( ways ), m_sets( sizeBytes / ( LineBytes * ways ) ), m_clock( 0 ), m_misses( 0 ),
+			m_tags( static_cast< size_t >( m_sets ) * ways, ~0ull ), m_used( m_tags.size(), 0 ) {}
+
+		static const uint32_t LineBytes = 64;
+
+		// Returns true on a miss
+		bool Access( uint64_t address )
+		{
+			uint64_t line = address / LineBytes;
+			size_t set = static_cast< size_t >( line % m_sets ) * m_ways;
+			size_t victim = set;
+			m_clock++;
+			for ( size_t w = set; w < set + m_ways; w++ )
+			{
+				if ( m_tags[w] == line )
+				{
+					m_used[w] = m_clock;
+					return false;
+				}
+				if ( m_used[w] < m_used[victim] ) victim = w;
+			}
+			m_tags[victim] = line;
+			m_used[victim] = m_clock;
+			m_misses++;
+			return true;
+		}
+
+		uint64_t GetMisses() const { return m_misses; }
+
+	private:
+		uint32_t m_ways;
+		uint32_t m_sets;
+		uint64_t m_clock;
+		uint64_t m_misses;
+		std::vector<uint64_t> m_tags;
+		std::vector<uint64_t> m_used;
+	};
+
+	// Last level cache misses of this thread from perf events, invalid where the
+	// kernel or the sandbox does not expose them
+	class HardwareCounter
+	{
+	public:
+		HardwareCounter() : m_fd( -1 )
+		{
+#if defined( __linux__ )
+			perf_event_attr attr;
+			memset( &attr, 0, sizeof( attr ) );
+			attr.size = sizeof( attr );
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.inherit = 1;
+			m_fd = static_cast< int >( syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 ) );
+#endif
+		}
+
+		~HardwareCounter()
+		{
+#if defined( __linux__ )
+			if ( m_fd >= 0 ) close( m_fd );
+#endif
+		}
+
+		bool IsValid() const { return m_fd >= 0; }
+
+		void Start()
+		{
+#if defined( __linux__ )
+			if ( m_fd < 0 ) return;
+			ioctl( m_fd, PERF_EVENT_IOC_RESET, 0 );
+			ioctl( m_fd, PERF_EVENT_IOC_ENABLE, 0 );
+#endif
+		}
+
+		uint64_t Stop()
+		{
+			uint64_t count = 0;
+#if defined( __linux__ )
+			if ( m_fd < 0 ) return 0;
+			ioctl( m_fd, PERF_EVENT_IOC_DISABLE, 0 );
+			if ( read( m_fd, &count, sizeof( count ) ) != sizeof( count ) ) count = 0;
+#endif
+			return count;
+		}
+
+	private:
+		int m_fd;
+	};
+
+	void PrintCounter( const char* label, const HardwareCounter& counter, double perUnit )
+	{
+		if ( counter.IsValid() ) printf( "  %s %6.2f", label, perUnit );
+		else printf( "  %s    n/a", label );
+	}
+
+	// Orbiting views at the distance of the default camera
+	void ViewEye( const BenchArgs& args, uint32_t view, float eye[3] )
+	{
+		const float distance = args.size * 3.38f;
+		float angle = 6.2831853f * view / args.views;
+		eye[0] = distance * 0.8f * cosf( angle );
+		eye[1] = distance * 0.6f * sinf( angle * 3.f );
+		eye[2] = distance * 0.8f * sinf( angle );
+	}
+
+	// Replays the voxel reads of the first view in pixel order through a 32 KiB 8 way
+	// L1 and a 1 MiB 16 way L2 behind it, returns the misses per 1000 samples
+	void SimulateCache( const BenchArgs& args, const VolumeView& view, double& l1, double& l2 )
+	{
+		const float target[3] = { 0.f, 0.f, 0.f };
+		const RaymarchParams params = RaymarchParams::Default();
+		CacheModel L1( 32 << 10, 8 );
+		CacheModel L2( 1 << 20, 16 );
+		std::vector<uint32_t> indices( args.size * 2 );
+		uint64_t samples = 0;
+		float eye[3];
+		ViewEye( args, 0, eye );
+		for ( uint32_t j = 0; j < args.image; j++ )
+			for ( uint32_t i = 0; i < args.image; i++ )
+			{
+				float d[3];
+				CameraRay( eye, target, 0.785398f, args.image, args.image, i, j, d );
+				uint32_t count = TraceRay( view, params, eye, d, indices.data(), static_cast< uint32_t >( indices.size() ) );
+				for ( uint32_t s = 0; s < count; s++ )
+				{
+					uint64_t address = static_cast< uint64_t >( indices[s] ) * sizeof( uint32_t );
+					if ( L1.Access( address ) ) L2.Access( address );
+				}
+				samples += count;
+			}
+		l1 = samples ? L1.GetMisses() * 1000.0 / samples : 0.0;
+		l2 = samples ? L2.GetMisses() * 1000.0 / samples : 0.0;
+	}
+
+	// Step and raymarch timing of one layout, the checksums have to agree between layouts
+	struct LayoutResult
+	{
+		uint64_t volumeChecksum;
+		uint64_t imageChecksum;
+	};
+
+	LayoutResult BenchLayout( const BenchArgs& args, VolumeLayoutType layout, StepKernelType kernel )
+	{
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads, layout );
+		engine.SetStepKernel( kernel );
+		engine.FillShellVolume();
+		HardwareCounter counter;
+
+		counter.Start();
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+			engine.Step();
+		double stepSeconds = Seconds( start );
+		uint64_t stepMisses = counter.Stop();
+
+		const float target[3] = { 0.f, 0.f, 0.f };
+		const RaymarchParams params = RaymarchParams::Default();
+		std::vector<float> image( static_cast< size_t >( args.image ) * args.image * 4 );
+		uint64_t imageChecksum = 1469598103934665603ull;
+		uint64_t samples = 0;
+		counter.Start();
+		start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t v = 0; v < args.views; v++ )
+		{
+			float eye[3];
+			ViewEye( args, v, eye );
+			samples += RaymarchImage( engine.GetView(), params, eye, target, 0.785398f, args.image, args.image, image.data() );
+			for ( float value : image )
+			{
+				uint32_t bits;
+				memcpy( &bits, &value, sizeof( bits ) );
+				imageChecksum = ( imageChecksum ^ bits ) * 1099511628211ull;
+			}
+		}
+		double marchSeconds = Seconds( start );
+		uint64_t marchMisses = counter.Stop();
+
+		double l1, l2;
+		SimulateCache( args, engine.GetView(), l1, l2 );
+
+		LayoutResult result = { LinearChecksum( engine ), imageChecksum };
+		double rays = static_cast< double >( args.image ) * args.image * args.views;
+		printf( "%-7s step %8.3f ms/frame  raymarch %8.2f ms/view %7.2f Mrays/s %8.1f Msamples/s\n",
+				GetVolumeLayoutName( layout ), stepSeconds * 1000.0 / args.frames,
+				marchSeconds * 1000.0 / args.views, rays / marchSeconds * 1e-6, samples / marchSeconds * 1e-6 );
+		printf( "        misses/1k samples  sim L1 %6.1f  sim L2 %6.1f", l1, l2 );
+		PrintCounter( "hw raymarch", counter, samples ? marchMisses * 1000.0 / samples : 0.0 );
+		PrintCounter( "hw step/1k voxels", counter,
+					  stepMisses * 1000.0 / ( static_cast< double >( engine.GetVoxelCount() ) * args.frames ) );
+		printf( "\n" );
+		return result;
+	}
+
+	// Netpbm PAM with an RGB_ALPHA tuple, readable by most image tools
+	bool WritePAM( const char* path, const uint8_t* rgba, uint32_t width, uint32_t height )
+	{
+		FILE* file = fopen( path, "wb" );
+		if ( !file ) return false;
+		fprintf( file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height );
+		size_t size = static_cast< size_t >( width ) * height * 4;
+		bool ok = fwrite( rgba, 1, size, file ) == size;
+		return fclose( file ) == 0 && ok;
+	}
+
+	// The start up view of VolumetricAnimation rendered by one thread ray by ray and
+	// by all of them in every mode, the images have to be identical
+	int BenchRender( const BenchArgs& args, const VolumeEngine& engine )
+	{
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		const RaymarchParams params = RaymarchParams::Default();
+		const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+		std::vector<float> reference( pixels * 4 );
+		std::vector<float> image( pixels * 4 );
+
+		VolumeRenderer single( 1 );
+		single.SetMode( RenderModeSingle );
+		auto start = std::chrono::high_resolution_clock::now();
+		uint64_t samples = single.Render( engine.GetView(), params, camera, args.image, args.image, reference.data() );
+		double seconds = Seconds( start );
+		printf( "single   1 thread  %8.2f ms %7.2f Mrays/s  %.1f samples/ray  %.1f%% skipped\n", seconds * 1000.0,
+				pixels / seconds * 1e-6, static_cast< double >( samples ) / pixels,
+				samples ? 100.0 * single.GetSkippedSampleCount() / samples : 0.0 );
+
+		VolumeRenderer renderer( args.threads );
+		bool match = true;
+		for ( int mode = 0; mode < RenderModeCount; mode++ )
+		{
+			if ( mode == RenderModePacket && !IsRayPacketSupported() ) continue;
+			// The reference above already is single rays on one thread
+			if ( mode == RenderModeSingle && renderer.GetThreadCount() == 1 ) continue;
+			renderer.SetMode( static_cast< RenderMode >( mode ) );
+			start = std::chrono::high_resolution_clock::now();
+			renderer.Render( engine.GetView(), params, camera, args.image, args.image, image.data() );
+			seconds = Seconds( start );
+
+			bool same = memcmp( reference.data(), image.data(), image.size() * sizeof( float ) ) == 0;
+			match = match && same;
+			printf( "%-7s %2u thread%s %8.2f ms %7.2f Mrays/s", GetRenderModeName( static_cast< RenderMode >( mode ) ),
+					renderer.GetThreadCount(), renderer.GetThreadCount() == 1 ? " " : "s", seconds * 1000.0,
+					pixels / seconds * 1e-6 );
+			printf( "  %.1f%% skipped", samples ? 100.0 * renderer.GetSkippedSampleCount() / samples : 0.0 );
+			if ( mode == RenderModePacket )
+				printf( "  %u packets, %.1f%% diverged", renderer.GetPacketCount(),
+						renderer.GetPacketCount() ? 100.0 * renderer.GetDivergedPacketCount() / renderer.GetPacketCount() : 0.0 );
+			printf( "%s\n", same ? "" : "  MISMATCH" );
+		}
+
+		if ( args.out )
+		{
+			std::vector<uint8_t> packed( pixels * 4 );
+			PackRGBA8( image.data(), pixels, packed.data() );
+			if ( !WritePAM( args.out, packed.data(), args.image, args.image ) )
+			{
+				fprintf( stderr, "can't write %s\n", args.out );
+				return 1;
+			}
+		}
+		return match ? 0 : 1;
+	}
+
+	// Additive and front to back compositing of the start up view, the latter with and
+	// without early termination. Single rays and packets have to agree.
+	int BenchCompositing( const BenchArgs& args, const VolumeEngine& engine )
+	{
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+		std::vector<float> reference( pixels * 4 );
+		std::vector<float> image( pixels * 4 );
+		VolumeRenderer renderer( args.threads );
+		bool match = true;
+
+		const RaymarchCompositing compositing[3] = { CompositeAdditive, CompositeFrontToBack, CompositeFrontToBack };
+		const float termination[3] = { 1.f, 1.f, RaymarchParams::Default().terminationOpacity };
+		for ( int i = 0; i < 3; i++ )
+		{
+			RaymarchParams params = RaymarchParams::Default();
+			params.compositing = compositing[i];
+			params.terminationOpacity = termination[i];
+
+			renderer.SetMode( RenderModeSingle );
+			renderer.Render( engine.GetView(), params, camera, args.image, args.image, reference.data() );
+			renderer.SetMode( IsRayPacketSupported() ? RenderModePacket : RenderModeSingle );
+			auto start = std::chrono::high_resolution_clock::now();
+			uint64_t samples = renderer.Render( engine.GetView(), params, camera, args.image, args.image, image.data() );
+			double seconds = Seconds( start );
+
+			// Rays that miss the box take no samples and are left out of the average
+			size_t rays = 0;
+			for ( size_t p = 0; p < pixels; p++ )
+				if ( image[p * 4] != 0.f || image[p * 4 + 1] != 0.f || image[p * 4 + 2] != 0.f ) rays++;
+			bool same = memcmp( reference.data(), image.data(), image.size() * sizeof( float ) ) == 0;
+			match = match && same;
+			char name[32];
+			if ( params.compositing == CompositeFrontToBack && params.terminationOpacity < 1.f )
+				snprintf( name, sizeof( name ), "%s, stop at %.2f", GetCompositingName( params.compositing ), params.terminationOpacity );
+			else
+				snprintf( name, sizeof( name ), "%s", GetCompositingName( params.compositing ) );
+			printf( "%-26s %8.2f ms %7.2f Mrays/s  %5.1f samples/ray%s\n", name, seconds * 1000.0, pixels / seconds * 1e-6,
+					rays ? static_cast< double >( samples ) / rays : 0.0, same ? "" : "  MISMATCH" );
+		}
+		return match ? 0 : 1;
+	}
+
+	// Steps with a mip chain, which has to equal one rebuilt from scratch afterwards.
+	// Then the orbit views are rendered from one, two and four times as far with and
+	// without LOD, single rays and packets have to agree.
+	int BenchMips( const BenchArgs& args )
+	{
+		const uint32_t levels = 4;
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		engine.FillShellVolume();
+		engine.SetMipLevelCount( levels );
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+			engine.Step();
+		double stepSeconds = Seconds( start );
+
+		const VolumeMipChain& mips = *engine.GetMipChain();
+		std::vector<uint32_t> stepped;
+		for ( uint32_t l = 1; l <= mips.GetLevelCount(); l++ )
+			stepped.insert( stepped.end(), mips.GetVoxels( l ),
+							mips.GetVoxels( l ) + static_cast< size_t >( mips.GetWidth( l ) ) * mips.GetHeight( l ) * mips.GetDepth( l ) );
+		engine.MarkAllBricksActive();
+		bool mipsMatch = true;
+		size_t offset = 0;
+		for ( uint32_t l = 1; l <= mips.GetLevelCount(); l++ )
+		{
+			size_t count = static_cast< size_t >( mips.GetWidth( l ) ) * mips.GetHeight( l ) * mips.GetDepth( l );
+			mipsMatch = mipsMatch && std::equal( mips.GetVoxels( l ), mips.GetVoxels( l ) + count, stepped.begin() + offset );
+			offset += count;
+		}
+		printf( "step    %8.3f ms/frame with %u levels  mips %s\n", stepSeconds * 1000.0 / args.frames, mips.GetLevelCount(),
+				mipsMatch ? "match" : "MISMATCH" );
+
+		const float target[3] = { 0.f, 0.f, 0.f };
+		const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+		std::vector<float> reference( pixels * 4 );
+		std::vector<float> image( pixels * 4 );
+		std::vector<float> single( pixels * 4 );
+		VolumeRenderer renderer( args.threads );
+		bool match = mipsMatch;
+		for ( uint32_t distance = 1; distance <= 4; distance *= 2 )
+		{
+			double seconds[2] = {}, squared = 0.0;
+			bool same = true;
+			for ( uint32_t v = 0; v < args.views; v++ )
+			{
+				float eye[3];
+				ViewEye( args, v, eye );
+				for ( int c = 0; c < 3; c++ ) eye[c] *= distance;
+				const RaymarchCamera camera = RaymarchCamera::LookAt( eye, target, 0.785398f, 1.f, 0.01f,
+																	  args.size * 16.f * distance );
+				RaymarchParams params = RaymarchParams::Default();
+				for ( int lod = 0; lod < 2; lod++ )
+				{
+					params.lodScale = lod ? camera.GetPixelScale( args.image ) : 0.f;
+					renderer.SetMode( IsRayPacketSupported() ? RenderModePacket : RenderModeSingle );
+					start = std::chrono::high_resolution_clock::now();
+					renderer.Render( engine.GetView(), params, camera, args.image, args.image,
+									 lod ? image.data() : reference.data() );
+					seconds[lod] += Seconds( start );
+				}
+				renderer.SetMode( RenderModeSingle );
+				renderer.Render( engine.GetView(), params, camera, args.image, args.image, single.data() );
+				same = same && memcmp( single.data(), image.data(), image.size() * sizeof( float ) ) == 0;
+				for ( size_t i = 0; i < image.size(); i++ )
+					squared += static_cast< double >( image[i] - reference[i] ) * ( image[i] - reference[i] );
+			}
+			match = match && same;
+			printf( "x%u      %8.2f ms/view  lod %8.2f ms/view  rms diff %.2e%s\n", distance, seconds[0] * 1000.0 / args.views,
+					seconds[1] * 1000.0 / args.views, sqrt( squared / ( image.size() * args.views ) ), same ? "" : "  MISMATCH" );
+		}
+		return match ? 0 : 1;
+	}
+
+	// Shell volume with every voxel outside a ball of a third of the smallest dimension
+	// replaced by the background colour. Uniform bricks stay uniform under Step(), so after the
+	// steps the incremental ranges have to equal rebuilt ones and the start up view is
+	// rendered with and without skipping.
+	int BenchSkipping( const BenchArgs& args )
+	{
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		engine.FillShellVolume();
+		const float radius = std::min( args.width, std::min( args.height, args.depth ) ) / 3.f;
+		for ( uint32_t z = 0; z < args.depth; z++ )
+			for ( uint32_t y = 0; y < args.height; y++ )
+				for ( uint32_t x = 0; x < args.width; x++ )
+				{
+					float dx = x + 0.5f - args.width * 0.5f, dy = y + 0.5f - args.height * 0.5f, dz = z + 0.5f - args.depth * 0.5f;
+					if ( dx * dx + dy * dy + dz * dz > radius * radius )
+						engine.GetVoxels()[engine.GetVoxelIndex( x, y, z )] = 0x00404040;
+				}
+		engine.MarkAllBricksActive();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+			engine.Step();
+		double stepSeconds = Seconds( start );
+
+		const std::vector<uint32_t> ranges( engine.GetBrickRanges(), engine.GetBrickRanges() + engine.GetBrickCount() * 2 );
+		engine.MarkAllBricksActive();
+		bool rangesMatch = std::equal( ranges.begin(), ranges.end(), engine.GetBrickRanges() );
+		printf( "step    %8.3f ms/frame  %u/%u bricks uniform  ranges %s\n", stepSeconds * 1000.0 / args.frames,
+				engine.CountUniformBricks(), engine.GetBrickCount(), rangesMatch ? "match" : "MISMATCH" );
+
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+		std::vector<float> reference( pixels * 4 );
+		std::vector<float> image( pixels * 4 );
+		VolumeRenderer renderer( args.threads );
+		RaymarchParams params = RaymarchParams::Default();
+		// One render of a small volume is too short to time against the other, so
+		// both take turns and keep their best
+		double seconds[2] = {};
+		uint64_t samples[2] = {}, skipped[2] = {};
+		for ( uint32_t v = 0; v < args.views; v++ )
+			for ( int skip = 0; skip < 2; skip++ )
+			{
+				params.skipUniformBricks = skip != 0;
+				start = std::chrono::high_resolution_clock::now();
+				samples[skip] = renderer.Render( engine.GetView(), params, camera, args.image, args.image,
+												 skip ? image.data() : reference.data() );
+				seconds[skip] = v ? std::min( seconds[skip], Seconds( start ) ) : Seconds( start );
+				skipped[skip] = renderer.GetSkippedSampleCount();
+			}
+		float maxDiff = 0.f;
+		for ( size_t i = 0; i < image.size(); i++ ) maxDiff = std::max( maxDiff, fabsf( image[i] - reference[i] ) );
+		for ( int skip = 0; skip < 2; skip++ )
+		{
+			printf( "%-7s %8.2f ms %7.2f Mrays/s  %.1f samples/ray  %.1f%% skipped", skip ? "skip" : "noskip",
+					seconds[skip] * 1000.0, pixels / seconds[skip] * 1e-6, static_cast< double >( samples[skip] ) / pixels,
+					samples[skip] ? 100.0 * skipped[skip] / samples[skip] : 0.0 );
+			if ( skip ) printf( "  max diff %.2e", maxDiff );
+			printf( "\n" );
+		}
+		return rangesMatch ? 0 : 1;
+	}
+
+	// Scalar and BMI2 Morton codes for a 256^3 block, the two have to agree
+	int BenchGenerate( const BenchArgs& args )
+	{
+		TaskPool pool( args.threads );
+		const VolumeParams params = VolumeParams::Default();
+		// Partial bricks on every axis, within the Morton padding limit
+		const uint32_t sizes[2][3] = { { args.width, args.height, args.depth }, { 37, 34, 29 } };
+		int result = 0;
+		for ( int type = 0; type < VolumeLayoutCount; type++ )
+			for ( int s = 0; s < 2; s++ )
+			{
+				const uint32_t* size = sizes[s];
+				if ( !VolumeSizeSupported( type, size[0], size[1], size[2] ) )
+				{
+					printf( "%-7s %4ux%ux%u  not supported\n", GetVolumeLayoutName( static_cast< VolumeLayoutType >( type ) ),
+							size[0], size[1], size[2] );
+					continue;
+				}
+				const size_t count = VolumeStorageCount( type, size[0], size[1], size[2] );
+				std::vector<uint32_t> serial( count ), parallel( count, 0 );
+
+				auto start = std::chrono::high_resolution_clock::now();
+				GenerateShellVolumeSerial( params, type, size[0], size[1], size[2], serial.data() );
+				double serialSeconds = Seconds( start );
+				start = std::chrono::high_resolution_clock::now();
+				GenerateShellVolume( params, type, size[0], size[1], size[2], parallel.data(), &pool );
+				double parallelSeconds = Seconds( start );
+
+				bool same = serial == parallel;
+				if ( !same ) result = 1;
+				printf( "%-7s %4ux%ux%u  serial %8.2f ms  parallel %8.2f ms on %u thread%s%s\n",
+						GetVolumeLayoutName( static_cast< VolumeLayoutType >( type ) ), size[0], size[1], size[2],
+						serialSeconds * 1000.0, parallelSeconds * 1000.0, pool.GetThreadCount(),
+						pool.GetThreadCount() == 1 ? "" : "s", same ? "" : "  MISMATCH" );
+			}
+		return result;
+	}
+
+	// Scene at a small size on one thread and on the pool in every layout, the voxels
+	// have to be the same
+	bool SceneIsDeterministic( uint32_t scene, TaskPool& pool )
+	{
+		const uint32_t size = 40;
+		const SceneParams sceneParams = SceneParams::Default();
+		const VolumeParams params = VolumeParams::Default();
+		std::vector<uint32_t> reference( size * size * size );
+		GenerateScene( scene, sceneParams, params, VOLUME_LAYOUT_LINEAR, size, size, size, reference.data(), nullptr );
+		if ( scene == SceneShells )
+		{
+			std::vector<uint32_t> shells( reference.size() );
+			GenerateShellVolume( params, VOLUME_LAYOUT_LINEAR, size, size, size, shells.data(), nullptr );
+			if ( shells != reference ) return false;
+		}
+		for ( uint32_t layout = 0; layout < VolumeLayoutCount; layout++ )
+		{
+			std::vector<uint32_t> voxels( VolumeStorageCount( layout, size, size, size ) );
+			GenerateScene( scene, sceneParams, params, layout, size, size, size, voxels.data(), &pool );
+			for ( uint32_t z = 0; z < size; z++ )
+				for ( uint32_t y = 0; y < size; y++ )
+					for ( uint32_t x = 0; x < size; x++ )
+						if ( voxels[VolumeVoxelIndex( layout, x, y, z, size, size )] != reference[( z * size + y ) * size + x] )
+							return false;
+		}
+		return true;
+	}
+
+	int BenchScenes( const BenchArgs& args )
+	{
+		TaskPool pool( args.threads );
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		std::vector<float> image( static_cast< size_t >( args.image ) * args.image * 4 );
+		VolumeRenderer renderer( args.threads );
+		const RaymarchParams params = RaymarchParams::Default();
+		int result = 0;
+		for ( uint32_t scene = 0; scene < GetSceneCount(); scene++ )
+		{
+			bool deterministic = SceneIsDeterministic( scene, pool );
+			if ( !deterministic ) result = 1;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			GenerateScene( scene, SceneParams::Default(), engine.GetParams(), engine.GetLayout(), args.width, args.height,
+						   args.depth, engine.GetVoxels(), &pool );
+			double generateSeconds = Seconds( start );
+			engine.MarkAllBricksActive();
+			uint64_t filled = 0;
+			for ( uint64_t i = 0; i < engine.GetVoxelCount(); i++ ) filled += engine.GetVoxels()[i] != SceneEmptyVoxel;
+
+			start = std::chrono::high_resolution_clock::now();
+			for ( uint32_t i = 0; i < args.frames; i++ )
+				engine.Step();
+			double stepSeconds = Seconds( start );
+			uint32_t activeBricks = engine.GetActiveBrickCount();
+			uint32_t uniformBricks = engine.CountUniformBricks();
+
+			start = std::chrono::high_resolution_clock::now();
+			uint64_t samples = renderer.Render( engine.GetView(), params, camera, args.image, args.image, image.data() );
+			double renderSeconds = Seconds( start );
+
+			printf( "%-12s gen %8.2f ms  %5.1f%% filled  step %8.3f ms/frame  %5u active %5u uniform  render %7.2f ms"
+					"  %5.1f%% skipped%s\n", GetScene( scene ).name, generateSeconds * 1000.0,
+					100.0 * filled / engine.GetVoxelCount(), stepSeconds * 1000.0 / args.frames, activeBricks, uniformBricks,
+					renderSeconds * 1000.0, samples ? 100.0 * renderer.GetSkippedSampleCount() / samples : 0.0,
+					deterministic ? "" : "  MISMATCH" );
+		}
+		return result;
+	}
+
+	// The shells written as a volume file and stepped in place from a copy on write
+	// mapping of it, which has to match the generated volume and leave the file as is
+	int BenchVolumeFile( const BenchArgs& args )
+	{
+		const char* path = "VolumeBench.volume.tmp";
+		int result = 0;
+		for ( int type = 0; type < VolumeLayoutCount; type++ )
+		{
+			const VolumeLayoutType layout = static_cast< VolumeLayoutType >( type );
+			if ( !VolumeSizeSupported( layout, args.width, args.height, args.depth ) )
+			{
+				printf( "%-7s not supported at this size\n", GetVolumeLayoutName( layout ) );
+				continue;
+			}
+			VolumeEngine engine( args.width, args.height, args.depth, args.threads, layout );
+			auto start = std::chrono::high_resolution_clock::now();
+			engine.FillShellVolume();
+			double generateSeconds = Seconds( start );
+			const uint64_t initial = Checksum( engine.GetVoxels(), engine.GetStorageCount() );
+
+			start = std::chrono::high_resolution_clock::now();
+			bool written = WriteVolumeFile( path, layout, args.width, args.height, args.depth, engine.GetVoxels() );
+			double writeSeconds = Seconds( start );
+
+			start = std::chrono::high_resolution_clock::now();
+			std::unique_ptr<MappedVolumeFile> file( new MappedVolumeFile( path, MappedVolumeFile::CopyOnWrite ) );
+			double mapSeconds = Seconds( start );
+			if ( !written || !file->IsOpen() )
+			{
+				printf( "%-7s cannot write or map %s  MISMATCH\n", GetVolumeLayoutName( layout ), path );
+				remove( path );
+				return 1;
+			}
+			start = std::chrono::high_resolution_clock::now();
+			VolumeEngine mapped( std::move( file ), args.threads );
+			double openSeconds = Seconds( start );
+
+			bool same = mapped.GetLayout() == layout && LinearChecksum( mapped ) == LinearChecksum( engine );
+			for ( uint32_t i = 0; i < args.frames; i++ )
+			{
+				engine.Step();
+				mapped.Step();
+			}
+			same = same && LinearChecksum( mapped ) == LinearChecksum( engine );
+			{
+				MappedVolumeFile check( path, MappedVolumeFile::ReadOnly );
+				same = same && check.IsOpen() && Checksum( check.GetVoxels(), check.GetStorageCount() ) == initial;
+			}
+			if ( !same ) result = 1;
+			printf( "%-7s generate %8.2f ms  write %8.2f ms  map %6.3f ms  engine on the mapping %8.2f ms%s\n",
+					GetVolumeLayoutName( layout ), generateSeconds * 1000.0, writeSeconds * 1000.0, mapSeconds * 1000.0,
+					openSeconds * 1000.0, same ? "" : "  MISMATCH" );
+		}
+		remove( path );
+		return result;
+	}
+
+	// The shells as snapshots at the first and the last frame: size, codec speed, the
+	// codec of each brick, and a full and a random brick decode against the engine
+	int BenchSnapshot( const BenchArgs& args )
+	{
+		const char* path = "VolumeBench.snapshot.tmp";
+		TaskPool pool( args.threads );
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		engine.FillShellVolume();
+		int result = 0;
+		for ( int pass = 0; pass < 2; pass++ )
+		{
+			if ( pass == 1 )
+				for ( uint32_t i = 0; i < args.frames; i++ )
+					engine.Step();
+
+			SnapshotStats stats;
+			auto start = std::chrono::high_resolution_clock::now();
+			bool written = WriteSnapshot( path, engine.GetView(), &pool, &stats );
+			double encodeSeconds = Seconds( start );
+			SnapshotReader reader( path );
+			if ( !written || !reader.IsOpen() )
+			{
+				printf( "cannot write or open %s  MISMATCH\n", path );
+				remove( path );
+				return 1;
+			}
+
+			std::vector<uint32_t> linear( engine.GetVoxelCount() );
+			start = std::chrono::high_resolution_clock::now();
+			bool same = reader.ReadVolume( VolumeLayoutLinear, linear.data(), &pool );
+			double decodeSeconds = Seconds( start );
+			same = same && Checksum( linear.data(), linear.size() ) == LinearChecksum( engine );
+
+			// Single bricks against the same bricks of a bricked decode, padding as the
+			// background the writer filled in
+			std::vector<uint32_t> bricked( VolumeStorageCount( VolumeLayoutBricked, args.width, args.height, args.depth ),
+										   0x40404040 );
+			same = same && reader.ReadVolume( VolumeLayoutBricked, bricked.data(), &pool );
+			const uint32_t samples = std::min( 256u, reader.GetBrickCount() );
+			uint32_t random = 12345;
+			double randomSeconds = 0.0;
+			for ( uint32_t i = 0; i < samples && same; i++ )
+			{
+				random = random * 1664525u + 1013904223u;
+				const uint32_t brick = random % reader.GetBrickCount();
+				uint32_t voxels[VOLUME_BRICK_VOXELS];
+				start = std::chrono::high_resolution_clock::now();
+				same = reader.ReadBrick( brick, voxels );
+				randomSeconds += Seconds( start );
+				same = same && memcmp( voxels, &bricked[static_cast< size_t >( brick ) * VOLUME_BRICK_VOXELS],
+									   sizeof( voxels ) ) == 0;
+			}
+			if ( !same ) result = 1;
+
+			printf( "frame %-4u %6.2fx  encode %7.1f MB/s  decode %7.1f MB/s  brick %6.2f us ", pass ? args.frames : 0,
+					static_cast< double >( stats.rawBytes ) / stats.encodedBytes, stats.rawBytes / encodeSeconds * 1e-6,
+					stats.rawBytes / decodeSeconds * 1e-6, samples ? randomSeconds * 1e6 / samples : 0.0 );
+			for ( int codec = 0; codec < SnapshotCodecCount; codec++ )
+				printf( " %s %.1f%%", GetSnapshotCodecName( static_cast< SnapshotCodec >( codec ) ),
+						100.0 * stats.codecBricks[codec] / reader.GetBrickCount() );
+			printf( "%s\n", same ? "" : "  MISMATCH" );
+		}
+		remove( path );
+		return result;
+	}
+
+	// The shells stepped and rendered out of core with an eighth of the volume in
+	// memory, against the in memory engine and renderer
+	int BenchPaged( const BenchArgs& args )
+	{
+		const char* path = "VolumeBench.bricks.tmp";
+		const uint64_t bytes = static_cast< uint64_t >( VolumeBrickCount( args.width ) ) * VolumeBrickCount( args.height ) *
+			VolumeBrickCount( args.depth ) * BrickCache::BrickBytes;
+		int result = 0;
+		{
+			PagedVolume paged( path, args.width, args.height, args.depth, static_cast< size_t >( bytes / 8 ), args.threads );
+			if ( !paged.IsOpen() )
+			{
+				printf( "cannot create %s\n", path );
+				return 1;
+			}
+			VolumeEngine engine( args.width, args.height, args.depth, args.threads, VolumeLayoutBricked );
+			engine.FillShellVolume();
+			for ( uint32_t i = 0; i < args.frames; i++ )
+				engine.Step();
+
+			auto start = std::chrono::high_resolution_clock::now();
+			paged.FillShellVolume();
+			double generateSeconds = Seconds( start );
+			start = std::chrono::high_resolution_clock::now();
+			for ( uint32_t i = 0; i < args.frames; i++ )
+				paged.Step();
+			double stepSeconds = Seconds( start );
+			BrickCacheStats stats = paged.GetCache().GetStats();
+
+			std::vector<uint32_t> linear( engine.GetVoxelCount() );
+			paged.CopyToLinear( linear.data() );
+			bool same = Checksum( linear.data(), linear.size() ) == LinearChecksum( engine );
+			if ( !same ) result = 1;
+			printf( "step    %8.3f ms/frame  %u slots for %u bricks  gen %.2f ms  %llu misses %llu prefetched %llu "
+					"written back%s\n", stepSeconds * 1000.0 / args.frames, paged.GetCache().GetSlotCount(),
+					paged.GetBrickCount(), generateSeconds * 1000.0, static_cast< unsigned long long >( stats.misses ),
+					static_cast< unsigned long long >( stats.prefetches ), static_cast< unsigned long long >( stats.writebacks ),
+					same ? "" : "  MISMATCH" );
+
+			const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+			const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+			std::vector<float> reference( pixels * 4 );
+			std::vector<float> image( pixels * 4 );
+			VolumeRenderer renderer( args.threads );
+			renderer.SetMode( RenderModeSingle );
+			RaymarchParams params = RaymarchParams::Default();
+			for ( int compositing = 0; compositing < CompositeCount; compositing++ )
+			{
+				params.compositing = static_cast< RaymarchCompositing >( compositing );
+				renderer.Render( engine.GetView(), params, camera, args.image, args.image, reference.data() );
+				paged.GetCache().ResetStats();
+				start = std::chrono::high_resolution_clock::now();
+				uint64_t samples = paged.Render( params, camera, args.image, args.image, image.data() );
+				double seconds = Seconds( start );
+				stats = paged.GetCache().GetStats();
+				bool match = memcmp( image.data(), reference.data(), image.size() * sizeof( float ) ) == 0;
+				if ( !match ) result = 1;
+				printf( "%-13s %8.2f ms  %.1f samples/ray  %llu hits %llu prefetch hits %llu misses %llu evictions%s\n",
+						GetCompositingName( params.compositing ), seconds * 1000.0, static_cast< double >( samples ) / pixels,
+						static_cast< unsigned long long >( stats.hits ), static_cast< unsigned long long >( stats.prefetchHits ),
+						static_cast< unsigned long long >( stats.misses ), static_cast< unsigned long long >( stats.evictions ),
+						match ? "" : "  MISMATCH" );
+			}
+		}
+		remove( path );
+		return result;
+	}
+
+	// The shells recorded every step with a keyframe every 16 frames, then played
+	// back in order and by random seeks, every frame against the engine's
+	int BenchRecord( const BenchArgs& args )
+	{
+		const char* path = "VolumeBench.record.tmp";
+		const uint32_t interval = 16;
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		std::vector<uint64_t> checksums;
+		double recordSeconds = 0.0;
+		VolumeRecordStats stats;
+		{
+			VolumeRecorder recorder( path, args.width, args.height, args.depth, interval, args.threads );
+			if ( !recorder.IsOpen() )
+			{
+				printf( "cannot create %s  MISMATCH\n", path );
+				return 1;
+			}
+			engine.FillShellVolume();
+			for ( uint32_t i = 0; i <= args.frames; i++ )
+			{
+				if ( i ) engine.Step();
+				checksums.push_back( LinearChecksum( engine ) );
+				auto start = std::chrono::high_resolution_clock::now();
+				recorder.RecordFrame( engine );
+				recordSeconds += Seconds( start );
+			}
+			stats = recorder.GetStats();
+			if ( !recorder.Close() )
+			{
+				printf( "cannot write %s  MISMATCH\n", path );
+				remove( path );
+				return 1;
+			}
+		}
+
+		int result = 0;
+		VolumePlayer player( path, args.threads );
+		bool same = player.IsOpen() && player.GetFrameCount() == checksums.size();
+		std::vector<uint32_t> linear( engine.GetVoxelCount() );
+		double playSeconds = 0.0;
+		for ( uint32_t i = 0; i < checksums.size() && same; i++ )
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			same = player.NextFrame();
+			playSeconds += Seconds( start );
+			player.CopyTo( VolumeLayoutLinear, linear.data() );
+			same = same && Checksum( linear.data(), linear.size() ) == checksums[i];
+		}
+
+		const uint32_t seeks = 8;
+		uint32_t random = 12345;
+		double seekSeconds = 0.0;
+		for ( uint32_t i = 0; i < seeks && same; i++ )
+		{
+			random = random * 1664525u + 1013904223u;
+			const uint32_t frame = random % static_cast< uint32_t >( checksums.size() );
+			auto start = std::chrono::high_resolution_clock::now();
+			same = player.Seek( frame );
+			seekSeconds += Seconds( start );
+			player.CopyTo( VolumeLayoutLinear, linear.data() );
+			same = same && Checksum( linear.data(), linear.size() ) == checksums[frame];
+		}
+		if ( !same ) result = 1;
+
+		const uint32_t deltas = stats.frames - stats.keyframes;
+		const double frameBytes = static_cast< double >( stats.rawBytes ) / stats.frames;
+		printf( "record  %8.2f ms/frame  keyframe %8.1f KB %5.2fx  delta %8.1f KB %7.2fx  %.1f bricks/delta  all %.2fx\n",
+				recordSeconds * 1000.0 / stats.frames, stats.keyframeBytes / 1024.0 / stats.keyframes,
+				frameBytes * stats.keyframes / stats.keyframeBytes,
+				deltas ? stats.deltaBytes / 1024.0 / deltas : 0.0,
+				stats.deltaBytes ? frameBytes * deltas / stats.deltaBytes : 0.0,
+				deltas ? static_cast< double >( stats.deltaBricks ) / deltas : 0.0,
+				static_cast< double >( stats.rawBytes ) / ( stats.keyframeBytes + stats.deltaBytes ) );
+		printf( "play    %8.2f ms/frame %7.1f frames/s  seek %8.2f ms avg%s\n", playSeconds * 1000.0 / checksums.size(),
+				checksums.size() / playSeconds, seekSeconds * 1000.0 / seeks, same ? "" : "  MISMATCH" );
+		remove( path );
+		return result;
+	}
+
+	// Frames submitted back to back, faster than any disk, so the queue fills and
+	// frames drop. Submit must stay a copy, and what is written has to be the image.
+	int BenchCapture( const BenchArgs& args, const VolumeEngine& engine )
+	{
+		const uint32_t frames = 16;
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		const size_t pixels = static_cast< size_t >( args.image ) * args.image;
+		std::vector<float> image( pixels * 4 );
+		VolumeRenderer renderer( args.threads );
+		renderer.Render( engine.GetView(), RaymarchParams::Default(), camera, args.image, args.image, image.data() );
+		std::vector<uint8_t> packed( pixels * 4 );
+		PackRGBA8( image.data(), pixels, packed.data() );
+
+		const char* paths[CaptureFormatCount] = { "VolumeBench.capture.ppm", "VolumeBench.capture.png",
+												  "VolumeBench.capture.y4m" };
+		int result = 0;
+		for ( int type = 0; type < CaptureFormatCount; type++ )
+		{
+			const CaptureFormat format = static_cast< CaptureFormat >( type );
+			double submitSeconds = 0.0, maxSubmitSeconds = 0.0;
+			CaptureStats stats;
+			{
+				FrameCapture capture( paths[type], format, CapturePixelRGBA32Float, args.image, args.image );
+				for ( uint32_t i = 0; i < frames; i++ )
+				{
+					auto start = std::chrono::high_resolution_clock::now();
+					capture.Submit( image.data(), args.image * 4 * sizeof( float ) );
+					double seconds = Seconds( start );
+					submitSeconds += seconds;
+					maxSubmitSeconds = std::max( maxSubmitSeconds, seconds );
+				}
+				capture.Flush();
+				stats = capture.GetStats();
+			}
+
+			bool same = stats.written + stats.dropped == frames && stats.written && !stats.failed;
+			if ( format == CaptureY4M )
+			{
+				const uint64_t frameBytes = 6 + pixels + 2 * static_cast< uint64_t >( ( args.image + 1 ) / 2 ) * ( ( args.image + 1 ) / 2 );
+				char header[96];
+				const int length = snprintf( header, sizeof( header ), "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C420jpeg\n",
+											 args.image, args.image );
+				FILE* file = fopen( paths[type], "rb" );
+				same = same && file && fseek( file, 0, SEEK_END ) == 0 &&
+					static_cast< uint64_t >( ftell( file ) ) == length + stats.written * frameBytes;
+				if ( file ) fclose( file );
+				remove( paths[type] );
+			}
+			else
+			{
+				// The first frame is never dropped, the queue starts empty
+				std::string first( paths[type] );
+				first.insert( first.rfind( '.' ), "00000" );
+				std::vector<uint8_t> bytes;
+				FILE* file = fopen( first.c_str(), "rb" );
+				if ( file )
+				{
+					int c;
+					while ( ( c = fgetc( file ) ) != EOF ) bytes.push_back( static_cast< uint8_t >( c ) );
+					fclose( file );
+				}
+				if ( format == CapturePPM )
+				{
+					char header[64];
+					size_t length = snprintf( header, sizeof( header ), "P6\n%u %u\n255\n", args.image, args.image );
+					same = same && bytes.size() == length + pixels * 3 && memcmp( bytes.data(), header, length ) == 0;
+					for ( size_t i = 0; i < pixels && same; i++ )
+						same = memcmp( &bytes[length + i * 3], &packed[i * 4], 3 ) == 0;
+				}
+				else
+				{
+					// Stored deflate: the filter byte and the row of every line follow each other
+					same = same && bytes.size() > 8 && memcmp( bytes.data() + 1, "PNG", 3 ) == 0;
+					const size_t rowBytes = static_cast< size_t >( args.image ) * 4;
+					const uint8_t* rowStart = same ? std::search( bytes.data(), bytes.data() + bytes.size(), packed.data(),
+																  packed.data() + rowBytes ) : nullptr;
+					same = same && rowStart != bytes.data() + bytes.size();
+				}
+				for ( uint32_t i = 0; i < frames; i++ )
+				{
+					char number[16];
+					snprintf( number, sizeof( number ), "%05u", i );
+					std::string path( paths[type] );
+					path.insert( path.rfind( '.' ), number );
+					remove( path.c_str() );
+				}
+			}
+			if ( !same ) result = 1;
+			printf( "%-7s submit %6.3f ms avg %6.3f ms max  %2llu written %2llu dropped  queue max %u  writer %7.1f MB/s%s\n",
+					GetCaptureFormatName( format ), submitSeconds * 1000.0 / frames, maxSubmitSeconds * 1000.0,
+					static_cast< unsigned long long >( stats.written ), static_cast< unsigned long long >( stats.dropped ),
+					stats.maxQueueDepth, stats.writeSeconds > 0.0 ? stats.bytesWritten / stats.writeSeconds * 1e-6 : 0.0,
+					same ? "" : "  MISMATCH" );
+		}
+		return result;
+	}
+
+	int BenchMorton()
+	{
+		const uint32_t side = 256;
+		const uint32_t count = side * side * side;
+		std::vector<uint32_t> codes( count );
+		int result = 0;
+
+		MortonEncodeFunc encoders[2] = { MortonEncode3_Scalar, nullptr };
+		MortonDecodeFunc decoders[2] = { MortonDecode3_Scalar, nullptr };
+		const char* names[2] = { "scalar", "bmi2" };
+#if VE_X86
+		if ( CpuFeatures::Get().bmi2 )
+		{
+			encoders[1] = MortonEncode3_BMI2;
+			decoders[1] = MortonDecode3_BMI2;
+		}
+#endif
+		uint64_t reference = 0;
+		for ( int f = 0; f < 2; f++ )
+		{
+			if ( !encoders[f] ) continue;
+			auto start = std::chrono::high_resolution_clock::now();
+			uint32_t n = 0;
+			for ( uint32_t z = 0; z < side; z++ )
+				for ( uint32_t y = 0; y < side; y++ )
+					for ( uint32_t x = 0; x < side; x++ )
+						codes[n++] = encoders[f]( x, y, z );
+			double encodeSeconds = Seconds( start );
+
+			uint64_t hash = Checksum( codes.data(), count );
+			start = std::chrono::high_resolution_clock::now();
+			uint32_t sum = 0;
+			for ( uint32_t i = 0; i < count; i++ )
+			{
+				uint32_t x, y, z;
+				decoders[f]( i, x, y, z );
+				sum += x ^ ( y << 10 ) ^ ( z << 20 );
+			}
+			double decodeSeconds = Seconds( start );
+			hash = ( hash ^ sum ) * 1099511628211ull;
+
+			if ( !reference ) reference = hash;
+			if ( hash != reference ) result = 1;
+			printf( "%-7s encode %7.1f Mcodes/s  decode %7.1f Mcodes/s%s%s\n", names[f], count / encodeSeconds * 1e-6,
+					count / decodeSeconds * 1e-6, f == 1 && !UseMortonBMI2() ? "  (slow pdep, not dispatched)" : "",
+					hash == reference ? "" : "  MISMATCH" );
+		}
+		return result;
+	}
+
+	// The app's frame through RenderDevice on the null backend: upload the start
+	// volume, then per frame a csmain dispatch, which runs the step kernel, and the
+	// cube draw, which is only recorded. The volume read back has to be the engine's.
+	// Voxels per thread group of the CPU csmain
+	const uint32_t CpuStepGroupVoxels = 4096;
+
+	// csmain for the null device: the step kernel of engine over the whole buffer
+	// bound first, VolumeParams as the constants. doubleBuffered binds the last step
+	// second, each group copies its voxels over and steps them.
+	ComputePipelineDesc CpuStepPipelineDesc( const VolumeEngine& engine, bool doubleBuffered = false )
+	{
+		const StepKernelFunc step = GetStepKernelFunc( engine.GetStepKernel() );
+		ComputePipelineDesc desc = {};
+		desc.name = "csmain";
+		desc.bufferCount = doubleBuffered ? 2 : 1;
+		desc.constantBytes = sizeof( VolumeParams );
+		desc.cpuKernel = [step]( const RenderBindings& bindings, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ,
+								 TaskPool& pool )
+		{
+			VolumeParams params;
+			memcpy( &params, bindings.constants, sizeof( params ) );
+			const StepTables tables = StepTables::Build( params );
+			uint32_t* voxels = static_cast< uint32_t* >( bindings.buffers[0]->Map() );
+			const uint32_t* last = bindings.bufferCount > 1 ? static_cast< const uint32_t* >( bindings.buffers[1]->Map() ) : nullptr;
+			const size_t voxelCount = static_cast< size_t >( bindings.buffers[0]->GetSize() / sizeof( uint32_t ) );
+			pool.ParallelFor( groupsX * groupsY * groupsZ, 4, [&]( uint32_t begin, uint32_t end )
+			{
+				const size_t first = static_cast< size_t >( begin ) * CpuStepGroupVoxels;
+				const size_t limit = std::min( voxelCount, static_cast< size_t >( end ) * CpuStepGroupVoxels );
+				if ( first >= limit ) return;
+				if ( last ) memcpy( voxels + first, last + first, ( limit - first ) * sizeof( uint32_t ) );
+				step( voxels + first, limit - first, tables, nullptr );
+			} );
+		};
+		return desc;
+	}
+
+	// psmain for the null device, which rasterizes nothing: the app's raymarch of
+	// camera as a kernel over the volume bound first, one thread group per pixel of the
+	// groupsX x groupsY image bound second, 4 floats each
+	ComputePipelineDesc CpuRenderPipelineDesc( const VolumeEngine& engine, const RaymarchCamera& camera )
+	{
+		VolumeView view = engine.GetView();
+		// The engine's ranges and mips are of its own volume
+		view.brickRange = view.cellRange = nullptr;
+		view.mipVoxels = nullptr;
+		view.mipCount = 0;
+		ComputePipelineDesc desc = {};
+		desc.name = "psmain";
+		desc.bufferCount = 2;
+		desc.cpuKernel = [view, camera]( const RenderBindings& bindings, uint32_t groupsX, uint32_t groupsY, uint32_t,
+										 TaskPool& pool )
+		{
+			VolumeView volume = view;
+			volume.voxels = static_cast< const uint32_t* >( bindings.buffers[0]->Map() );
+			float* rgba = static_cast< float* >( bindings.buffers[1]->Map() );
+			const RaymarchParams params = RaymarchParams::Default();
+			double inverse[16];
+			if ( !camera.GetInverse( inverse ) ) return;
+			pool.ParallelFor( groupsY, 1, [&]( uint32_t begin, uint32_t end )
+			{
+				for ( uint32_t y = begin; y < end; y++ )
+					for ( uint32_t x = 0; x < groupsX; x++ )
+					{
+						float dir[3];
+						camera.GetPixelRay( inverse, groupsX, groupsY, x, y, dir );
+						MarchRay( volume, params, camera.eye, dir, rgba + ( static_cast< size_t >( y ) * groupsX + x ) * 4 );
+					}
+			} );
+		};
+		return desc;
+	}
+
+	int BenchNullDevice( const BenchArgs& args )
+	{
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		engine.FillShellVolume();
+		const size_t count = engine.GetStorageCount();
+		const uint64_t bytes = count * sizeof( uint32_t );
+		const uint32_t groups = static_cast< uint32_t >( ( count + CpuStepGroupVoxels - 1 ) / CpuStepGroupVoxels );
+
+		std::unique_ptr<RenderDevice> device = CreateNullRenderDevice( args.threads );
+		std::unique_ptr<RenderBuffer> upload = device->CreateBuffer( bytes, RenderHeapUpload, "upload" );
+		std::unique_ptr<RenderBuffer> volume = device->CreateBuffer( bytes, RenderHeapDefault, "volume" );
+		std::unique_ptr<RenderBuffer> readback = device->CreateBuffer( bytes, RenderHeapReadback, "readback" );
+		memcpy( upload->Map(), engine.GetVoxels(), bytes );
+		upload->Unmap();
+
+		std::unique_ptr<RenderPipeline> csmain = device->CreateComputePipeline( CpuStepPipelineDesc( engine ) );
+
+		GraphicsPipelineDesc graphicsDesc = {};
+		graphicsDesc.name = "psmain";
+		graphicsDesc.vertexStride = 3 * sizeof( float );
+		graphicsDesc.targetFormat = RenderTargetRGBA8;
+		graphicsDesc.bufferCount = 1;
+		std::unique_ptr<RenderPipeline> psmain = device->CreateGraphicsPipeline( graphicsDesc );
+		std::unique_ptr<RenderBuffer> vertices = device->CreateBuffer( 8 * 3 * sizeof( float ), RenderHeapUpload, "vertices" );
+		std::unique_ptr<RenderBuffer> indices = device->CreateBuffer( 36 * sizeof( uint16_t ), RenderHeapUpload, "indices" );
+		std::unique_ptr<RenderTarget> target = device->CreateTarget( args.image, args.image, RenderTargetRGBA8, "target" );
+		std::unique_ptr<RenderBuffer> targetReadback =
+			device->CreateBuffer( target->GetReadbackBytes(), RenderHeapReadback, "target readback" );
+
+		std::unique_ptr<RenderQueue> computeQueue = device->CreateQueue( RenderQueueCompute );
+		std::unique_ptr<RenderQueue> graphicsQueue = device->CreateQueue( RenderQueueGraphics );
+		std::unique_ptr<RenderCommandList> computeList = device->CreateCommandList( RenderQueueCompute );
+		std::unique_ptr<RenderCommandList> graphicsList = device->CreateCommandList( RenderQueueGraphics );
+		std::unique_ptr<RenderFence> fence = device->CreateFence();
+		uint64_t fenceValue = 0;
+
+		const VolumeParams params = engine.GetParams();
+		const float clearColor[4] = { 0.25f, 0.25f, 0.25f, 1.f };
+		RenderBindings bindings = {};
+		bindings.buffers[0] = volume.get();
+		bindings.bufferCount = 1;
+		bindings.constants = &params;
+		bindings.constantBytes = sizeof( params );
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+		{
+			computeList->Reset();
+			if ( i == 0 ) computeList->CopyBuffer( volume.get(), 0, upload.get(), 0, bytes );
+			computeList->Dispatch( csmain.get(), bindings, groups, 1, 1 );
+			computeList->Barrier( volume.get() );
+			computeList->Close();
+			computeQueue->Execute( computeList.get() );
+			computeQueue->Signal( fence.get(), ++fenceValue );
+
+			graphicsQueue->WaitFence( fence.get(), fenceValue );
+			graphicsList->Reset();
+			graphicsList->ClearTarget( target.get(), clearColor );
+			graphicsList->DrawIndexed( psmain.get(), bindings, target.get(), vertices.get(), indices.get(), 36, 1 );
+			if ( i + 1 == args.frames )
+			{
+				graphicsList->CopyBuffer( readback.get(), 0, volume.get(), 0, bytes );
+				graphicsList->CopyTargetToBuffer( targetReadback.get(), target.get() );
+			}
+			graphicsList->Close();
+			graphicsQueue->Execute( graphicsList.get() );
+			graphicsQueue->Signal( fence.get(), ++fenceValue );
+			fence->Wait( fenceValue );
+		}
+		const double seconds = Seconds( start );
+
+		for ( uint32_t i = 0; i < args.frames; i++ )
+			engine.Step();
+		const uint32_t* stepped = static_cast< const uint32_t* >( readback->Map() );
+		bool same = Checksum( stepped, count ) == Checksum( engine.GetVoxels(), count );
+		readback->Unmap();
+		// Nothing is rasterized, the target keeps its clear color
+		const uint8_t* pixels = static_cast< const uint8_t* >( targetReadback->Map() );
+		for ( uint64_t i = 0; i < target->GetReadbackBytes() && same; i += 4 )
+			same = pixels[i] == 64 && pixels[i + 1] == 64 && pixels[i + 2] == 64 && pixels[i + 3] == 255;
+		targetReadback->Unmap();
+
+		const RenderDeviceStats stats = device->GetStats();
+		same = same && fence->GetCompletedValue() == fenceValue && stats.dispatches == args.frames &&
+			stats.draws == args.frames && stats.skippedDispatches == 0;
+		const double voxels = static_cast< double >( count ) * args.frames;
+		printf( "null    %8.3f ms/frame  %8.1f Mvoxels/s  %llu executes  %llu dispatches of %u groups  %llu draws  "
+				"%llu copies %.1f MB%s\n", seconds * 1000.0 / args.frames, voxels / seconds * 1e-6,
+				static_cast< unsigned long long >( stats.executes ), static_cast< unsigned long long >( stats.dispatches ),
+				groups, static_cast< unsigned long long >( stats.draws ), static_cast< unsigned long long >( stats.copies ),
+				stats.copyBytes / ( 1024.0 * 1024.0 ), same ? "" : "  MISMATCH" );
+		return same ? 0 : 1;
+	}
+
+	// The frames of BenchNullDevice with up to framesInFlight of them queued, the cube
+	// draw replaced by psmain's raymarch on the graphics queue so that it takes the
+	// share of the frame it takes in the app. Every frame has its lists and a readback
+	// of the stepped volume; the CPU waits on the graphics fence only to reuse them,
+	// then checks the volume read back against the engine as the app reads its
+	// counters. Compute waits on the GPU for the graphics work of the frame before to
+	// be done with the volume, graphics for the compute work of its frame.
+	// doubleBuffered steps into the volume the graphics work of the frame before last
+	// read, so compute waits only for that and overlaps the frame before once two or
+	// more are in flight; with one the CPU retires it first. Both queues read the last
+	// volume then, which the null device allows as its buffers have no states.
+	int BenchFramesInFlight( const BenchArgs& args, uint32_t framesInFlight, bool doubleBuffered )
+	{
+		VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+		engine.FillShellVolume();
+		const size_t count = engine.GetStorageCount();
+		const uint64_t bytes = count * sizeof( uint32_t );
+		const uint32_t groups = static_cast< uint32_t >( ( count + CpuStepGroupVoxels - 1 ) / CpuStepGroupVoxels );
+
+		std::unique_ptr<RenderDevice> device = CreateNullRenderDevice( args.threads );
+		std::unique_ptr<RenderBuffer> upload = device->CreateBuffer( bytes, RenderHeapUpload, "upload" );
+		// Frame i steps into volumes[i % volumeCount]
+		const uint32_t volumeCount = doubleBuffered ? 2 : 1;
+		std::unique_ptr<RenderBuffer> volumes[2];
+		for ( uint32_t i = 0; i < volumeCount; i++ )
+			volumes[i] = device->CreateBuffer( bytes, RenderHeapDefault, "volume" );
+		memcpy( upload->Map(), engine.GetVoxels(), bytes );
+		upload->Unmap();
+		std::unique_ptr<RenderPipeline> csmain = device->CreateComputePipeline( CpuStepPipelineDesc( engine, doubleBuffered ) );
+		const RaymarchCamera camera = RaymarchCamera::Default( args.image, args.image, args.size );
+		std::unique_ptr<RenderPipeline> psmain = device->CreateComputePipeline( CpuRenderPipelineDesc( engine, camera ) );
+		std::unique_ptr<RenderBuffer> image =
+			device->CreateBuffer( uint64_t( args.image ) * args.image * 4 * sizeof( float ), RenderHeapDefault, "image" );
+
+		struct FrameContext
+		{
+			std::unique_ptr<RenderCommandList> computeList;
+			std::unique_ptr<RenderCommandList> graphicsList;
+			std::unique_ptr<RenderBuffer> readback;
+			// Graphics fence value of the frame, 0 before the first one
+			uint64_t fenceValue;
+			uint32_t frame;
+		};
+		std::vector<FrameContext> contexts( framesInFlight );
+		for ( FrameContext& context : contexts )
+		{
+			context.computeList = device->CreateCommandList( RenderQueueCompute );
+			context.graphicsList = device->CreateCommandList( RenderQueueGraphics );
+			context.readback = device->CreateBuffer( bytes, RenderHeapReadback, "readback" );
+			context.fenceValue = 0;
+			context.frame = 0;
+		}
+		// Last, the queues finish their work before what it uses goes away
+		std::unique_ptr<RenderFence> computeFence = device->CreateFence();
+		std::unique_ptr<RenderFence> graphicsFence = device->CreateFence();
+		std::unique_ptr<RenderQueue> computeQueue = device->CreateQueue( RenderQueueCompute );
+		std::unique_ptr<RenderQueue> graphicsQueue = device->CreateQueue( RenderQueueGraphics );
+		uint64_t computeValue = 0;
+		uint64_t graphicsValue = 0;
+		// Graphics fence value of the last frame that read each volume
+		uint64_t volumeValues[2] = {};
+
+		std::vector<uint64_t> expected( args.frames );
+		for ( uint32_t i = 0; i < args.frames; i++ )
+		{
+			engine.Step();
+			expected[i] = Checksum( engine.GetVoxels(), count );
+		}
+
+		const VolumeParams params = engine.GetParams();
+		RenderBindings bindings = {};
+		bindings.constants = &params;
+		bindings.constantBytes = sizeof( params );
+		RenderBindings renderBindings = {};
+		renderBindings.buffers[1] = image.get();
+		renderBindings.bufferCount = 2;
+
+		bool same = true;
+		double waitSeconds = 0.0;
+		auto retire = [&]( FrameContext& context )
+		{
+			auto waitStart = std::chrono::high_resolution_clock::now();
+			graphicsFence->Wait( context.fenceValue );
+			waitSeconds += Seconds( waitStart );
+			const uint32_t* stepped = static_cast< const uint32_t* >( context.readback->Map() );
+			same = same && Checksum( stepped, count ) == expected[context.frame];
+			context.readback->Unmap();
+			context.fenceValue = 0;
+		};
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+		{
+			FrameContext& context = contexts[i % framesInFlight];
+			if ( context.fenceValue ) retire( context );
+			const uint32_t current = i % volumeCount;
+			RenderBuffer* volume = volumes[current].get();
+			RenderBuffer* last = volumes[( i + 1 ) % volumeCount].get();
+
+			bindings.buffers[0] = volume;
+			bindings.buffers[1] = last;
+			bindings.bufferCount = volumeCount;
+			context.computeList->Reset();
+			if ( i == 0 ) context.computeList->CopyBuffer( last, 0, upload.get(), 0, bytes );
+			context.computeList->Dispatch( csmain.get(), bindings, groups, 1, 1 );
+			context.computeList->Barrier( volume );
+			context.computeList->Close();
+			computeQueue->WaitFence( graphicsFence.get(), volumeValues[current] );
+			computeQueue->Execute( context.computeList.get() );
+			computeQueue->Signal( computeFence.get(), ++computeValue );
+
+			renderBindings.buffers[0] = volume;
+			context.graphicsList->Reset();
+			context.graphicsList->Dispatch( psmain.get(), renderBindings, args.image, args.image, 1 );
+			context.graphicsList->CopyBuffer( context.readback.get(), 0, volume, 0, bytes );
+			context.graphicsList->Close();
+			graphicsQueue->WaitFence( computeFence.get(), computeValue );
+			graphicsQueue->Execute( context.graphicsList.get() );
+			graphicsQueue->Signal( graphicsFence.get(), ++graphicsValue );
+			volumeValues[current] = graphicsValue;
+			context.fenceValue = graphicsValue;
+			context.frame = i;
+		}
+		// The frames still queued, oldest first
+		for ( uint32_t i = 0; i < framesInFlight; i++ )
+		{
+			FrameContext& context = contexts[( args.frames + i ) % framesInFlight];
+			if ( context.fenceValue ) retire( context );
+		}
+		const double seconds = Seconds( start );
+
+		// Some compute runs alongside graphics only when the volume is double buffered
+		const RenderDeviceStats stats = device->GetStats();
+		const uint64_t computeBusy = stats.busyNanoseconds[RenderQueueCompute];
+		printf( "%s %u in flight  %8.3f ms/frame  cpu wait %8.3f ms/frame %5.1f%%  compute %8.3f ms/frame %5.1f%% "
+				"overlapped%s\n", doubleBuffered ? "double" : "single", framesInFlight, seconds * 1000.0 / args.frames,
+				waitSeconds * 1000.0 / args.frames, 100.0 * waitSeconds / seconds, computeBusy * 1e-6 / args.frames,
+				computeBusy ? 100.0 * stats.overlapNanoseconds / computeBusy : 0.0, same ? "" : "  MISMATCH" );
+		return same ? 0 : 1;
+	}
+}
+
+int main( int argc, char** argv )
+{
+	BenchArgs args = ParseArgs( argc, argv );
+
+	VolumeEngine engine( args.width, args.height, args.depth, args.threads );
+	printf( "volume %ux%ux%u, %u frames, %u thread%s\n", args.width, args.height, args.depth, args.frames,
+			engine.GetThreadCount(), engine.GetThreadCount() == 1 ? "" : "s" );
+
+	auto start = std::chrono::high_resolution_clock::now();
+	engine.FillShellVolume();
+	printf( "init    %8.2f ms\n", Seconds( start ) * 1000.0 );
+	if ( args.save && !WriteVolumeFile( args.save, engine.GetLayout(), args.width, args.height, args.depth, engine.GetVoxels() ) )
+		fprintf( stderr, "cannot write %s\n", args.save );
+
+	const std::vector<uint32_t> initial( engine.GetVoxels(), engine.GetVoxels() + engine.GetVoxelCount() );
+
+	uint64_t reference = 0;
+	int result = 0;
+	for ( int type = StepKernelScalar; type < StepKernelCount; type++ )
+	{
+		StepKernelType kernel = static_cast< StepKernelType >( type );
+		if ( !IsStepKernelSupported( kernel ) ) continue;
+		if ( args.kernel && strcmp( args.kernel, GetStepKernelName( kernel ) ) != 0 ) continue;
+
+		engine.SetStepKernel( kernel );
+		std::copy( initial.begin(), initial.end(), engine.GetVoxels() );
+		engine.MarkAllBricksActive();
+
+		start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < args.frames; i++ )
+			engine.Step();
+		double seconds = Seconds( start );
+
+		uint64_t checksum = Checksum( engine.GetVoxels(), engine.GetVoxelCount() );
+		if ( reference == 0 ) reference = checksum;
+		bool match = checksum == reference;
+		if ( !match ) result = 1;
+
+		double voxels = static_cast< double >( engine.GetVoxelCount() ) * args.frames;
+		printf( "%-7s %8.3f ms/frame  %8.1f Mvoxels/s  %u/%u bricks active  checksum %016llx%s\n",
+				GetStepKernelName( kernel ), seconds * 1000.0 / args.frames, voxels / seconds * 1e-6,
+				engine.GetActiveBrickCount(), engine.GetBrickCount(),
+				static_cast< unsigned long long >( checksum ), match ? "" : "  MISMATCH" );
+	}
+
+	// Closed form seek straight to the last frame has to land on the same volume
+	start = std::chrono::high_resolution_clock::now();
+	engine.Seek( initial.data(), args.frames );
+	double seekSeconds = Seconds( start );
+	uint64_t checksum = Checksum( engine.GetVoxels(), engine.GetVoxelCount() );
+	if ( reference && checksum != reference ) result = 1;
+	printf( "seek    %8.3f ms to frame %u          checksum %016llx%s\n", seekSeconds * 1000.0, args.frames,
+			static_cast< unsigned long long >( checksum ), !reference || checksum == reference ? "" : "  MISMATCH" );
+
+	printf( "layouts, %s kernel, %u views of %u^2 rays\n", GetStepKernelName( engine.GetStepKernel() ), args.views, args.image );
+	LayoutResult layoutReference = {};
+	for ( int type = 0; type < VolumeLayoutCount; type++ )
+	{
+		if ( !VolumeSizeSupported( type, args.width, args.height, args.depth ) )
+		{
+			printf( "%-7s not supported at this size\n", GetVolumeLayoutName( static_cast< VolumeLayoutType >( type ) ) );
+			continue;
+		}
+		LayoutResult layout = BenchLayout( args, static_cast< VolumeLayoutType >( type ), engine.GetStepKernel() );
+		if ( type == 0 ) layoutReference = layout;
+		if ( ( reference && layout.volumeChecksum != reference ) || layout.volumeChecksum != layoutReference.volumeChecksum ||
+			 layout.imageChecksum != layoutReference.imageChecksum )
+		{
+			printf( "        MISMATCH volume %016llx image %016llx\n", static_cast< unsigned long long >( layout.volumeChecksum ),
+					static_cast< unsigned long long >( layout.imageChecksum ) );
+			result = 1;
+		}
+	}
+
+	printf( "render, %u^2 pixels, start up camera\n", args.image );
+	if ( BenchRender( args, engine ) ) result = 1;
+
+	printf( "compositing, %u^2 pixels, start up camera\n", args.image );
+	if ( BenchCompositing( args, engine ) ) result = 1;
+
+
+	printf( "empty space skipping, ball of radius %u after %u frames, best of %u renders\n",
+			std::min( args.width, std::min( args.height, args.depth ) ) / 3, args.frames, args.views );
+	if ( BenchSkipping( args ) ) result = 1;
+
+	printf( "mip chain, %u views of %u^2 rays\n", args.views, args.image );
+	if ( BenchMips( args ) ) result = 1;
+
+	printf( "shell generator\n" );
+	if ( BenchGenerate( args ) ) result = 1;
+
+	printf( "scenes, %u frames, start up camera\n", args.frames );
+	if ( BenchScenes( args ) ) result = 1;
+
+	printf( "volume file, %u frames stepped on a copy on write mapping\n", args.frames );
+	if ( BenchVolumeFile( args ) ) result = 1;
+
+	printf( "snapshot, the shells at frame 0 and %u\n", args.frames );
+	if ( BenchSnapshot( args ) ) result = 1;
+
+	printf( "recording, %u frames, a keyframe every 16\n", args.frames );
+	if ( BenchRecord( args ) ) result = 1;
+
+	printf( "paged volume, %u frames, %u^2 pixels, an eighth in memory\n", args.frames, args.image );
+	if ( BenchPaged( args ) ) result = 1;
+
+	printf( "frame capture, 16 frames of %u^2 submitted back to back\n", args.image );
+	if ( BenchCapture( args, engine ) ) result = 1;
+
+	printf( "null render device, %u frames of csmain and the cube draw\n", args.frames );
+	if ( BenchNullDevice( args ) ) result = 1;
+
+	printf( "frames in flight on the null render device, %u frames, single and double buffered volume\n", args.frames );
+	for ( int doubleBuffered = 0; doubleBuffered < 2; doubleBuffered++ )
+		for ( uint32_t framesInFlight = 1; framesInFlight <= 3; framesInFlight++ )
+			if ( BenchFramesInFlight( args, framesInFlight, doubleBuffered != 0 ) ) result = 1;
+
+	printf( "morton codes, 256^3\n" );
+	if ( BenchMorton() ) result = 1;
+	return result;
+}
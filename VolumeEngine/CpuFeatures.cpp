@@ -0,0 +1,77 @@
+#include "CpuFeatures.h"
+
+#if VE_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+#if VE_X86
+	void CpuId( uint32_t leaf, uint32_t subLeaf, uint32_t regs[4] )
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuidex( info, static_cast< int >( leaf ), static_cast< int >( subLeaf ) );
+		for ( int i = 0; i < 4; i++ ) regs[i] = static_cast< uint32_t >( info[i] );
+#else
+		__cpuid_count( leaf, subLeaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+	}
+
+	uint64_t XGetBV()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv( 0 );
+#else
+		uint32_t lo, hi;
+		__asm__ __volatile__( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+		return ( static_cast< uint64_t >( hi ) << 32 ) | lo;
+#endif
+	}
+#endif
+
+	CpuFeatures Detect()
+	{
+		CpuFeatures features = {};
+#if VE_X86
+		uint32_t regs[4];
+		CpuId( 0, 0, regs );
+		uint32_t maxLeaf = regs[0];
+		// "AuthenticAMD" in ebx, edx, ecx
+		bool amd = regs[1] == 0x68747541 && regs[3] == 0x69746e65 && regs[2] == 0x444d4163;
+
+		CpuId( 1, 0, regs );
+		uint32_t family = ( regs[0] >> 8 ) & 0xf;
+		if ( family == 0xf ) family += ( regs[0] >> 20 ) & 0xff;
+		features.sse41 = ( regs[2] & ( 1u << 19 ) ) != 0;
+		bool osxsave = ( regs[2] & ( 1u << 27 ) ) != 0;
+		bool avx = ( regs[2] & ( 1u << 28 ) ) != 0;
+
+		// The OS has to save YMM (bits 1,2) and ZMM/opmask (bits 5,6,7) state
+		uint64_t xcr0 = osxsave ? XGetBV() : 0;
+		bool ymmEnabled = avx && ( xcr0 & 0x6 ) == 0x6;
+		bool zmmEnabled = ymmEnabled && ( xcr0 & 0xe0 ) == 0xe0;
+
+		if ( maxLeaf >= 7 )
+		{
+			CpuId( 7, 0, regs );
+			features.avx2 = ymmEnabled && ( regs[1] & ( 1u << 5 ) ) != 0;
+			features.bmi2 = ( regs[1] & ( 1u << 8 ) ) != 0;
+			features.avx512f = zmmEnabled && ( regs[1] & ( 1u << 16 ) ) != 0;
+			features.avx512bw = zmmEnabled && ( regs[1] & ( 1u << 30 ) ) != 0;
+		}
+		features.fastPdep = features.bmi2 && !( amd && family < 0x19 );
+#endif
+		return features;
+	}
+}
+
+const CpuFeatures& CpuFeatures::Get()
+{
+	static const CpuFeatures features = Detect();
+	return features;
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Runtime CPU feature detection for the SIMD paths of the volume engine.
+//
+// Every ISA specific function is compiled with VE_TARGET("...") so GCC/Clang
+// accept the intrinsics without raising the baseline of the whole library; MSVC
+// does not need the attribute. Callers must check CpuFeatures::Get() before
+// calling into such a function.
+
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VE_X86 1
+#else
+#define VE_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define VE_TARGET(isa)
+#else
+#define VE_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// AVX-512 intrinsics need VS2017 or newer
+#if VE_X86 && ( !defined(_MSC_VER) || _MSC_VER >= 1910 || defined(__clang__) )
+#define VE_HAS_AVX512 1
+#else
+#define VE_HAS_AVX512 0
+#endif
+
+struct CpuFeatures
+{
+	bool sse41;
+	bool avx2;
+	bool avx512f;
+	bool avx512bw;
+	bool bmi2;
+	// pdep/pext are microcoded (hundreds of cycles) on AMD before Zen 3
+	bool fastPdep;
+
+	// Detected once, including the OS support for the extended register state
+	static const CpuFeatures& Get();
+};
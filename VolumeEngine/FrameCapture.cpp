@@ -0,0 +1,391 @@
+#include "FrameCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	FILE* OpenFile( const char* path )
+	{
+		FILE* file = nullptr;
+#ifdef _WIN32
+		fopen_s( &file, path, "wb" );
+#else
+		file = fopen( path, "wb" );
+#endif
+		return file;
+	}
+
+	// Round to nearest like PackRGBA8, so the images match the render target bytes
+	uint8_t FloatToUnorm8( float v )
+	{
+		v = v > 0.f ? ( v < 1.f ? v : 1.f ) : 0.f;
+		return static_cast< uint8_t >( v * 255.f + 0.5f );
+	}
+
+	float HalfToFloat( uint16_t h )
+	{
+		const uint32_t sign = static_cast< uint32_t >( h & 0x8000 ) << 16;
+		uint32_t exponent = ( h >> 10 ) & 0x1f;
+		uint32_t mantissa = h & 0x3ff;
+		uint32_t bits;
+		if ( exponent == 0x1f ) bits = sign | 0x7f800000 | ( mantissa << 13 );
+		else if ( exponent ) bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+		else if ( !mantissa ) bits = sign;
+		else
+		{
+			// Denormal, normalize the mantissa
+			exponent = 113;
+			while ( !( mantissa & 0x400 ) )
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | ( exponent << 23 ) | ( ( mantissa & 0x3ff ) << 13 );
+		}
+		float f;
+		memcpy( &f, &bits, sizeof( f ) );
+		return f;
+	}
+
+	uint32_t PixelBytes( CapturePixelFormat format )
+	{
+		return format == CapturePixelRGBA32Float ? 16 : format == CapturePixelRGBA16Float ? 8 : 4;
+	}
+
+	void PutBigEndian( std::vector<uint8_t>& out, uint32_t v )
+	{
+		const uint8_t bytes[4] = { static_cast< uint8_t >( v >> 24 ), static_cast< uint8_t >( v >> 16 ),
+								   static_cast< uint8_t >( v >> 8 ), static_cast< uint8_t >( v ) };
+		out.insert( out.end(), bytes, bytes + 4 );
+	}
+
+	uint32_t Crc32( const uint8_t* data, size_t size, uint32_t crc = 0 )
+	{
+		static uint32_t table[256];
+		static bool init = [] ()
+		{
+			for ( uint32_t i = 0; i < 256; i++ )
+			{
+				uint32_t c = i;
+				for ( int k = 0; k < 8; k++ ) c = c & 1 ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+				table[i] = c;
+			}
+			return true;
+		}();
+		( void ) init;
+		crc = ~crc;
+		for ( size_t i = 0; i < size; i++ ) crc = table[( crc ^ data[i] ) & 0xff] ^ ( crc >> 8 );
+		return ~crc;
+	}
+
+	// Length, type, data and the CRC of type and data
+	void PutChunk( std::vector<uint8_t>& out, const char type[4], const uint8_t* data, size_t size )
+	{
+		PutBigEndian( out, static_cast< uint32_t >( size ) );
+		const size_t start = out.size();
+		out.insert( out.end(), type, type + 4 );
+		out.insert( out.end(), data, data + size );
+		PutBigEndian( out, Crc32( &out[start], out.size() - start ) );
+	}
+
+	// RGBA8 PNG: every row with filter type 0 in a zlib stream of stored blocks
+	void EncodePNG( const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<uint8_t>& out )
+	{
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		out.assign( signature, signature + 8 );
+
+		std::vector<uint8_t> header;
+		PutBigEndian( header, width );
+		PutBigEndian( header, height );
+		const uint8_t format[5] = { 8, 6, 0, 0, 0 };
+		header.insert( header.end(), format, format + 5 );
+		PutChunk( out, "IHDR", header.data(), header.size() );
+
+		const size_t rowBytes = static_cast< size_t >( width ) * 4;
+		const size_t rawBytes = ( rowBytes + 1 ) * height;
+		std::vector<uint8_t> zlib;
+		zlib.reserve( rawBytes + rawBytes / 65535 * 5 + 16 );
+		zlib.push_back( 0x78 );
+		zlib.push_back( 0x01 );
+		uint32_t a = 1, b = 0;
+		size_t blockLeft = 0, left = rawBytes;
+		for ( uint32_t y = 0; y < height; y++ )
+			for ( size_t x = 0; x <= rowBytes; x++ )
+			{
+				if ( !blockLeft )
+				{
+					blockLeft = left < 65535 ? left : 65535;
+					const uint16_t length = static_cast< uint16_t >( blockLeft );
+					zlib.push_back( left == blockLeft ? 1 : 0 );
+					zlib.push_back( static_cast< uint8_t >( length ) );
+					zlib.push_back( static_cast< uint8_t >( length >> 8 ) );
+					zlib.push_back( static_cast< uint8_t >( ~length ) );
+					zlib.push_back( static_cast< uint8_t >( ~length >> 8 ) );
+				}
+				const uint8_t v = x ? rgba[y * rowBytes + x - 1] : 0;
+				zlib.push_back( v );
+				a = ( a + v ) % 65521;
+				b = ( b + a ) % 65521;
+				blockLeft--;
+				left--;
+			}
+		PutBigEndian( zlib, ( b << 16 ) | a );
+		PutChunk( out, "IDAT", zlib.data(), zlib.size() );
+		PutChunk( out, "IEND", nullptr, 0 );
+	}
+
+	// One "FRAME" of the C420jpeg stream, chroma averaged over 2x2 pixels
+	void EncodeY4MFrame( const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<uint8_t>& out )
+	{
+		const uint32_t chromaWidth = ( width + 1 ) / 2;
+		const uint32_t chromaHeight = ( height + 1 ) / 2;
+		const size_t lumaBytes = static_cast< size_t >( width ) * height;
+		const size_t chromaBytes = static_cast< size_t >( chromaWidth ) * chromaHeight;
+		static const char frame[] = "FRAME\n";
+		out.assign( frame, frame + 6 );
+		out.resize( 6 + lumaBytes + 2 * chromaBytes );
+		uint8_t* luma = &out[6];
+		uint8_t* cb = luma + lumaBytes;
+		uint8_t* cr = cb + chromaBytes;
+		// 16.16 fixed point BT.601 coefficients
+		for ( size_t i = 0; i < lumaBytes; i++ )
+		{
+			const uint8_t* p = rgba + i * 4;
+			luma[i] = static_cast< uint8_t >( ( 19595 * p[0] + 38470 * p[1] + 7471 * p[2] + 32768 ) >> 16 );
+		}
+		for ( uint32_t cy = 0; cy < chromaHeight; cy++ )
+			for ( uint32_t cx = 0; cx < chromaWidth; cx++ )
+			{
+				int32_t r = 0, g = 0, b = 0, n = 0;
+				for ( uint32_t y = cy * 2; y < cy * 2 + 2 && y < height; y++ )
+					for ( uint32_t x = cx * 2; x < cx * 2 + 2 && x < width; x++ )
+					{
+						const uint8_t* p = rgba + ( static_cast< size_t >( y ) * width + x ) * 4;
+						r += p[0];
+						g += p[1];
+						b += p[2];
+						n++;
+					}
+				const int32_t u = ( -11059 * r - 21709 * g + 32768 * b ) / n;
+				const int32_t v = ( 32768 * r - 27439 * g - 5329 * b ) / n;
+				const size_t i = static_cast< size_t >( cy ) * chromaWidth + cx;
+				cb[i] = static_cast< uint8_t >( std::min( 255, std::max( 0, 128 + ( ( u + 32768 ) >> 16 ) ) ) );
+				cr[i] = static_cast< uint8_t >( std::min( 255, std::max( 0, 128 + ( ( v + 32768 ) >> 16 ) ) ) );
+			}
+	}
+}
+
+const char* GetCaptureFormatName( CaptureFormat format )
+{
+	static const char* names[CaptureFormatCount] = { "ppm", "png", "y4m" };
+	return format < CaptureFormatCount ? names[format] : "unknown";
+}
+
+CaptureFormat GetCaptureFormatFromPath( const char* path )
+{
+	const char* dot = strrchr( path, '.' );
+	if ( dot )
+		for ( int format = 0; format < CaptureFormatCount; format++ )
+		{
+			const char* name = GetCaptureFormatName( static_cast< CaptureFormat >( format ) );
+			size_t i = 0;
+			while ( name[i] && dot[i + 1] && ( dot[i + 1] | 0x20 ) == name[i] ) i++;
+			if ( !name[i] && !dot[i + 1] ) return static_cast< CaptureFormat >( format );
+		}
+	return CapturePPM;
+}
+
+FrameCapture::FrameCapture( const char* path, CaptureFormat format, CapturePixelFormat pixelFormat, uint32_t width,
+							uint32_t height, uint32_t queueFrames, uint32_t frameRate ) :
+	m_path( path ), m_format( format ), m_pixelFormat( pixelFormat ), m_width( width ), m_height( height ),
+	m_frameRate( frameRate ), m_stream( nullptr ), m_writing( 0 ), m_stop( false ), m_stats()
+{
+	m_frameBytes = static_cast< size_t >( width ) * height * PixelBytes( pixelFormat );
+	if ( format == CaptureY4M )
+	{
+		m_stream = OpenFile( path );
+		if ( !m_stream ) return;
+		char header[96];
+		int length = snprintf( header, sizeof( header ), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height,
+							   frameRate );
+		m_stats.bytesWritten += fwrite( header, 1, length, m_stream );
+	}
+	else
+	{
+		// The frame number goes in front of the extension
+		const size_t slash = m_path.find_last_of( "/\\" );
+		const size_t dot = m_path.rfind( '.' );
+		if ( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) )
+		{
+			m_pathSuffix = m_path.substr( dot );
+			m_path.erase( dot );
+		}
+	}
+
+	queueFrames = queueFrames ? queueFrames : 1;
+	m_slots.resize( queueFrames );
+	for ( uint32_t i = 0; i < queueFrames; i++ )
+	{
+		m_slots[i].resize( m_frameBytes );
+		m_freeSlots.push_back( queueFrames - 1 - i );
+	}
+	m_rgba.resize( static_cast< size_t >( width ) * height * 4 );
+	m_writer = std::thread( &FrameCapture::WriterLoop, this );
+}
+
+FrameCapture::~FrameCapture()
+{
+	if ( m_writer.joinable() )
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_stop = true;
+		}
+		m_queued.notify_one();
+		m_writer.join();
+	}
+	if ( m_stream ) fclose( m_stream );
+}
+
+bool FrameCapture::Submit( const void* pixels, size_t rowPitch )
+{
+	uint32_t slot;
+	uint64_t number;
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		number = m_stats.submitted++;
+		if ( m_freeSlots.empty() || !IsOpen() )
+		{
+			m_stats.dropped++;
+			return false;
+		}
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+
+	// The copy happens outside the lock, the writer only sees the slot once queued
+	const size_t rowBytes = static_cast< size_t >( m_width ) * PixelBytes( m_pixelFormat );
+	uint8_t* dst = m_slots[slot].data();
+	const uint8_t* src = static_cast< const uint8_t* >( pixels );
+	if ( rowPitch == rowBytes ) memcpy( dst, src, m_frameBytes );
+	else
+		for ( uint32_t y = 0; y < m_height; y++ )
+			memcpy( dst + y * rowBytes, src + y * rowPitch, rowBytes );
+
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		QueuedFrame frame = { slot, number };
+		m_queue.push_back( frame );
+		m_stats.queueDepth = static_cast< uint32_t >( m_queue.size() );
+		m_stats.maxQueueDepth = std::max( m_stats.maxQueueDepth, m_stats.queueDepth );
+	}
+	m_queued.notify_one();
+	return true;
+}
+
+void FrameCapture::Flush()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_done.wait( lock, [this] { return m_queue.empty() && !m_writing; } );
+}
+
+CaptureStats FrameCapture::GetStats() const
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	return m_stats;
+}
+
+void FrameCapture::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	for ( ;; )
+	{
+		m_queued.wait( lock, [this] { return m_stop || !m_queue.empty(); } );
+		if ( m_queue.empty() ) break;
+		const QueuedFrame frame = m_queue.front();
+		m_queue.pop_front();
+		m_stats.queueDepth = static_cast< uint32_t >( m_queue.size() );
+		m_writing++;
+		lock.unlock();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		const bool written = WriteFrame( m_slots[frame.slot].data(), frame.number );
+		const double seconds =
+			std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+
+		lock.lock();
+		m_freeSlots.push_back( frame.slot );
+		m_writing--;
+		if ( written ) m_stats.written++;
+		else m_stats.failed++;
+		m_stats.bytesWritten += written ? m_encoded.size() : 0;
+		m_stats.writeSeconds += seconds;
+		m_done.notify_all();
+	}
+}
+
+void FrameCapture::ConvertToRGBA8( const uint8_t* pixels )
+{
+	const size_t count = static_cast< size_t >( m_width ) * m_height * 4;
+	switch ( m_pixelFormat )
+	{
+	case CapturePixelRGBA8:
+		memcpy( m_rgba.data(), pixels, count );
+		break;
+	case CapturePixelRGBA16Float:
+		for ( size_t i = 0; i < count; i++ )
+		{
+			uint16_t h;
+			memcpy( &h, pixels + i * 2, sizeof( h ) );
+			m_rgba[i] = FloatToUnorm8( HalfToFloat( h ) );
+		}
+		break;
+	default:
+		for ( size_t i = 0; i < count; i++ )
+		{
+			float f;
+			memcpy( &f, pixels + i * 4, sizeof( f ) );
+			m_rgba[i] = FloatToUnorm8( f );
+		}
+		break;
+	}
+}
+
+bool FrameCapture::WriteFrame( const uint8_t* pixels, uint64_t number )
+{
+	ConvertToRGBA8( pixels );
+	const size_t pixelCount = static_cast< size_t >( m_width ) * m_height;
+	switch ( m_format )
+	{
+	case CaptureY4M:
+		EncodeY4MFrame( m_rgba.data(), m_width, m_height, m_encoded );
+		return fwrite( m_encoded.data(), 1, m_encoded.size(), m_stream ) == m_encoded.size();
+	case CapturePNG:
+		EncodePNG( m_rgba.data(), m_width, m_height, m_encoded );
+		break;
+	default:
+	{
+		char header[64];
+		int length = snprintf( header, sizeof( header ), "P6\n%u %u\n255\n", m_width, m_height );
+		m_encoded.assign( header, header + length );
+		m_encoded.resize( length + pixelCount * 3 );
+		uint8_t* rgb = &m_encoded[length];
+		for ( size_t i = 0; i < pixelCount; i++ )
+		{
+			rgb[i * 3 + 0] = m_rgba[i * 4 + 0];
+			rgb[i * 3 + 1] = m_rgba[i * 4 + 1];
+			rgb[i * 3 + 2] = m_rgba[i * 4 + 2];
+		}
+		break;
+	}
+	}
+
+	char digits[24];
+	snprintf( digits, sizeof( digits ), "%05llu", static_cast< unsigned long long >( number ) );
+	FILE* file = OpenFile( ( m_path + digits + m_pathSuffix ).c_str() );
+	if ( !file ) return false;
+	bool ok = fwrite( m_encoded.data(), 1, m_encoded.size(), file ) == m_encoded.size();
+	return fclose( file ) == 0 && ok;
+}
@@ -0,0 +1,129 @@
+#pragma once
+// Rendered frames to disk without holding up the render loop. Submit copies a
+// finished frame (a CPU raymarcher image or a mapped GPU readback) into a free slot
+// of a bounded queue and returns; a writer thread converts and encodes the queued
+// frames in order. When every slot is still queued the frame is dropped and
+// counted instead of waiting for the disk, so a slow disk costs frames, never
+// frame time.
+//
+// CapturePPM   one binary P6 file per frame
+// CapturePNG   one RGBA PNG per frame, stored deflate blocks (no compression)
+// CaptureY4M   a single YUV4MPEG2 stream, 4:2:0 full range BT.601, for ffmpeg and
+//              most players
+//
+// Sequences are numbered by submitted frame, dropped frames leave gaps.
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat
+{
+	CapturePPM,
+	CapturePNG,
+	CaptureY4M,
+	CaptureFormatCount
+};
+
+const char* GetCaptureFormatName( CaptureFormat format );
+// By the extension of path, CapturePPM unless .png or .y4m
+CaptureFormat GetCaptureFormatFromPath( const char* path );
+
+// Pixels handed to Submit, converted to 8 bits per channel by the writer
+enum CapturePixelFormat
+{
+	// R8G8B8A8_UNORM
+	CapturePixelRGBA8,
+	// R16G16B16A16_FLOAT, the swap chain format of the app
+	CapturePixelRGBA16Float,
+	// Four floats, what VolumeRenderer::Render produces
+	CapturePixelRGBA32Float,
+	CapturePixelFormatCount
+};
+
+struct CaptureStats
+{
+	uint64_t submitted;
+	uint64_t written;
+	// No free slot when submitted
+	uint64_t dropped;
+	// Could not be written, for sequences the frame file could not be created
+	uint64_t failed;
+	uint32_t queueDepth;
+	uint32_t maxQueueDepth;
+	uint64_t bytesWritten;
+	// Writer time converting, encoding and writing
+	double writeSeconds;
+};
+
+class FrameCapture
+{
+public:
+	// The sequence formats put the frame number, five digits at least, in front of
+	// the extension of path: frame.png gives frame00000.png, frame00001.png, ...
+	// queueFrames slots of width x height pixels are allocated up front.
+	FrameCapture( const char* path, CaptureFormat format, CapturePixelFormat pixelFormat, uint32_t width,
+				  uint32_t height, uint32_t queueFrames = 4, uint32_t frameRate = 60 );
+	// Writes the frames still queued, then stops the writer
+	~FrameCapture();
+
+	FrameCapture( FrameCapture const& ) = delete;
+	FrameCapture& operator=( FrameCapture const& ) = delete;
+
+	// False if the Y4M stream cannot be created
+	bool IsOpen() const { return m_format != CaptureY4M || m_stream != nullptr; }
+	CaptureFormat GetFormat() const { return m_format; }
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+
+	// Queue a copy of the frame, rows rowPitch bytes apart. Never waits for the
+	// writer: false and counted as dropped if no slot is free.
+	bool Submit( const void* pixels, size_t rowPitch );
+	// Wait until the writer has written everything queued so far
+	void Flush();
+	CaptureStats GetStats() const;
+
+private:
+	struct QueuedFrame
+	{
+		uint32_t slot;
+		uint64_t number;
+	};
+
+	void WriterLoop();
+	bool WriteFrame( const uint8_t* pixels, uint64_t number );
+	void ConvertToRGBA8( const uint8_t* pixels );
+
+	// Y4M stream path, or the sequence path before and after the frame number
+	std::string m_path;
+	std::string m_pathSuffix;
+	CaptureFormat m_format;
+	CapturePixelFormat m_pixelFormat;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_frameRate;
+	size_t m_frameBytes;
+	// The Y4M stream, sequences open a file per frame
+	FILE* m_stream;
+
+	std::vector<std::vector<uint8_t>> m_slots;
+	std::vector<uint32_t> m_freeSlots;
+	std::deque<QueuedFrame> m_queue;
+	// Frames popped but not written yet, for Flush
+	uint32_t m_writing;
+	bool m_stop;
+	CaptureStats m_stats;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_queued;
+	std::condition_variable m_done;
+
+	// Writer only: the frame in 8 bit RGBA and the encoded bytes
+	std::vector<uint8_t> m_rgba;
+	std::vector<uint8_t> m_encoded;
+	std::thread m_writer;
+};
@@ -0,0 +1,547 @@
+#include "RenderDevice.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const char* GetRenderQueueName( RenderQueueType type )
+{
+	switch ( type )
+	{
+	case RenderQueueGraphics: return "graphics";
+	case RenderQueueCompute: return "compute";
+	case RenderQueueCopy: return "copy";
+	default: return "unknown";
+	}
+}
+
+namespace
+{
+	class NullBuffer : public RenderBuffer
+	{
+	public:
+		NullBuffer( uint64_t bytes, RenderHeapType heap )
+			: m_heap( heap ), m_data( static_cast< size_t >( bytes ), 0 )
+		{
+		}
+
+		virtual uint64_t GetSize() const { return m_data.size(); }
+		virtual RenderHeapType GetHeapType() const { return m_heap; }
+		// Any heap, kernels and copies work on the memory directly
+		virtual void* Map() { return m_data.data(); }
+		virtual void Unmap() {}
+
+	private:
+		RenderHeapType m_heap;
+		std::vector<uint8_t> m_data;
+	};
+
+	class NullTarget : public RenderTarget
+	{
+	public:
+		NullTarget( uint32_t width, uint32_t height, RenderTargetFormat format )
+			: m_width( width ), m_height( height ), m_format( format )
+			, m_pixels( static_cast< size_t >( GetReadbackBytes() ), 0 )
+		{
+		}
+
+		virtual uint32_t GetWidth() const { return m_width; }
+		virtual uint32_t GetHeight() const { return m_height; }
+		virtual RenderTargetFormat GetFormat() const { return m_format; }
+		virtual uint32_t GetReadbackRowPitch() const { return m_width * ( m_format == RenderTargetRGBA8 ? 4 : 8 ); }
+		virtual uint64_t GetReadbackBytes() const { return uint64_t( GetReadbackRowPitch() ) * m_height; }
+
+		void Clear( const float color[4] );
+		const uint8_t* GetPixels() const { return m_pixels.data(); }
+
+	private:
+		uint32_t m_width;
+		uint32_t m_height;
+		RenderTargetFormat m_format;
+		std::vector<uint8_t> m_pixels;
+	};
+
+	uint16_t FloatToHalf( float value )
+	{
+		uint32_t bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		uint32_t sign = ( bits >> 16 ) & 0x8000;
+		int32_t exponent = static_cast< int32_t >( ( bits >> 23 ) & 0xff ) - 127 + 15;
+		uint32_t mantissa = bits & 0x7fffff;
+		if ( exponent <= 0 ) return static_cast< uint16_t >( sign );
+		if ( exponent >= 31 ) return static_cast< uint16_t >( sign | 0x7c00 );
+		return static_cast< uint16_t >( sign | ( exponent << 10 ) | ( mantissa >> 13 ) );
+	}
+
+	void NullTarget::Clear( const float color[4] )
+	{
+		uint8_t pixel[8];
+		uint32_t pixelBytes = m_format == RenderTargetRGBA8 ? 4 : 8;
+		for ( uint32_t c = 0; c < 4; ++c )
+		{
+			if ( m_format == RenderTargetRGBA8 )
+			{
+				float v = std::min( std::max( color[c], 0.f ), 1.f );
+				pixel[c] = static_cast< uint8_t >( v * 255.f + 0.5f );
+			}
+			else
+			{
+				uint16_t half = FloatToHalf( color[c] );
+				memcpy( pixel + c * 2, &half, 2 );
+			}
+		}
+		for ( size_t i = 0; i < m_pixels.size(); i += pixelBytes )
+			memcpy( &m_pixels[i], pixel, pixelBytes );
+	}
+
+	class NullPipeline : public RenderPipeline
+	{
+	public:
+		NullPipeline( const char* name, const CpuComputeKernel& kernel ) : m_name( name ? name : "" ), m_kernel( kernel ) {}
+
+		virtual const char* GetName() const { return m_name.c_str(); }
+		const CpuComputeKernel& GetKernel() const { return m_kernel; }
+
+	private:
+		std::string m_name;
+		CpuComputeKernel m_kernel;
+	};
+
+	enum NullCommandType
+	{
+		NullCommandCopy,
+		NullCommandDispatch,
+		NullCommandBarrier,
+		NullCommandClear,
+		NullCommandDraw,
+		NullCommandCopyTarget
+	};
+
+	struct NullCommand
+	{
+		NullCommandType type;
+		RenderBuffer* dst;
+		RenderBuffer* src;
+		uint64_t dstOffset;
+		uint64_t srcOffset;
+		uint64_t bytes;
+		NullPipeline* pipeline;
+		NullTarget* target;
+		RenderBindings bindings;
+		// Offset of the constants in the list's constant storage
+		uint32_t constantOffset;
+		uint32_t groups[3];
+		float color[4];
+	};
+
+	class NullCommandList : public RenderCommandList
+	{
+	public:
+		explicit NullCommandList( RenderQueueType type ) : m_type( type ), m_closed( false ) {}
+
+		virtual RenderQueueType GetType() const { return m_type; }
+		virtual void Reset()
+		{
+			m_commands.clear();
+			m_constants.clear();
+			m_closed = false;
+		}
+		virtual void Close() { m_closed = true; }
+
+		virtual void CopyBuffer( RenderBuffer* dst, uint64_t dstOffset, RenderBuffer* src, uint64_t srcOffset,
+								 uint64_t bytes )
+		{
+			NullCommand& command = Append( NullCommandCopy );
+			command.dst = dst;
+			command.dstOffset = dstOffset;
+			command.src = src;
+			command.srcOffset = srcOffset;
+			command.bytes = bytes;
+		}
+		virtual void Dispatch( RenderPipeline* pipeline, const RenderBindings& bindings, uint32_t groupsX, uint32_t groupsY,
+							   uint32_t groupsZ )
+		{
+			NullCommand& command = Append( NullCommandDispatch );
+			command.pipeline = static_cast< NullPipeline* >( pipeline );
+			SetBindings( command, bindings );
+			command.groups[0] = groupsX;
+			command.groups[1] = groupsY;
+			command.groups[2] = groupsZ;
+		}
+		virtual void Barrier( RenderBuffer* buffer )
+		{
+			Append( NullCommandBarrier ).dst = buffer;
+		}
+		virtual void ClearTarget( RenderTarget* target, const float color[4] )
+		{
+			NullCommand& command = Append( NullCommandClear );
+			command.target = static_cast< NullTarget* >( target );
+			memcpy( command.color, color, sizeof( command.color ) );
+		}
+		virtual void DrawIndexed( RenderPipeline* pipeline, const RenderBindings& bindings, RenderTarget* target,
+								  RenderBuffer* vertices, RenderBuffer* indices, uint32_t indexCount, uint32_t instanceCount )
+		{
+			NullCommand& command = Append( NullCommandDraw );
+			command.pipeline = static_cast< NullPipeline* >( pipeline );
+			SetBindings( command, bindings );
+			command.target = static_cast< NullTarget* >( target );
+			command.src = vertices;
+			command.dst = indices;
+			command.groups[0] = indexCount;
+			command.groups[1] = instanceCount;
+		}
+		virtual void CopyTargetToBuffer( RenderBuffer* dst, RenderTarget* target )
+		{
+			NullCommand& command = Append( NullCommandCopyTarget );
+			command.dst = dst;
+			command.target = static_cast< NullTarget* >( target );
+			command.bytes = target->GetReadbackBytes();
+		}
+
+		bool IsClosed() const { return m_closed; }
+		const std::vector<NullCommand>& GetCommands() const { return m_commands; }
+		// Of all commands, NullCommand::constantOffset into it
+		const std::vector<uint8_t>& GetConstants() const { return m_constants; }
+
+	private:
+		NullCommand& Append( NullCommandType type )
+		{
+			NullCommand command = {};
+			command.type = type;
+			m_commands.push_back( command );
+			return m_commands.back();
+		}
+		void SetBindings( NullCommand& command, const RenderBindings& bindings )
+		{
+			command.bindings = bindings;
+			command.bindings.bufferCount = std::min( bindings.bufferCount, MaxBindBuffers );
+			command.bindings.constantBytes = std::min( bindings.constantBytes, MaxBindConstantBytes );
+			command.bindings.constants = nullptr;
+			command.constantOffset = static_cast< uint32_t >( m_constants.size() );
+			if ( command.bindings.constantBytes )
+			{
+				const uint8_t* constants = static_cast< const uint8_t* >( bindings.constants );
+				m_constants.insert( m_constants.end(), constants, constants + command.bindings.constantBytes );
+			}
+		}
+
+		RenderQueueType m_type;
+		bool m_closed;
+		std::vector<NullCommand> m_commands;
+		std::vector<uint8_t> m_constants;
+	};
+
+	class NullFence : public RenderFence
+	{
+	public:
+		NullFence() : m_value( 0 ) {}
+
+		virtual uint64_t GetCompletedValue() const
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			return m_value;
+		}
+		virtual void Wait( uint64_t value )
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			m_signaledCV.wait( lock, [&] { return m_value >= value; } );
+		}
+
+		void Signal( uint64_t value )
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			if ( value <= m_value ) return;
+			m_value = value;
+			m_signaledCV.notify_all();
+		}
+
+	private:
+		mutable std::mutex m_mutex;
+		std::condition_variable m_signaledCV;
+		uint64_t m_value;
+	};
+
+	struct NullStats
+	{
+		std::atomic<uint64_t> copies;
+		std::atomic<uint64_t> copyBytes;
+		std::atomic<uint64_t> dispatches;
+		std::atomic<uint64_t> threadGroups;
+		std::atomic<uint64_t> skippedDispatches;
+		std::atomic<uint64_t> draws;
+		std::atomic<uint64_t> drawIndices;
+		std::atomic<uint64_t> clears;
+		std::atomic<uint64_t> executes;
+		std::atomic<uint64_t> busyNanoseconds[RenderQueueTypeCount];
+		std::atomic<uint64_t> overlapNanoseconds;
+
+		NullStats()
+			: copies( 0 ), copyBytes( 0 ), dispatches( 0 ), threadGroups( 0 ), skippedDispatches( 0 ), draws( 0 )
+			, drawIndices( 0 ), clears( 0 ), executes( 0 ), overlapNanoseconds( 0 ), m_busyQueues( 0 )
+		{
+			for ( uint32_t i = 0; i < RenderQueueTypeCount; i++ ) busyNanoseconds[i] = 0;
+		}
+
+		// Around every list a queue replays; the overlap runs from the second queue
+		// getting busy to the last but one getting idle
+		std::chrono::steady_clock::time_point BeginBusy()
+		{
+			std::lock_guard<std::mutex> lock( m_busyMutex );
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if ( m_busyQueues++ == 1 ) m_overlapStart = now;
+			return now;
+		}
+		void EndBusy( RenderQueueType type, std::chrono::steady_clock::time_point start )
+		{
+			std::lock_guard<std::mutex> lock( m_busyMutex );
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			busyNanoseconds[type] += Nanoseconds( now - start );
+			if ( m_busyQueues-- == 2 ) overlapNanoseconds += Nanoseconds( now - m_overlapStart );
+		}
+
+	private:
+		static uint64_t Nanoseconds( std::chrono::steady_clock::duration duration )
+		{
+			return static_cast< uint64_t >( std::chrono::duration_cast<std::chrono::nanoseconds>( duration ).count() );
+		}
+
+		std::mutex m_busyMutex;
+		uint32_t m_busyQueues;
+		std::chrono::steady_clock::time_point m_overlapStart;
+	};
+
+	// What Execute(), Signal() and WaitFence() queue up: a copy of the list's commands
+	// and constants, so the list can be reset and recorded again right away, or a fence
+	struct NullSubmission
+	{
+		std::vector<NullCommand> commands;
+		std::vector<uint8_t> constants;
+		NullFence* fence;
+		uint64_t value;
+		bool wait;
+	};
+
+	// Runs its submissions in order on a thread of its own, the kernels on a pool of
+	// its own, so the work of two queues overlaps as compute does graphics on a GPU
+	class NullQueue : public RenderQueue
+	{
+	public:
+		NullQueue( RenderQueueType type, NullStats& stats, uint32_t threadCount )
+			: m_type( type ), m_stats( stats ), m_pool( threadCount ), m_quit( false ), m_thread( &NullQueue::Run, this )
+		{
+		}
+		// Finishes what was submitted first
+		virtual ~NullQueue()
+		{
+			{
+				std::lock_guard<std::mutex> lock( m_mutex );
+				m_quit = true;
+			}
+			m_pendingCV.notify_one();
+			m_thread.join();
+		}
+
+		virtual RenderQueueType GetType() const { return m_type; }
+		virtual void Execute( RenderCommandList* list );
+		virtual void Signal( RenderFence* fence, uint64_t value ) { Submit( static_cast< NullFence* >( fence ), value, false ); }
+		virtual void WaitFence( RenderFence* fence, uint64_t value ) { Submit( static_cast< NullFence* >( fence ), value, true ); }
+
+	private:
+		void Submit( NullFence* fence, uint64_t value, bool wait );
+		void Push( NullSubmission& submission );
+		void Run();
+		void Replay( const NullSubmission& submission );
+
+		RenderQueueType m_type;
+		NullStats& m_stats;
+		TaskPool m_pool;
+
+		std::mutex m_mutex;
+		std::condition_variable m_pendingCV;
+		std::deque<NullSubmission> m_pending;
+		bool m_quit;
+		// Last, starts once the rest is set up
+		std::thread m_thread;
+	};
+
+	void NullQueue::Execute( RenderCommandList* list )
+	{
+		NullCommandList* commands = static_cast< NullCommandList* >( list );
+		// As D3D12, only closed lists execute
+		if ( !commands->IsClosed() ) return;
+		NullSubmission submission;
+		submission.commands = commands->GetCommands();
+		submission.constants = commands->GetConstants();
+		submission.fence = nullptr;
+		submission.value = 0;
+		submission.wait = false;
+		Push( submission );
+	}
+
+	void NullQueue::Submit( NullFence* fence, uint64_t value, bool wait )
+	{
+		NullSubmission submission;
+		submission.fence = fence;
+		submission.value = value;
+		submission.wait = wait;
+		Push( submission );
+	}
+
+	void NullQueue::Push( NullSubmission& submission )
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_pending.push_back( std::move( submission ) );
+		}
+		m_pendingCV.notify_one();
+	}
+
+	void NullQueue::Run()
+	{
+		for ( ;; )
+		{
+			NullSubmission submission;
+			{
+				std::unique_lock<std::mutex> lock( m_mutex );
+				m_pendingCV.wait( lock, [&] { return m_quit || !m_pending.empty(); } );
+				if ( m_pending.empty() ) return;
+				submission = std::move( m_pending.front() );
+				m_pending.pop_front();
+			}
+			// As on D3D12, waiting on a value nobody signals stalls the queue for good
+			if ( !submission.fence ) Replay( submission );
+			else if ( submission.wait ) submission.fence->Wait( submission.value );
+			else submission.fence->Signal( submission.value );
+		}
+	}
+
+	void NullQueue::Replay( const NullSubmission& submission )
+	{
+		++m_stats.executes;
+		const std::chrono::steady_clock::time_point start = m_stats.BeginBusy();
+		for ( const NullCommand& command : submission.commands )
+		{
+			switch ( command.type )
+			{
+			case NullCommandCopy:
+			{
+				uint64_t bytes = command.bytes;
+				if ( command.dstOffset + bytes > command.dst->GetSize() || command.srcOffset + bytes > command.src->GetSize() )
+					break;
+				uint8_t* dst = static_cast< uint8_t* >( command.dst->Map() ) + command.dstOffset;
+				const uint8_t* src = static_cast< const uint8_t* >( command.src->Map() ) + command.srcOffset;
+				memmove( dst, src, static_cast< size_t >( bytes ) );
+				++m_stats.copies;
+				m_stats.copyBytes += bytes;
+				break;
+			}
+			case NullCommandDispatch:
+			{
+				++m_stats.dispatches;
+				m_stats.threadGroups += uint64_t( command.groups[0] ) * command.groups[1] * command.groups[2];
+				const CpuComputeKernel& kernel = command.pipeline->GetKernel();
+				if ( !kernel )
+				{
+					++m_stats.skippedDispatches;
+					break;
+				}
+				RenderBindings bindings = command.bindings;
+				bindings.constants = bindings.constantBytes ? &submission.constants[command.constantOffset] : nullptr;
+				kernel( bindings, command.groups[0], command.groups[1], command.groups[2], m_pool );
+				break;
+			}
+			case NullCommandBarrier:
+				// Commands already run one after the other
+				break;
+			case NullCommandClear:
+				command.target->Clear( command.color );
+				++m_stats.clears;
+				break;
+			case NullCommandDraw:
+				++m_stats.draws;
+				m_stats.drawIndices += uint64_t( command.groups[0] ) * std::max( command.groups[1], 1u );
+				break;
+			case NullCommandCopyTarget:
+				if ( command.bytes > command.dst->GetSize() ) break;
+				memcpy( command.dst->Map(), command.target->GetPixels(), static_cast< size_t >( command.bytes ) );
+				++m_stats.copies;
+				m_stats.copyBytes += command.bytes;
+				break;
+			}
+		}
+		m_stats.EndBusy( m_type, start );
+	}
+
+	class NullRenderDevice : public RenderDevice
+	{
+	public:
+		explicit NullRenderDevice( uint32_t threadCount ) : m_threadCount( threadCount ) {}
+
+		virtual const char* GetName() const { return "null"; }
+
+		virtual std::unique_ptr<RenderBuffer> CreateBuffer( uint64_t bytes, RenderHeapType heap, const char* )
+		{
+			return std::unique_ptr<RenderBuffer>( new NullBuffer( bytes, heap ) );
+		}
+		virtual std::unique_ptr<RenderTarget> CreateTarget( uint32_t width, uint32_t height, RenderTargetFormat format,
+															const char* )
+		{
+			return std::unique_ptr<RenderTarget>( new NullTarget( width, height, format ) );
+		}
+		virtual std::unique_ptr<RenderPipeline> CreateComputePipeline( const ComputePipelineDesc& desc )
+		{
+			return std::unique_ptr<RenderPipeline>( new NullPipeline( desc.name, desc.cpuKernel ) );
+		}
+		virtual std::unique_ptr<RenderPipeline> CreateGraphicsPipeline( const GraphicsPipelineDesc& desc )
+		{
+			return std::unique_ptr<RenderPipeline>( new NullPipeline( desc.name, CpuComputeKernel() ) );
+		}
+		virtual std::unique_ptr<RenderCommandList> CreateCommandList( RenderQueueType type )
+		{
+			return std::unique_ptr<RenderCommandList>( new NullCommandList( type ) );
+		}
+		virtual std::unique_ptr<RenderQueue> CreateQueue( RenderQueueType type )
+		{
+			return std::unique_ptr<RenderQueue>( new NullQueue( type, m_stats, m_threadCount ) );
+		}
+		virtual std::unique_ptr<RenderFence> CreateFence()
+		{
+			return std::unique_ptr<RenderFence>( new NullFence() );
+		}
+
+		virtual RenderDeviceStats GetStats() const
+		{
+			RenderDeviceStats stats;
+			stats.copies = m_stats.copies;
+			stats.copyBytes = m_stats.copyBytes;
+			stats.dispatches = m_stats.dispatches;
+			stats.threadGroups = m_stats.threadGroups;
+			stats.skippedDispatches = m_stats.skippedDispatches;
+			stats.draws = m_stats.draws;
+			stats.drawIndices = m_stats.drawIndices;
+			stats.clears = m_stats.clears;
+			stats.executes = m_stats.executes;
+			for ( uint32_t i = 0; i < RenderQueueTypeCount; i++ ) stats.busyNanoseconds[i] = m_stats.busyNanoseconds[i];
+			stats.overlapNanoseconds = m_stats.overlapNanoseconds;
+			return stats;
+		}
+
+	private:
+		NullStats m_stats;
+		// Of the pool of every queue
+		uint32_t m_threadCount;
+	};
+}
+
+std::unique_ptr<RenderDevice> CreateNullRenderDevice( uint32_t threadCount )
+{
+	return std::unique_ptr<RenderDevice>( new NullRenderDevice( threadCount ) );
+}
@@ -0,0 +1,216 @@
+#pragma once
+// A thin device layer over what the samples use of D3D12: buffers in the three
+// heap types, render targets, compute and graphics pipelines, command lists
+// recording copies, dispatches and draws, queues and fences. One backend so far,
+// the samples still drive D3D12 directly; a D3D12 backend comes with their port:
+//
+// NullRenderDevice   CPU only and portable: copies and clears are done in memory,
+//                    dispatches run the CPU kernel of their pipeline, draws are
+//                    recorded and counted but not rasterized. Every queue runs
+//                    its work in order on a thread and pool of its own, fences are
+//                    signaled as it gets there, so the CPU runs ahead of the
+//                    queues as it would of a GPU. For CI and benchmarks.
+//
+// Bindings are the same for both stages: up to MaxBindBuffers default heap buffers
+// as root UAVs u0, u1, ... and constantBytes of root constants at b0. For D3D12,
+// buffer states would be tracked per buffer when commands are recorded, so lists
+// have to execute in the order they were recorded and a buffer must not be in use
+// by two queues at once.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+class TaskPool;
+
+enum RenderQueueType
+{
+	RenderQueueGraphics,
+	RenderQueueCompute,
+	RenderQueueCopy,
+	RenderQueueTypeCount
+};
+
+enum RenderHeapType
+{
+	// GPU memory, copy and UAV access
+	RenderHeapDefault,
+	// CPU writes, GPU reads
+	RenderHeapUpload,
+	// GPU writes by copy, CPU reads
+	RenderHeapReadback
+};
+
+enum RenderTargetFormat
+{
+	RenderTargetRGBA8,
+	RenderTargetRGBA16Float,
+	RenderTargetFormatCount
+};
+
+const char* GetRenderQueueName( RenderQueueType type );
+
+class RenderBuffer
+{
+public:
+	virtual ~RenderBuffer() {}
+	virtual uint64_t GetSize() const = 0;
+	virtual RenderHeapType GetHeapType() const = 0;
+	// Upload and readback buffers only, the whole buffer
+	virtual void* Map() = 0;
+	virtual void Unmap() = 0;
+};
+
+class RenderTarget
+{
+public:
+	virtual ~RenderTarget() {}
+	virtual uint32_t GetWidth() const = 0;
+	virtual uint32_t GetHeight() const = 0;
+	virtual RenderTargetFormat GetFormat() const = 0;
+	// Layout CopyTargetToBuffer() writes: rows this far apart, this many bytes
+	virtual uint32_t GetReadbackRowPitch() const = 0;
+	virtual uint64_t GetReadbackBytes() const = 0;
+};
+
+static const uint32_t MaxBindBuffers = 8;
+// Root constants and root UAVs have to fit the 64 DWORDs of a root signature
+static const uint32_t MaxBindConstantBytes = 128;
+
+struct RenderBindings
+{
+	RenderBuffer* buffers[MaxBindBuffers];
+	uint32_t bufferCount;
+	// Copied when the command is recorded, at most MaxBindConstantBytes
+	const void* constants;
+	uint32_t constantBytes;
+};
+
+// The CPU body of a compute shader for NullRenderDevice: run every thread group of
+// a groupsX x groupsY x groupsZ dispatch on the bound buffers (their Map()
+// pointers, whatever the heap) with the recorded copy of the constants. pool is
+// the queue's, to spread the groups over its threads.
+typedef std::function<void( const RenderBindings& bindings, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ,
+							TaskPool& pool )> CpuComputeKernel;
+
+struct ComputePipelineDesc
+{
+	const char* name;
+	// Compiled compute shader for D3D12
+	const void* shader;
+	size_t shaderBytes;
+	// For NullRenderDevice, dispatches are counted but skipped without one
+	CpuComputeKernel cpuKernel;
+	uint32_t bufferCount;
+	uint32_t constantBytes;
+};
+
+struct GraphicsPipelineDesc
+{
+	const char* name;
+	const void* vertexShader;
+	size_t vertexShaderBytes;
+	const void* pixelShader;
+	size_t pixelShaderBytes;
+	// One float3 POSITION per vertex
+	uint32_t vertexStride;
+	RenderTargetFormat targetFormat;
+	uint32_t bufferCount;
+	uint32_t constantBytes;
+};
+
+class RenderPipeline
+{
+public:
+	virtual ~RenderPipeline() {}
+	virtual const char* GetName() const = 0;
+};
+
+class RenderCommandList
+{
+public:
+	virtual ~RenderCommandList() {}
+	virtual RenderQueueType GetType() const = 0;
+	// Start recording again, once the last execution finished
+	virtual void Reset() = 0;
+	virtual void Close() = 0;
+
+	virtual void CopyBuffer( RenderBuffer* dst, uint64_t dstOffset, RenderBuffer* src, uint64_t srcOffset,
+							 uint64_t bytes ) = 0;
+	virtual void Dispatch( RenderPipeline* pipeline, const RenderBindings& bindings, uint32_t groupsX, uint32_t groupsY,
+						   uint32_t groupsZ ) = 0;
+	// Order the UAV accesses to buffer before the barrier before those after it
+	virtual void Barrier( RenderBuffer* buffer ) = 0;
+
+	// Graphics lists only. Draws are triangle lists with 16 bit indices, no depth.
+	virtual void ClearTarget( RenderTarget* target, const float color[4] ) = 0;
+	virtual void DrawIndexed( RenderPipeline* pipeline, const RenderBindings& bindings, RenderTarget* target,
+							  RenderBuffer* vertices, RenderBuffer* indices, uint32_t indexCount, uint32_t instanceCount ) = 0;
+	// The target into a readback buffer, GetReadbackBytes() of it
+	virtual void CopyTargetToBuffer( RenderBuffer* dst, RenderTarget* target ) = 0;
+};
+
+class RenderFence
+{
+public:
+	virtual ~RenderFence() {}
+	virtual uint64_t GetCompletedValue() const = 0;
+	// Block the calling thread until value is reached
+	virtual void Wait( uint64_t value ) = 0;
+};
+
+class RenderQueue
+{
+public:
+	virtual ~RenderQueue() {}
+	virtual RenderQueueType GetType() const = 0;
+	// The list and what it uses have to stay until a fence signaled after it is
+	// reached, frames in flight record into lists of their own
+	virtual void Execute( RenderCommandList* list ) = 0;
+	// fence reaches value once the work executed so far is done
+	virtual void Signal( RenderFence* fence, uint64_t value ) = 0;
+	// Work executed after this waits on the GPU for fence to reach value
+	virtual void WaitFence( RenderFence* fence, uint64_t value ) = 0;
+};
+
+// Work the queues ran since the device was created
+struct RenderDeviceStats
+{
+	uint64_t copies;
+	uint64_t copyBytes;
+	uint64_t dispatches;
+	uint64_t threadGroups;
+	// NullRenderDevice dispatches of pipelines without a CPU kernel
+	uint64_t skippedDispatches;
+	uint64_t draws;
+	uint64_t drawIndices;
+	uint64_t clears;
+	uint64_t executes;
+	// The time each queue spent running lists and the time two or more queues did
+	// at once
+	uint64_t busyNanoseconds[RenderQueueTypeCount];
+	uint64_t overlapNanoseconds;
+};
+
+class RenderDevice
+{
+public:
+	virtual ~RenderDevice() {}
+	virtual const char* GetName() const = 0;
+
+	// Null on failure
+	virtual std::unique_ptr<RenderBuffer> CreateBuffer( uint64_t bytes, RenderHeapType heap, const char* name ) = 0;
+	virtual std::unique_ptr<RenderTarget> CreateTarget( uint32_t width, uint32_t height, RenderTargetFormat format,
+														const char* name ) = 0;
+	virtual std::unique_ptr<RenderPipeline> CreateComputePipeline( const ComputePipelineDesc& desc ) = 0;
+	virtual std::unique_ptr<RenderPipeline> CreateGraphicsPipeline( const GraphicsPipelineDesc& desc ) = 0;
+	virtual std::unique_ptr<RenderCommandList> CreateCommandList( RenderQueueType type ) = 0;
+	virtual std::unique_ptr<RenderQueue> CreateQueue( RenderQueueType type ) = 0;
+	virtual std::unique_ptr<RenderFence> CreateFence() = 0;
+
+	virtual RenderDeviceStats GetStats() const = 0;
+};
+
+// threadCount for the CPU kernels of each queue, 0 uses all hardware threads
+std::unique_ptr<RenderDevice> CreateNullRenderDevice( uint32_t threadCount = 0 );
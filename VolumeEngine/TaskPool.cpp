@@ -0,0 +1,89 @@
+#include "TaskPool.h"
+
+TaskPool::TaskPool( uint32_t threadCount ) :
+	m_quit( false ), m_generation( 0 ), m_busyWorkers( 0 ), m_func( nullptr ), m_count( 0 ), m_grain( 1 ), m_next( 0 )
+{
+	if ( threadCount == 0 )
+	{
+		threadCount = std::thread::hardware_concurrency();
+		if ( threadCount == 0 ) threadCount = 1;
+	}
+	// The thread calling ParallelFor works too, so spawn one less
+	for ( uint32_t i = 1; i < threadCount; i++ )
+		m_workers.emplace_back( &TaskPool::WorkerLoop, this );
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_quit = true;
+	}
+	m_wakeCV.notify_all();
+	for ( auto& worker : m_workers )
+		worker.join();
+}
+
+void TaskPool::ParallelFor( uint32_t count, uint32_t grain, const RangeFunc& func )
+{
+	if ( count == 0 ) return;
+	if ( grain == 0 ) grain = 1;
+
+	// Not worth waking anybody up
+	if ( m_workers.empty() || count <= grain )
+	{
+		func( 0, count );
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_func = &func;
+		m_count = count;
+		m_grain = grain;
+		m_next.store( 0, std::memory_order_relaxed );
+		m_busyWorkers = static_cast< uint32_t >( m_workers.size() );
+		m_generation++;
+	}
+	m_wakeCV.notify_all();
+
+	RunChunks();
+
+	// Workers must have left RunChunks before m_func goes out of scope
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_doneCV.wait( lock, [this] { return m_busyWorkers == 0; } );
+	m_func = nullptr;
+}
+
+void TaskPool::RunChunks()
+{
+	for ( ;; )
+	{
+		uint32_t begin = m_next.fetch_add( m_grain, std::memory_order_relaxed );
+		if ( begin >= m_count ) break;
+		uint32_t end = begin + m_grain < m_count ? begin + m_grain : m_count;
+		( *m_func )( begin, end );
+	}
+}
+
+void TaskPool::WorkerLoop()
+{
+	uint64_t seenGeneration = 0;
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_mutex );
+			m_wakeCV.wait( lock, [&] { return m_quit || m_generation != seenGeneration; } );
+			if ( m_quit ) return;
+			seenGeneration = m_generation;
+		}
+
+		RunChunks();
+
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_busyWorkers--;
+		}
+		m_doneCV.notify_one();
+	}
+}
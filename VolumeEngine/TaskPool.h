@@ -0,0 +1,50 @@
+#pragma once
+// Minimal persistent worker pool used by the CPU volume engine. Work is
+// expressed as a ParallelFor over [0, count) which is cut into chunks and
+// pulled by the workers and the calling thread until the range is drained.
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskPool
+{
+public:
+	typedef std::function<void( uint32_t begin, uint32_t end )> RangeFunc;
+
+	// threadCount == 0 picks std::thread::hardware_concurrency()
+	explicit TaskPool( uint32_t threadCount = 0 );
+	~TaskPool();
+
+	TaskPool( TaskPool const& ) = delete;
+	TaskPool& operator=( TaskPool const& ) = delete;
+
+	// Number of threads taking part in ParallelFor, the caller included
+	uint32_t GetThreadCount() const { return static_cast< uint32_t >( m_workers.size() ) + 1; }
+
+	// Call func on disjoint sub ranges covering [0, count), blocks until all
+	// of them finished. grain is the number of items handed out at once.
+	void ParallelFor( uint32_t count, uint32_t grain, const RangeFunc& func );
+
+private:
+	void WorkerLoop();
+	void RunChunks();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeCV;
+	std::condition_variable m_doneCV;
+	bool m_quit;
+	uint64_t m_generation;
+	uint32_t m_busyWorkers;
+
+	// Current job, only valid while a ParallelFor is in flight
+	const RangeFunc* m_func;
+	uint32_t m_count;
+	uint32_t m_grain;
+	std::atomic<uint32_t> m_next;
+};
@@ -0,0 +1,441 @@
+#include "VolumeEngine.h"
+#include "TaskPool.h"
+#include "VolumeFile.h"
+#include "VolumeGenerate.h"
+#include "VolumeMip.h"
+#include "VolumeMorton.h"
+#include "VolumeSeek.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// Channel wise byte range of count contiguous voxels, 16 bytes at a time so the
+	// compiler can keep lo and hi in vector registers
+	void AccumulateRange( const uint32_t* voxels, uint32_t count, uint8_t lo[16], uint8_t hi[16] )
+	{
+		const uint8_t* bytes = reinterpret_cast< const uint8_t* >( voxels );
+		uint32_t i = 0;
+		for ( ; i + 4 <= count; i += 4, bytes += 16 )
+			for ( int j = 0; j < 16; j++ )
+			{
+				lo[j] = bytes[j] < lo[j] ? bytes[j] : lo[j];
+				hi[j] = bytes[j] > hi[j] ? bytes[j] : hi[j];
+			}
+		for ( ; i < count; i++, bytes += 4 )
+			for ( int j = 0; j < 4; j++ )
+			{
+				lo[j] = bytes[j] < lo[j] ? bytes[j] : lo[j];
+				hi[j] = bytes[j] > hi[j] ? bytes[j] : hi[j];
+			}
+	}
+}
+
+const char* GetVolumeLayoutName( VolumeLayoutType layout )
+{
+	static const char* names[VolumeLayoutCount] = { "linear", "bricked", "morton" };
+	return layout < VolumeLayoutCount ? names[layout] : "unknown";
+}
+
+VolumeEngine::VolumeEngine( uint32_t width, uint32_t height, uint32_t depth, uint32_t threadCount,
+							VolumeLayoutType layout ) :
+	m_width( width ), m_height( height ), m_depth( depth ), m_layout( layout ), m_frameIndex( 0 ),
+	m_params( VolumeParams::Default() ), m_kernel( GetBestStepKernel() ), m_activeBrickCount( 0 ),
+	m_pool( new TaskPool( threadCount ) )
+{
+	m_ownedVoxels.resize( VolumeStorageCount( m_layout, m_width, m_height, m_depth ) );
+	m_voxels = m_ownedVoxels.data();
+	m_storageCount = m_ownedVoxels.size();
+	Init();
+}
+
+VolumeEngine::VolumeEngine( std::unique_ptr<MappedVolumeFile> file, uint32_t threadCount ) :
+	m_width( file->GetHeader().width ), m_height( file->GetHeader().height ), m_depth( file->GetHeader().depth ),
+	m_layout( static_cast< VolumeLayoutType >( file->GetHeader().layout ) ), m_frameIndex( 0 ),
+	m_params( VolumeParams::Default() ), m_kernel( GetBestStepKernel() ), m_voxels( file->GetVoxels() ),
+	m_storageCount( file->GetStorageCount() ), m_file( std::move( file ) ), m_activeBrickCount( 0 ),
+	m_pool( new TaskPool( threadCount ) )
+{
+	Init();
+}
+
+void VolumeEngine::Init()
+{
+	m_tables = StepTables::Build( m_params );
+	m_brickActive.resize( GetBrickCount() );
+	m_brickChanged.resize( GetBrickCount() );
+	if ( m_layout == VolumeLayoutLinear )
+		m_rowChanged.resize( static_cast< size_t >( GetBrickCountX() ) * m_height * GetBrickCountZ() );
+	m_brickRange.resize( GetBrickCount() * 2 );
+	m_cellRange.resize( GetCellCount() * 2 );
+	MarkAllBricksActive();
+}
+
+VolumeEngine::~VolumeEngine()
+{
+}
+
+uint32_t VolumeEngine::GetThreadCount() const
+{
+	return m_pool->GetThreadCount();
+}
+
+VolumeView VolumeEngine::GetView() const
+{
+	VolumeView view = { m_voxels, m_width, m_height, m_depth, static_cast< uint32_t >( m_layout ),
+						m_brickRange.data(), m_cellRange.data(), m_mips ? m_mips->GetLevelVoxels() : nullptr,
+						m_mips ? m_mips->GetLevelCount() : 0 };
+	return view;
+}
+
+uint32_t VolumeEngine::GetMipLevelCount() const
+{
+	return m_mips ? m_mips->GetLevelCount() : 0;
+}
+
+void VolumeEngine::SetMipLevelCount( uint32_t levelCount )
+{
+	m_mips.reset( levelCount ? new VolumeMipChain( m_width, m_height, m_depth, levelCount ) : nullptr );
+	if ( m_mips ) m_mips->Update( GetView(), nullptr, *m_pool );
+}
+
+void VolumeEngine::SetParams( const VolumeParams& params )
+{
+	m_params = params;
+	m_tables = StepTables::Build( m_params );
+	m_seek.reset();
+	// Fixed points of the old params may move under the new ones
+	MarkAllBricksActive();
+}
+
+void VolumeEngine::MarkAllBricksActive()
+{
+	std::fill( m_brickActive.begin(), m_brickActive.end(), static_cast< uint8_t >( 1 ) );
+	BuildBrickRanges( GetView(), m_brickRange.data(), *m_pool );
+	UpdateCellRanges( m_brickActive.data(), true );
+	if ( m_mips ) m_mips->Update( GetView(), nullptr, *m_pool );
+}
+
+void BuildCellRanges( uint32_t width, uint32_t height, uint32_t depth, const uint32_t* brickRange,
+					  const uint8_t* brickFlags, bool all, uint32_t* cellRange )
+{
+	const uint32_t bricksX = VolumeBrickCount( width );
+	const uint32_t bricksY = VolumeBrickCount( height );
+	const uint32_t bricksZ = VolumeBrickCount( depth );
+	const uint32_t cellsX = VolumeCellCount( width );
+	const uint32_t cellsY = VolumeCellCount( height );
+	const uint32_t cellCount = cellsX * cellsY * VolumeCellCount( depth );
+	const uint32_t cellBricks = VOLUME_CELL_SIZE / VOLUME_BRICK_SIZE;
+	for ( uint32_t cell = 0; cell < cellCount; cell++ )
+	{
+		const uint32_t bx0 = cell % cellsX * cellBricks;
+		const uint32_t by0 = cell / cellsX % cellsY * cellBricks;
+		const uint32_t bz0 = cell / cellsX / cellsY * cellBricks;
+		const uint32_t bx1 = std::min( bx0 + cellBricks, bricksX );
+		const uint32_t by1 = std::min( by0 + cellBricks, bricksY );
+		const uint32_t bz1 = std::min( bz0 + cellBricks, bricksZ );
+
+		bool dirty = all;
+		for ( uint32_t bz = bz0; bz < bz1 && !dirty; bz++ )
+			for ( uint32_t by = by0; by < by1 && !dirty; by++ )
+				for ( uint32_t bx = bx0; bx < bx1 && !dirty; bx++ )
+					dirty = brickFlags[( bz * bricksY + by ) * bricksX + bx] != 0;
+		if ( !dirty ) continue;
+
+		// Channel wise minimum and maximum of the brick ranges
+		uint8_t lo[4] = { 0xff, 0xff, 0xff, 0xff }, hi[4] = {};
+		for ( uint32_t bz = bz0; bz < bz1; bz++ )
+			for ( uint32_t by = by0; by < by1; by++ )
+				for ( uint32_t bx = bx0; bx < bx1; bx++ )
+				{
+					const uint32_t* range = &brickRange[( ( bz * bricksY + by ) * bricksX + bx ) * 2];
+					for ( int c = 0; c < 4; c++ )
+					{
+						lo[c] = std::min( lo[c], static_cast< uint8_t >( range[0] >> ( c * 8 ) ) );
+						hi[c] = std::max( hi[c], static_cast< uint8_t >( range[1] >> ( c * 8 ) ) );
+					}
+				}
+		cellRange[cell * 2] = lo[0] | lo[1] << 8 | lo[2] << 16 | static_cast< uint32_t >( lo[3] ) << 24;
+		cellRange[cell * 2 + 1] = hi[0] | hi[1] << 8 | hi[2] << 16 | static_cast< uint32_t >( hi[3] ) << 24;
+	}
+}
+
+void VolumeEngine::UpdateCellRanges( const uint8_t* brickFlags, bool all )
+{
+	BuildCellRanges( m_width, m_height, m_depth, m_brickRange.data(), brickFlags, all, m_cellRange.data() );
+}
+
+uint32_t VolumeEngine::CountUniformBricks() const
+{
+	uint32_t count = 0;
+	for ( size_t i = 0; i < m_brickRange.size(); i += 2 )
+		count += m_brickRange[i] == m_brickRange[i + 1];
+	return count;
+}
+
+void BuildBrickRange( const VolumeView& volume, uint32_t bx, uint32_t by, uint32_t bz, uint32_t* brickRange )
+{
+	const uint32_t brickSize = VOLUME_BRICK_SIZE;
+	const uint32_t sizeX = ( bx + 1 ) * brickSize < volume.width ? brickSize : volume.width - bx * brickSize;
+	const uint32_t sizeY = ( by + 1 ) * brickSize < volume.height ? brickSize : volume.height - by * brickSize;
+	const uint32_t sizeZ = ( bz + 1 ) * brickSize < volume.depth ? brickSize : volume.depth - bz * brickSize;
+	const uint32_t* voxels = volume.voxels;
+	uint8_t lo[16], hi[16];
+	memset( lo, 0xff, sizeof( lo ) );
+	memset( hi, 0, sizeof( hi ) );
+
+	// Rows of a brick are contiguous except in the Morton layout, whole bricks are
+	// except in the linear one. Padding voxels are left out.
+	const uint32_t x0 = bx * brickSize, y0 = by * brickSize, z0 = bz * brickSize;
+	if ( volume.layout != VolumeLayoutLinear && sizeX == brickSize && sizeY == brickSize && sizeZ == brickSize )
+		AccumulateRange( voxels + VolumeVoxelIndex( volume.layout, x0, y0, z0, volume.width, volume.height ),
+						 VOLUME_BRICK_VOXELS, lo, hi );
+	else
+		for ( uint32_t z = z0; z < z0 + sizeZ; z++ )
+			for ( uint32_t y = y0; y < y0 + sizeY; y++ )
+			{
+				if ( volume.layout != VolumeLayoutMorton )
+				{
+					AccumulateRange( voxels + VolumeVoxelIndex( volume.layout, x0, y, z, volume.width, volume.height ), sizeX,
+									 lo, hi );
+					continue;
+				}
+				for ( uint32_t x = x0; x < x0 + sizeX; x++ )
+					AccumulateRange( voxels + VolumeVoxelIndex( volume.layout, x, y, z, volume.width, volume.height ), 1, lo, hi );
+			}
+
+	uint32_t minWord = 0, maxWord = 0;
+	for ( int c = 0; c < 4; c++ )
+	{
+		uint8_t cLo = std::min( std::min( lo[c], lo[c + 4] ), std::min( lo[c + 8], lo[c + 12] ) );
+		uint8_t cHi = std::max( std::max( hi[c], hi[c + 4] ), std::max( hi[c + 8], hi[c + 12] ) );
+		minWord |= static_cast< uint32_t >( cLo ) << ( c * 8 );
+		maxWord |= static_cast< uint32_t >( cHi ) << ( c * 8 );
+	}
+	uint32_t brick = VolumeBrickIndex( x0, y0, z0, VolumeBrickCount( volume.width ), VolumeBrickCount( volume.height ) );
+	brickRange[brick * 2] = minWord;
+	brickRange[brick * 2 + 1] = maxWord;
+}
+
+void BuildBrickRanges( const VolumeView& volume, uint32_t* brickRange, TaskPool& pool )
+{
+	const uint32_t bricksX = VolumeBrickCount( volume.width );
+	const uint32_t bricksY = VolumeBrickCount( volume.height );
+	pool.ParallelFor( VolumeBrickCount( volume.depth ), 1, [&]( uint32_t bzBegin, uint32_t bzEnd )
+	{
+		for ( uint32_t bz = bzBegin; bz < bzEnd; bz++ )
+			for ( uint32_t by = 0; by < bricksY; by++ )
+				for ( uint32_t bx = 0; bx < bricksX; bx++ )
+					BuildBrickRange( volume, bx, by, bz, brickRange );
+	} );
+}
+
+void VolumeEngine::UpdateBrickRange( uint32_t bx, uint32_t by, uint32_t bz )
+{
+	BuildBrickRange( GetView(), bx, by, bz, m_brickRange.data() );
+}
+
+void VolumeEngine::CopyToLinear( uint32_t* dst ) const
+{
+	const size_t sliceSize = static_cast< size_t >( m_width ) * m_height;
+	const uint32_t* voxels = m_voxels;
+	if ( m_layout == VolumeLayoutMorton )
+	{
+		// Read in storage order and scatter, decoding each code
+		const MortonDecodeFunc decode = GetMortonDecodeFunc();
+		const uint32_t chunk = 1u << 15;
+		const uint32_t storage = static_cast< uint32_t >( m_storageCount );
+		m_pool->ParallelFor( ( storage + chunk - 1 ) / chunk, 1, [&]( uint32_t begin, uint32_t end )
+		{
+			uint32_t last = end * chunk < storage ? end * chunk : storage;
+			for ( uint32_t code = begin * chunk; code < last; code++ )
+			{
+				uint32_t x, y, z;
+				decode( code, x, y, z );
+				if ( x < m_width && y < m_height && z < m_depth )
+					dst[z * sliceSize + static_cast< size_t >( y ) * m_width + x] = voxels[code];
+			}
+		} );
+		return;
+	}
+	m_pool->ParallelFor( m_depth, 1, [&]( uint32_t zBegin, uint32_t zEnd )
+	{
+		for ( uint32_t z = zBegin; z < zEnd; z++ )
+		{
+			if ( m_layout == VolumeLayoutLinear )
+			{
+				memcpy( dst + z * sliceSize, voxels + z * sliceSize, sliceSize * sizeof( uint32_t ) );
+				continue;
+			}
+			for ( uint32_t y = 0; y < m_height; y++ )
+			{
+				uint32_t* row = dst + z * sliceSize + static_cast< size_t >( y ) * m_width;
+				for ( uint32_t x = 0; x < m_width; x++ )
+					row[x] = voxels[GetVoxelIndex( x, y, z )];
+			}
+		}
+	} );
+}
+
+void VolumeEngine::SetStepKernel( StepKernelType type )
+{
+	m_kernel = IsStepKernelSupported( type ) ? type : StepKernelScalar;
+}
+
+void VolumeEngine::FillShellVolume()
+{
+	GenerateShellVolume( m_params, m_layout, m_width, m_height, m_depth, m_voxels, m_pool.get() );
+	m_frameIndex = 0;
+	MarkAllBricksActive();
+}
+
+void VolumeEngine::Step()
+{
+	const uint32_t bricksX = GetBrickCountX();
+	const uint32_t bricksY = GetBrickCountY();
+	std::atomic<uint32_t> activeBricks( 0 );
+
+	// One slab of bricks per task, so every brick is owned by a single thread
+	m_pool->ParallelFor( GetBrickCountZ(), 1, [&]( uint32_t bzBegin, uint32_t bzEnd )
+	{
+		uint32_t stepped = 0;
+		for ( uint32_t bz = bzBegin; bz < bzEnd; bz++ )
+		{
+			uint8_t* active = &m_brickActive[bz * bricksX * bricksY];
+			uint8_t* changed = &m_brickChanged[bz * bricksX * bricksY];
+			if ( m_layout == VolumeLayoutLinear )
+				StepLinearSlab( bz, active, changed );
+			else
+				StepBrickedSlab( bz, active, changed );
+
+			// Only changed bricks can have a new range
+			for ( uint32_t i = 0; i < bricksX * bricksY; i++ )
+			{
+				stepped += active[i];
+				active[i] = changed[i];
+				if ( changed[i] ) UpdateBrickRange( i % bricksX, i / bricksX, bz );
+			}
+		}
+		activeBricks.fetch_add( stepped, std::memory_order_relaxed );
+	} );
+	m_activeBrickCount = activeBricks.load();
+	// The active flags are now the changed ones
+	UpdateCellRanges( m_brickActive.data(), false );
+	if ( m_mips ) m_mips->Update( GetView(), m_brickActive.data(), *m_pool );
+	m_frameIndex++;
+}
+
+void VolumeEngine::StepLinearSlab( uint32_t bz, const uint8_t* active, uint8_t* changed )
+{
+	static_assert( BrickSize == StepChangeGroup, "kernel change flags have to cover one brick row" );
+	const uint32_t bricksX = GetBrickCountX();
+	const uint32_t bricksY = GetBrickCountY();
+	const size_t sliceSize = static_cast< size_t >( m_width ) * m_height;
+	const StepKernelFunc kernel = GetStepKernelFunc( m_kernel );
+	uint32_t* voxels = m_voxels;
+
+	// Runs of active bricks along x are contiguous in memory and go to the kernel at
+	// once. Brick rows start on change group boundaries: the kernel flags for row y
+	// land in rowChanged[y * bricksX + bx] and are folded into bricks at the end.
+	uint8_t* rowChanged = &m_rowChanged[static_cast< size_t >( bz ) * bricksX * m_height];
+	std::fill( rowChanged, rowChanged + static_cast< size_t >( bricksX ) * m_height, 0 );
+	uint32_t zEnd = ( bz + 1 ) * BrickSize < m_depth ? ( bz + 1 ) * BrickSize : m_depth;
+	bool allActive = std::find( active, active + bricksX * bricksY, 0 ) == active + bricksX * bricksY;
+	if ( allActive && m_width % BrickSize == 0 )
+	{
+		// Rows are back to back, so step whole slices in one call
+		for ( uint32_t z = bz * BrickSize; z < zEnd; z++ )
+			kernel( voxels + z * sliceSize, sliceSize, m_tables, rowChanged );
+	}
+	else for ( uint32_t z = bz * BrickSize; z < zEnd; z++ )
+		for ( uint32_t y = 0; y < m_height; y++ )
+		{
+			const uint8_t* rowActive = active + ( y / BrickSize ) * bricksX;
+			uint32_t* row = voxels + z * sliceSize + static_cast< size_t >( y ) * m_width;
+			for ( uint32_t bx = 0; bx < bricksX; )
+			{
+				if ( !rowActive[bx] ) { bx++; continue; }
+				uint32_t runBegin = bx;
+				while ( bx < bricksX && rowActive[bx] ) bx++;
+
+				uint32_t x0 = runBegin * BrickSize;
+				uint32_t x1 = bx * BrickSize < m_width ? bx * BrickSize : m_width;
+				kernel( row + x0, x1 - x0, m_tables, &rowChanged[y * bricksX + runBegin] );
+			}
+		}
+
+	for ( uint32_t by = 0; by < bricksY; by++ )
+	{
+		uint32_t yEnd = ( by + 1 ) * BrickSize < m_height ? ( by + 1 ) * BrickSize : m_height;
+		for ( uint32_t bx = 0; bx < bricksX; bx++ )
+		{
+			uint8_t brickChanged = 0;
+			for ( uint32_t y = by * BrickSize; y < yEnd; y++ )
+				brickChanged |= rowChanged[y * bricksX + bx];
+			changed[by * bricksX + bx] = brickChanged;
+		}
+	}
+}
+
+void VolumeEngine::StepBrickedSlab( uint32_t bz, const uint8_t* active, uint8_t* changed )
+{
+	const uint32_t bricksX = GetBrickCountX();
+	const uint32_t bricksY = GetBrickCountY();
+	const StepKernelFunc kernel = GetStepKernelFunc( m_kernel );
+	const uint32_t sizeZ = ( bz + 1 ) * BrickSize < m_depth ? BrickSize : m_depth - bz * BrickSize;
+
+	// Every brick is one contiguous block, border bricks skip their padding. Inside a
+	// brick the bricked layout is row by row, the Morton one Z-ordered.
+	for ( uint32_t by = 0; by < bricksY; by++ )
+	{
+		const uint32_t sizeY = ( by + 1 ) * BrickSize < m_height ? BrickSize : m_height - by * BrickSize;
+		for ( uint32_t bx = 0; bx < bricksX; bx++ )
+		{
+			uint32_t brick = by * bricksX + bx;
+			changed[brick] = 0;
+			if ( !active[brick] ) continue;
+
+			uint32_t* voxels = &m_voxels[GetVoxelIndex( bx * BrickSize, by * BrickSize, bz * BrickSize )];
+			const uint32_t sizeX = ( bx + 1 ) * BrickSize < m_width ? BrickSize : m_width - bx * BrickSize;
+			uint8_t rowChanged[BrickSize * BrickSize] = {};
+			if ( sizeX == BrickSize && sizeY == BrickSize && sizeZ == BrickSize )
+				kernel( voxels, VOLUME_BRICK_VOXELS, m_tables, rowChanged );
+			else if ( m_layout == VolumeLayoutBricked )
+				for ( uint32_t z = 0; z < sizeZ; z++ )
+					for ( uint32_t y = 0; y < sizeY; y++ )
+						kernel( voxels + ( z * BrickSize + y ) * BrickSize, sizeX, m_tables, &rowChanged[z * BrickSize + y] );
+			else
+				for ( uint32_t z = 0; z < sizeZ; z++ )
+					for ( uint32_t y = 0; y < sizeY; y++ )
+						for ( uint32_t x = 0; x < sizeX; x++ )
+							kernel( voxels + MortonVoxelIndex( x, y, z ), 1, m_tables, &rowChanged[z * BrickSize + y] );
+
+			for ( uint32_t i = 0; i < BrickSize * BrickSize; i++ )
+				changed[brick] |= rowChanged[i];
+		}
+	}
+}
+
+void VolumeEngine::Seek( const uint32_t* initial, uint64_t frame )
+{
+	if ( !m_seek ) m_seek.reset( new VolumeSeek( m_params ) );
+
+	// Voxels are independent, so any layout is processed in storage order. Padding
+	// voxels are carried along harmlessly.
+	const size_t chunk = 1u << 16;
+	const size_t storage = m_storageCount;
+	const VolumeSeek& seek = *m_seek;
+	uint32_t* voxels = m_voxels;
+
+	m_pool->ParallelFor( static_cast< uint32_t >( ( storage + chunk - 1 ) / chunk ), 1, [&]( uint32_t begin, uint32_t end )
+	{
+		size_t offset = begin * chunk;
+		size_t last = end * chunk < storage ? end * chunk : storage;
+		seek.SeekVoxels( initial + offset, voxels + offset, last - offset, frame );
+	} );
+	m_frameIndex = frame;
+	MarkAllBricksActive();
+}
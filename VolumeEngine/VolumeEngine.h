@@ -0,0 +1,176 @@
+#pragma once
+// Headless CPU reference of the volume animation in VolumetricAnimation_shader.hlsl.
+// Everything in this library is plain C++ without any Windows or D3D dependency so
+// it can be built and profiled on machines without a GPU.
+//
+// Voxels are stored the same way as m_volumeBuffer: one UINT per voxel packed as
+// R8G8B8A8_UINT (x in the lowest byte, w the phase index in the highest byte),
+// placed in the buffer according to one of the layouts in VolumeLayout.h.
+
+#include "VolumeLayout.h"
+#include "VolumeRaymarch.h"
+#include "VolumeStep.h"
+
+#include <memory>
+#include <vector>
+
+class MappedVolumeFile;
+class TaskPool;
+class VolumeMipChain;
+class VolumeSeek;
+
+enum VolumeLayoutType
+{
+	VolumeLayoutLinear = VOLUME_LAYOUT_LINEAR,
+	VolumeLayoutBricked = VOLUME_LAYOUT_BRICKED,
+	VolumeLayoutMorton = VOLUME_LAYOUT_MORTON,
+	VolumeLayoutCount
+};
+
+const char* GetVolumeLayoutName( VolumeLayoutType layout );
+
+// The range of brick ( bx, by, bz ) of volume, written to its two words of brickRange
+// (see GetBrickRanges), or those of every brick on the threads of pool
+void BuildBrickRange( const VolumeView& volume, uint32_t bx, uint32_t by, uint32_t bz, uint32_t* brickRange );
+void BuildBrickRanges( const VolumeView& volume, uint32_t* brickRange, TaskPool& pool );
+
+// Rebuild the cell ranges of a width x height x depth volume (see GetCellRanges) from
+// its brick ranges, only cells holding a brick with a non zero flag unless all
+void BuildCellRanges( uint32_t width, uint32_t height, uint32_t depth, const uint32_t* brickRange,
+					  const uint8_t* brickFlags, bool all, uint32_t* cellRange );
+
+class VolumeEngine
+{
+public:
+	// threadCount == 0 uses all hardware threads. The size has to be one
+	// VolumeSizeSupported accepts for layout.
+	VolumeEngine( uint32_t width, uint32_t height, uint32_t depth, uint32_t threadCount = 0,
+				  VolumeLayoutType layout = VolumeLayoutLinear );
+	// The volume of an open volume file, stepped in place: size and layout come from
+	// its header and its payload is the storage, nothing is copied. Open it
+	// CopyOnWrite to keep the file as it is.
+	explicit VolumeEngine( std::unique_ptr<MappedVolumeFile> file, uint32_t threadCount = 0 );
+	~VolumeEngine();
+
+	VolumeEngine( VolumeEngine const& ) = delete;
+	VolumeEngine& operator=( VolumeEngine const& ) = delete;
+
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetDepth() const { return m_depth; }
+	uint64_t GetVoxelCount() const { return static_cast< uint64_t >( m_width ) * m_height * m_depth; }
+	uint32_t GetThreadCount() const;
+
+	VolumeLayoutType GetLayout() const { return m_layout; }
+	// Size of GetVoxels() in voxels, larger than GetVoxelCount() for padded layouts
+	size_t GetStorageCount() const { return m_storageCount; }
+	uint32_t GetVoxelIndex( uint32_t x, uint32_t y, uint32_t z ) const
+	{
+		return VolumeVoxelIndex( m_layout, x, y, z, m_width, m_height );
+	}
+	// Copy the volume out in linear x + y*W + z*W*H order
+	void CopyToLinear( uint32_t* dst ) const;
+
+	const VolumeParams& GetParams() const { return m_params; }
+	void SetParams( const VolumeParams& params );
+
+	// Defaults to the widest kernel the CPU supports
+	StepKernelType GetStepKernel() const { return m_kernel; }
+	void SetStepKernel( StepKernelType type );
+
+	uint32_t* GetVoxels() { return m_voxels; }
+	const uint32_t* GetVoxels() const { return m_voxels; }
+	// The view carries the brick ranges, so raymarching it skips uniform bricks, and
+	// the mip chain
+	VolumeView GetView() const;
+
+	// Mip levels kept below the volume, see VolumeMipChain. 0 (the default) keeps
+	// none, otherwise Step() refreshes them after every step.
+	uint32_t GetMipLevelCount() const;
+	void SetMipLevelCount( uint32_t levelCount );
+	// Null without mip levels
+	const VolumeMipChain* GetMipChain() const { return m_mips.get(); }
+
+	// Number of Step() calls since the last FillShellVolume()
+	uint64_t GetFrameIndex() const { return m_frameIndex; }
+
+	// The volume is tracked in bricks of BrickSize^3 voxels (one csmain thread group).
+	// A brick goes idle once a step leaves all of its voxels unchanged: each voxel is
+	// then a fixed point of csmain and stays so, and Step() skips the brick for good.
+	static const uint32_t BrickSize = VOLUME_BRICK_SIZE;
+	uint32_t GetBrickCountX() const { return VolumeBrickCount( m_width ); }
+	uint32_t GetBrickCountY() const { return VolumeBrickCount( m_height ); }
+	uint32_t GetBrickCountZ() const { return VolumeBrickCount( m_depth ); }
+	uint32_t GetBrickCount() const { return GetBrickCountX() * GetBrickCountY() * GetBrickCountZ(); }
+	// One flag per brick, x fastest, non zero while the brick is active
+	const uint8_t* GetBrickActiveFlags() const { return m_brickActive.data(); }
+	// Bricks processed by the last Step()
+	uint32_t GetActiveBrickCount() const { return m_activeBrickCount; }
+	// Two words per brick, the channel wise minimum and maximum of its voxels packed
+	// like a voxel. Step() refreshes the bricks it changed, a brick whose two words
+	// are equal holds one value only.
+	const uint32_t* GetBrickRanges() const { return m_brickRange.data(); }
+	// The same for the cells of VOLUME_CELL_SIZE^3 voxels, VolumeCellIndex() order.
+	// Step() refreshes the cells holding a changed brick.
+	uint32_t GetCellCount() const
+	{
+		return VolumeCellCount( m_width ) * VolumeCellCount( m_height ) * VolumeCellCount( m_depth );
+	}
+	const uint32_t* GetCellRanges() const { return m_cellRange.data(); }
+	// Bricks whose range is a single value
+	uint32_t CountUniformBricks() const;
+	// Must be called after changing voxels through GetVoxels(), also rebuilds the
+	// brick ranges and the mip chain
+	void MarkAllBricksActive();
+
+	// Initial concentric shell volume, identical to the one built in LoadAssets
+	void FillShellVolume();
+
+	// Advance the volume by one csmain dispatch, only active bricks are touched
+	void Step();
+
+	// Set the volume to the state frame steps after initial (e.g. the volume from
+	// FillShellVolume, GetStorageCount() voxels in this engine's layout) in O(voxels).
+	// initial may be GetVoxels() itself.
+	void Seek( const uint32_t* initial, uint64_t frame );
+
+private:
+	// Tables, brick state and ranges once the storage is in place
+	void Init();
+	// Step the active bricks of slab bz, changed receives one flag per brick of the slab
+	void StepLinearSlab( uint32_t bz, const uint8_t* active, uint8_t* changed );
+	// Bricked and Morton layouts, both keep every brick in one block of 512 voxels
+	void StepBrickedSlab( uint32_t bz, const uint8_t* active, uint8_t* changed );
+	// Recompute m_brickRange for one brick
+	void UpdateBrickRange( uint32_t bx, uint32_t by, uint32_t bz );
+	// Recompute m_cellRange from the brick ranges, only cells holding a brick with
+	// a non zero flag unless all
+	void UpdateCellRanges( const uint8_t* brickFlags, bool all );
+
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_depth;
+	VolumeLayoutType m_layout;
+	uint64_t m_frameIndex;
+	VolumeParams m_params;
+	StepTables m_tables;
+	StepKernelType m_kernel;
+	// m_ownedVoxels or the payload of m_file
+	uint32_t* m_voxels;
+	size_t m_storageCount;
+	std::vector<uint32_t> m_ownedVoxels;
+	std::unique_ptr<MappedVolumeFile> m_file;
+	std::vector<uint8_t> m_brickActive;
+	// Scratch of Step, sized in Init so stepping does not allocate: the change flag of
+	// every brick and for the linear layout the flags of every brick row. Slab bz owns
+	// its part of both.
+	std::vector<uint8_t> m_brickChanged;
+	std::vector<uint8_t> m_rowChanged;
+	std::vector<uint32_t> m_brickRange;
+	std::vector<uint32_t> m_cellRange;
+	uint32_t m_activeBrickCount;
+	std::unique_ptr<TaskPool> m_pool;
+	std::unique_ptr<VolumeMipChain> m_mips;
+	// Orbit tables for Seek, built on first use for the current params
+	std::unique_ptr<VolumeSeek> m_seek;
+};
@@ -0,0 +1,153 @@
+#include "VolumeFile.h"
+#include "VolumeLayout.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char Magic[8] = { 'V', 'O', 'L', 'A', 'N', 'I', 'M', 0 };
+
+	uint64_t AlignUp( uint64_t value, uint64_t alignment )
+	{
+		return ( value + alignment - 1 ) / alignment * alignment;
+	}
+
+	// Map the whole file, nullptr on failure
+	void* MapFile( const char* path, MappedVolumeFile::Access access, size_t& bytes )
+	{
+		bytes = 0;
+#if defined(_WIN32)
+		HANDLE file = CreateFileA( path, GENERIC_READ | ( access == MappedVolumeFile::ReadWrite ? GENERIC_WRITE : 0 ),
+								   FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( file == INVALID_HANDLE_VALUE ) return nullptr;
+		LARGE_INTEGER size;
+		void* base = nullptr;
+		if ( GetFileSizeEx( file, &size ) && size.QuadPart >= static_cast< LONGLONG >( sizeof( VolumeFileHeader ) ) )
+		{
+			const DWORD protect = access == MappedVolumeFile::ReadOnly ? PAGE_READONLY :
+				access == MappedVolumeFile::CopyOnWrite ? PAGE_WRITECOPY : PAGE_READWRITE;
+			const DWORD viewAccess = access == MappedVolumeFile::ReadOnly ? FILE_MAP_READ :
+				access == MappedVolumeFile::CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_WRITE;
+			// The view keeps the mapping and the file alive once the handles are closed
+			HANDLE mapping = CreateFileMappingA( file, nullptr, protect, 0, 0, nullptr );
+			if ( mapping )
+			{
+				base = MapViewOfFile( mapping, viewAccess, 0, 0, 0 );
+				CloseHandle( mapping );
+			}
+			bytes = static_cast< size_t >( size.QuadPart );
+		}
+		CloseHandle( file );
+		return base;
+#else
+		int fd = open( path, access == MappedVolumeFile::ReadWrite ? O_RDWR : O_RDONLY );
+		if ( fd < 0 ) return nullptr;
+		struct stat info;
+		void* base = nullptr;
+		if ( fstat( fd, &info ) == 0 && info.st_size >= static_cast< off_t >( sizeof( VolumeFileHeader ) ) )
+		{
+			const int prot = access == MappedVolumeFile::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+			const int flags = access == MappedVolumeFile::CopyOnWrite ? MAP_PRIVATE : MAP_SHARED;
+			bytes = static_cast< size_t >( info.st_size );
+			base = mmap( nullptr, bytes, prot, flags, fd, 0 );
+			if ( base == MAP_FAILED ) base = nullptr;
+		}
+		// The mapping stays valid after the descriptor is closed
+		close( fd );
+		return base;
+#endif
+	}
+
+	void UnmapFile( void* base, size_t bytes )
+	{
+#if defined(_WIN32)
+		( void ) bytes;
+		UnmapViewOfFile( base );
+#else
+		munmap( base, bytes );
+#endif
+	}
+}
+
+const char* GetVolumeFormatName( VolumeVoxelFormat format )
+{
+	static const char* names[VolumeFormatCount] = { "r8g8b8a8_uint" };
+	return format < VolumeFormatCount ? names[format] : "unknown";
+}
+
+VolumeFileHeader VolumeFileHeader::Make( uint32_t layout, uint32_t width, uint32_t height, uint32_t depth )
+{
+	VolumeFileHeader header;
+	memcpy( header.magic, Magic, sizeof( Magic ) );
+	header.version = Version;
+	header.headerSize = sizeof( VolumeFileHeader );
+	header.width = width;
+	header.height = height;
+	header.depth = depth;
+	header.layout = layout;
+	header.format = VolumeFormatR8G8B8A8Uint;
+	header.reserved = 0;
+	header.payloadOffset = AlignUp( sizeof( VolumeFileHeader ), VolumeFileAlignment );
+	header.payloadBytes = VolumeStorageCount( layout, width, height, depth ) * sizeof( uint32_t );
+	return header;
+}
+
+bool VolumeFileHeader::IsValid() const
+{
+	return memcmp( magic, Magic, sizeof( Magic ) ) == 0 && version == Version && headerSize == sizeof( VolumeFileHeader ) &&
+		layout <= VOLUME_LAYOUT_MORTON && VolumeSizeSupported( layout, width, height, depth ) && format == VolumeFormatR8G8B8A8Uint &&
+		payloadOffset >= headerSize && payloadOffset % VolumeFileAlignment == 0 &&
+		payloadBytes == VolumeStorageCount( layout, width, height, depth ) * sizeof( uint32_t );
+}
+
+bool WriteVolumeFile( const char* path, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+					  const uint32_t* voxels )
+{
+	const VolumeFileHeader header = VolumeFileHeader::Make( layout, width, height, depth );
+	FILE* file = nullptr;
+#if defined(_WIN32)
+	fopen_s( &file, path, "wb" );
+#else
+	file = fopen( path, "wb" );
+#endif
+	if ( !file ) return false;
+	const std::vector<uint8_t> padding( static_cast< size_t >( header.payloadOffset - sizeof( header ) ), 0 );
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+		fwrite( padding.data(), 1, padding.size(), file ) == padding.size() &&
+		fwrite( voxels, 1, static_cast< size_t >( header.payloadBytes ), file ) == header.payloadBytes;
+	return fclose( file ) == 0 && ok;
+}
+
+MappedVolumeFile::MappedVolumeFile( const char* path, Access access ) :
+	m_base( nullptr ), m_mappedBytes( 0 )
+{
+	static_assert( sizeof( VolumeFileHeader ) == 56, "the header layout is the file format" );
+	void* base = MapFile( path, access, m_mappedBytes );
+	if ( !base ) return;
+	const VolumeFileHeader& header = *static_cast< const VolumeFileHeader* >( base );
+	if ( !header.IsValid() || header.payloadOffset + header.payloadBytes > m_mappedBytes )
+	{
+		UnmapFile( base, m_mappedBytes );
+		return;
+	}
+	m_base = base;
+}
+
+MappedVolumeFile::~MappedVolumeFile()
+{
+	if ( m_base ) UnmapFile( m_base, m_mappedBytes );
+}
@@ -0,0 +1,91 @@
+#pragma once
+// Prebuilt volumes on disk. A volume file is a VolumeFileHeader followed, at the
+// next multiple of VolumeFileAlignment, by the voxels exactly as they sit in
+// memory: VolumeStorageCount( layout, width, height, depth ) packed voxels in
+// layout, padding included. MappedVolumeFile maps such a file and hands out the
+// payload in place, so it can be the storage of a VolumeEngine or the source of
+// the volume upload in LoadAssets without being read or copied first; pages come
+// in from the file cache as they are touched. Integers are little endian.
+
+#include <cstddef>
+#include <cstdint>
+
+// How the payload voxels are packed
+enum VolumeVoxelFormat
+{
+	// One uint per voxel as in m_volumeBuffer: R8G8B8A8_UINT, x in the lowest byte
+	// and the phase in w
+	VolumeFormatR8G8B8A8Uint,
+	VolumeFormatCount
+};
+
+const char* GetVolumeFormatName( VolumeVoxelFormat format );
+
+// Payload offsets are a multiple of this: the allocation granularity of Windows
+// views and a multiple of every page size, so the payload is page aligned
+const uint32_t VolumeFileAlignment = 65536;
+
+struct VolumeFileHeader
+{
+	// "VOLANIM" and a zero
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	// VOLUME_LAYOUT_* of VolumeLayout.h
+	uint32_t layout;
+	// VolumeVoxelFormat
+	uint32_t format;
+	uint32_t reserved;
+	uint64_t payloadOffset;
+	uint64_t payloadBytes;
+
+	static const uint32_t Version = 1;
+
+	// Header of a width x height x depth volume in layout
+	static VolumeFileHeader Make( uint32_t layout, uint32_t width, uint32_t height, uint32_t depth );
+	// Magic, version, layout, format and payload size all agree with each other
+	bool IsValid() const;
+};
+
+// Write voxels (VolumeStorageCount( layout, width, height, depth ) of them) as a
+// volume file, false on any I/O error
+bool WriteVolumeFile( const char* path, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+					  const uint32_t* voxels );
+
+class MappedVolumeFile
+{
+public:
+	enum Access
+	{
+		// The voxels must not be written
+		ReadOnly,
+		// Writes stay private to the mapping, the file keeps the volume it had. What a
+		// VolumeEngine stepping a prebuilt start volume wants.
+		CopyOnWrite,
+		// Writes go to the file
+		ReadWrite
+	};
+
+	// Not open if the file is missing, cannot be mapped or fails the header checks
+	MappedVolumeFile( const char* path, Access access );
+	~MappedVolumeFile();
+
+	MappedVolumeFile( MappedVolumeFile const& ) = delete;
+	MappedVolumeFile& operator=( MappedVolumeFile const& ) = delete;
+
+	bool IsOpen() const { return m_base != nullptr; }
+	const VolumeFileHeader& GetHeader() const { return *static_cast< const VolumeFileHeader* >( m_base ); }
+	// The payload in place, GetStorageCount() voxels in GetHeader().layout
+	uint32_t* GetVoxels() const
+	{
+		return reinterpret_cast< uint32_t* >( static_cast< uint8_t* >( m_base ) + GetHeader().payloadOffset );
+	}
+	size_t GetStorageCount() const { return static_cast< size_t >( GetHeader().payloadBytes / sizeof( uint32_t ) ); }
+
+private:
+	void* m_base;
+	size_t m_mappedBytes;
+};
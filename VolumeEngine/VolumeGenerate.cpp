@@ -0,0 +1,230 @@
+#include "VolumeGenerate.h"
+#include "TaskPool.h"
+#include "VolumeLayout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if VE_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// memset( 64 ) of the LoadAssets staging buffer
+	const uint32_t Background = 0x40404040;
+
+	struct ShellSetup
+	{
+		float halfWidth;
+		float halfHeight;
+		float halfDepth;
+		float radius;
+		// colVal[i][c] by channel, zero past the 6th phase like StepTables
+		uint32_t colVal[4][8];
+		const VolumeParams* params;
+	};
+
+	ShellSetup BuildSetup( const VolumeParams& params, uint32_t width, uint32_t height, uint32_t depth )
+	{
+		ShellSetup setup;
+		setup.halfWidth = width / 2.f;
+		setup.halfHeight = height / 2.f;
+		setup.halfDepth = depth / 2.f;
+		float a = width / 2.f;
+		float b = height / 2.f;
+		float c = depth / 2.f;
+		setup.radius = sqrtf( a*a + b*b + c*c );
+		for ( int ch = 0; ch < 4; ch++ )
+			for ( int i = 0; i < 8; i++ ) setup.colVal[ch][i] = i < 6 ? params.colVal[i][ch] : 0;
+		setup.params = &params;
+		return setup;
+	}
+
+	// One voxel with the float operations of the LoadAssets loop
+	inline uint32_t ShellVoxel( const ShellSetup& setup, uint32_t x, uint32_t y, uint32_t z )
+	{
+		float _x = x - setup.halfWidth;
+		float _y = y - setup.halfHeight;
+		float _z = z - setup.halfDepth;
+		float currentRadius = sqrtf( _x*_x + _y*_y + _z*_z );
+		float scale = currentRadius * 3.f / setup.radius;
+		uint32_t idx = 4 - ( uint32_t ) floorf( scale );
+		uint32_t interm = ( uint32_t ) ( 192 * scale + 0.5f );
+		uint8_t col = interm % 192 + 1;
+		const uint32_t* colVal = setup.params->colVal[idx];
+		uint32_t r = static_cast< uint8_t >( 64 + col * colVal[0] );
+		uint32_t g = static_cast< uint8_t >( 64 + col * colVal[1] );
+		uint32_t b = static_cast< uint8_t >( 64 + col * colVal[2] );
+		uint32_t a = static_cast< uint8_t >( colVal[3] );
+		return r | ( g << 8 ) | ( b << 16 ) | ( a << 24 );
+	}
+
+	typedef void( *ShellRowFunc )( const ShellSetup& setup, uint32_t y, uint32_t z, uint32_t width, uint32_t* out );
+
+	void ShellRow_Scalar( const ShellSetup& setup, uint32_t y, uint32_t z, uint32_t width, uint32_t* out )
+	{
+		for ( uint32_t x = 0; x < width; x++ ) out[x] = ShellVoxel( setup, x, y, z );
+	}
+
+#if VE_X86
+	// 8 voxels per iteration. Mul, add, sqrt and div are all correctly rounded and
+	// done in the scalar order, so the results match ShellVoxel bit for bit.
+	VE_TARGET( "avx2" )
+	void ShellRow_AVX2( const ShellSetup& setup, uint32_t y, uint32_t z, uint32_t width, uint32_t* out )
+	{
+		const float _y = y - setup.halfHeight;
+		const float _z = z - setup.halfDepth;
+		const __m256 yy = _mm256_set1_ps( _y*_y );
+		const __m256 zz = _mm256_set1_ps( _z*_z );
+		const __m256 halfWidth = _mm256_set1_ps( setup.halfWidth );
+		const __m256 radius = _mm256_set1_ps( setup.radius );
+		const __m256 three = _mm256_set1_ps( 3.f );
+		const __m256 steps = _mm256_set1_ps( 192.f );
+		const __m256 half = _mm256_set1_ps( 0.5f );
+		const __m256i four = _mm256_set1_epi32( 4 );
+		const __m256i period = _mm256_set1_epi32( 192 );
+		const __m256i one = _mm256_set1_epi32( 1 );
+		const __m256i background = _mm256_set1_epi32( 64 );
+		const __m256i byteMask = _mm256_set1_epi32( 0xff );
+		__m256i colVal[4];
+		for ( int c = 0; c < 4; c++ ) colVal[c] = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( setup.colVal[c] ) );
+		__m256i xs = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+		const __m256i eight = _mm256_set1_epi32( 8 );
+
+		uint32_t x = 0;
+		for ( ; x + 8 <= width; x += 8, xs = _mm256_add_epi32( xs, eight ) )
+		{
+			__m256 _x = _mm256_sub_ps( _mm256_cvtepi32_ps( xs ), halfWidth );
+			__m256 currentRadius = _mm256_sqrt_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( _x, _x ), yy ), zz ) );
+			__m256 scale = _mm256_div_ps( _mm256_mul_ps( currentRadius, three ), radius );
+			__m256i idx = _mm256_sub_epi32( four, _mm256_cvttps_epi32( _mm256_floor_ps( scale ) ) );
+			__m256i interm = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( steps, scale ), half ) );
+
+			// interm % 192 without a division, scale is at most 3 so interm at most 576
+			__m256i rem = interm;
+			for ( int k = 1; k <= 3; k++ )
+			{
+				__m256i past = _mm256_cmpgt_epi32( interm, _mm256_set1_epi32( 192 * k - 1 ) );
+				rem = _mm256_sub_epi32( rem, _mm256_and_si256( past, period ) );
+			}
+			__m256i col = _mm256_add_epi32( rem, one );
+
+			// The phase tables are looked up with vpermd, idx is 1 to 4
+			__m256i r = _mm256_add_epi32( background, _mm256_mullo_epi32( col, _mm256_permutevar8x32_epi32( colVal[0], idx ) ) );
+			__m256i g = _mm256_add_epi32( background, _mm256_mullo_epi32( col, _mm256_permutevar8x32_epi32( colVal[1], idx ) ) );
+			__m256i b = _mm256_add_epi32( background, _mm256_mullo_epi32( col, _mm256_permutevar8x32_epi32( colVal[2], idx ) ) );
+			__m256i a = _mm256_permutevar8x32_epi32( colVal[3], idx );
+			__m256i voxel = _mm256_or_si256(
+				_mm256_or_si256( _mm256_and_si256( r, byteMask ), _mm256_slli_epi32( _mm256_and_si256( g, byteMask ), 8 ) ),
+				_mm256_or_si256( _mm256_slli_epi32( _mm256_and_si256( b, byteMask ), 16 ), _mm256_slli_epi32( a, 24 ) ) );
+			_mm256_storeu_si256( reinterpret_cast< __m256i* >( out + x ), voxel );
+		}
+		for ( ; x < width; x++ ) out[x] = ShellVoxel( setup, x, y, z );
+	}
+#endif
+
+	ShellRowFunc GetShellRowFunc()
+	{
+#if VE_X86
+		if ( CpuFeatures::Get().avx2 ) return ShellRow_AVX2;
+#endif
+		return ShellRow_Scalar;
+	}
+}
+
+void GenerateVolumeRows( const VolumeRowFunc& row, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+						 uint32_t* voxels, TaskPool* pool )
+{
+	// Padded layouts leave voxels outside the volume, give them the background first
+	const size_t storageCount = VolumeStorageCount( layout, width, height, depth );
+	if ( storageCount > static_cast< size_t >( width ) * height * depth )
+	{
+		const size_t chunk = 1 << 16;
+		const uint32_t chunkCount = static_cast< uint32_t >( ( storageCount + chunk - 1 ) / chunk );
+		auto fill = [&]( uint32_t begin, uint32_t end )
+		{
+			std::fill( voxels + begin * chunk, voxels + std::min( end * chunk, storageCount ), Background );
+		};
+		if ( pool ) pool->ParallelFor( chunkCount, 1, fill );
+		else fill( 0, chunkCount );
+	}
+
+	// One z slab per task. The linear layout gets its rows written in place, the
+	// others a row at a time through a scratch row.
+	auto slab = [&]( uint32_t zBegin, uint32_t zEnd )
+	{
+		std::vector<uint32_t> scratch( layout == VOLUME_LAYOUT_LINEAR ? 0 : width );
+		for ( uint32_t z = zBegin; z < zEnd; z++ )
+			for ( uint32_t y = 0; y < height; y++ )
+			{
+				if ( layout == VOLUME_LAYOUT_LINEAR )
+				{
+					row( y, z, voxels + ( static_cast< size_t >( z ) * height + y ) * width );
+					continue;
+				}
+				row( y, z, scratch.data() );
+				if ( layout == VOLUME_LAYOUT_BRICKED )
+				{
+					// A brick row is VOLUME_BRICK_SIZE contiguous voxels
+					for ( uint32_t x = 0; x < width; x += VOLUME_BRICK_SIZE )
+						memcpy( voxels + VolumeVoxelIndex( layout, x, y, z, width, height ), &scratch[x],
+								std::min<uint32_t>( VOLUME_BRICK_SIZE, width - x ) * sizeof( uint32_t ) );
+				}
+				else
+				{
+					for ( uint32_t x = 0; x < width; x++ ) voxels[VolumeVoxelIndex( layout, x, y, z, width, height )] = scratch[x];
+				}
+			}
+	};
+	if ( pool ) pool->ParallelFor( depth, 1, slab );
+	else slab( 0, depth );
+}
+
+void GenerateShellRow( const VolumeParams& params, uint32_t width, uint32_t height, uint32_t depth, uint32_t y,
+					   uint32_t z, uint32_t* row )
+{
+	GetShellRowFunc()( BuildSetup( params, width, height, depth ), y, z, width, row );
+}
+
+void GenerateShellVolume( const VolumeParams& params, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+						  uint32_t* voxels, TaskPool* pool )
+{
+	const ShellSetup setup = BuildSetup( params, width, height, depth );
+	const ShellRowFunc shellRow = GetShellRowFunc();
+	GenerateVolumeRows( [&]( uint32_t y, uint32_t z, uint32_t* row ) { shellRow( setup, y, z, width, row ); }, layout, width,
+						height, depth, voxels, pool );
+}
+
+void GenerateShellVolumeSerial( const VolumeParams& params, uint32_t layout, uint32_t width, uint32_t height,
+								uint32_t depth, uint32_t* voxels )
+{
+	// Only the voxel address goes through the layout
+	uint8_t* volumeBuffer = reinterpret_cast< uint8_t* >( voxels );
+	memset( volumeBuffer, 64, VolumeStorageCount( layout, width, height, depth ) * sizeof( uint32_t ) );
+	float a = width / 2.f;
+	float b = height / 2.f;
+	float c = depth / 2.f;
+	float radius = sqrtf( a*a + b*b + c*c );
+
+	for ( uint32_t z = 0; z < depth; z++ )
+		for ( uint32_t y = 0; y < height; y++ )
+			for ( uint32_t x = 0; x < width; x++ )
+			{
+				float _x = x - width / 2.f;
+				float _y = y - height / 2.f;
+				float _z = z - depth / 2.f;
+				float currentRaidus = sqrtf( _x*_x + _y*_y + _z*_z );
+				float scale = currentRaidus *3.f / radius;
+				uint32_t idx = 4 - ( uint32_t ) floorf( scale );
+				uint32_t interm = ( uint32_t ) ( 192 * scale + 0.5f );
+				uint8_t col = interm % 192 + 1;
+				size_t offset = VolumeVoxelIndex( layout, x, y, z, width, height ) * ( size_t ) 4;
+				volumeBuffer[offset + 0] += col * params.colVal[idx][0];
+				volumeBuffer[offset + 1] += col * params.colVal[idx][1];
+				volumeBuffer[offset + 2] += col * params.colVal[idx][2];
+				volumeBuffer[offset + 3] = ( uint8_t ) params.colVal[idx][3];
+			}
+}
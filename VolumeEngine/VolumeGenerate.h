@@ -0,0 +1,38 @@
+#pragma once
+// The concentric shell volume the animation starts from, built by the init loop of
+// VolumetricAnimation::LoadAssets. GenerateShellVolume fills it in parallel over
+// z slabs and evaluates the distances 8 voxels at a time with AVX2; the bytes are
+// the same as those of the serial loop, which is kept as GenerateShellVolumeSerial.
+//
+// Both write straight into the storage they are given, e.g. a mapped upload heap,
+// VolumeStorageCount( layout, width, height, depth ) voxels in layout. Other
+// volumes can be built the same way through GenerateVolumeRows, see VolumeScene.h.
+
+#include "VolumeStep.h"
+
+#include <cstdint>
+#include <functional>
+
+class TaskPool;
+
+// Writes the width voxels of row y, z of a volume, x = 0 first. Called for
+// different rows at the same time.
+typedef std::function<void( uint32_t y, uint32_t z, uint32_t* row )> VolumeRowFunc;
+
+// Fill a volume row by row with row, over z slabs on pool (or the calling thread
+// if null). Padding voxels of the layout get the background 0x40404040.
+void GenerateVolumeRows( const VolumeRowFunc& row, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+						 uint32_t* voxels, TaskPool* pool );
+
+// Row y, z of the shell volume, the shells scene of VolumeScene.h
+void GenerateShellRow( const VolumeParams& params, uint32_t width, uint32_t height, uint32_t depth, uint32_t y,
+					   uint32_t z, uint32_t* row );
+
+// A null pool runs on the calling thread
+void GenerateShellVolume( const VolumeParams& params, uint32_t layout, uint32_t width, uint32_t height, uint32_t depth,
+						  uint32_t* voxels, TaskPool* pool );
+
+// Straight port of the LoadAssets loop, including its float evaluation order and
+// UINT8 wrap around
+void GenerateShellVolumeSerial( const VolumeParams& params, uint32_t layout, uint32_t width, uint32_t height,
+								uint32_t depth, uint32_t* voxels );
@@ -0,0 +1,140 @@
+#ifndef VOLUME_LAYOUT_H
+#define VOLUME_LAYOUT_H
+// Voxel addressing shared by VolumeEngine, the volume generator in
+// VolumetricAnimation::LoadAssets and VolumetricAnimation_shader.hlsl, so it is
+// written in the subset of C that both the C++ compiler and fxc accept.
+//
+// VOLUME_LAYOUT_LINEAR   x + y*W + z*W*H, the original m_volumeBuffer order
+// VOLUME_LAYOUT_BRICKED  8x8x8 bricks stored one after the other (x fastest, then
+//                        y, then z), each brick itself in linear order. A brick is
+//                        one csmain thread group and SV_GroupIndex is the offset
+//                        inside it. Partial bricks at the border are padded, so the
+//                        buffer holds VolumeStorageCount() voxels.
+// VOLUME_LAYOUT_MORTON   Z-order: the bits of x, y and z interleaved (x lowest), up
+//                        to 1024 voxels per axis. The volume is padded to a power of
+//                        two cube, within which every aligned 8x8x8 brick is again a
+//                        contiguous block of 512 voxels.
+//
+// Every layout takes at most VOLUME_MAX_SIZE voxels per axis, so any voxel index fits
+// a uint. VolumeStorageCount and VolumeSizeSupported are C++ only.
+
+#ifdef __cplusplus
+#include <cstdint>
+typedef uint32_t uint;
+#define VL_INLINE inline
+#else
+#define VL_INLINE
+#endif
+
+#define VOLUME_LAYOUT_LINEAR 0
+#define VOLUME_LAYOUT_BRICKED 1
+#define VOLUME_LAYOUT_MORTON 2
+
+#define VOLUME_BRICK_SIZE 8
+#define VOLUME_BRICK_VOXELS 512
+// 4x4x4 bricks, the coarse level of the brick range grid used to skip empty space
+#define VOLUME_CELL_SIZE 32
+// Largest edge of a volume: Morton codes interleave 10 bits per axis, and 1024^3
+// voxels keep every index of every layout within 32 bits
+#define VOLUME_MAX_SIZE 1024
+// A Morton volume is refused when its power of two cube would hold more than this
+// many times its voxels, 1024x64x64 would otherwise take 1024^3
+#define VOLUME_MORTON_MAX_PADDING 8
+
+// Bricks along one axis of size voxels
+VL_INLINE uint VolumeBrickCount( uint size )
+{
+	return ( size + VOLUME_BRICK_SIZE - 1 ) / VOLUME_BRICK_SIZE;
+}
+
+VL_INLINE uint LinearVoxelIndex( uint x, uint y, uint z, uint width, uint height )
+{
+	return x + y * width + z * width * height;
+}
+
+// Brick holding voxel (x, y, z), x fastest. bricksX/bricksY are
+// VolumeBrickCount( width )/VolumeBrickCount( height ).
+VL_INLINE uint VolumeBrickIndex( uint x, uint y, uint z, uint bricksX, uint bricksY )
+{
+	return ( x >> 3 ) + ( ( y >> 3 ) + ( z >> 3 ) * bricksY ) * bricksX;
+}
+
+// Cells along one axis of size voxels
+VL_INLINE uint VolumeCellCount( uint size )
+{
+	return ( size + VOLUME_CELL_SIZE - 1 ) / VOLUME_CELL_SIZE;
+}
+
+// Cell holding voxel (x, y, z), x fastest. cellsX/cellsY are
+// VolumeCellCount( width )/VolumeCellCount( height ).
+VL_INLINE uint VolumeCellIndex( uint x, uint y, uint z, uint cellsX, uint cellsY )
+{
+	return ( x >> 5 ) + ( ( y >> 5 ) + ( z >> 5 ) * cellsY ) * cellsX;
+}
+
+VL_INLINE uint BrickedVoxelIndex( uint x, uint y, uint z, uint bricksX, uint bricksY )
+{
+	uint brick = VolumeBrickIndex( x, y, z, bricksX, bricksY );
+	return brick * VOLUME_BRICK_VOXELS + ( ( x & 7 ) | ( ( y & 7 ) << 3 ) | ( ( z & 7 ) << 6 ) );
+}
+
+// Moves bit i of the low 10 bits of v to bit 3i
+VL_INLINE uint MortonSpread3( uint v )
+{
+	v &= 0x3ff;
+	v = ( v | ( v << 16 ) ) & 0x030000ff;
+	v = ( v | ( v << 8 ) ) & 0x0300f00f;
+	v = ( v | ( v << 4 ) ) & 0x030c30c3;
+	v = ( v | ( v << 2 ) ) & 0x09249249;
+	return v;
+}
+
+VL_INLINE uint MortonVoxelIndex( uint x, uint y, uint z )
+{
+	return MortonSpread3( x ) | ( MortonSpread3( y ) << 1 ) | ( MortonSpread3( z ) << 2 );
+}
+
+// Edge of the power of two cube a Morton ordered volume is padded to
+VL_INLINE uint MortonCubeSize( uint width, uint height, uint depth )
+{
+	uint size = VOLUME_BRICK_SIZE;
+	while ( size < width || size < height || size < depth ) size <<= 1;
+	return size;
+}
+
+VL_INLINE uint VolumeVoxelIndex( uint layout, uint x, uint y, uint z, uint width, uint height )
+{
+	if ( layout == VOLUME_LAYOUT_BRICKED )
+		return BrickedVoxelIndex( x, y, z, VolumeBrickCount( width ), VolumeBrickCount( height ) );
+	if ( layout == VOLUME_LAYOUT_MORTON )
+		return MortonVoxelIndex( x, y, z );
+	return LinearVoxelIndex( x, y, z, width, height );
+}
+
+#ifdef __cplusplus
+// Number of voxels the buffer has to hold, padding included
+inline uint64_t VolumeStorageCount( uint layout, uint width, uint height, uint depth )
+{
+	if ( layout == VOLUME_LAYOUT_BRICKED )
+		return static_cast< uint64_t >( VolumeBrickCount( width ) ) * VolumeBrickCount( height ) * VolumeBrickCount( depth ) *
+			   VOLUME_BRICK_VOXELS;
+	if ( layout == VOLUME_LAYOUT_MORTON )
+	{
+		uint64_t size = MortonCubeSize( width, height, depth );
+		return size * size * size;
+	}
+	return static_cast< uint64_t >( width ) * height * depth;
+}
+
+// Whether layout can hold a width x height x depth volume: 1 to VOLUME_MAX_SIZE voxels
+// per axis, and for Morton at most VOLUME_MORTON_MAX_PADDING times the voxels stored
+inline bool VolumeSizeSupported( uint layout, uint width, uint height, uint depth )
+{
+	if ( !width || !height || !depth || width > VOLUME_MAX_SIZE || height > VOLUME_MAX_SIZE || depth > VOLUME_MAX_SIZE )
+		return false;
+	return layout != VOLUME_LAYOUT_MORTON || VolumeStorageCount( layout, width, height, depth ) <=
+		static_cast< uint64_t >( width ) * height * depth * VOLUME_MORTON_MAX_PADDING;
+}
+#endif
+
+#endif
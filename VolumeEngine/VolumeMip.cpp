@@ -0,0 +1,137 @@
+#include "VolumeMip.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Storage offsets of the voxels of a 2x2x2 block at even coordinates, x fastest
+	const uint32_t BrickedOffsets[8] = { 0, 1, 8, 9, 64, 65, 72, 73 };
+	const uint32_t MortonOffsets[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+	// Channel wise rounded average of 8 voxels, two channels per word in 16 bit lanes
+	inline uint32_t Average8( const uint32_t v[8] )
+	{
+		uint32_t even = 0x00040004, odd = 0x00040004;
+		for ( int i = 0; i < 8; i++ )
+		{
+			even += v[i] & 0x00ff00ff;
+			odd += ( v[i] >> 8 ) & 0x00ff00ff;
+		}
+		return ( ( even >> 3 ) & 0x00ff00ff ) | ( ( ( odd >> 3 ) & 0x00ff00ff ) << 8 );
+	}
+}
+
+VolumeMipChain::VolumeMipChain( uint32_t width, uint32_t height, uint32_t depth, uint32_t levelCount )
+{
+	while ( m_levels.size() < levelCount && ( width > 1 || height > 1 || depth > 1 ) )
+	{
+		width = ( width + 1 ) / 2;
+		height = ( height + 1 ) / 2;
+		depth = ( depth + 1 ) / 2;
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.depth = depth;
+		level.voxels.resize( static_cast< size_t >( width ) * height * depth );
+		level.dirty.resize( VolumeBrickCount( width ) * VolumeBrickCount( height ) * VolumeBrickCount( depth ) );
+		m_levels.push_back( std::move( level ) );
+	}
+	for ( const Level& level : m_levels )
+		m_levelVoxels.push_back( level.voxels.data() );
+}
+
+void VolumeMipChain::Update( const VolumeView& source, const uint8_t* brickFlags, TaskPool& pool )
+{
+	const uint32_t* parent = source.voxels;
+	uint32_t parentLayout = source.layout;
+	uint32_t parentSize[3] = { source.width, source.height, source.depth };
+	const uint8_t* parentDirty = brickFlags;
+
+	for ( Level& level : m_levels )
+	{
+		const uint32_t bricksX = VolumeBrickCount( level.width );
+		const uint32_t bricksY = VolumeBrickCount( level.height );
+		const uint32_t bricksZ = VolumeBrickCount( level.depth );
+		const uint32_t parentBricks[3] = { VolumeBrickCount( parentSize[0] ), VolumeBrickCount( parentSize[1] ),
+										   VolumeBrickCount( parentSize[2] ) };
+
+		// A brick averages the 2x2x2 bricks of the level above it
+		for ( uint32_t bz = 0; bz < bricksZ; bz++ )
+			for ( uint32_t by = 0; by < bricksY; by++ )
+				for ( uint32_t bx = 0; bx < bricksX; bx++ )
+				{
+					uint8_t dirty = !parentDirty;
+					for ( uint32_t z = bz * 2; z < std::min( bz * 2 + 2, parentBricks[2] ) && !dirty; z++ )
+						for ( uint32_t y = by * 2; y < std::min( by * 2 + 2, parentBricks[1] ) && !dirty; y++ )
+							for ( uint32_t x = bx * 2; x < std::min( bx * 2 + 2, parentBricks[0] ) && !dirty; x++ )
+								dirty = parentDirty[( z * parentBricks[1] + y ) * parentBricks[0] + x];
+					level.dirty[( bz * bricksY + by ) * bricksX + bx] = dirty != 0;
+				}
+
+		uint32_t* voxels = level.voxels.data();
+		pool.ParallelFor( bricksZ, 1, [&]( uint32_t bzBegin, uint32_t bzEnd )
+		{
+			for ( uint32_t bz = bzBegin; bz < bzEnd; bz++ )
+				for ( uint32_t by = 0; by < bricksY; by++ )
+					for ( uint32_t bx = 0; bx < bricksX; bx++ )
+					{
+						if ( !level.dirty[( bz * bricksY + by ) * bricksX + bx] ) continue;
+						const uint32_t z1 = std::min( ( bz + 1 ) * VOLUME_BRICK_SIZE, level.depth );
+						const uint32_t y1 = std::min( ( by + 1 ) * VOLUME_BRICK_SIZE, level.height );
+						const uint32_t x1 = std::min( ( bx + 1 ) * VOLUME_BRICK_SIZE, level.width );
+						const uint32_t x0 = bx * VOLUME_BRICK_SIZE;
+						for ( uint32_t z = bz * VOLUME_BRICK_SIZE; z < z1; z++ )
+							for ( uint32_t y = by * VOLUME_BRICK_SIZE; y < y1; y++ )
+							{
+								uint32_t* row = voxels + ( static_cast< size_t >( z ) * level.height + y ) * level.width;
+								const uint32_t py[2] = { y * 2, std::min( y * 2 + 1, parentSize[1] - 1 ) };
+								const uint32_t pz[2] = { z * 2, std::min( z * 2 + 1, parentSize[2] - 1 ) };
+								if ( parentLayout == VOLUME_LAYOUT_LINEAR )
+								{
+									// The four parent rows are contiguous
+									const uint32_t* rows[4];
+									for ( int i = 0; i < 4; i++ )
+										rows[i] = parent + ( static_cast< size_t >( pz[i >> 1] ) * parentSize[1] + py[i & 1] ) * parentSize[0];
+									for ( uint32_t x = x0; x < x1; x++ )
+									{
+										const uint32_t px1 = std::min( x * 2 + 1, parentSize[0] - 1 );
+										const uint32_t v[8] = { rows[0][x * 2], rows[0][px1], rows[1][x * 2], rows[1][px1],
+																rows[2][x * 2], rows[2][px1], rows[3][x * 2], rows[3][px1] };
+										row[x] = Average8( v );
+									}
+									continue;
+								}
+								// Bricked and Morton keep an even 2x2x2 block at fixed offsets from
+								// its first voxel, inside one brick
+								const uint32_t* offsets = parentLayout == VOLUME_LAYOUT_MORTON ? MortonOffsets : BrickedOffsets;
+								const bool inside = py[1] != py[0] && pz[1] != pz[0];
+								for ( uint32_t x = x0; x < x1; x++ )
+								{
+									const uint32_t px[2] = { x * 2, std::min( x * 2 + 1, parentSize[0] - 1 ) };
+									uint32_t v[8];
+									if ( inside && px[1] != px[0] )
+									{
+										const uint32_t* base = parent + VolumeVoxelIndex( parentLayout, px[0], py[0], pz[0], parentSize[0],
+																						   parentSize[1] );
+										for ( int i = 0; i < 8; i++ ) v[i] = base[offsets[i]];
+										row[x] = Average8( v );
+										continue;
+									}
+									for ( int i = 0; i < 8; i++ )
+										v[i] = parent[VolumeVoxelIndex( parentLayout, px[i & 1], py[( i >> 1 ) & 1], pz[i >> 2],
+																		parentSize[0], parentSize[1] )];
+									row[x] = Average8( v );
+								}
+							}
+					}
+		} );
+
+		parent = voxels;
+		parentLayout = VOLUME_LAYOUT_LINEAR;
+		parentSize[0] = level.width;
+		parentSize[1] = level.height;
+		parentSize[2] = level.depth;
+		parentDirty = level.dirty.data();
+	}
+}
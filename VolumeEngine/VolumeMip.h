@@ -0,0 +1,50 @@
+#pragma once
+// Mip chain of a volume for distant views. Level k is the volume averaged over
+// 2x2x2 voxels k times, channel wise and rounded, ceil( size / 2^k ) voxels along
+// each axis in the linear layout. An odd sized level repeats its last voxel.
+//
+// The chain is refreshed in 8x8x8 bricks of every level: a brick is rebuilt when one
+// of the bricks of the level above it changed, so a step that leaves most of the
+// volume alone costs little here too. Same as csmip in VolumetricAnimation_shader.hlsl.
+
+#include "VolumeRaymarch.h"
+
+#include <cstdint>
+#include <vector>
+
+class TaskPool;
+
+class VolumeMipChain
+{
+public:
+	// levelCount levels below the volume, fewer if the volume runs out of voxels
+	VolumeMipChain( uint32_t width, uint32_t height, uint32_t depth, uint32_t levelCount );
+
+	uint32_t GetLevelCount() const { return static_cast< uint32_t >( m_levels.size() ); }
+	// Level 1 is the first one below the volume
+	uint32_t GetWidth( uint32_t level ) const { return m_levels[level - 1].width; }
+	uint32_t GetHeight( uint32_t level ) const { return m_levels[level - 1].height; }
+	uint32_t GetDepth( uint32_t level ) const { return m_levels[level - 1].depth; }
+	const uint32_t* GetVoxels( uint32_t level ) const { return m_levels[level - 1].voxels.data(); }
+	// GetVoxels() of every level, for VolumeView::mipVoxels
+	const uint32_t* const* GetLevelVoxels() const { return m_levelVoxels.data(); }
+
+	// Rebuild the bricks of every level covering a brick of source whose flag in
+	// brickFlags (one per VolumeBrickIndex()) is non zero, or all of them if
+	// brickFlags is null
+	void Update( const VolumeView& source, const uint8_t* brickFlags, TaskPool& pool );
+
+private:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;
+		std::vector<uint32_t> voxels;
+		// One flag per brick, set by Update() for the bricks it rebuilds
+		std::vector<uint8_t> dirty;
+	};
+
+	std::vector<Level> m_levels;
+	std::vector<const uint32_t*> m_levelVoxels;
+};
@@ -0,0 +1,69 @@
+#include "VolumeMorton.h"
+
+#if VE_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// Bits of one axis in a Morton code, x starting at bit 0
+	const uint32_t AxisMask = 0x09249249;
+
+	uint32_t Compact3( uint32_t v )
+	{
+		v &= AxisMask;
+		v = ( v ^ ( v >> 2 ) ) & 0x030c30c3;
+		v = ( v ^ ( v >> 4 ) ) & 0x0300f00f;
+		v = ( v ^ ( v >> 8 ) ) & 0x030000ff;
+		v = ( v ^ ( v >> 16 ) ) & 0x000003ff;
+		return v;
+	}
+}
+
+void MortonDecode3_Scalar( uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z )
+{
+	x = Compact3( code );
+	y = Compact3( code >> 1 );
+	z = Compact3( code >> 2 );
+}
+
+#if VE_X86
+VE_TARGET( "bmi2" )
+uint32_t MortonEncode3_BMI2( uint32_t x, uint32_t y, uint32_t z )
+{
+	return _pdep_u32( x, AxisMask ) | _pdep_u32( y, AxisMask << 1 ) | _pdep_u32( z, AxisMask << 2 );
+}
+
+VE_TARGET( "bmi2" )
+void MortonDecode3_BMI2( uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z )
+{
+	x = _pext_u32( code, AxisMask );
+	y = _pext_u32( code, AxisMask << 1 );
+	z = _pext_u32( code, AxisMask << 2 );
+}
+#endif
+
+bool UseMortonBMI2()
+{
+#if VE_X86
+	return CpuFeatures::Get().fastPdep;
+#else
+	return false;
+#endif
+}
+
+MortonEncodeFunc GetMortonEncodeFunc()
+{
+#if VE_X86
+	if ( UseMortonBMI2() ) return MortonEncode3_BMI2;
+#endif
+	return MortonEncode3_Scalar;
+}
+
+MortonDecodeFunc GetMortonDecodeFunc()
+{
+#if VE_X86
+	if ( UseMortonBMI2() ) return MortonDecode3_BMI2;
+#endif
+	return MortonDecode3_Scalar;
+}
@@ -0,0 +1,27 @@
+#pragma once
+// Morton (Z-order) encode/decode of voxel coordinates for VOLUME_LAYOUT_MORTON,
+// 10 bits per axis. The BMI2 versions need one pdep/pext per axis; the scalar
+// ones use the shift and mask sequence from VolumeLayout.h. Both produce the
+// same codes.
+
+#include "CpuFeatures.h"
+#include "VolumeLayout.h"
+
+inline uint32_t MortonEncode3_Scalar( uint32_t x, uint32_t y, uint32_t z )
+{
+	return MortonVoxelIndex( x, y, z );
+}
+void MortonDecode3_Scalar( uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z );
+
+#if VE_X86
+uint32_t MortonEncode3_BMI2( uint32_t x, uint32_t y, uint32_t z );
+void MortonDecode3_BMI2( uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z );
+#endif
+
+typedef uint32_t( *MortonEncodeFunc )( uint32_t x, uint32_t y, uint32_t z );
+typedef void( *MortonDecodeFunc )( uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z );
+
+// BMI2 when CpuFeatures::fastPdep, the scalar version otherwise
+bool UseMortonBMI2();
+MortonEncodeFunc GetMortonEncodeFunc();
+MortonDecodeFunc GetMortonDecodeFunc();
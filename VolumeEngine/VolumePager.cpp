@@ -0,0 +1,592 @@
+#define VE_MARCH_TARGET
+#include "VolumeRaymarch.inl"
+#include "VolumePager.h"
+#include "TaskPool.h"
+#include "VolumeEngine.h"
+#include "VolumeRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+	// memset( 64 ) of the LoadAssets staging buffer, what padding voxels hold
+	const uint32_t Background = 0x40404040;
+
+	// Slot indices times VOLUME_BRICK_VOXELS have to fit the 32 bit voxel index of
+	// the sample loop, 16 GiB of bricks
+	const uint32_t MaxSlots = 1u << 23;
+
+	bool SeekFile( FILE* file, uint64_t offset )
+	{
+#ifdef _WIN32
+		return _fseeki64( file, static_cast< __int64 >( offset ), SEEK_SET ) == 0;
+#else
+		return fseeko( file, static_cast< off_t >( offset ), SEEK_SET ) == 0;
+#endif
+	}
+
+	// Channel wise byte range of count contiguous voxels
+	void AccumulateRange( const uint32_t* voxels, uint32_t count, uint8_t lo[4], uint8_t hi[4] )
+	{
+		const uint8_t* bytes = reinterpret_cast< const uint8_t* >( voxels );
+		for ( uint32_t i = 0; i < count; i++, bytes += 4 )
+			for ( int j = 0; j < 4; j++ )
+			{
+				lo[j] = bytes[j] < lo[j] ? bytes[j] : lo[j];
+				hi[j] = bytes[j] > hi[j] ? bytes[j] : hi[j];
+			}
+	}
+
+	// Bricked addressing that pins the brick of the current sample in the cache and
+	// returns the index of the voxel in its slot, so the sinks read the slot memory.
+	// Consecutive samples mostly stay in one brick, which is then pinned only once.
+	struct PagedAddress
+	{
+		PagedAddress( BrickCache& cache, const VolumeView& volume ) :
+			cache( cache ), bricksX( VolumeBrickCount( volume.width ) ), bricksY( VolumeBrickCount( volume.height ) ),
+			brick( ~0u ), base( 0 ) {}
+		~PagedAddress()
+		{
+			if ( brick != ~0u ) cache.ReleaseBrick( brick, false );
+		}
+
+		uint32_t operator()( uint32_t x, uint32_t y, uint32_t z ) const
+		{
+			const uint32_t index = VolumeBrickIndex( x, y, z, bricksX, bricksY );
+			if ( index != brick )
+			{
+				if ( brick != ~0u ) cache.ReleaseBrick( brick, false );
+				brick = index;
+				base = static_cast< uint32_t >( cache.AcquireBrick( index ) - cache.GetSlotVoxels() );
+			}
+			return base + ( ( x & 7 ) | ( ( y & 7 ) << 3 ) | ( ( z & 7 ) << 6 ) );
+		}
+
+		BrickCache& cache;
+		uint32_t bricksX, bricksY;
+		mutable uint32_t brick;
+		mutable uint32_t base;
+	};
+
+	// MarchRay at the fixed step without mip levels, sampling through the cache
+	uint32_t MarchPaged( const VolumeView& volume, BrickCache& cache, const RaymarchParams& params, const float origin[3],
+						 const float dir[3], float rgba[4], uint32_t& skipped )
+	{
+		rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.f;
+		skipped = 0;
+		float d[3], tnear, tfar;
+		for ( int c = 0; c < 3; c++ ) d[c] = dir[c] == 0.f ? 1e-15f : dir[c];
+		const float boxMax[3] = { volume.width * 0.5f, volume.height * 0.5f, volume.depth * 0.5f };
+		const float boxMin[3] = { -boxMax[0], -boxMax[1], -boxMax[2] };
+		if ( !IntersectBox( origin, d, boxMin, boxMax, tnear, tfar ) ) return 0;
+
+		const PagedAddress address( cache, volume );
+		uint32_t samples;
+		if ( params.compositing == CompositeFrontToBack )
+		{
+			CompositeSink sink( cache.GetSlotVoxels(), params );
+			samples = March( volume, address, params, origin, d, tnear, tfar, sink, skipped );
+			for ( int c = 0; c < 4; c++ ) rgba[c] = sink.rgba[c];
+			return samples;
+		}
+		AccumulateSink sink( cache.GetSlotVoxels() );
+		samples = March( volume, address, params, origin, d, tnear, tfar, sink, skipped );
+		const float scale = params.density / 256.f;
+		for ( int c = 0; c < 4; c++ ) rgba[c] = sink.sum[c] * scale;
+		return samples;
+	}
+}
+
+BrickCache::BrickCache( const char* path, uint64_t offset, uint32_t brickCount, size_t budgetBytes, bool create ) :
+	m_file( nullptr ), m_offset( offset ), m_brickCount( brickCount ), m_lruHead( None ), m_lruTail( None ),
+	m_stats(), m_quit( false )
+{
+	size_t slots = std::min<size_t>( budgetBytes / BrickBytes, std::max( brickCount, MinSlots ) );
+	m_slotCount = static_cast< uint32_t >( std::min<size_t>( std::max<size_t>( slots, MinSlots ), MaxSlots ) );
+	m_slotVoxels.resize( static_cast< size_t >( m_slotCount ) * VOLUME_BRICK_VOXELS );
+	m_slots.resize( m_slotCount );
+	for ( uint32_t i = 0; i < m_slotCount; i++ )
+	{
+		Slot& slot = m_slots[i];
+		slot.brick = None;
+		slot.pins = 0;
+		slot.dirty = slot.loading = slot.prefetched = false;
+		slot.prev = slot.next = None;
+		PushFront( i );
+	}
+
+#ifdef _WIN32
+	fopen_s( &m_file, path, create ? "w+b" : "r+b" );
+#else
+	m_file = fopen( path, create ? "w+b" : "r+b" );
+#endif
+	if ( m_file ) m_loader = std::thread( &BrickCache::LoaderLoop, this );
+}
+
+BrickCache::~BrickCache()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_quit = true;
+	}
+	m_prefetchCV.notify_all();
+	if ( m_loader.joinable() ) m_loader.join();
+	if ( !m_file ) return;
+	Flush();
+	fclose( m_file );
+}
+
+uint32_t* BrickCache::AcquireBrick( uint32_t brick )
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	for ( ;; )
+	{
+		auto it = m_resident.find( brick );
+		if ( it != m_resident.end() )
+		{
+			Slot& slot = m_slots[it->second];
+			if ( !slot.loading )
+			{
+				if ( slot.prefetched ) m_stats.prefetchHits++;
+				else m_stats.hits++;
+				slot.prefetched = false;
+				slot.pins++;
+				Unlink( it->second );
+				PushFront( it->second );
+				return &m_slotVoxels[static_cast< size_t >( it->second ) * VOLUME_BRICK_VOXELS];
+			}
+		}
+		else if ( !m_writing.count( brick ) )
+		{
+			uint32_t slot = LoadBrick( lock, brick, 1, false );
+			if ( slot != None )
+			{
+				m_stats.misses++;
+				return &m_slotVoxels[static_cast< size_t >( slot ) * VOLUME_BRICK_VOXELS];
+			}
+		}
+		// Being read or written back, or every slot is pinned
+		m_changedCV.wait( lock );
+	}
+}
+
+void BrickCache::ReleaseBrick( uint32_t brick, bool dirty )
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	Slot& slot = m_slots[m_resident.find( brick )->second];
+	slot.dirty |= dirty;
+	if ( --slot.pins == 0 ) m_changedCV.notify_all();
+}
+
+void BrickCache::Prefetch( const uint32_t* bricks, uint32_t count )
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	const size_t limit = m_slotCount / 4;
+	for ( uint32_t i = 0; i < count && m_prefetchQueue.size() < limit; i++ )
+		if ( !m_resident.count( bricks[i] ) && !m_writing.count( bricks[i] ) ) m_prefetchQueue.push_back( bricks[i] );
+	m_prefetchCV.notify_one();
+}
+
+void BrickCache::Flush()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_changedCV.wait( lock, [this]
+	{
+		for ( const Slot& slot : m_slots )
+			if ( slot.loading ) return false;
+		return true;
+	} );
+	for ( uint32_t i = 0; i < m_slotCount; i++ )
+	{
+		if ( m_slots[i].brick == None || !m_slots[i].dirty ) continue;
+		WriteBricks( m_slots[i].brick, 1, &m_slotVoxels[static_cast< size_t >( i ) * VOLUME_BRICK_VOXELS] );
+		m_slots[i].dirty = false;
+	}
+}
+
+void BrickCache::Discard()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_prefetchQueue.clear();
+	m_changedCV.wait( lock, [this]
+	{
+		for ( const Slot& slot : m_slots )
+			if ( slot.loading ) return false;
+		return m_writing.empty();
+	} );
+	for ( Slot& slot : m_slots )
+	{
+		slot.brick = None;
+		slot.dirty = slot.prefetched = false;
+	}
+	m_resident.clear();
+}
+
+bool BrickCache::ReadBricks( uint32_t first, uint32_t count, uint32_t* voxels )
+{
+	std::lock_guard<std::mutex> lock( m_fileMutex );
+	const size_t voxelCount = static_cast< size_t >( count ) * VOLUME_BRICK_VOXELS;
+	size_t read = 0;
+	if ( SeekFile( m_file, m_offset + static_cast< uint64_t >( first ) * BrickBytes ) )
+		read = fread( voxels, sizeof( uint32_t ), voxelCount, m_file );
+	// Bricks past the end of a new file were never written
+	std::fill( voxels + read, voxels + voxelCount, 0u );
+	return read == voxelCount;
+}
+
+bool BrickCache::WriteBricks( uint32_t first, uint32_t count, const uint32_t* voxels )
+{
+	std::lock_guard<std::mutex> lock( m_fileMutex );
+	const size_t voxelCount = static_cast< size_t >( count ) * VOLUME_BRICK_VOXELS;
+	if ( !SeekFile( m_file, m_offset + static_cast< uint64_t >( first ) * BrickBytes ) ) return false;
+	return fwrite( voxels, sizeof( uint32_t ), voxelCount, m_file ) == voxelCount;
+}
+
+BrickCacheStats BrickCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	return m_stats;
+}
+
+void BrickCache::ResetStats()
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	m_stats = BrickCacheStats();
+}
+
+uint32_t BrickCache::FindVictim() const
+{
+	for ( uint32_t slot = m_lruTail; slot != None; slot = m_slots[slot].prev )
+		if ( m_slots[slot].pins == 0 && !m_slots[slot].loading ) return slot;
+	return None;
+}
+
+uint32_t BrickCache::LoadBrick( std::unique_lock<std::mutex>& lock, uint32_t brick, uint32_t pins, bool prefetched )
+{
+	const uint32_t index = FindVictim();
+	if ( index == None ) return None;
+
+	// The slot changes hands under the lock, the I/O happens outside of it. Readers
+	// of either brick wait on loading and m_writing until it is done.
+	Slot& slot = m_slots[index];
+	const uint32_t evicted = slot.brick;
+	const bool writeBack = evicted != None && slot.dirty;
+	if ( evicted != None )
+	{
+		m_resident.erase( evicted );
+		m_stats.evictions++;
+	}
+	if ( writeBack )
+	{
+		m_writing.insert( evicted );
+		m_stats.writebacks++;
+	}
+	slot.brick = brick;
+	slot.pins = pins;
+	slot.dirty = false;
+	slot.loading = true;
+	slot.prefetched = prefetched;
+	m_resident[brick] = index;
+	Unlink( index );
+	PushFront( index );
+
+	uint32_t* voxels = &m_slotVoxels[static_cast< size_t >( index ) * VOLUME_BRICK_VOXELS];
+	lock.unlock();
+	if ( writeBack ) WriteBricks( evicted, 1, voxels );
+	ReadBricks( brick, 1, voxels );
+	lock.lock();
+
+	if ( writeBack ) m_writing.erase( evicted );
+	slot.loading = false;
+	m_changedCV.notify_all();
+	return index;
+}
+
+void BrickCache::Unlink( uint32_t slot )
+{
+	Slot& s = m_slots[slot];
+	if ( s.prev != None ) m_slots[s.prev].next = s.next;
+	else if ( m_lruHead == slot ) m_lruHead = s.next;
+	if ( s.next != None ) m_slots[s.next].prev = s.prev;
+	else if ( m_lruTail == slot ) m_lruTail = s.prev;
+	s.prev = s.next = None;
+}
+
+void BrickCache::PushFront( uint32_t slot )
+{
+	Slot& s = m_slots[slot];
+	s.prev = None;
+	s.next = m_lruHead;
+	if ( m_lruHead != None ) m_slots[m_lruHead].prev = slot;
+	m_lruHead = slot;
+	if ( m_lruTail == None ) m_lruTail = slot;
+}
+
+void BrickCache::LoaderLoop()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	for ( ;; )
+	{
+		m_prefetchCV.wait( lock, [this] { return m_quit || !m_prefetchQueue.empty(); } );
+		if ( m_quit ) return;
+		const uint32_t brick = m_prefetchQueue.front();
+		m_prefetchQueue.pop_front();
+		// Hints can be stale by the time they come up
+		if ( m_resident.count( brick ) || m_writing.count( brick ) ) continue;
+		if ( LoadBrick( lock, brick, 0, true ) != None ) m_stats.prefetches++;
+	}
+}
+
+PagedVolume::PagedVolume( const char* path, uint32_t width, uint32_t height, uint32_t depth, size_t budgetBytes,
+						  uint32_t threadCount ) :
+	m_width( width ), m_height( height ), m_depth( depth ), m_params( VolumeParams::Default() ),
+	m_pool( new TaskPool( threadCount ) ), m_activeBrickCount( 0 )
+{
+	m_tables = StepTables::Build( m_params );
+	const uint32_t brickCount = VolumeBrickCount( width ) * VolumeBrickCount( height ) * VolumeBrickCount( depth );
+	m_cache.reset( new BrickCache( path, 0, brickCount, budgetBytes, true ) );
+	m_brickActive.assign( brickCount, 1 );
+	m_brickRange.resize( static_cast< size_t >( brickCount ) * 2 );
+	m_cellRange.resize( static_cast< size_t >( VolumeCellCount( width ) ) * VolumeCellCount( height ) *
+						VolumeCellCount( depth ) * 2 );
+}
+
+PagedVolume::~PagedVolume()
+{
+}
+
+void PagedVolume::Generate( const VolumeRowFunc& row )
+{
+	m_cache->Discard();
+	const uint32_t bricksX = VolumeBrickCount( m_width );
+	const uint32_t bricksY = VolumeBrickCount( m_height );
+	const uint32_t slabBricks = bricksX * bricksY;
+	std::vector<uint32_t> slab( static_cast< size_t >( slabBricks ) * VOLUME_BRICK_VOXELS );
+	for ( uint32_t bz = 0; bz < VolumeBrickCount( m_depth ); bz++ )
+	{
+		// One slab of bricks at a time is assembled in memory, rows in parallel
+		const uint32_t z0 = bz * VOLUME_BRICK_SIZE;
+		const uint32_t sizeZ = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_depth - z0 );
+		std::fill( slab.begin(), slab.end(), Background );
+		m_pool->ParallelFor( sizeZ * m_height, 8, [&]( uint32_t begin, uint32_t end )
+		{
+			std::vector<uint32_t> scratch( m_width );
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				const uint32_t z = i / m_height, y = i % m_height;
+				row( y, z0 + z, scratch.data() );
+				for ( uint32_t x = 0; x < m_width; x += VOLUME_BRICK_SIZE )
+					memcpy( &slab[BrickedVoxelIndex( x, y, z, bricksX, bricksY )], &scratch[x],
+							std::min<uint32_t>( VOLUME_BRICK_SIZE, m_width - x ) * sizeof( uint32_t ) );
+			}
+		} );
+		m_pool->ParallelFor( slabBricks, 64, [&]( uint32_t begin, uint32_t end )
+		{
+			for ( uint32_t i = begin; i < end; i++ )
+				UpdateBrickRange( bz * slabBricks + i, &slab[static_cast< size_t >( i ) * VOLUME_BRICK_VOXELS] );
+		} );
+		m_cache->WriteBricks( bz * slabBricks, slabBricks, slab.data() );
+	}
+	std::fill( m_brickActive.begin(), m_brickActive.end(), static_cast< uint8_t >( 1 ) );
+	BuildCellRanges( m_width, m_height, m_depth, m_brickRange.data(), m_brickActive.data(), true, m_cellRange.data() );
+}
+
+void PagedVolume::FillShellVolume()
+{
+	const VolumeParams params = m_params;
+	const uint32_t width = m_width, height = m_height, depth = m_depth;
+	Generate( [&]( uint32_t y, uint32_t z, uint32_t* row ) { GenerateShellRow( params, width, height, depth, y, z, row ); } );
+}
+
+void PagedVolume::Step()
+{
+	const uint32_t bricksX = VolumeBrickCount( m_width );
+	const uint32_t bricksY = VolumeBrickCount( m_height );
+	const uint32_t bricksZ = VolumeBrickCount( m_depth );
+	const uint32_t slabBricks = bricksX * bricksY;
+	const StepKernelFunc kernel = GetStepKernelFunc( GetBestStepKernel() );
+	// The flags turn into the changed ones as the slabs go, the next slab's prefetch
+	// needs the old ones
+	const std::vector<uint8_t> active( m_brickActive );
+	std::atomic<uint32_t> activeBricks( 0 );
+
+	m_pool->ParallelFor( bricksZ, 1, [&]( uint32_t bzBegin, uint32_t bzEnd )
+	{
+		std::vector<uint32_t> next;
+		uint32_t stepped = 0;
+		for ( uint32_t bz = bzBegin; bz < bzEnd; bz++ )
+		{
+			next.clear();
+			for ( uint32_t i = 0; bz + 1 < bricksZ && i < slabBricks; i++ )
+				if ( active[( bz + 1 ) * slabBricks + i] ) next.push_back( ( bz + 1 ) * slabBricks + i );
+			m_cache->Prefetch( next.data(), static_cast< uint32_t >( next.size() ) );
+
+			// VolumeEngine::StepBrickedSlab on one brick in the cache at a time
+			const uint32_t sizeZ = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_depth - bz * VOLUME_BRICK_SIZE );
+			for ( uint32_t i = 0; i < slabBricks; i++ )
+			{
+				const uint32_t brick = bz * slabBricks + i;
+				if ( !active[brick] ) continue;
+				stepped++;
+
+				const uint32_t sizeX = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_width - i % bricksX * VOLUME_BRICK_SIZE );
+				const uint32_t sizeY = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_height - i / bricksX * VOLUME_BRICK_SIZE );
+				uint32_t* voxels = m_cache->AcquireBrick( brick );
+				uint8_t rowChanged[VOLUME_BRICK_SIZE * VOLUME_BRICK_SIZE] = {};
+				if ( sizeX == VOLUME_BRICK_SIZE && sizeY == VOLUME_BRICK_SIZE && sizeZ == VOLUME_BRICK_SIZE )
+					kernel( voxels, VOLUME_BRICK_VOXELS, m_tables, rowChanged );
+				else
+					for ( uint32_t z = 0; z < sizeZ; z++ )
+						for ( uint32_t y = 0; y < sizeY; y++ )
+							kernel( voxels + ( z * VOLUME_BRICK_SIZE + y ) * VOLUME_BRICK_SIZE, sizeX, m_tables,
+									&rowChanged[z * VOLUME_BRICK_SIZE + y] );
+
+				uint8_t changed = 0;
+				for ( uint32_t r = 0; r < VOLUME_BRICK_SIZE * VOLUME_BRICK_SIZE; r++ ) changed |= rowChanged[r];
+				if ( changed ) UpdateBrickRange( brick, voxels );
+				m_cache->ReleaseBrick( brick, changed != 0 );
+				m_brickActive[brick] = changed;
+			}
+		}
+		activeBricks.fetch_add( stepped, std::memory_order_relaxed );
+	} );
+	m_activeBrickCount = activeBricks.load();
+	BuildCellRanges( m_width, m_height, m_depth, m_brickRange.data(), m_brickActive.data(), false, m_cellRange.data() );
+}
+
+void PagedVolume::CopyToLinear( uint32_t* dst )
+{
+	m_cache->Flush();
+	const uint32_t bricksX = VolumeBrickCount( m_width );
+	const uint32_t bricksY = VolumeBrickCount( m_height );
+	const uint32_t slabBricks = bricksX * bricksY;
+	std::vector<uint32_t> slab( static_cast< size_t >( slabBricks ) * VOLUME_BRICK_VOXELS );
+	for ( uint32_t bz = 0; bz < VolumeBrickCount( m_depth ); bz++ )
+	{
+		m_cache->ReadBricks( bz * slabBricks, slabBricks, slab.data() );
+		const uint32_t z0 = bz * VOLUME_BRICK_SIZE;
+		for ( uint32_t z = z0; z < std::min<uint32_t>( z0 + VOLUME_BRICK_SIZE, m_depth ); z++ )
+			for ( uint32_t y = 0; y < m_height; y++ )
+				for ( uint32_t x = 0; x < m_width; x++ )
+					dst[( static_cast< size_t >( z ) * m_height + y ) * m_width + x] =
+						slab[BrickedVoxelIndex( x, y, z - z0, bricksX, bricksY )];
+	}
+}
+
+uint64_t PagedVolume::Render( const RaymarchParams& params, const RaymarchCamera& camera, uint32_t width, uint32_t height,
+							  float* rgba )
+{
+	double inv[16];
+	if ( width == 0 || height == 0 ) return 0;
+	if ( !camera.GetInverse( inv ) )
+	{
+		std::fill( rgba, rgba + static_cast< size_t >( width ) * height * 4, 0.f );
+		return 0;
+	}
+
+	const VolumeView view = GetView();
+	const uint32_t tilesX = ( width + TileSize - 1 ) / TileSize;
+	const uint32_t tilesY = ( height + TileSize - 1 ) / TileSize;
+	std::atomic<uint64_t> samples( 0 );
+	m_pool->ParallelFor( tilesX * tilesY, 1, [&]( uint32_t begin, uint32_t end )
+	{
+		uint64_t tileSamples = 0;
+		for ( uint32_t tile = begin; tile < end; tile++ )
+		{
+			PrefetchTile( view, params, camera, inv, width, height, tile, tilesX );
+			const uint32_t x0 = tile % tilesX * TileSize;
+			const uint32_t y0 = tile / tilesX * TileSize;
+			for ( uint32_t y = y0; y < std::min( y0 + TileSize, height ); y++ )
+				for ( uint32_t x = x0; x < std::min( x0 + TileSize, width ); x++ )
+				{
+					float dir[3];
+					uint32_t skipped;
+					camera.GetPixelRay( inv, width, height, x, y, dir );
+					tileSamples += MarchPaged( view, *m_cache, params, camera.eye, dir,
+											   rgba + ( static_cast< size_t >( y ) * width + x ) * 4, skipped );
+				}
+		}
+		samples += tileSamples;
+	} );
+	return samples;
+}
+
+VolumeView PagedVolume::GetView() const
+{
+	VolumeView view = { nullptr, m_width, m_height, m_depth, VOLUME_LAYOUT_BRICKED, m_brickRange.data(), m_cellRange.data(),
+						nullptr, 0 };
+	return view;
+}
+
+void PagedVolume::UpdateBrickRange( uint32_t brick, const uint32_t* voxels )
+{
+	const uint32_t bricksX = VolumeBrickCount( m_width );
+	const uint32_t bricksY = VolumeBrickCount( m_height );
+	const uint32_t sizeX = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_width - brick % bricksX * VOLUME_BRICK_SIZE );
+	const uint32_t sizeY = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_height - brick / bricksX % bricksY * VOLUME_BRICK_SIZE );
+	const uint32_t sizeZ = std::min<uint32_t>( VOLUME_BRICK_SIZE, m_depth - brick / bricksX / bricksY * VOLUME_BRICK_SIZE );
+	uint8_t lo[4] = { 0xff, 0xff, 0xff, 0xff }, hi[4] = {};
+	// Padding voxels are left out
+	for ( uint32_t z = 0; z < sizeZ; z++ )
+		for ( uint32_t y = 0; y < sizeY; y++ )
+			AccumulateRange( voxels + ( z * VOLUME_BRICK_SIZE + y ) * VOLUME_BRICK_SIZE, sizeX, lo, hi );
+	m_brickRange[brick * 2] = lo[0] | lo[1] << 8 | lo[2] << 16 | static_cast< uint32_t >( lo[3] ) << 24;
+	m_brickRange[brick * 2 + 1] = hi[0] | hi[1] << 8 | hi[2] << 16 | static_cast< uint32_t >( hi[3] ) << 24;
+}
+
+void PagedVolume::PrefetchTile( const VolumeView& view, const RaymarchParams& params, const RaymarchCamera& camera,
+								const double inverse[16], uint32_t width, uint32_t height, uint32_t tile, uint32_t tilesX )
+{
+	struct TileRay
+	{
+		float d[3];
+		float tnear;
+		float tfar;
+	};
+	const float boxMax[3] = { view.width * 0.5f, view.height * 0.5f, view.depth * 0.5f };
+	const float boxMin[3] = { -boxMax[0], -boxMax[1], -boxMax[2] };
+	const uint32_t x0 = tile % tilesX * TileSize;
+	const uint32_t y0 = tile / tilesX * TileSize;
+	std::vector<TileRay> rays;
+	for ( uint32_t y = y0; y < std::min( y0 + TileSize, height ); y++ )
+		for ( uint32_t x = x0; x < std::min( x0 + TileSize, width ); x++ )
+		{
+			float dir[3];
+			TileRay ray;
+			camera.GetPixelRay( inverse, width, height, x, y, dir );
+			for ( int c = 0; c < 3; c++ ) ray.d[c] = dir[c] == 0.f ? 1e-15f : dir[c];
+			if ( IntersectBox( camera.eye, ray.d, boxMin, boxMax, ray.tnear, ray.tfar ) ) rays.push_back( ray );
+		}
+
+	// All rays a brick length at a time, so the hints come out as a front moving away
+	// from the eye. The cache drops whatever is past a quarter of its slots anyway.
+	const uint32_t bricksX = VolumeBrickCount( view.width );
+	const uint32_t bricksY = VolumeBrickCount( view.height );
+	const size_t limit = m_cache->GetSlotCount() / 4;
+	std::vector<uint32_t> hints;
+	std::unordered_set<uint32_t> seen;
+	for ( uint32_t k = 0; !rays.empty() && hints.size() < limit; k++ )
+	{
+		size_t live = 0;
+		for ( const TileRay& ray : rays )
+		{
+			const float t = ray.tnear + static_cast< float >( k * VOLUME_BRICK_SIZE );
+			if ( t > ray.tfar ) continue;
+			rays[live++] = ray;
+			const int x = static_cast< int >( camera.eye[0] + ray.d[0] * t + boxMax[0] );
+			const int y = static_cast< int >( camera.eye[1] + ray.d[1] * t + boxMax[1] );
+			const int z = static_cast< int >( camera.eye[2] + ray.d[2] * t + boxMax[2] );
+			if ( static_cast< uint32_t >( x ) >= view.width || static_cast< uint32_t >( y ) >= view.height ||
+				 static_cast< uint32_t >( z ) >= view.depth )
+				continue;
+			const uint32_t brick = VolumeBrickIndex( x, y, z, bricksX, bricksY );
+			// The march samples a uniform run from the ranges alone, bar its first voxel
+			if ( params.skipUniformBricks && view.brickRange[brick * 2] == view.brickRange[brick * 2 + 1] ) continue;
+			if ( seen.insert( brick ).second ) hints.push_back( brick );
+		}
+		rays.resize( live );
+	}
+	m_cache->Prefetch( hints.data(), static_cast< uint32_t >( std::min( hints.size(), limit ) ) );
+}
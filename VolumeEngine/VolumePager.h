@@ -0,0 +1,196 @@
+#pragma once
+// Volumes larger than memory. The bricks live in a file, VOLUME_LAYOUT_BRICKED
+// storage (8x8x8 voxels, 2 KiB each, in VolumeBrickIndex() order), and BrickCache
+// keeps a budget of them in memory with LRU replacement. PagedVolume steps and
+// raymarches such a volume through the cache; only the per brick active flags and
+// value ranges stay in memory, 9 bytes per brick, 144 MiB at 2048^3.
+//
+// A brick is pinned between AcquireBrick and ReleaseBrick and never evicted while
+// pinned, so every thread may pin a few at a time. Misses read on the calling
+// thread, prefetch hints are read ahead on a loader thread of the cache.
+
+#include "VolumeGenerate.h"
+#include "VolumeRaymarch.h"
+#include "VolumeStep.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class TaskPool;
+struct RaymarchCamera;
+
+struct BrickCacheStats
+{
+	// Acquires served from memory, a prefetched brick counts once as a prefetch hit
+	uint64_t hits;
+	uint64_t prefetchHits;
+	// Acquires that waited for a read
+	uint64_t misses;
+	// Bricks dropped to make room and the dirty ones among them written back
+	uint64_t evictions;
+	uint64_t writebacks;
+	// Bricks the loader read ahead
+	uint64_t prefetches;
+};
+
+class BrickCache
+{
+public:
+	static const size_t BrickBytes = VOLUME_BRICK_VOXELS * sizeof( uint32_t );
+	// The budget never goes below this many bricks
+	static const uint32_t MinSlots = 64;
+
+	// brickCount bricks from byte offset on in path, which is created when create is
+	// set and opened for update otherwise. budgetBytes of them are kept in memory.
+	BrickCache( const char* path, uint64_t offset, uint32_t brickCount, size_t budgetBytes, bool create );
+	// Writes back the dirty bricks
+	~BrickCache();
+
+	BrickCache( BrickCache const& ) = delete;
+	BrickCache& operator=( BrickCache const& ) = delete;
+
+	bool IsOpen() const { return m_file != nullptr; }
+	uint32_t GetBrickCount() const { return m_brickCount; }
+	uint32_t GetSlotCount() const { return m_slotCount; }
+
+	// VOLUME_BRICK_VOXELS voxels of brick, read on a miss, pinned until ReleaseBrick.
+	// The pointer is GetSlotVoxels() plus a multiple of VOLUME_BRICK_VOXELS.
+	uint32_t* AcquireBrick( uint32_t brick );
+	// dirty has the brick written back before it is evicted
+	void ReleaseBrick( uint32_t brick, bool dirty );
+	const uint32_t* GetSlotVoxels() const { return m_slotVoxels.data(); }
+
+	// Read bricks ahead on the loader thread, in order. Bricks in memory are skipped,
+	// and hints beyond a quarter of the slots are dropped so read ahead never evicts
+	// the bricks in use.
+	void Prefetch( const uint32_t* bricks, uint32_t count );
+
+	// Write back every dirty brick
+	void Flush();
+	// Forget every brick in memory without writing it back, for bulk writes
+	void Discard();
+	// count bricks from first straight from or to the file, bypassing the cache. Bricks
+	// written this way must not be in memory.
+	bool ReadBricks( uint32_t first, uint32_t count, uint32_t* voxels );
+	bool WriteBricks( uint32_t first, uint32_t count, const uint32_t* voxels );
+
+	BrickCacheStats GetStats() const;
+	void ResetStats();
+
+private:
+	struct Slot
+	{
+		uint32_t brick;
+		uint32_t pins;
+		bool dirty;
+		bool loading;
+		bool prefetched;
+		// LRU list, most recent first
+		uint32_t prev;
+		uint32_t next;
+	};
+
+	static const uint32_t None = ~0u;
+
+	// Unpinned slot to reuse, least recently used first, None if all are pinned.
+	// Caller holds m_mutex.
+	uint32_t FindVictim() const;
+	// Load brick into a victim slot, m_mutex held in lock and released for the I/O.
+	// Returns the slot, None if every slot is pinned.
+	uint32_t LoadBrick( std::unique_lock<std::mutex>& lock, uint32_t brick, uint32_t pins, bool prefetched );
+	void Unlink( uint32_t slot );
+	void PushFront( uint32_t slot );
+	void LoaderLoop();
+
+	FILE* m_file;
+	uint64_t m_offset;
+	uint32_t m_brickCount;
+	uint32_t m_slotCount;
+	std::vector<uint32_t> m_slotVoxels;
+	std::vector<Slot> m_slots;
+	uint32_t m_lruHead;
+	uint32_t m_lruTail;
+	std::unordered_map<uint32_t, uint32_t> m_resident;
+	// Evicted bricks still being written back, a read of them waits
+	std::unordered_set<uint32_t> m_writing;
+	std::deque<uint32_t> m_prefetchQueue;
+	BrickCacheStats m_stats;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_changedCV;
+	std::condition_variable m_prefetchCV;
+	std::mutex m_fileMutex;
+	std::thread m_loader;
+	bool m_quit;
+};
+
+class PagedVolume
+{
+public:
+	// A width x height x depth volume in a new brick file at path, budgetBytes of it in
+	// memory. threadCount == 0 uses all hardware threads.
+	PagedVolume( const char* path, uint32_t width, uint32_t height, uint32_t depth, size_t budgetBytes,
+				 uint32_t threadCount = 0 );
+	~PagedVolume();
+
+	PagedVolume( PagedVolume const& ) = delete;
+	PagedVolume& operator=( PagedVolume const& ) = delete;
+
+	bool IsOpen() const { return m_cache->IsOpen(); }
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetDepth() const { return m_depth; }
+	uint32_t GetBrickCount() const { return static_cast< uint32_t >( m_brickActive.size() ); }
+	uint32_t GetActiveBrickCount() const { return m_activeBrickCount; }
+	const VolumeParams& GetParams() const { return m_params; }
+	BrickCache& GetCache() { return *m_cache; }
+
+	// Write the volume row by row, slab of bricks by slab straight to the file, and
+	// rebuild the ranges. Every brick is active afterwards.
+	void Generate( const VolumeRowFunc& row );
+	// The volume of VolumeEngine::FillShellVolume
+	void FillShellVolume();
+
+	// VolumeEngine::Step through the cache, bricks that go idle are never read again.
+	// The active bricks of the next slab are prefetched while a slab is stepped.
+	void Step();
+
+	// Copy the volume out in linear order, for small volumes
+	void CopyToLinear( uint32_t* dst );
+
+	// VolumeRenderer::Render in RenderModeSingle without mip levels. Uniform runs are
+	// skipped from the ranges in memory. Before a tile is marched the bricks its rays
+	// enter are prefetched, nearest first, tile by tile ahead of the rays. Returns the number of samples taken.
+	uint64_t Render( const RaymarchParams& params, const RaymarchCamera& camera, uint32_t width, uint32_t height,
+					 float* rgba );
+
+private:
+	// View for the sample loop: ranges, size and bricked layout, no voxels
+	VolumeView GetView() const;
+	// Range of brick from its voxels in the cache
+	void UpdateBrickRange( uint32_t brick, const uint32_t* voxels );
+	// Hint the bricks the rays of one tile cross, in order of distance along the rays.
+	// Uniform bricks are left out when the march skips them.
+	void PrefetchTile( const VolumeView& view, const RaymarchParams& params, const RaymarchCamera& camera,
+					   const double inverse[16], uint32_t width, uint32_t height, uint32_t tile, uint32_t tilesX );
+
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_depth;
+	VolumeParams m_params;
+	StepTables m_tables;
+	std::unique_ptr<BrickCache> m_cache;
+	std::unique_ptr<TaskPool> m_pool;
+	std::vector<uint8_t> m_brickActive;
+	std::vector<uint32_t> m_brickRange;
+	std::vector<uint32_t> m_cellRange;
+	uint32_t m_activeBrickCount;
+	static const uint32_t TileSize = 16;
+};
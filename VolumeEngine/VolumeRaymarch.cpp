@@ -0,0 +1,272 @@
+#define VE_MARCH_TARGET
+#include "VolumeRaymarch.inl"
+#include "VolumeMorton.h"
+
+#include <cmath>
+
+namespace
+{
+	// Clip the ray against the volume box, d receives the direction psmain marches along
+	bool SetupRay( const VolumeView& volume, const float origin[3], const float dir[3], float d[3], float& tnear,
+				   float& tfar )
+	{
+		// psmain nudges zero components so the slab test never divides by zero
+		for ( int c = 0; c < 3; c++ ) d[c] = dir[c] == 0.f ? 1e-15f : dir[c];
+
+		const float boxMax[3] = { volume.width * 0.5f, volume.height * 0.5f, volume.depth * 0.5f };
+		const float boxMin[3] = { -boxMax[0], -boxMax[1], -boxMax[2] };
+		return IntersectBox( origin, d, boxMin, boxMax, tnear, tfar );
+	}
+
+	// Mip level for a ray entering the box at tnear, see RaymarchParams::lodScale
+	uint32_t SelectLod( const VolumeView& volume, const RaymarchParams& params, float tnear )
+	{
+		const float footprint = fmaxf( tnear, 0.f ) * params.lodScale;
+		uint32_t level = 0;
+		while ( level < volume.mipCount && static_cast< float >( 2u << level ) <= footprint ) level++;
+		return level;
+	}
+
+	template<class Sink>
+	uint32_t MarchLayout( const VolumeView& volume, const RaymarchParams& params, const float o[3], const float d[3],
+						  float tnear, float tfar, Sink& sink, uint32_t& skipped )
+	{
+		switch ( volume.layout )
+		{
+		case VOLUME_LAYOUT_BRICKED:
+			return March( volume, VoxelAddress<VOLUME_LAYOUT_BRICKED>( volume ), params, o, d, tnear, tfar, sink, skipped );
+		case VOLUME_LAYOUT_MORTON:
+			return March( volume, VoxelAddress<VOLUME_LAYOUT_MORTON>( volume ), params, o, d, tnear, tfar, sink, skipped );
+		default:
+			return March( volume, VoxelAddress<VOLUME_LAYOUT_LINEAR>( volume ), params, o, d, tnear, tfar, sink, skipped );
+		}
+	}
+
+	// MarchRay after the box clipping, d already nudged
+	uint32_t MarchClipped( const VolumeView& volume, const RaymarchParams& params, const float origin[3], const float d[3],
+						   float tnear, float tfar, float rgba[4], uint32_t* skipped )
+	{
+		uint32_t samples, jumped;
+		if ( params.compositing == CompositeFrontToBack )
+		{
+#if VE_X86
+			if ( volume.layout == VOLUME_LAYOUT_MORTON && UseMortonBMI2() )
+				samples = MarchMortonComposite_BMI2( volume, params, origin, d, tnear, tfar, rgba, jumped );
+			else
+#endif
+			{
+				CompositeSink sink( volume.voxels, params );
+				samples = MarchLayout( volume, params, origin, d, tnear, tfar, sink, jumped );
+				for ( int c = 0; c < 4; c++ ) rgba[c] = sink.rgba[c];
+			}
+			if ( skipped ) *skipped = jumped;
+			return samples;
+		}
+
+		AccumulateSink sink( volume.voxels );
+#if VE_X86
+		if ( volume.layout == VOLUME_LAYOUT_MORTON && UseMortonBMI2() )
+			samples = MarchMortonAccumulate_BMI2( volume, params, origin, d, tnear, tfar, sink.sum, jumped );
+		else
+#endif
+			samples = MarchLayout( volume, params, origin, d, tnear, tfar, sink, jumped );
+		if ( skipped ) *skipped = jumped;
+
+		// Channels are summed as integers, the result differs from the shader's float
+		// accumulation only by rounding
+		const float scale = params.density / 256.f;
+		for ( int c = 0; c < 4; c++ ) rgba[c] = sink.sum[c] * scale;
+		return samples;
+	}
+}
+
+VolumeView GetMipView( const VolumeView& volume, uint32_t level )
+{
+	if ( level == 0 || level > volume.mipCount ) return volume;
+	const uint32_t round = ( 1u << level ) - 1;
+	VolumeView view = { volume.mipVoxels[level - 1], ( volume.width + round ) >> level, ( volume.height + round ) >> level,
+						( volume.depth + round ) >> level, VOLUME_LAYOUT_LINEAR, nullptr, nullptr, nullptr, 0 };
+	return view;
+}
+
+const char* GetCompositingName( RaymarchCompositing compositing )
+{
+	static const char* names[CompositeCount] = { "additive", "front to back" };
+	return compositing < CompositeCount ? names[compositing] : "unknown";
+}
+
+RaymarchParams RaymarchParams::Default()
+{
+	RaymarchParams params;
+	params.stepSize = 5.f;
+	params.density = 0.01f;
+	params.skipUniformBricks = true;
+	params.compositing = CompositeAdditive;
+	params.opacity = 0.5f;
+	params.terminationOpacity = 0.99f;
+	params.lodScale = 0.f;
+	return params;
+}
+
+bool IntersectBox( const float origin[3], const float dir[3], const float boxMin[3], const float boxMax[3],
+				   float& tnear, float& tfar )
+{
+	tnear = -INFINITY;
+	tfar = INFINITY;
+	for ( int c = 0; c < 3; c++ )
+	{
+		float invR = 1.f / dir[c];
+		float tbot = invR * ( boxMin[c] - origin[c] );
+		float ttop = invR * ( boxMax[c] - origin[c] );
+		tnear = fmaxf( tnear, fminf( ttop, tbot ) );
+		tfar = fminf( tfar, fmaxf( ttop, tbot ) );
+	}
+	return tnear <= tfar;
+}
+
+uint32_t MarchRay( const VolumeView& volume, const RaymarchParams& params, const float origin[3], const float dir[3],
+				   float rgba[4], uint32_t* skipped )
+{
+	rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.f;
+	if ( skipped ) *skipped = 0;
+	float d[3], tnear, tfar;
+	if ( !SetupRay( volume, origin, dir, d, tnear, tfar ) ) return 0;
+
+	const uint32_t level = SelectLod( volume, params, tnear );
+	if ( level == 0 ) return MarchClipped( volume, params, origin, d, tnear, tfar, rgba, skipped );
+
+	// The same samples in the voxels of the level, t is unchanged
+	const float scale = 1.f / static_cast< float >( 1u << level );
+	const float o[3] = { origin[0] * scale, origin[1] * scale, origin[2] * scale };
+	const float ld[3] = { d[0] * scale, d[1] * scale, d[2] * scale };
+	return MarchClipped( GetMipView( volume, level ), params, o, ld, tnear, tfar, rgba, skipped );
+}
+
+bool IsRayPacketSupported()
+{
+#if VE_X86
+	return CpuFeatures::Get().avx2;
+#else
+	return false;
+#endif
+}
+
+void IntersectPacket( const VolumeView& volume, RayPacket& packet )
+{
+#if VE_X86
+	if ( IsRayPacketSupported() )
+	{
+		IntersectPacket_AVX2( volume, packet );
+		return;
+	}
+#endif
+	packet.hitMask = 0;
+	for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+	{
+		const float dir[3] = { packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] };
+		float d[3];
+		if ( SetupRay( volume, packet.origin, dir, d, packet.tnear[i], packet.tfar[i] ) ) packet.hitMask |= 1u << i;
+		for ( int c = 0; c < 3; c++ ) packet.dir[c][i] = d[c];
+	}
+}
+
+void MarchPacket( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+				  uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] )
+{
+#if VE_X86
+	// All rays have to be on one mip level, the packet is then marched on that level
+	uint32_t level = ~0u;
+	bool sameLevel = true;
+	for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+	{
+		if ( !( packet.hitMask & ( 1u << i ) ) ) continue;
+		uint32_t rayLevel = SelectLod( volume, params, packet.tnear[i] );
+		sameLevel = sameLevel && ( level == ~0u || rayLevel == level );
+		level = rayLevel;
+	}
+	if ( level == ~0u ) level = 0;
+	if ( IsRayPacketSupported() && sameLevel )
+	{
+		if ( level == 0 )
+		{
+			MarchPacket_AVX2( volume, params, packet, rgba, samples, skipped );
+			return;
+		}
+		const float scale = 1.f / static_cast< float >( 1u << level );
+		RayPacket scaled = packet;
+		for ( int c = 0; c < 3; c++ )
+		{
+			scaled.origin[c] *= scale;
+			for ( uint32_t i = 0; i < RayPacket::Size; i++ ) scaled.dir[c][i] *= scale;
+		}
+		MarchPacket_AVX2( GetMipView( volume, level ), params, scaled, rgba, samples, skipped );
+		return;
+	}
+#endif
+	for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+	{
+		const float dir[3] = { packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] };
+		if ( packet.hitMask & ( 1u << i ) )
+			samples[i] = MarchRay( volume, params, packet.origin, dir, rgba + i * 4, &skipped[i] );
+		else
+		{
+			samples[i] = skipped[i] = 0;
+			rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = rgba[i * 4 + 3] = 0.f;
+		}
+	}
+}
+
+uint32_t TraceRay( const VolumeView& volume, const RaymarchParams& params, const float origin[3], const float dir[3],
+				   uint32_t* indices, uint32_t maxCount )
+{
+	float d[3], tnear, tfar;
+	if ( !SetupRay( volume, origin, dir, d, tnear, tfar ) ) return 0;
+
+#if VE_X86
+	if ( volume.layout == VOLUME_LAYOUT_MORTON && UseMortonBMI2() )
+	{
+		uint32_t count;
+		MarchMortonTrace_BMI2( volume, params, origin, d, tnear, tfar, indices, maxCount, count );
+		return count;
+	}
+#endif
+	TraceSink sink( indices, maxCount );
+	uint32_t skipped;
+	MarchLayout( volume, params, origin, d, tnear, tfar, sink, skipped );
+	return sink.count;
+}
+
+void CameraRay( const float eye[3], const float target[3], float fovY, uint32_t width, uint32_t height, uint32_t i,
+				uint32_t j, float dir[3] )
+{
+	// Camera basis, y up
+	float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	float len = sqrtf( f[0] * f[0] + f[1] * f[1] + f[2] * f[2] );
+	for ( int c = 0; c < 3; c++ ) f[c] /= len;
+	float r[3] = { f[2], 0.f, -f[0] };
+	len = sqrtf( r[0] * r[0] + r[2] * r[2] );
+	for ( int c = 0; c < 3; c++ ) r[c] = len > 0.f ? r[c] / len : ( c == 0 ? 1.f : 0.f );
+	const float u[3] = { f[1] * r[2] - f[2] * r[1], f[2] * r[0] - f[0] * r[2], f[0] * r[1] - f[1] * r[0] };
+
+	const float tanHalf = tanf( fovY * 0.5f );
+	const float aspect = static_cast< float >( width ) / height;
+	float px = ( ( i + 0.5f ) / width * 2.f - 1.f ) * tanHalf * aspect;
+	float py = ( 1.f - ( j + 0.5f ) / height * 2.f ) * tanHalf;
+	for ( int c = 0; c < 3; c++ ) dir[c] = f[c] + px * r[c] + py * u[c];
+	len = sqrtf( dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2] );
+	for ( int c = 0; c < 3; c++ ) dir[c] /= len;
+}
+
+uint64_t RaymarchImage( const VolumeView& volume, const RaymarchParams& params, const float eye[3], const float target[3],
+						float fovY, uint32_t width, uint32_t height, float* rgba )
+{
+	uint64_t samples = 0;
+	for ( uint32_t j = 0; j < height; j++ )
+		for ( uint32_t i = 0; i < width; i++ )
+		{
+			float d[3];
+			CameraRay( eye, target, fovY, width, height, i, j, d );
+			samples += MarchRay( volume, params, eye, d, rgba + ( static_cast< size_t >( j ) * width + i ) * 4 );
+		}
+	return samples;
+}
@@ -0,0 +1,127 @@
+#pragma once
+// psmain on the CPU. A ray is clipped against the volume box and the voxels at
+// fixed steps along it are accumulated as value / 256 * density, exactly like
+// VolumetricAnimation_shader.hlsl, or composited front to back. The box is centred
+// at the origin with one world unit per voxel, the cube VolumetricAnimation draws.
+
+#include "VolumeLayout.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Read only view of a volume buffer in one of the VolumeLayout.h layouts
+struct VolumeView
+{
+	const uint32_t* voxels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t layout;
+	// Optional value ranges, two words per VolumeBrickIndex() and per
+	// VolumeCellIndex(): the channel wise minimum and maximum packed like a voxel.
+	// nullptr disables skipping.
+	const uint32_t* brickRange;
+	const uint32_t* cellRange;
+	// Optional mip chain, mipCount levels of half the size each in the linear
+	// layout, see VolumeMipChain. RaymarchParams::lodScale picks one per ray.
+	const uint32_t* const* mipVoxels;
+	uint32_t mipCount;
+};
+
+// Level level of the volume's mip chain as a view of its own, in voxels of 2^level
+// volume voxels. Level 0 is the volume.
+VolumeView GetMipView( const VolumeView& volume, uint32_t level );
+
+// How samples are combined along a ray, the COMPOSITING values of the shader
+enum RaymarchCompositing
+{
+	// rgba += value / 256 * density at every sample, psmain's original sum
+	CompositeAdditive,
+	// Emission and absorption: a sample of colour c = value.rgb / 256 has opacity
+	// a = min( opacity * max( c.r, c.g, c.b ), 1 ) and adds ( 1 - rgba.a ) * a * c to
+	// rgba.rgb and ( 1 - rgba.a ) * a to rgba.a. The ray stops once rgba.a reaches
+	// terminationOpacity.
+	CompositeFrontToBack,
+	CompositeCount
+};
+
+const char* GetCompositingName( RaymarchCompositing compositing );
+
+struct RaymarchParams
+{
+	// tSmallStep in world units
+	float stepSize;
+	float density;
+	// Jump over cells and bricks whose range is a single value, taking all the
+	// samples the ray has in a run of them at once. Bricks are only jumped with steps
+	// of at most half a brick, and never by ray packets.
+	bool skipUniformBricks;
+	RaymarchCompositing compositing;
+	// CompositeFrontToBack only: opacity of a sample whose brightest channel is 1,
+	// and the accumulated opacity at which a ray ends. 1 never ends a ray early.
+	float opacity;
+	float terminationOpacity;
+	// Size in voxels of one pixel at distance 1 from the eye, RaymarchCamera::
+	// GetPixelScale(). A ray marches the coarsest mip level whose voxels are no
+	// larger than its pixel where it enters the box, at the same steps. 0 always
+	// marches the volume itself.
+	float lodScale;
+
+	// The constants used by psmain
+	static RaymarchParams Default();
+};
+
+// Slab test against the box centred at the origin, same as IntersectBox in the shader
+bool IntersectBox( const float origin[3], const float dir[3], const float boxMin[3], const float boxMax[3],
+				   float& tnear, float& tfar );
+
+// Accumulated color along one ray, zero when it misses the box. dir has to be
+// normalized. Samples falling outside the volume read zero, like out of bounds
+// buffer reads on the GPU. Returns the number of samples taken, skipped (if not
+// null) receives how many of them were accounted for by uniform brick jumps.
+uint32_t MarchRay( const VolumeView& volume, const RaymarchParams& params, const float origin[3], const float dir[3],
+				   float rgba[4], uint32_t* skipped = nullptr );
+
+// RayPacket::Size rays from one origin, marched together with SIMD
+struct RayPacket
+{
+	static const uint32_t Size = 8;
+	float origin[3];
+	// Normalized directions, one array per component
+	float dir[3][Size];
+	// Set by IntersectPacket
+	float tnear[Size];
+	float tfar[Size];
+	// Bit i is set when ray i hits the box
+	uint32_t hitMask;
+};
+
+// True when IntersectPacket and MarchPacket have a SIMD path on this CPU (AVX2),
+// otherwise they loop over the rays one by one
+bool IsRayPacketSupported();
+
+// IntersectBox for every ray of the packet. Zero direction components get the
+// psmain nudge in place, so dir is what the rays are marched along afterwards.
+void IntersectPacket( const VolumeView& volume, RayPacket& packet );
+
+// MarchRay for the rays in hitMask, all of them at once. Rays on different mip levels
+// are marched one by one. rgba receives Size pixels
+// of 4 floats (zero for rays not in hitMask), samples and skipped the counts of each
+// ray. Results are identical to MarchRay ray by ray.
+void MarchPacket( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+				  uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] );
+
+// Storage indices of the voxels MarchRay reads along the ray, in order, for cache
+// studies. Writes at most maxCount and returns the number written.
+uint32_t TraceRay( const VolumeView& volume, const RaymarchParams& params, const float origin[3], const float dir[3],
+				   uint32_t* indices, uint32_t maxCount );
+
+// Normalized direction through the centre of pixel (i, j) of a pinhole camera at eye
+// looking at target, y up, vertical field of view fovY (radians)
+void CameraRay( const float eye[3], const float target[3], float fovY, uint32_t width, uint32_t height, uint32_t i,
+				uint32_t j, float dir[3] );
+
+// Image of the CameraRay camera, rgba receives width * height pixels of 4 floats,
+// rows top to bottom. Single threaded. Returns the number of samples taken.
+uint64_t RaymarchImage( const VolumeView& volume, const RaymarchParams& params, const float eye[3], const float target[3],
+						float fovY, uint32_t width, uint32_t height, float* rgba );
@@ -0,0 +1,305 @@
+// Sample loop of MarchRay, included by VolumeRaymarch.cpp and VolumeRaymarchBMI2.cpp.
+// The includer defines VE_MARCH_TARGET, the target attribute every function below
+// is compiled with, so the BMI2 unit gets pdep inlined into the loop.
+
+#include "CpuFeatures.h"
+#include "VolumeRaymarch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Voxel address for one layout, resolved at compile time in the sample loop
+	template<uint32_t Layout>
+	struct VoxelAddress
+	{
+		explicit VoxelAddress( const VolumeView& volume ) :
+			width( volume.width ), height( volume.height ),
+			bricksX( VolumeBrickCount( volume.width ) ), bricksY( VolumeBrickCount( volume.height ) ) {}
+
+		VE_MARCH_TARGET uint32_t operator()( uint32_t x, uint32_t y, uint32_t z ) const
+		{
+			if ( Layout == VOLUME_LAYOUT_BRICKED ) return BrickedVoxelIndex( x, y, z, bricksX, bricksY );
+			if ( Layout == VOLUME_LAYOUT_MORTON ) return MortonVoxelIndex( x, y, z );
+			return LinearVoxelIndex( x, y, z, width, height );
+		}
+
+		uint32_t width, height, bricksX, bricksY;
+	};
+
+	// Step counts are small, so floor and ceil go through int conversion after
+	// clamping, which also keeps the huge quotients of nudged axes in range. The
+	// skipping helpers use std::min and std::max, fminf and fmaxf are library calls
+	// without fast math.
+	VE_MARCH_TARGET inline float StepFloor( float x )
+	{
+		return static_cast< float >( static_cast< int >( std::min( 16777216.f, std::max( -1.f, x ) ) ) );
+	}
+
+	VE_MARCH_TARGET inline float StepCeil( float x )
+	{
+		float i = StepFloor( x );
+		return i < x ? i + 1.f : i;
+	}
+
+	// A sink gets every in bounds sample with the number of samples it stands for and
+	// returns how many of them it used, fewer only once it needs no more (Done).
+
+	// Sums the channels of the sampled voxels, count times each
+	struct AccumulateSink
+	{
+		AccumulateSink( const uint32_t* voxels ) : voxels( voxels ), sum() {}
+
+		VE_MARCH_TARGET uint32_t operator()( uint32_t index, uint32_t count )
+		{
+			uint32_t v = voxels[index];
+			sum[0] += ( v & 0xff ) * count;
+			sum[1] += ( ( v >> 8 ) & 0xff ) * count;
+			sum[2] += ( ( v >> 16 ) & 0xff ) * count;
+			sum[3] += ( v >> 24 ) * count;
+			return count;
+		}
+
+		bool Done() const { return false; }
+
+		const uint32_t* voxels;
+		uint32_t sum[4];
+	};
+
+	// Longest run CompositeWeight blends sample by sample
+	const uint32_t CompositeLoopSamples = 16;
+
+	// Weight ( 1 - alpha ) * a of one CompositeFrontToBack sample of opacity a, or the
+	// total weight of count equal samples, which leave ( 1 - alpha ) * ( 1 - a )^count
+	// transparent. Such a run is cut at the sample that reaches termination, count
+	// receives the samples used. Short runs are blended sample by sample, which costs
+	// less than the logf and powf of the closed form. VolumeRaymarchAVX2.cpp calls this
+	// for its runs.
+	VE_MARCH_TARGET inline float CompositeWeight( float a, float alpha, float termination, uint32_t& count )
+	{
+		const float transparency = 1.f - alpha;
+		if ( a <= 0.f ) return 0.f;
+		if ( count == 1 ) return transparency * a;
+		const float keep = 1.f - a;
+		if ( count <= CompositeLoopSamples )
+		{
+			float left = transparency;
+			uint32_t n = 0;
+			do
+			{
+				left *= keep;
+				n++;
+			}
+			while ( n < count && left > 1.f - termination );
+			count = n;
+			return transparency - left;
+		}
+		float n = static_cast< float >( count );
+		n = fminf( n, fmaxf( StepCeil( logf( ( 1.f - termination ) / transparency ) / logf( keep ) ), 1.f ) );
+		count = static_cast< uint32_t >( n );
+		return transparency * ( 1.f - powf( keep, n ) );
+	}
+
+	// Blends the sampled voxels front to back, see CompositeFrontToBack
+	struct CompositeSink
+	{
+		CompositeSink( const uint32_t* voxels, const RaymarchParams& params ) :
+			voxels( voxels ), opacity( params.opacity ), termination( fminf( params.terminationOpacity, 1.f ) ), rgba() {}
+
+		// Colour and opacity of voxel index
+		VE_MARCH_TARGET float Sample( uint32_t index, float c[3] ) const
+		{
+			uint32_t v = voxels[index];
+			c[0] = ( v & 0xff ) * ( 1.f / 256.f );
+			c[1] = ( ( v >> 8 ) & 0xff ) * ( 1.f / 256.f );
+			c[2] = ( ( v >> 16 ) & 0xff ) * ( 1.f / 256.f );
+			return fminf( opacity * fmaxf( fmaxf( c[0], c[1] ), c[2] ), 1.f );
+		}
+
+		VE_MARCH_TARGET uint32_t operator()( uint32_t index, uint32_t count )
+		{
+			float c[3];
+			const float a = Sample( index, c );
+			const float w = CompositeWeight( a, rgba[3], termination, count );
+			for ( int i = 0; i < 3; i++ ) rgba[i] += w * c[i];
+			rgba[3] += w;
+			return count;
+		}
+
+		bool Done() const { return !( rgba[3] < termination ); }
+
+		const uint32_t* voxels;
+		float opacity;
+		float termination;
+		float rgba[4];
+	};
+
+	// Records the sampled storage indices, a uniform brick jump reads one voxel
+	struct TraceSink
+	{
+		TraceSink( uint32_t* indices, uint32_t maxCount ) : indices( indices ), maxCount( maxCount ), count( 0 ) {}
+
+		VE_MARCH_TARGET uint32_t operator()( uint32_t index, uint32_t samples )
+		{
+			if ( count < maxCount ) indices[count++] = index;
+			return samples;
+		}
+
+		bool Done() const { return false; }
+
+		uint32_t* indices;
+		uint32_t maxCount;
+		uint32_t count;
+	};
+
+	// Samples, the current one included, a ray at voxel space position p takes inside
+	// the block of edge voxels holding voxel (x, y, z) when advancing by 1 / invS per
+	// sample: along each axis the distance to the exit face in steps, with the int3
+	// truncation rule deciding whether a sample exactly on the lower face is inside.
+	// Capped by the samples left before tfar. Truncating negative quotients instead
+	// of flooring them only changes counts below one, which end up as one either way.
+	VE_MARCH_TARGET inline float BlockSteps( const VolumeView& volume, const float p[3], const float invS[3], int x,
+											 int y, int z, int edge, float t, float tfar, float invStepSize )
+	{
+		const int idx[3] = { x, y, z };
+		const float size[3] = { static_cast< float >( volume.width ), static_cast< float >( volume.height ),
+								static_cast< float >( volume.depth ) };
+		float n = StepFloor( ( tfar - t ) * invStepSize ) + 1.f;
+		for ( int c = 0; c < 3; c++ )
+		{
+			float lo = static_cast< float >( idx[c] & -edge );
+			float hi = std::min( lo + static_cast< float >( edge ), size[c] );
+			float k = invS[c] > 0.f ? StepCeil( ( hi - p[c] ) * invS[c] ) : StepFloor( ( lo - p[c] ) * invS[c] ) + 1.f;
+			n = std::min( n, k );
+		}
+		return std::max( n, 1.f );
+	}
+
+	// Cell or brick ranges, shift 5 for cells and 3 for bricks
+	struct RangeGrid
+	{
+		RangeGrid( const uint32_t* range, uint32_t countX, uint32_t countY, int shift ) :
+			range( range ), countX( countX ), countY( countY ), shift( shift ) {}
+
+		// Whether the block holding voxel (x, y, z) holds one value, value receives it
+		VE_MARCH_TARGET bool Uniform( int x, int y, int z, uint32_t& value ) const
+		{
+			// VolumeBrickIndex / VolumeCellIndex
+			const uint32_t* r = range + ( ( x >> shift ) + ( ( y >> shift ) + ( z >> shift ) * countY ) * countX ) * 2;
+			value = r[0];
+			return r[0] == r[1];
+		}
+
+		VE_MARCH_TARGET bool Holds( int x, int y, int z, uint32_t value ) const
+		{
+			uint32_t v;
+			return Uniform( x, y, z, v ) && v == value;
+		}
+
+		const uint32_t* range;
+		uint32_t countX, countY;
+		int shift;
+	};
+
+	// A block the ray crosses in less than two steps costs more to jump than to
+	// sample, so with steps over half a brick only cells are jumped
+	VE_MARCH_TARGET inline bool JumpCellsOnly( float stepSize )
+	{
+		return stepSize * 2.f > VOLUME_BRICK_SIZE;
+	}
+
+	// Samples a ray at p, inside a block of first holding value only, takes before it
+	// leaves the run of blocks holding that value only. first is the brick grid or,
+	// see JumpCellsOnly, the cell grid; a cell is only read once its brick holds value
+	// only. Every block of the run is crossed analytically with BlockSteps.
+	// VolumeRaymarchAVX2.cpp and psmain repeat these operations.
+	VE_MARCH_TARGET inline float UniformRunSteps( const VolumeView& volume, const RangeGrid& first,
+												  const RangeGrid& cells, uint32_t value, const float p[3],
+												  const float s[3], const float invS[3], int x, int y, int z, float t,
+												  float tfar, float stepSize, float invStepSize )
+	{
+		const bool cellsOnly = first.range == cells.range;
+		float steps = 0.f;
+		float q[3] = { p[0], p[1], p[2] };
+		for ( ;; )
+		{
+			const int edge = cellsOnly || cells.Holds( x, y, z, value ) ? VOLUME_CELL_SIZE : VOLUME_BRICK_SIZE;
+			steps += BlockSteps( volume, q, invS, x, y, z, edge, t + stepSize * steps, tfar, invStepSize );
+			if ( t + stepSize * steps > tfar ) break;
+			for ( int c = 0; c < 3; c++ ) q[c] = p[c] + s[c] * steps;
+			x = static_cast< int >( q[0] );
+			y = static_cast< int >( q[1] );
+			z = static_cast< int >( q[2] );
+			if ( static_cast< uint32_t >( x ) >= volume.width || static_cast< uint32_t >( y ) >= volume.height ||
+				 static_cast< uint32_t >( z ) >= volume.depth || !first.Holds( x, y, z, value ) )
+				break;
+		}
+		return steps;
+	}
+
+	// Steps from tnear to tfar, or until the sink is done, and hands every in bounds
+	// sample to sink with the number of samples it stands for, returns the number of
+	// steps taken. Without skipping that is one per sample and the float operations
+	// are those of psmain.
+	template<class Address, class Sink>
+	VE_MARCH_TARGET uint32_t March( const VolumeView& volume, const Address& address, const RaymarchParams& params,
+									const float o[3], const float d[3], float tnear, float tfar, Sink& sink,
+									uint32_t& skipped )
+	{
+		const float half[3] = { volume.width * 0.5f, volume.height * 0.5f, volume.depth * 0.5f };
+		float P[3] = { o[0] + d[0] * tnear, o[1] + d[1] * tnear, o[2] + d[2] * tnear };
+		const float step[3] = { d[0] * params.stepSize, d[1] * params.stepSize, d[2] * params.stepSize };
+		const bool skip = params.skipUniformBricks && volume.brickRange && volume.cellRange;
+		const float invStep[3] = { 1.f / step[0], 1.f / step[1], 1.f / step[2] };
+		const float invStepSize = 1.f / params.stepSize;
+		const RangeGrid bricks( volume.brickRange, VolumeBrickCount( volume.width ), VolumeBrickCount( volume.height ), 3 );
+		const RangeGrid cells( volume.cellRange, VolumeCellCount( volume.width ), VolumeCellCount( volume.height ), 5 );
+		const RangeGrid& first = JumpCellsOnly( params.stepSize ) ? cells : bricks;
+
+		uint32_t samples = 0;
+		skipped = 0;
+		for ( float t = tnear; t <= tfar && !sink.Done(); )
+		{
+			// int3 conversion truncates towards zero
+			const float p[3] = { P[0] + half[0], P[1] + half[1], P[2] + half[2] };
+			int x = static_cast< int >( p[0] );
+			int y = static_cast< int >( p[1] );
+			int z = static_cast< int >( p[2] );
+			float steps = 1.f;
+			if ( static_cast< uint32_t >( x ) < volume.width && static_cast< uint32_t >( y ) < volume.height &&
+				 static_cast< uint32_t >( z ) < volume.depth )
+			{
+				uint32_t value;
+				if ( skip && first.Uniform( x, y, z, value ) )
+					steps = UniformRunSteps( volume, first, cells, value, p, step, invStep, x, y, z, t, tfar, params.stepSize,
+											 invStepSize );
+				steps = static_cast< float >( sink( address( x, y, z ), static_cast< uint32_t >( steps ) ) );
+			}
+			P[0] += step[0] * steps;
+			P[1] += step[1] * steps;
+			P[2] += step[2] * steps;
+			t += params.stepSize * steps;
+			samples += static_cast< uint32_t >( steps );
+			skipped += static_cast< uint32_t >( steps ) - 1;
+		}
+		return samples;
+	}
+}
+
+#if VE_X86
+// Morton layout with pdep addressing, in VolumeRaymarchBMI2.cpp. Same as March with
+// an AccumulateSink (sum), a CompositeSink (rgba) or a TraceSink (indices, count).
+uint32_t MarchMortonAccumulate_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+									 const float d[3], float tnear, float tfar, uint32_t sum[4], uint32_t& skipped );
+uint32_t MarchMortonComposite_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+									const float d[3], float tnear, float tfar, float rgba[4], uint32_t& skipped );
+uint32_t MarchMortonTrace_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+								const float d[3], float tnear, float tfar, uint32_t* indices, uint32_t maxCount,
+								uint32_t& count );
+
+// RayPacket with 8 lane AVX2, in VolumeRaymarchAVX2.cpp
+void IntersectPacket_AVX2( const VolumeView& volume, RayPacket& packet );
+void MarchPacket_AVX2( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+					   uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] );
+#endif
@@ -0,0 +1,339 @@
+#include "CpuFeatures.h"
+
+#if VE_X86
+#include <immintrin.h>
+
+#define VE_MARCH_TARGET VE_TARGET( "avx2" )
+#include "VolumeRaymarch.inl"
+
+#include <cmath>
+
+namespace
+{
+	// VoxelAddress for 8 lanes
+	template<uint32_t Layout>
+	struct VoxelAddress8
+	{
+		VE_TARGET( "avx2" ) explicit VoxelAddress8( const VolumeView& volume ) :
+			width( _mm256_set1_epi32( static_cast< int >( volume.width ) ) ),
+			slice( _mm256_set1_epi32( static_cast< int >( volume.width * volume.height ) ) ),
+			bricksX( _mm256_set1_epi32( static_cast< int >( VolumeBrickCount( volume.width ) ) ) ),
+			brickSlice( _mm256_set1_epi32( static_cast< int >( VolumeBrickCount( volume.width ) * VolumeBrickCount( volume.height ) ) ) ) {}
+
+		VE_TARGET( "avx2" ) static __m256i Spread3( __m256i v )
+		{
+			v = _mm256_and_si256( v, _mm256_set1_epi32( 0x3ff ) );
+			v = _mm256_and_si256( _mm256_or_si256( v, _mm256_slli_epi32( v, 16 ) ), _mm256_set1_epi32( 0x030000ff ) );
+			v = _mm256_and_si256( _mm256_or_si256( v, _mm256_slli_epi32( v, 8 ) ), _mm256_set1_epi32( 0x0300f00f ) );
+			v = _mm256_and_si256( _mm256_or_si256( v, _mm256_slli_epi32( v, 4 ) ), _mm256_set1_epi32( 0x030c30c3 ) );
+			v = _mm256_and_si256( _mm256_or_si256( v, _mm256_slli_epi32( v, 2 ) ), _mm256_set1_epi32( 0x09249249 ) );
+			return v;
+		}
+
+		VE_TARGET( "avx2" ) __m256i operator()( __m256i x, __m256i y, __m256i z ) const
+		{
+			if ( Layout == VOLUME_LAYOUT_BRICKED )
+			{
+				// Same as BrickedVoxelIndex, the brick index is expanded so the
+				// products wrap the same way
+				const __m256i seven = _mm256_set1_epi32( 7 );
+				__m256i brick = _mm256_add_epi32( _mm256_srli_epi32( x, 3 ),
+												  _mm256_add_epi32( _mm256_mullo_epi32( _mm256_srli_epi32( y, 3 ), bricksX ),
+																	_mm256_mullo_epi32( _mm256_srli_epi32( z, 3 ), brickSlice ) ) );
+				__m256i inner = _mm256_or_si256( _mm256_and_si256( x, seven ),
+												 _mm256_or_si256( _mm256_slli_epi32( _mm256_and_si256( y, seven ), 3 ),
+																  _mm256_slli_epi32( _mm256_and_si256( z, seven ), 6 ) ) );
+				return _mm256_add_epi32( _mm256_slli_epi32( brick, 9 ), inner );
+			}
+			if ( Layout == VOLUME_LAYOUT_MORTON )
+				return _mm256_or_si256( Spread3( x ), _mm256_or_si256( _mm256_slli_epi32( Spread3( y ), 1 ),
+																	   _mm256_slli_epi32( Spread3( z ), 2 ) ) );
+			return _mm256_add_epi32( x, _mm256_add_epi32( _mm256_mullo_epi32( y, width ), _mm256_mullo_epi32( z, slice ) ) );
+		}
+
+		__m256i width, slice, bricksX, brickSlice;
+	};
+
+	// Cell or brick ranges of the lanes' voxels, shift 5 for cells and 3 for bricks
+	struct RangeGrid8
+	{
+		VE_TARGET( "avx2" ) RangeGrid8( const uint32_t* range, uint32_t countX, uint32_t countY, int shift ) :
+			range( reinterpret_cast< const int* >( range ) ), countX( _mm256_set1_epi32( static_cast< int >( countX ) ) ),
+			countY( _mm256_set1_epi32( static_cast< int >( countY ) ) ), shift( shift ) {}
+
+		// Lanes of mask whose range is one value, value receives the minimum
+		VE_TARGET( "avx2" ) __m256i Uniform( const __m256i idx[3], __m256i mask, __m256i& value ) const
+		{
+			// VolumeBrickIndex / VolumeCellIndex
+			__m256i index = _mm256_add_epi32( _mm256_srli_epi32( idx[0], shift ),
+											  _mm256_mullo_epi32( _mm256_add_epi32( _mm256_srli_epi32( idx[1], shift ),
+																					_mm256_mullo_epi32( _mm256_srli_epi32( idx[2], shift ), countY ) ),
+																  countX ) );
+			index = _mm256_add_epi32( index, index );
+			value = _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), range, index, mask, 4 );
+			__m256i hi = _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), range + 1, index, mask, 4 );
+			return _mm256_and_si256( mask, _mm256_cmpeq_epi32( value, hi ) );
+		}
+
+		const int* range;
+		__m256i countX, countY;
+		int shift;
+	};
+
+	// StepFloor and StepCeil of VolumeRaymarch.inl
+	VE_TARGET( "avx2" ) inline __m256 StepFloor8( __m256 x )
+	{
+		x = _mm256_min_ps( _mm256_max_ps( x, _mm256_set1_ps( -1.f ) ), _mm256_set1_ps( 16777216.f ) );
+		return _mm256_cvtepi32_ps( _mm256_cvttps_epi32( x ) );
+	}
+
+	VE_TARGET( "avx2" ) inline __m256 StepCeil8( __m256 x )
+	{
+		__m256 i = StepFloor8( x );
+		return _mm256_add_ps( i, _mm256_and_ps( _mm256_cmp_ps( i, x, _CMP_LT_OQ ), _mm256_set1_ps( 1.f ) ) );
+	}
+
+	// March with all 8 lanes in step, a lane drops out once its t passes tfar or, front
+	// to back, once it is opaque. Every lane does the float operations of March in the
+	// same order, so the results match as long as March only jumps cells too.
+	template<uint32_t Layout, RaymarchCompositing Compositing>
+	VE_TARGET( "avx2" )
+	void March8( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+				 uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] )
+	{
+		const VoxelAddress8<Layout> address( volume );
+		const int* voxels = reinterpret_cast< const int* >( volume.voxels );
+		const __m256 half[3] = { _mm256_set1_ps( volume.width * 0.5f ), _mm256_set1_ps( volume.height * 0.5f ),
+								 _mm256_set1_ps( volume.depth * 0.5f ) };
+		const __m256i size[3] = { _mm256_set1_epi32( static_cast< int >( volume.width ) ),
+								  _mm256_set1_epi32( static_cast< int >( volume.height ) ),
+								  _mm256_set1_epi32( static_cast< int >( volume.depth ) ) };
+		const __m256 sizeF[3] = { _mm256_set1_ps( static_cast< float >( volume.width ) ),
+								  _mm256_set1_ps( static_cast< float >( volume.height ) ),
+								  _mm256_set1_ps( static_cast< float >( volume.depth ) ) };
+		const __m256 stepSize = _mm256_set1_ps( params.stepSize );
+		const __m256 one = _mm256_set1_ps( 1.f );
+		const __m256 cellEdge = _mm256_set1_ps( static_cast< float >( VOLUME_CELL_SIZE ) );
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256i minusOne = _mm256_set1_epi32( -1 );
+		const __m256i byteMask = _mm256_set1_epi32( 0xff );
+		const __m256i cellMask = _mm256_set1_epi32( -VOLUME_CELL_SIZE );
+		const bool skip = params.skipUniformBricks && volume.brickRange && volume.cellRange;
+		const RangeGrid8 cells( volume.cellRange, VolumeCellCount( volume.width ), VolumeCellCount( volume.height ), 5 );
+
+		const __m256 tnear = _mm256_loadu_ps( packet.tnear );
+		const __m256 tfar = _mm256_loadu_ps( packet.tfar );
+		__m256 P[3], step[3];
+		for ( int c = 0; c < 3; c++ )
+		{
+			__m256 d = _mm256_loadu_ps( packet.dir[c] );
+			P[c] = _mm256_add_ps( _mm256_set1_ps( packet.origin[c] ), _mm256_mul_ps( d, tnear ) );
+			step[c] = _mm256_mul_ps( d, stepSize );
+		}
+		__m256 invStep[3];
+		for ( int c = 0; c < 3; c++ ) invStep[c] = _mm256_div_ps( one, step[c] );
+		const __m256 invStepSize = _mm256_set1_ps( 1.f / params.stepSize );
+
+		const __m256i laneBits = _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128 );
+		__m256i hit = _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( static_cast< int >( packet.hitMask ) ), laneBits ), laneBits );
+		__m256 t = tnear;
+		__m256i active = _mm256_and_si256( hit, _mm256_castps_si256( _mm256_cmp_ps( t, tfar, _CMP_LE_OQ ) ) );
+		__m256i count = _mm256_setzero_si256();
+		__m256i jumped = _mm256_setzero_si256();
+		__m256i sum[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+		// CompositeSink
+		const __m256 inv256 = _mm256_set1_ps( 1.f / 256.f );
+		const __m256 opacity = _mm256_set1_ps( params.opacity );
+		const float termination = fminf( params.terminationOpacity, 1.f );
+		__m256 color[4] = { zero, zero, zero, zero };
+
+		while ( !_mm256_testz_si256( active, active ) )
+		{
+			// int3 conversion truncates towards zero
+			__m256 p[3];
+			__m256i idx[3];
+			__m256i inside = active;
+			for ( int c = 0; c < 3; c++ )
+			{
+				p[c] = _mm256_add_ps( P[c], half[c] );
+				idx[c] = _mm256_cvttps_epi32( p[c] );
+				inside = _mm256_and_si256( inside, _mm256_and_si256( _mm256_cmpgt_epi32( idx[c], minusOne ),
+																	 _mm256_cmpgt_epi32( size[c], idx[c] ) ) );
+			}
+
+			// Lanes outside the volume read zero, like out of bounds buffer reads
+			__m256i v = _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), voxels, address( idx[0], idx[1], idx[2] ),
+													 inside, 4 );
+
+			// Lanes in a uniform cell take the UniformRunSteps samples at once. Packets
+			// only jump cells, as March does with JumpCellsOnly: two more gathers per
+			// sample for the brick ranges cost more than the bricks save.
+			__m256 steps = one;
+			if ( skip )
+			{
+				__m256i value;
+				const __m256i uniform = cells.Uniform( idx, inside, value );
+				if ( !_mm256_testz_si256( uniform, uniform ) )
+				{
+					__m256 run = zero;
+					__m256 q[3] = { p[0], p[1], p[2] };
+					__m256i qi[3] = { idx[0], idx[1], idx[2] };
+					__m256i extend = uniform;
+					while ( !_mm256_testz_si256( extend, extend ) )
+					{
+						// BlockSteps
+						__m256 at = _mm256_add_ps( t, _mm256_mul_ps( stepSize, run ) );
+						__m256 n = _mm256_add_ps( StepFloor8( _mm256_mul_ps( _mm256_sub_ps( tfar, at ), invStepSize ) ), one );
+						for ( int c = 0; c < 3; c++ )
+						{
+							__m256 faceLo = _mm256_cvtepi32_ps( _mm256_and_si256( qi[c], cellMask ) );
+							__m256 faceHi = _mm256_min_ps( _mm256_add_ps( faceLo, cellEdge ), sizeF[c] );
+							__m256 up = StepCeil8( _mm256_mul_ps( _mm256_sub_ps( faceHi, q[c] ), invStep[c] ) );
+							__m256 down = _mm256_add_ps( StepFloor8( _mm256_mul_ps( _mm256_sub_ps( faceLo, q[c] ), invStep[c] ) ), one );
+							n = _mm256_min_ps( n, _mm256_blendv_ps( down, up, _mm256_cmp_ps( invStep[c], zero, _CMP_GT_OQ ) ) );
+						}
+						run = _mm256_blendv_ps( run, _mm256_add_ps( run, _mm256_max_ps( n, one ) ), _mm256_castsi256_ps( extend ) );
+
+						at = _mm256_add_ps( t, _mm256_mul_ps( stepSize, run ) );
+						extend = _mm256_and_si256( extend, _mm256_castps_si256( _mm256_cmp_ps( at, tfar, _CMP_LE_OQ ) ) );
+						for ( int c = 0; c < 3; c++ )
+						{
+							q[c] = _mm256_add_ps( p[c], _mm256_mul_ps( step[c], run ) );
+							qi[c] = _mm256_cvttps_epi32( q[c] );
+							extend = _mm256_and_si256( extend, _mm256_and_si256( _mm256_cmpgt_epi32( qi[c], minusOne ),
+																				 _mm256_cmpgt_epi32( size[c], qi[c] ) ) );
+						}
+						__m256i cellValue;
+						const __m256i inCell = cells.Uniform( qi, extend, cellValue );
+						extend = _mm256_and_si256( inCell, _mm256_cmpeq_epi32( cellValue, value ) );
+					}
+					steps = _mm256_blendv_ps( one, run, _mm256_castsi256_ps( uniform ) );
+				}
+			}
+
+			if ( Compositing == CompositeFrontToBack )
+			{
+				// Lanes outside the volume read zero, so their weight is zero
+				__m256 c[3];
+				for ( int i = 0; i < 3; i++ )
+					c[i] = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( v, 8 * i ), byteMask ) ), inv256 );
+				const __m256 a = _mm256_min_ps( _mm256_mul_ps( opacity, _mm256_max_ps( _mm256_max_ps( c[0], c[1] ), c[2] ) ), one );
+				__m256 w = _mm256_mul_ps( _mm256_sub_ps( one, color[3] ), a );
+
+				// Runs are rare, their lanes go through CompositeWeight one by one
+				int runs = _mm256_movemask_ps( _mm256_and_ps( _mm256_cmp_ps( steps, one, _CMP_GT_OQ ), _mm256_castsi256_ps( active ) ) );
+				if ( runs )
+				{
+					float aLane[RayPacket::Size], alphaLane[RayPacket::Size], wLane[RayPacket::Size], stepsLane[RayPacket::Size];
+					_mm256_storeu_ps( aLane, a );
+					_mm256_storeu_ps( alphaLane, color[3] );
+					_mm256_storeu_ps( wLane, w );
+					_mm256_storeu_ps( stepsLane, steps );
+					for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+					{
+						if ( !( runs & ( 1 << i ) ) ) continue;
+						uint32_t n = static_cast< uint32_t >( stepsLane[i] );
+						wLane[i] = CompositeWeight( aLane[i], alphaLane[i], termination, n );
+						stepsLane[i] = static_cast< float >( n );
+					}
+					w = _mm256_loadu_ps( wLane );
+					steps = _mm256_loadu_ps( stepsLane );
+				}
+				w = _mm256_and_ps( w, _mm256_castsi256_ps( active ) );
+				for ( int i = 0; i < 3; i++ ) color[i] = _mm256_add_ps( color[i], _mm256_mul_ps( w, c[i] ) );
+				color[3] = _mm256_add_ps( color[3], w );
+			}
+
+			__m256i k = _mm256_cvttps_epi32( steps );
+			if ( Compositing == CompositeAdditive )
+			{
+				sum[0] = _mm256_add_epi32( sum[0], _mm256_mullo_epi32( _mm256_and_si256( v, byteMask ), k ) );
+				sum[1] = _mm256_add_epi32( sum[1], _mm256_mullo_epi32( _mm256_and_si256( _mm256_srli_epi32( v, 8 ), byteMask ), k ) );
+				sum[2] = _mm256_add_epi32( sum[2], _mm256_mullo_epi32( _mm256_and_si256( _mm256_srli_epi32( v, 16 ), byteMask ), k ) );
+				sum[3] = _mm256_add_epi32( sum[3], _mm256_mullo_epi32( _mm256_srli_epi32( v, 24 ), k ) );
+			}
+			count = _mm256_add_epi32( count, _mm256_and_si256( k, active ) );
+			jumped = _mm256_add_epi32( jumped, _mm256_and_si256( _mm256_add_epi32( k, minusOne ), active ) );
+
+			for ( int c = 0; c < 3; c++ ) P[c] = _mm256_add_ps( P[c], _mm256_mul_ps( step[c], steps ) );
+			t = _mm256_add_ps( t, _mm256_mul_ps( stepSize, steps ) );
+			active = _mm256_and_si256( active, _mm256_castps_si256( _mm256_cmp_ps( t, tfar, _CMP_LE_OQ ) ) );
+			if ( Compositing == CompositeFrontToBack )
+				active = _mm256_and_si256( active, _mm256_castps_si256( _mm256_cmp_ps( color[3], _mm256_set1_ps( termination ), _CMP_LT_OQ ) ) );
+		}
+
+		_mm256_storeu_si256( reinterpret_cast< __m256i* >( samples ), count );
+		_mm256_storeu_si256( reinterpret_cast< __m256i* >( skipped ), jumped );
+
+		if ( Compositing == CompositeFrontToBack )
+		{
+			float colors[4][RayPacket::Size];
+			for ( int c = 0; c < 4; c++ ) _mm256_storeu_ps( colors[c], color[c] );
+			for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+				for ( int c = 0; c < 4; c++ ) rgba[i * 4 + c] = colors[c][i];
+			return;
+		}
+
+		uint32_t sums[4][RayPacket::Size];
+		for ( int c = 0; c < 4; c++ ) _mm256_storeu_si256( reinterpret_cast< __m256i* >( sums[c] ), sum[c] );
+		const float scale = params.density / 256.f;
+		for ( uint32_t i = 0; i < RayPacket::Size; i++ )
+			for ( int c = 0; c < 4; c++ ) rgba[i * 4 + c] = sums[c][i] * scale;
+	}
+
+	template<RaymarchCompositing Compositing>
+	VE_TARGET( "avx2" )
+	void MarchLayout8( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+					   uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] )
+	{
+		switch ( volume.layout )
+		{
+		case VOLUME_LAYOUT_BRICKED:
+			March8<VOLUME_LAYOUT_BRICKED, Compositing>( volume, params, packet, rgba, samples, skipped );
+			break;
+		case VOLUME_LAYOUT_MORTON:
+			March8<VOLUME_LAYOUT_MORTON, Compositing>( volume, params, packet, rgba, samples, skipped );
+			break;
+		default:
+			March8<VOLUME_LAYOUT_LINEAR, Compositing>( volume, params, packet, rgba, samples, skipped );
+			break;
+		}
+	}
+}
+
+VE_TARGET( "avx2" )
+void IntersectPacket_AVX2( const VolumeView& volume, RayPacket& packet )
+{
+	const float half[3] = { volume.width * 0.5f, volume.height * 0.5f, volume.depth * 0.5f };
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps( 1.f );
+	__m256 tnear = _mm256_set1_ps( -INFINITY );
+	__m256 tfar = _mm256_set1_ps( INFINITY );
+	for ( int c = 0; c < 3; c++ )
+	{
+		// psmain nudges zero components so the slab test never divides by zero
+		__m256 d = _mm256_loadu_ps( packet.dir[c] );
+		d = _mm256_blendv_ps( d, _mm256_set1_ps( 1e-15f ), _mm256_cmp_ps( d, zero, _CMP_EQ_OQ ) );
+		_mm256_storeu_ps( packet.dir[c], d );
+
+		__m256 invR = _mm256_div_ps( one, d );
+		__m256 tbot = _mm256_mul_ps( invR, _mm256_set1_ps( -half[c] - packet.origin[c] ) );
+		__m256 ttop = _mm256_mul_ps( invR, _mm256_set1_ps( half[c] - packet.origin[c] ) );
+		tnear = _mm256_max_ps( tnear, _mm256_min_ps( ttop, tbot ) );
+		tfar = _mm256_min_ps( tfar, _mm256_max_ps( ttop, tbot ) );
+	}
+	_mm256_storeu_ps( packet.tnear, tnear );
+	_mm256_storeu_ps( packet.tfar, tfar );
+	packet.hitMask = static_cast< uint32_t >( _mm256_movemask_ps( _mm256_cmp_ps( tnear, tfar, _CMP_LE_OQ ) ) );
+}
+
+VE_TARGET( "avx2" )
+void MarchPacket_AVX2( const VolumeView& volume, const RaymarchParams& params, const RayPacket& packet, float* rgba,
+					   uint32_t samples[RayPacket::Size], uint32_t skipped[RayPacket::Size] )
+{
+	if ( params.compositing == CompositeFrontToBack )
+		MarchLayout8<CompositeFrontToBack>( volume, params, packet, rgba, samples, skipped );
+	else
+		MarchLayout8<CompositeAdditive>( volume, params, packet, rgba, samples, skipped );
+}
+#endif
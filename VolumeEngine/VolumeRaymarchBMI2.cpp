@@ -0,0 +1,52 @@
+#include "CpuFeatures.h"
+
+#if VE_X86
+#include <immintrin.h>
+
+#define VE_MARCH_TARGET VE_TARGET( "bmi2" )
+#include "VolumeRaymarch.inl"
+
+namespace
+{
+	// MortonVoxelIndex with one pdep per axis
+	struct MortonAddressBMI2
+	{
+		VE_MARCH_TARGET uint32_t operator()( uint32_t x, uint32_t y, uint32_t z ) const
+		{
+			return _pdep_u32( x, 0x09249249 ) | _pdep_u32( y, 0x12492492 ) | _pdep_u32( z, 0x24924924 );
+		}
+	};
+}
+
+VE_TARGET( "bmi2" )
+uint32_t MarchMortonAccumulate_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+									 const float d[3], float tnear, float tfar, uint32_t sum[4], uint32_t& skipped )
+{
+	AccumulateSink sink( volume.voxels );
+	uint32_t samples = March( volume, MortonAddressBMI2(), params, o, d, tnear, tfar, sink, skipped );
+	for ( int c = 0; c < 4; c++ ) sum[c] = sink.sum[c];
+	return samples;
+}
+
+VE_TARGET( "bmi2" )
+uint32_t MarchMortonComposite_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+									const float d[3], float tnear, float tfar, float rgba[4], uint32_t& skipped )
+{
+	CompositeSink sink( volume.voxels, params );
+	uint32_t samples = March( volume, MortonAddressBMI2(), params, o, d, tnear, tfar, sink, skipped );
+	for ( int c = 0; c < 4; c++ ) rgba[c] = sink.rgba[c];
+	return samples;
+}
+
+VE_TARGET( "bmi2" )
+uint32_t MarchMortonTrace_BMI2( const VolumeView& volume, const RaymarchParams& params, const float o[3],
+								const float d[3], float tnear, float tfar, uint32_t* indices, uint32_t maxCount,
+								uint32_t& count )
+{
+	TraceSink sink( indices, maxCount );
+	uint32_t skipped;
+	uint32_t samples = March( volume, MortonAddressBMI2(), params, o, d, tnear, tfar, sink, skipped );
+	count = sink.count;
+	return samples;
+}
+#endif
@@ -0,0 +1,303 @@
+#include "VolumeRecord.h"
+#include "TaskPool.h"
+#include "VolumeEngine.h"
+#include "VolumeSnapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+	const char Magic[8] = { 'V', 'O', 'L', 'R', 'E', 'C', 0, 0 };
+
+	// memset( 64 ) of the LoadAssets staging buffer, what padding voxels hold
+	const uint32_t Background = 0x40404040;
+
+	bool SeekFile( FILE* file, uint64_t offset )
+	{
+#ifdef _WIN32
+		return _fseeki64( file, static_cast< __int64 >( offset ), SEEK_SET ) == 0;
+#else
+		return fseeko( file, static_cast< off_t >( offset ), SEEK_SET ) == 0;
+#endif
+	}
+
+	FILE* OpenFile( const char* path, const char* mode )
+	{
+		FILE* file = nullptr;
+#ifdef _WIN32
+		fopen_s( &file, path, mode );
+#else
+		file = fopen( path, mode );
+#endif
+		return file;
+	}
+}
+
+VolumeRecorder::VolumeRecorder( const char* path, uint32_t width, uint32_t height, uint32_t depth,
+								uint32_t keyframeInterval, uint32_t threadCount ) :
+	m_file( nullptr ), m_header(), m_offset( 0 ), m_engineFrame( 0 ), m_engineRecorded( false ), m_stats(),
+	m_pool( new TaskPool( threadCount ) )
+{
+	static_assert( sizeof( VolumeRecordHeader ) == 48, "the header layout is the file format" );
+	static_assert( sizeof( VolumeRecordFrame ) == 16, "the index layout is the file format" );
+	memcpy( m_header.magic, Magic, sizeof( Magic ) );
+	m_header.version = VolumeRecordHeader::Version;
+	m_header.width = width;
+	m_header.height = height;
+	m_header.depth = depth;
+	m_header.brickCount = VolumeBrickCount( width ) * VolumeBrickCount( height ) * VolumeBrickCount( depth );
+	m_header.keyframeInterval = keyframeInterval ? keyframeInterval : 1;
+
+	m_file = OpenFile( path, "wb" );
+	// The header is written again by Close() with the frame count and index offset
+	if ( !m_file || !WriteBytes( &m_header, sizeof( m_header ) ) )
+	{
+		if ( m_file ) fclose( m_file );
+		m_file = nullptr;
+		return;
+	}
+	m_previous.resize( static_cast< size_t >( m_header.brickCount ) * VOLUME_BRICK_VOXELS );
+	const uint32_t batch = GetSnapshotBatchBricks( width, height );
+	m_encoded.resize( static_cast< size_t >( batch ) * SnapshotMaxBrickBytes );
+	m_sizes.resize( batch );
+}
+
+VolumeRecorder::~VolumeRecorder()
+{
+	Close();
+}
+
+bool VolumeRecorder::WriteBytes( const void* data, size_t size )
+{
+	if ( fwrite( data, 1, size, m_file ) != size ) return false;
+	m_offset += size;
+	return true;
+}
+
+bool VolumeRecorder::RecordFrame( const VolumeEngine& engine )
+{
+	const bool consecutive = m_engineRecorded && engine.GetFrameIndex() == m_engineFrame + 1;
+	m_engineFrame = engine.GetFrameIndex();
+	m_engineRecorded = true;
+	return RecordFrame( engine.GetView(), consecutive ? engine.GetBrickActiveFlags() : nullptr );
+}
+
+bool VolumeRecorder::RecordFrame( const VolumeView& volume, const uint8_t* changed )
+{
+	if ( !m_file || volume.width != m_header.width || volume.height != m_header.height ||
+		 volume.depth != m_header.depth )
+		return false;
+
+	VolumeRecordFrame frame;
+	frame.offset = m_offset;
+	frame.keyframe = m_index.size() % m_header.keyframeInterval == 0;
+	if ( frame.keyframe ) changed = nullptr;
+
+	std::vector<uint32_t> bricks;
+	std::vector<uint16_t> sizes;
+	const uint32_t batch = GetSnapshotBatchBricks( m_header.width, m_header.height );
+	bool ok = true;
+	for ( uint32_t first = 0; first < m_header.brickCount && ok; first += batch )
+	{
+		const uint32_t count = std::min( batch, m_header.brickCount - first );
+		m_pool->ParallelFor( count, 16, [&]( uint32_t begin, uint32_t end )
+		{
+			uint32_t voxels[VOLUME_BRICK_VOXELS];
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				const uint32_t brick = first + i;
+				m_sizes[i] = 0;
+				if ( changed && !changed[brick] ) continue;
+				GatherVolumeBrick( volume, brick, voxels );
+				uint32_t* previous = &m_previous[static_cast< size_t >( brick ) * VOLUME_BRICK_VOXELS];
+				if ( !frame.keyframe )
+				{
+					if ( memcmp( voxels, previous, sizeof( voxels ) ) == 0 ) continue;
+					// The XOR is zero wherever the brick did not change
+					for ( uint32_t v = 0; v < VOLUME_BRICK_VOXELS; v++ )
+					{
+						const uint32_t current = voxels[v];
+						voxels[v] ^= previous[v];
+						previous[v] = current;
+					}
+				}
+				else memcpy( previous, voxels, sizeof( voxels ) );
+				m_sizes[i] = static_cast< uint32_t >( EncodeSnapshotBrick( voxels, &m_encoded[i * SnapshotMaxBrickBytes] ) );
+			}
+		} );
+
+		for ( uint32_t i = 0; i < count && ok; i++ )
+		{
+			if ( !m_sizes[i] ) continue;
+			ok = WriteBytes( &m_encoded[i * SnapshotMaxBrickBytes], m_sizes[i] );
+			if ( !frame.keyframe ) bricks.push_back( first + i );
+			sizes.push_back( static_cast< uint16_t >( m_sizes[i] ) );
+		}
+	}
+	const uint32_t brickCount = static_cast< uint32_t >( sizes.size() );
+	ok = ok && WriteBytes( bricks.data(), bricks.size() * sizeof( uint32_t ) ) &&
+		WriteBytes( sizes.data(), sizes.size() * sizeof( uint16_t ) ) && WriteBytes( &brickCount, sizeof( brickCount ) );
+	if ( !ok ) return false;
+
+	frame.bytes = static_cast< uint32_t >( m_offset - frame.offset );
+	m_index.push_back( frame );
+	m_stats.frames++;
+	m_stats.rawBytes += static_cast< uint64_t >( volume.width ) * volume.height * volume.depth * sizeof( uint32_t );
+	if ( frame.keyframe )
+	{
+		m_stats.keyframes++;
+		m_stats.keyframeBytes += frame.bytes;
+	}
+	else
+	{
+		m_stats.deltaBytes += frame.bytes;
+		m_stats.deltaBricks += brickCount;
+	}
+	return true;
+}
+
+bool VolumeRecorder::Close()
+{
+	if ( !m_file ) return false;
+	m_header.frameCount = static_cast< uint32_t >( m_index.size() );
+	m_header.indexOffset = m_offset;
+	bool ok = WriteBytes( m_index.data(), m_index.size() * sizeof( VolumeRecordFrame ) ) && SeekFile( m_file, 0 ) &&
+		fwrite( &m_header, sizeof( m_header ), 1, m_file ) == 1;
+	ok = fclose( m_file ) == 0 && ok;
+	m_file = nullptr;
+	return ok;
+}
+
+VolumePlayer::VolumePlayer( const char* path, uint32_t threadCount ) :
+	m_file( nullptr ), m_header(), m_current( -1 ), m_pool( new TaskPool( threadCount ) )
+{
+	FILE* file = OpenFile( path, "rb" );
+	if ( !file ) return;
+	VolumeRecordHeader& h = m_header;
+	bool ok = fread( &h, sizeof( h ), 1, file ) == 1 && memcmp( h.magic, Magic, sizeof( Magic ) ) == 0 &&
+		h.version == VolumeRecordHeader::Version && VolumeSizeSupported( VOLUME_LAYOUT_BRICKED, h.width, h.height, h.depth ) &&
+		h.keyframeInterval &&
+		h.brickCount == VolumeBrickCount( h.width ) * VolumeBrickCount( h.height ) * VolumeBrickCount( h.depth );
+	if ( ok )
+	{
+		m_index.resize( h.frameCount );
+		ok = SeekFile( file, h.indexOffset ) &&
+			fread( m_index.data(), sizeof( VolumeRecordFrame ), m_index.size(), file ) == m_index.size() &&
+			( m_index.empty() || m_index[0].keyframe );
+		for ( uint32_t i = 0; i < h.frameCount && ok; i++ )
+			ok = m_index[i].offset + m_index[i].bytes <= h.indexOffset && m_index[i].bytes >= sizeof( uint32_t );
+	}
+	if ( !ok )
+	{
+		fclose( file );
+		m_index.clear();
+		return;
+	}
+	m_file = file;
+	m_voxels.assign( static_cast< size_t >( h.brickCount ) * VOLUME_BRICK_VOXELS, Background );
+}
+
+VolumePlayer::~VolumePlayer()
+{
+	if ( m_file ) fclose( m_file );
+}
+
+bool VolumePlayer::Seek( uint32_t frame )
+{
+	if ( !m_file || frame >= m_header.frameCount ) return false;
+	if ( m_current == frame ) return true;
+	uint32_t keyframe = frame;
+	while ( !m_index[keyframe].keyframe ) keyframe--;
+	// Carry on from the current frame unless a keyframe lies in between
+	uint32_t next = m_current >= 0 && m_current < frame && m_current >= keyframe ? static_cast< uint32_t >( m_current ) + 1 : keyframe;
+	for ( ; next <= frame; next++ )
+		if ( !ApplyFrame( next ) )
+		{
+			m_current = -1;
+			return false;
+		}
+	m_current = frame;
+	return true;
+}
+
+bool VolumePlayer::ApplyFrame( uint32_t frame )
+{
+	const VolumeRecordFrame& entry = m_index[frame];
+	m_block.resize( entry.bytes );
+	if ( !SeekFile( m_file, entry.offset ) || fread( m_block.data(), 1, m_block.size(), m_file ) != m_block.size() )
+		return false;
+
+	// The trailer: brick indices (delta frames only), sizes, count
+	uint32_t count;
+	memcpy( &count, &m_block[m_block.size() - sizeof( count )], sizeof( count ) );
+	const size_t trailer = sizeof( count ) + count * ( sizeof( uint16_t ) + ( entry.keyframe ? 0 : sizeof( uint32_t ) ) );
+	if ( count > m_header.brickCount || ( entry.keyframe && count != m_header.brickCount ) || trailer > m_block.size() )
+		return false;
+	const uint8_t* brickData = &m_block[m_block.size() - trailer];
+	const uint8_t* sizeData = brickData + ( entry.keyframe ? 0 : count * sizeof( uint32_t ) );
+
+	m_brickOffsets.resize( static_cast< size_t >( count ) + 1 );
+	m_brickOffsets[0] = 0;
+	for ( uint32_t i = 0; i < count; i++ )
+	{
+		uint16_t size;
+		memcpy( &size, sizeData + i * sizeof( size ), sizeof( size ) );
+		m_brickOffsets[i + 1] = m_brickOffsets[i] + size;
+	}
+	if ( m_brickOffsets[count] != m_block.size() - trailer ) return false;
+
+	std::atomic<bool> valid( true );
+	m_pool->ParallelFor( count, 16, [&]( uint32_t begin, uint32_t end )
+	{
+		uint32_t delta[VOLUME_BRICK_VOXELS];
+		for ( uint32_t i = begin; i < end; i++ )
+		{
+			uint32_t brick = i;
+			if ( !entry.keyframe ) memcpy( &brick, brickData + i * sizeof( brick ), sizeof( brick ) );
+			if ( brick >= m_header.brickCount )
+			{
+				valid = false;
+				continue;
+			}
+			uint32_t* voxels = &m_voxels[static_cast< size_t >( brick ) * VOLUME_BRICK_VOXELS];
+			const uint8_t* data = &m_block[static_cast< size_t >( m_brickOffsets[i] )];
+			const size_t size = static_cast< size_t >( m_brickOffsets[i + 1] - m_brickOffsets[i] );
+			if ( entry.keyframe )
+			{
+				if ( !DecodeSnapshotBrick( data, size, voxels ) ) valid = false;
+				continue;
+			}
+			if ( !DecodeSnapshotBrick( data, size, delta ) )
+			{
+				valid = false;
+				continue;
+			}
+			for ( uint32_t v = 0; v < VOLUME_BRICK_VOXELS; v++ ) voxels[v] ^= delta[v];
+		}
+	} );
+	return valid;
+}
+
+VolumeView VolumePlayer::GetView() const
+{
+	VolumeView view = { m_voxels.data(), m_header.width, m_header.height, m_header.depth, VOLUME_LAYOUT_BRICKED,
+						nullptr, nullptr, nullptr, 0 };
+	return view;
+}
+
+void VolumePlayer::CopyTo( uint32_t layout, uint32_t* dst ) const
+{
+	if ( layout == VOLUME_LAYOUT_BRICKED )
+	{
+		memcpy( dst, m_voxels.data(), m_voxels.size() * sizeof( uint32_t ) );
+		return;
+	}
+	m_pool->ParallelFor( m_header.brickCount, 16, [&]( uint32_t begin, uint32_t end )
+	{
+		for ( uint32_t brick = begin; brick < end; brick++ )
+			ScatterVolumeBrick( &m_voxels[static_cast< size_t >( brick ) * VOLUME_BRICK_VOXELS], brick, layout,
+								m_header.width, m_header.height, m_header.depth, dst );
+	} );
+}
@@ -0,0 +1,150 @@
+#pragma once
+// The animated volume over time. VolumeRecorder appends one frame per call: every
+// keyframeInterval frames a keyframe holding every brick, in between a delta frame
+// holding only the bricks that changed since the last frame, each stored as the
+// XOR with its previous state so the unchanged voxels in it are zero. Bricks are
+// compressed with the snapshot codec of VolumeSnapshot.h, in parallel.
+//
+// VolumePlayer decodes the frames into a volume in the bricked layout. Seeking goes
+// to the nearest keyframe at or before the target and applies the deltas after it,
+// or carries on from the current frame when that is closer. Every frame is one
+// read, its bricks decode in parallel.
+//
+// A frame is its encoded bricks, for a delta frame the indices of those bricks, the
+// 16 bit size of each and last the brick count. An index of every frame follows
+// them. Integers are little endian.
+
+#include "VolumeRaymarch.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+class TaskPool;
+class VolumeEngine;
+
+struct VolumeRecordHeader
+{
+	// "VOLREC" and two zeros
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t brickCount;
+	uint32_t keyframeInterval;
+	uint32_t frameCount;
+	uint32_t reserved;
+	uint64_t indexOffset;
+
+	static const uint32_t Version = 1;
+};
+
+struct VolumeRecordFrame
+{
+	uint64_t offset;
+	uint32_t bytes;
+	uint32_t keyframe;
+};
+
+struct VolumeRecordStats
+{
+	uint32_t frames;
+	uint32_t keyframes;
+	uint64_t keyframeBytes;
+	uint64_t deltaBytes;
+	// Bricks stored by the delta frames
+	uint64_t deltaBricks;
+	// Voxel bytes of all recorded frames
+	uint64_t rawBytes;
+};
+
+class VolumeRecorder
+{
+public:
+	// threadCount == 0 uses all hardware threads
+	VolumeRecorder( const char* path, uint32_t width, uint32_t height, uint32_t depth, uint32_t keyframeInterval = 30,
+					uint32_t threadCount = 0 );
+	// Close()s the file
+	~VolumeRecorder();
+
+	VolumeRecorder( VolumeRecorder const& ) = delete;
+	VolumeRecorder& operator=( VolumeRecorder const& ) = delete;
+
+	bool IsOpen() const { return m_file != nullptr; }
+	uint32_t GetFrameCount() const { return static_cast< uint32_t >( m_index.size() ); }
+	const VolumeRecordStats& GetStats() const { return m_stats; }
+
+	// Append volume, of the recorder's size in any layout, as the next frame.
+	// changed, if not null, has one flag per brick in VolumeBrickIndex() order and
+	// zero promises the brick is as in the last frame; delta frames then only look
+	// at the flagged bricks. False on I/O errors.
+	bool RecordFrame( const VolumeView& volume, const uint8_t* changed = nullptr );
+	// The hook for the animation: call after FillShellVolume() and after every
+	// Step(). After a step the engine's brick flags are the bricks it changed, they
+	// are used whenever the engine moved on by exactly one step since the last call.
+	bool RecordFrame( const VolumeEngine& engine );
+	// Write the frame index and the header, false on I/O errors
+	bool Close();
+
+private:
+	bool WriteBytes( const void* data, size_t size );
+
+	FILE* m_file;
+	VolumeRecordHeader m_header;
+	std::vector<VolumeRecordFrame> m_index;
+	uint64_t m_offset;
+	// The last recorded frame in the bricked layout, what deltas are taken against
+	std::vector<uint32_t> m_previous;
+	// Engine frame of the last RecordFrame( engine ), to tell whether its flags apply
+	uint64_t m_engineFrame;
+	bool m_engineRecorded;
+	VolumeRecordStats m_stats;
+	// Encoded bricks of a batch and their sizes, 0 for unchanged
+	std::vector<uint8_t> m_encoded;
+	std::vector<uint32_t> m_sizes;
+	std::unique_ptr<TaskPool> m_pool;
+};
+
+class VolumePlayer
+{
+public:
+	// Not open if the file is missing or not a complete recording
+	explicit VolumePlayer( const char* path, uint32_t threadCount = 0 );
+	~VolumePlayer();
+
+	VolumePlayer( VolumePlayer const& ) = delete;
+	VolumePlayer& operator=( VolumePlayer const& ) = delete;
+
+	bool IsOpen() const { return m_file != nullptr; }
+	const VolumeRecordHeader& GetHeader() const { return m_header; }
+	uint32_t GetFrameCount() const { return m_header.frameCount; }
+	const VolumeRecordFrame& GetFrame( uint32_t frame ) const { return m_index[frame]; }
+	// The frame in the volume, -1 before the first Seek
+	int64_t GetCurrentFrame() const { return m_current; }
+
+	// Decode frame into the volume, false if it is out of range or a read or
+	// decode fails; the volume is then undefined and the next Seek starts over
+	// from a keyframe
+	bool Seek( uint32_t frame );
+	// Seek to the next frame
+	bool NextFrame() { return Seek( static_cast< uint32_t >( m_current + 1 ) ); }
+
+	// The volume in VOLUME_LAYOUT_BRICKED, without brick ranges or mips
+	VolumeView GetView() const;
+	// Copy the volume out in layout, VolumeStorageCount( layout, ... ) voxels
+	void CopyTo( uint32_t layout, uint32_t* dst ) const;
+
+private:
+	bool ApplyFrame( uint32_t frame );
+
+	FILE* m_file;
+	VolumeRecordHeader m_header;
+	std::vector<VolumeRecordFrame> m_index;
+	int64_t m_current;
+	std::vector<uint32_t> m_voxels;
+	std::vector<uint8_t> m_block;
+	std::vector<uint64_t> m_brickOffsets;
+	std::unique_ptr<TaskPool> m_pool;
+};
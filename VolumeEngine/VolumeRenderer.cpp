@@ -0,0 +1,294 @@
+#include "VolumeRenderer.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace
+{
+	// General 4x4 inverse by cofactors, in double so the unprojected far plane point
+	// keeps full float precision. Returns false for a singular matrix.
+	bool InvertMatrix( const float m[16], double inv[16] )
+	{
+		double a[16];
+		for ( int i = 0; i < 16; i++ ) a[i] = m[i];
+
+		inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+		inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+		inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+		inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+		inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+		inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+		inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+		inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+		inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+		inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+		inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+		inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+		inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+		inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+		inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+		inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+		double det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+		if ( det == 0.0 ) return false;
+		for ( int i = 0; i < 16; i++ ) inv[i] /= det;
+		return true;
+	}
+
+	// Direction from the eye through the centre of pixel (x, y): the far plane point
+	// of the pixel unprojected with the row vector convention of the shader's mul
+	void PixelRay( const double inv[16], const float eye[3], uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+				   float dir[3] )
+	{
+		const double ndc[4] = { ( x + 0.5 ) / width * 2.0 - 1.0, 1.0 - ( y + 0.5 ) / height * 2.0, 1.0, 1.0 };
+		double p[4];
+		for ( int c = 0; c < 4; c++ )
+			p[c] = ndc[0] * inv[c] + ndc[1] * inv[4 + c] + ndc[2] * inv[8 + c] + ndc[3] * inv[12 + c];
+		double d[3] = { p[0] / p[3] - eye[0], p[1] / p[3] - eye[1], p[2] / p[3] - eye[2] };
+		double len = sqrt( d[0] * d[0] + d[1] * d[1] + d[2] * d[2] );
+		for ( int c = 0; c < 3; c++ ) dir[c] = static_cast< float >( d[c] / len );
+	}
+
+	void Normalize( float v[3] )
+	{
+		float len = sqrtf( v[0] * v[0] + v[1] * v[1] + v[2] * v[2] );
+		for ( int c = 0; c < 3; c++ ) v[c] /= len;
+	}
+
+	void Cross( const float a[3], const float b[3], float r[3] )
+	{
+		r[0] = a[1] * b[2] - a[2] * b[1];
+		r[1] = a[2] * b[0] - a[0] * b[2];
+		r[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	float Dot( const float a[3], const float b[3] )
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+}
+
+RaymarchCamera RaymarchCamera::LookAt( const float eye[3], const float target[3], float fovY, float aspect, float nearZ,
+									   float farZ )
+{
+	// XMMatrixLookAtLH
+	const float up[3] = { 0.f, 1.f, 0.f };
+	float zAxis[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	Normalize( zAxis );
+	float xAxis[3], yAxis[3];
+	Cross( up, zAxis, xAxis );
+	Normalize( xAxis );
+	Cross( zAxis, xAxis, yAxis );
+	const float view[16] = {
+		xAxis[0], yAxis[0], zAxis[0], 0.f,
+		xAxis[1], yAxis[1], zAxis[1], 0.f,
+		xAxis[2], yAxis[2], zAxis[2], 0.f,
+		-Dot( xAxis, eye ), -Dot( yAxis, eye ), -Dot( zAxis, eye ), 1.f };
+
+	// XMMatrixPerspectiveFovLH
+	const float h = cosf( fovY * 0.5f ) / sinf( fovY * 0.5f );
+	const float w = h / aspect;
+	const float range = farZ / ( farZ - nearZ );
+	const float proj[16] = {
+		w, 0.f, 0.f, 0.f,
+		0.f, h, 0.f, 0.f,
+		0.f, 0.f, range, 1.f,
+		0.f, 0.f, -range * nearZ, 0.f };
+
+	RaymarchCamera camera;
+	for ( int r = 0; r < 4; r++ )
+		for ( int c = 0; c < 4; c++ )
+			camera.viewProj[r * 4 + c] = view[r * 4] * proj[c] + view[r * 4 + 1] * proj[4 + c] +
+				view[r * 4 + 2] * proj[8 + c] + view[r * 4 + 3] * proj[12 + c];
+	for ( int c = 0; c < 3; c++ ) camera.eye[c] = eye[c];
+	return camera;
+}
+
+RaymarchCamera RaymarchCamera::Default( uint32_t width, uint32_t height, uint32_t volumeSize )
+{
+	// VolumetricAnimation::LoadAssets and LoadSizeDependentResource
+	const float extent = volumeSize / 256.f;
+	const float eye[3] = { 500.f * extent, 500.f * extent, -500.f * extent };
+	const float target[3] = { 0.f, 0.f, 0.f };
+	return LookAt( eye, target, 3.141592654f / 4, width / static_cast< float >( height ), 0.01f, 1250.f * extent );
+}
+
+float RaymarchCamera::GetPixelScale( uint32_t height ) const
+{
+	// The y column of viewProj is the view's unit up axis scaled by 1 / tan( fovY / 2 )
+	const float h = sqrtf( viewProj[1] * viewProj[1] + viewProj[5] * viewProj[5] + viewProj[9] * viewProj[9] );
+	return h > 0.f && height ? 2.f / ( h * height ) : 0.f;
+}
+
+bool RaymarchCamera::GetInverse( double inverse[16] ) const
+{
+	return InvertMatrix( viewProj, inverse );
+}
+
+void RaymarchCamera::GetPixelRay( const double inverse[16], uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+								  float dir[3] ) const
+{
+	PixelRay( inverse, eye, width, height, x, y, dir );
+}
+
+const char* GetRenderModeName( RenderMode mode )
+{
+	static const char* names[RenderModeCount] = { "single", "packet" };
+	return mode < RenderModeCount ? names[mode] : "unknown";
+}
+
+VolumeRenderer::VolumeRenderer( uint32_t threadCount ) :
+	m_pool( new TaskPool( threadCount ) ), m_tileSize( 16 ),
+	m_mode( IsRayPacketSupported() ? RenderModePacket : RenderModeSingle ), m_packetCount( 0 ), m_divergedPacketCount( 0 ),
+	m_skippedSampleCount( 0 )
+{
+}
+
+VolumeRenderer::~VolumeRenderer()
+{
+}
+
+uint32_t VolumeRenderer::GetThreadCount() const
+{
+	return m_pool->GetThreadCount();
+}
+
+uint64_t VolumeRenderer::Render( const VolumeView& volume, const RaymarchParams& params, const RaymarchCamera& camera,
+								 uint32_t width, uint32_t height, float* rgba )
+{
+	double inv[16];
+	if ( width == 0 || height == 0 ) return 0;
+	if ( !InvertMatrix( camera.viewProj, inv ) )
+	{
+		std::fill( rgba, rgba + static_cast< size_t >( width ) * height * 4, 0.f );
+		return 0;
+	}
+
+	const uint32_t tilesX = ( width + m_tileSize - 1 ) / m_tileSize;
+	const uint32_t tilesY = ( height + m_tileSize - 1 ) / m_tileSize;
+	const bool packets = m_mode == RenderModePacket;
+	std::atomic<uint64_t> samples( 0 );
+	std::atomic<uint64_t> skipped( 0 );
+	std::atomic<uint32_t> packetCount( 0 );
+	std::atomic<uint32_t> divergedCount( 0 );
+	m_pool->ParallelFor( tilesX * tilesY, 1, [&]( uint32_t begin, uint32_t end )
+	{
+		uint64_t tileSamples = 0;
+		uint64_t tileSkipped = 0;
+		uint32_t tilePackets = 0;
+		uint32_t tileDiverged = 0;
+		for ( uint32_t tile = begin; tile < end; tile++ )
+		{
+			const uint32_t x0 = tile % tilesX * m_tileSize;
+			const uint32_t y0 = tile / tilesX * m_tileSize;
+			const uint32_t x1 = std::min( x0 + m_tileSize, width );
+			const uint32_t y1 = std::min( y0 + m_tileSize, height );
+
+			// Whole packets first, whatever is left of the tile ray by ray
+			uint32_t packetX1 = x0, packetY1 = y0;
+			if ( packets && x1 - x0 >= PacketWidth && y1 - y0 >= PacketHeight )
+			{
+				packetX1 = x0 + ( x1 - x0 ) / PacketWidth * PacketWidth;
+				packetY1 = y0 + ( y1 - y0 ) / PacketHeight * PacketHeight;
+				for ( uint32_t y = y0; y < packetY1; y += PacketHeight )
+					for ( uint32_t x = x0; x < packetX1; x += PacketWidth )
+					{
+						bool diverged;
+						tileSamples += RenderPacket( volume, params, camera, inv, width, height, x, y, rgba, tileSkipped,
+													 diverged );
+						tilePackets++;
+						if ( diverged ) tileDiverged++;
+					}
+			}
+			for ( uint32_t y = y0; y < y1; y++ )
+				for ( uint32_t x = y < packetY1 ? packetX1 : x0; x < x1; x++ )
+				{
+					float dir[3];
+					uint32_t raySkipped;
+					PixelRay( inv, camera.eye, width, height, x, y, dir );
+					tileSamples += MarchRay( volume, params, camera.eye, dir, rgba + ( static_cast< size_t >( y ) * width + x ) * 4,
+											 &raySkipped );
+					tileSkipped += raySkipped;
+				}
+		}
+		samples += tileSamples;
+		skipped += tileSkipped;
+		packetCount += tilePackets;
+		divergedCount += tileDiverged;
+	} );
+	m_packetCount = packetCount;
+	m_divergedPacketCount = divergedCount;
+	m_skippedSampleCount = skipped;
+	return samples;
+}
+
+uint64_t VolumeRenderer::RenderPacket( const VolumeView& volume, const RaymarchParams& params, const RaymarchCamera& camera,
+									   const double inv[16], uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+									   float* rgba, uint64_t& skipped, bool& diverged )
+{
+	const uint32_t rows = PacketHeight;
+	RayPacket packet[rows];
+	uint32_t hitRows = 0;
+	float minLength = INFINITY, maxLength = 0.f;
+	for ( uint32_t r = 0; r < rows; r++ )
+	{
+		for ( int c = 0; c < 3; c++ ) packet[r].origin[c] = camera.eye[c];
+		for ( uint32_t i = 0; i < PacketWidth; i++ )
+		{
+			float dir[3];
+			PixelRay( inv, camera.eye, width, height, x + i, y + r, dir );
+			for ( int c = 0; c < 3; c++ ) packet[r].dir[c][i] = dir[c];
+		}
+		IntersectPacket( volume, packet[r] );
+		if ( packet[r].hitMask == ( 1u << PacketWidth ) - 1 ) hitRows++;
+		else if ( packet[r].hitMask ) hitRows = rows + 1;
+		for ( uint32_t i = 0; i < PacketWidth; i++ )
+		{
+			if ( !( packet[r].hitMask & ( 1u << i ) ) ) continue;
+			float length = packet[r].tfar[i] - packet[r].tnear[i];
+			minLength = std::min( minLength, length );
+			maxLength = std::max( maxLength, length );
+		}
+	}
+
+	// Rays missing next to rays hitting, or short rays next to long ones, would leave
+	// lanes idle for most of the march
+	diverged = ( hitRows != 0 && hitRows != rows ) || minLength * 2.f < maxLength - params.stepSize;
+
+	uint64_t samples = 0;
+	for ( uint32_t r = 0; r < rows; r++ )
+	{
+		float* row = rgba + ( static_cast< size_t >( y + r ) * width + x ) * 4;
+		if ( diverged )
+		{
+			for ( uint32_t i = 0; i < PacketWidth; i++ )
+			{
+				const float dir[3] = { packet[r].dir[0][i], packet[r].dir[1][i], packet[r].dir[2][i] };
+				uint32_t raySkipped;
+				samples += MarchRay( volume, params, camera.eye, dir, row + i * 4, &raySkipped );
+				skipped += raySkipped;
+			}
+			continue;
+		}
+		uint32_t laneSamples[RayPacket::Size], laneSkipped[RayPacket::Size];
+		MarchPacket( volume, params, packet[r], row, laneSamples, laneSkipped );
+		for ( uint32_t i = 0; i < PacketWidth; i++ )
+		{
+			samples += laneSamples[i];
+			skipped += laneSkipped[i];
+		}
+	}
+	return samples;
+}
+
+void PackRGBA8( const float* rgba, size_t pixelCount, uint8_t* dst )
+{
+	for ( size_t i = 0; i < pixelCount * 4; i++ )
+	{
+		float v = rgba[i];
+		v = v > 0.f ? ( v < 1.f ? v : 1.f ) : 0.f;
+		dst[i] = static_cast< uint8_t >( v * 255.f + 0.5f );
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+// Multithreaded CPU version of VolumetricAnimation's draw: the image psmain
+// produces for a camera and viewport, computed in screen tiles on a TaskPool.
+// Pixels the cube does not cover stay zero, the colour the render target is
+// cleared to, so CPU and GPU frames can be compared pixel for pixel. A ray
+// hits the box exactly where the rasterized cube covers the pixel centre, up to
+// rounding on the silhouette.
+
+#include "VolumeRaymarch.h"
+
+#include <memory>
+
+class TaskPool;
+
+// Camera of one frame, exactly what VolumetricAnimation passes to the shader:
+// viewProj is the worldViewProj constant (CModelViewerCamera's view * proj as a
+// row major XMFLOAT4X4, row vectors) and eye is viewPos.
+struct RaymarchCamera
+{
+	float viewProj[16];
+	float eye[3];
+
+	// The matrices CModelViewerCamera builds after SetViewParams( eye, target ) and
+	// SetProjParams( fovY, aspect, nearZ, farZ ) with no mouse input, left handed, y up
+	static RaymarchCamera LookAt( const float eye[3], const float target[3], float fovY, float aspect, float nearZ,
+								  float farZ );
+	// The camera VolumetricAnimation starts with for a width x height window, volumeSize
+	// is the largest dimension of the volume
+	static RaymarchCamera Default( uint32_t width, uint32_t height, uint32_t volumeSize = 256 );
+
+	// RaymarchParams::lodScale for a viewport height pixels high: 2 tan( fovY / 2 ) /
+	// height, with the field of view taken from the projection in viewProj
+	float GetPixelScale( uint32_t height ) const;
+
+	// Inverse of viewProj for GetPixelRay, false when it is singular
+	bool GetInverse( double inverse[16] ) const;
+	// Direction of the ray VolumeRenderer casts through the centre of pixel (x, y) of
+	// a width x height viewport
+	void GetPixelRay( const double inverse[16], uint32_t width, uint32_t height, uint32_t x, uint32_t y,
+					  float dir[3] ) const;
+};
+
+enum RenderMode
+{
+	// One MarchRay per pixel
+	RenderModeSingle,
+	// 8x2 pixel packets through MarchPacket. A packet whose rays do not all hit the
+	// box, or whose ray lengths differ by more than 2x, is marched ray by ray.
+	RenderModePacket,
+	RenderModeCount
+};
+
+const char* GetRenderModeName( RenderMode mode );
+
+class VolumeRenderer
+{
+public:
+	// threadCount == 0 uses all hardware threads
+	explicit VolumeRenderer( uint32_t threadCount = 0 );
+	~VolumeRenderer();
+
+	VolumeRenderer( VolumeRenderer const& ) = delete;
+	VolumeRenderer& operator=( VolumeRenderer const& ) = delete;
+
+	uint32_t GetThreadCount() const;
+
+	// Tiles are tileSize x tileSize pixels, handed out to the threads one at a time
+	uint32_t GetTileSize() const { return m_tileSize; }
+	void SetTileSize( uint32_t tileSize ) { m_tileSize = tileSize ? tileSize : 1; }
+
+	// Both modes produce the same image. Defaults to RenderModePacket where
+	// IsRayPacketSupported(), RenderModeSingle otherwise.
+	RenderMode GetMode() const { return m_mode; }
+	void SetMode( RenderMode mode ) { m_mode = mode; }
+
+	// Packets of the last Render() and how many of them fell back to single rays
+	uint32_t GetPacketCount() const { return m_packetCount; }
+	uint32_t GetDivergedPacketCount() const { return m_divergedPacketCount; }
+	// Samples of the last Render() taken by uniform brick jumps rather than one by one
+	uint64_t GetSkippedSampleCount() const { return m_skippedSampleCount; }
+
+	// Render a width x height viewport, rgba receives width * height pixels of 4
+	// floats, rows top to bottom. Pixel (x, y) casts the ray psmain casts for the
+	// fragment at its centre. Returns the number of samples taken.
+	uint64_t Render( const VolumeView& volume, const RaymarchParams& params, const RaymarchCamera& camera,
+					 uint32_t width, uint32_t height, float* rgba );
+
+	static const uint32_t PacketWidth = 8;
+	static const uint32_t PacketHeight = RayPacket::Size * 2 / PacketWidth;
+
+private:
+	// One PacketWidth x PacketHeight block at (x, y), returns the samples taken and
+	// adds the skipped ones to skipped
+	uint64_t RenderPacket( const VolumeView& volume, const RaymarchParams& params, const RaymarchCamera& camera,
+						   const double inv[16], uint32_t width, uint32_t height, uint32_t x, uint32_t y, float* rgba,
+						   uint64_t& skipped, bool& diverged );
+
+	std::unique_ptr<TaskPool> m_pool;
+	uint32_t m_tileSize;
+	RenderMode m_mode;
+	uint32_t m_packetCount;
+	uint32_t m_divergedPacketCount;
+	uint64_t m_skippedSampleCount;
+};
+
+// The R8G8B8A8_UNORM value the render target stores for each float pixel:
+// saturated and rounded to nearest
+void PackRGBA8( const float* rgba, size_t pixelCount, uint8_t* dst );
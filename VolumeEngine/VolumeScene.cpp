@@ -0,0 +1,284 @@
+#include "VolumeScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	inline uint32_t Hash( uint32_t x )
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t Hash( uint32_t seed, uint32_t a, uint32_t b, uint32_t c )
+	{
+		return Hash( seed ^ Hash( a ^ Hash( b ^ Hash( c ) ) ) );
+	}
+
+	// [0, 1) from the top 24 bits of a hash
+	inline float Unit( uint32_t h )
+	{
+		return ( h >> 8 ) * ( 1.f / 16777216.f );
+	}
+
+	// Level for t in [0, 1], 1 at t = 0
+	inline uint32_t Level( float t )
+	{
+		return 1 + static_cast< uint32_t >( std::min( std::max( t, 0.f ), 1.f ) * ( SceneMaxLevel - 1 ) );
+	}
+
+	// Random point in the volume and size around featureSize for object i
+	struct SceneObject
+	{
+		float center[3];
+		float size;
+	};
+
+	uint32_t PlaceObjects( const SceneContext& context, SceneObject objects[SceneMaxObjects] )
+	{
+		const uint32_t count = std::min( context.scene.count, SceneMaxObjects );
+		const float extent[3] = { static_cast< float >( context.width ), static_cast< float >( context.height ),
+								  static_cast< float >( context.depth ) };
+		for ( uint32_t i = 0; i < count; i++ )
+		{
+			for ( uint32_t c = 0; c < 3; c++ ) objects[i].center[c] = Unit( Hash( context.scene.seed, i, c, 0 ) ) * extent[c];
+			objects[i].size = context.scene.featureSize * ( 0.5f + Unit( Hash( context.scene.seed, i, 3, 0 ) ) );
+		}
+		return count;
+	}
+
+	void ShellsRow( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row )
+	{
+		GenerateShellRow( *context.params, context.width, context.height, context.depth, y, z, row );
+	}
+
+	// Add weight times trilinear value noise with a smoothstep fade and lattice spacing
+	// period to row y, z. The corners only change every period voxels along the row.
+	void AddValueNoise( uint32_t seed, uint32_t y, uint32_t z, uint32_t width, float period, float weight, float* row )
+	{
+		uint32_t cell[2];
+		float t[2];
+		const uint32_t yz[2] = { y, z };
+		for ( int c = 0; c < 2; c++ )
+		{
+			float p = yz[c] / period;
+			float f = floorf( p );
+			cell[c] = static_cast< uint32_t >( f );
+			t[c] = ( p - f ) * ( p - f ) * ( 3.f - 2.f * ( p - f ) );
+		}
+		// Noise on the lattice planes x = cx and x = cx + 1, interpolated in y and z
+		uint32_t cx = ~0u;
+		float plane[2] = { 0.f, 0.f };
+		for ( uint32_t x = 0; x < width; x++ )
+		{
+			float p = x / period;
+			float f = floorf( p );
+			if ( static_cast< uint32_t >( f ) != cx )
+			{
+				cx = static_cast< uint32_t >( f );
+				for ( uint32_t i = 0; i < 2; i++ )
+				{
+					float corner[4];
+					for ( uint32_t j = 0; j < 4; j++ ) corner[j] = Unit( Hash( seed, cx + i, cell[0] + ( j & 1 ), cell[1] + ( j >> 1 ) ) );
+					float lo = corner[0] + ( corner[1] - corner[0] ) * t[0];
+					float hi = corner[2] + ( corner[3] - corner[2] ) * t[0];
+					plane[i] = lo + ( hi - lo ) * t[1];
+				}
+			}
+			float tx = ( p - f ) * ( p - f ) * ( 3.f - 2.f * ( p - f ) );
+			row[x] += weight * ( plane[0] + ( plane[1] - plane[0] ) * tx );
+		}
+	}
+
+	// Two octaves of value noise, the filled part banded into the six phases
+	void NoiseRow( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row )
+	{
+		const float period = std::max( context.scene.featureSize, 1.f );
+		const float fill = context.scene.fill;
+		std::vector<float> noise( context.width, 0.f );
+		AddValueNoise( context.scene.seed, y, z, context.width, period, 2.f / 3.f, noise.data() );
+		AddValueNoise( Hash( context.scene.seed ), y, z, context.width, period * 0.5f, 1.f / 3.f, noise.data() );
+		for ( uint32_t x = 0; x < context.width; x++ )
+		{
+			if ( noise[x] >= fill )
+			{
+				row[x] = SceneEmptyVoxel;
+				continue;
+			}
+			float band = noise[x] / fill * 6.f;
+			uint32_t phase = std::min( static_cast< uint32_t >( band ), 5u );
+			row[x] = EncodeSceneVoxel( *context.params, phase, Level( band - phase ) );
+		}
+	}
+
+	// Inside where sum( r^2 / d^2 ) >= 1, in the phase of the nearest ball by field
+	void MetaballsRow( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row )
+	{
+		SceneObject balls[SceneMaxObjects];
+		const uint32_t count = PlaceObjects( context, balls );
+		for ( uint32_t x = 0; x < context.width; x++ )
+		{
+			const float p[3] = { x + 0.5f, y + 0.5f, z + 0.5f };
+			float field = 0.f, strongest = 0.f, distance = 0.f, radius = 1.f;
+			uint32_t nearest = 0;
+			for ( uint32_t i = 0; i < count; i++ )
+			{
+				float d2 = 0.f;
+				for ( int c = 0; c < 3; c++ ) d2 += ( p[c] - balls[i].center[c] ) * ( p[c] - balls[i].center[c] );
+				float f = balls[i].size * balls[i].size / ( d2 + 1.f );
+				field += f;
+				if ( f > strongest )
+				{
+					strongest = f;
+					nearest = i;
+					distance = sqrtf( d2 );
+					radius = balls[i].size;
+				}
+			}
+			row[x] = field >= 1.f ? EncodeSceneVoxel( *context.params, nearest % 6, Level( distance / radius ) ) : SceneEmptyVoxel;
+		}
+	}
+
+	// Signed distance to primitive i at p relative to its center: sphere, box, torus
+	// around y and cylinder along z, in turn
+	float PrimitiveDistance( uint32_t i, const float p[3], float size )
+	{
+		switch ( i % 4 )
+		{
+		case 0:
+			return sqrtf( p[0] * p[0] + p[1] * p[1] + p[2] * p[2] ) - size;
+		case 1:
+		{
+			const float half[3] = { size, size * 0.75f, size * 0.5f };
+			float q[3], outside = 0.f, inside = -INFINITY;
+			for ( int c = 0; c < 3; c++ )
+			{
+				q[c] = fabsf( p[c] ) - half[c];
+				outside += std::max( q[c], 0.f ) * std::max( q[c], 0.f );
+				inside = std::max( inside, q[c] );
+			}
+			return sqrtf( outside ) + std::min( inside, 0.f );
+		}
+		case 2:
+		{
+			float ring = sqrtf( p[0] * p[0] + p[2] * p[2] ) - size;
+			return sqrtf( ring * ring + p[1] * p[1] ) - size * 0.35f;
+		}
+		default:
+		{
+			float d[2] = { sqrtf( p[0] * p[0] + p[1] * p[1] ) - size * 0.6f, fabsf( p[2] ) - size };
+			float outside = sqrtf( std::max( d[0], 0.f ) * std::max( d[0], 0.f ) + std::max( d[1], 0.f ) * std::max( d[1], 0.f ) );
+			return outside + std::min( std::max( d[0], d[1] ), 0.f );
+		}
+		}
+	}
+
+	// Union of the primitives, levels banded by the depth below the surface
+	void SdfRow( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row )
+	{
+		SceneObject primitives[SceneMaxObjects];
+		const uint32_t count = PlaceObjects( context, primitives );
+		for ( uint32_t x = 0; x < context.width; x++ )
+		{
+			float nearest = INFINITY, size = 1.f;
+			uint32_t primitive = 0;
+			for ( uint32_t i = 0; i < count; i++ )
+			{
+				const float p[3] = { x + 0.5f - primitives[i].center[0], y + 0.5f - primitives[i].center[1],
+									 z + 0.5f - primitives[i].center[2] };
+				float d = PrimitiveDistance( i, p, primitives[i].size );
+				if ( d < nearest )
+				{
+					nearest = d;
+					primitive = i;
+					size = primitives[i].size;
+				}
+			}
+			row[x] = nearest < 0.f ? EncodeSceneVoxel( *context.params, primitive % 6, Level( -nearest / size ) ) : SceneEmptyVoxel;
+		}
+	}
+
+	// Every other featureSize cube filled with one random voxel, shifted by the seed
+	void CheckerboardRow( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row )
+	{
+		const uint32_t edge = std::max( static_cast< uint32_t >( context.scene.featureSize ), 1u );
+		const uint32_t seed = context.scene.seed;
+		const uint32_t cy = ( y + Hash( seed, 0, 1, 0 ) % edge ) / edge;
+		const uint32_t cz = ( z + Hash( seed, 0, 2, 0 ) % edge ) / edge;
+		const uint32_t ox = Hash( seed, 0, 0, 0 ) % edge;
+		for ( uint32_t x = 0; x < context.width; x++ )
+		{
+			const uint32_t cx = ( x + ox ) / edge;
+			if ( ( cx + cy + cz ) & 1 )
+			{
+				row[x] = SceneEmptyVoxel;
+				continue;
+			}
+			uint32_t h = Hash( seed, cx, cy, cz );
+			row[x] = EncodeSceneVoxel( *context.params, h % 6, 1 + ( h >> 8 ) % SceneMaxLevel );
+		}
+	}
+
+	std::vector<VolumeScene>& GetRegistry()
+	{
+		static std::vector<VolumeScene> scenes = {
+			{ "shells", ShellsRow },
+			{ "noise", NoiseRow },
+			{ "metaballs", MetaballsRow },
+			{ "sdf", SdfRow },
+			{ "checkerboard", CheckerboardRow }
+		};
+		return scenes;
+	}
+}
+
+SceneParams SceneParams::Default()
+{
+	SceneParams params;
+	params.seed = 1;
+	params.featureSize = 32.f;
+	params.count = 8;
+	params.fill = 0.5f;
+	return params;
+}
+
+uint32_t GetSceneCount()
+{
+	return static_cast< uint32_t >( GetRegistry().size() );
+}
+
+const VolumeScene& GetScene( uint32_t index )
+{
+	return GetRegistry()[index];
+}
+
+int FindScene( const char* name )
+{
+	const std::vector<VolumeScene>& scenes = GetRegistry();
+	for ( size_t i = 0; i < scenes.size(); i++ )
+		if ( strcmp( scenes[i].name, name ) == 0 ) return static_cast< int >( i );
+	return -1;
+}
+
+uint32_t RegisterScene( const char* name, SceneRowFunc row )
+{
+	VolumeScene scene = { name, row };
+	GetRegistry().push_back( scene );
+	return GetSceneCount() - 1;
+}
+
+void GenerateScene( uint32_t scene, const SceneParams& sceneParams, const VolumeParams& params, uint32_t layout,
+					uint32_t width, uint32_t height, uint32_t depth, uint32_t* voxels, TaskPool* pool )
+{
+	const SceneContext context = { &params, sceneParams, width, height, depth };
+	const SceneRowFunc sceneRow = GetScene( scene ).row;
+	GenerateVolumeRows( [&]( uint32_t y, uint32_t z, uint32_t* row ) { sceneRow( context, y, z, row ); }, layout, width,
+						height, depth, voxels, pool );
+}
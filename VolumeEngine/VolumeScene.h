@@ -0,0 +1,95 @@
+#pragma once
+// Procedural start volumes for load tests. Every scene is a named row generator in
+// a registry; the built in ones are the shells of LoadAssets, a noise field,
+// metaballs, a few SDF primitives and a checkerboard. They differ a lot in how much
+// of the volume is animated and how coherent it is, which is what the step and
+// raymarch kernels are sensitive to.
+//
+// Scenes emit voxels the way csmain expects them: a phase in w and xyz at bgCol
+// plus level times colVal[phase], so csmain walks the voxel down to bgCol in
+// level steps and moves it on to the next phase. Empty space is SceneEmptyVoxel,
+// which csmain leaves alone, so bricks holding only that go idle after one step.
+// A scene is a pure function of its SceneParams, the bytes do not depend on the
+// thread count or the layout.
+
+#include "VolumeGenerate.h"
+
+#include <cstdint>
+
+class TaskPool;
+
+// Black in phase 6: csmain subtracts nothing for phases past 5 and xyz never equals
+// bgCol, so it keeps the voxel as it is
+const uint32_t SceneEmptyVoxel = 0x06000000;
+
+// Highest level the scenes use, bgCol + level stays within a byte for the default
+// constants
+const uint32_t SceneMaxLevel = 191;
+
+// Voxel of phase (0 to 5) that csmain takes level (1 to SceneMaxLevel) steps to finish
+inline uint32_t EncodeSceneVoxel( const VolumeParams& params, uint32_t phase, uint32_t level )
+{
+	uint32_t voxel = phase << 24;
+	for ( int c = 0; c < 3; c++ )
+		voxel |= ( ( params.bgCol[c] + level * params.colVal[phase][c] ) & 0xff ) << ( 8 * c );
+	return voxel;
+}
+
+const uint32_t SceneMaxObjects = 64;
+
+struct SceneParams
+{
+	// Placement of the balls and primitives, noise lattice and checker phases
+	uint32_t seed;
+	// Noise period, checker edge and typical ball and primitive radius in voxels
+	float featureSize;
+	// Number of metaballs and SDF primitives, at most SceneMaxObjects
+	uint32_t count;
+	// Noise value below which a voxel is filled, 0 to 1, 0.5 fills about half the volume
+	float fill;
+
+	static SceneParams Default();
+};
+
+// Everything a scene row gets
+struct SceneContext
+{
+	const VolumeParams* params;
+	SceneParams scene;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+};
+
+// Writes the width voxels of row y, z, called for different rows at the same time
+typedef void( *SceneRowFunc )( const SceneContext& context, uint32_t y, uint32_t z, uint32_t* row );
+
+struct VolumeScene
+{
+	const char* name;
+	SceneRowFunc row;
+};
+
+// The built in scenes come first, SceneShells is the volume of FillShellVolume
+enum BuiltinScene
+{
+	SceneShells = 0,
+	SceneNoise,
+	SceneMetaballs,
+	SceneSdf,
+	SceneCheckerboard,
+	BuiltinSceneCount
+};
+
+uint32_t GetSceneCount();
+const VolumeScene& GetScene( uint32_t index );
+// Index of the scene called name, -1 if there is none
+int FindScene( const char* name );
+// Add a scene after the built in ones and return its index. Not thread safe, meant
+// to be called at startup.
+uint32_t RegisterScene( const char* name, SceneRowFunc row );
+
+// Fill voxels (VolumeStorageCount( layout, width, height, depth ) of them) with
+// scene, on pool or the calling thread if null
+void GenerateScene( uint32_t scene, const SceneParams& sceneParams, const VolumeParams& params, uint32_t layout,
+					uint32_t width, uint32_t height, uint32_t depth, uint32_t* voxels, TaskPool* pool );
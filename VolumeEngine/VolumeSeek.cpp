@@ -0,0 +1,182 @@
+#include "VolumeSeek.h"
+
+namespace
+{
+	int64_t Gcd( int64_t a, int64_t b )
+	{
+		while ( b ) { int64_t t = a % b; a = b; b = t; }
+		return a;
+	}
+
+	// Inverse of a modulo m, a and m coprime
+	int64_t InverseMod( int64_t a, int64_t m )
+	{
+		int64_t r0 = m, r1 = a % m, t0 = 0, t1 = 1;
+		while ( r1 )
+		{
+			int64_t q = r0 / r1, tmp;
+			tmp = r0 - q * r1; r0 = r1; r1 = tmp;
+			tmp = t0 - q * t1; t0 = t1; t1 = tmp;
+		}
+		return ( t0 % m + m ) % m;
+	}
+}
+
+VolumeSeek::VolumeSeek( const VolumeParams& params )
+{
+	for ( uint32_t cls = 0; cls < ClassCount; cls++ )
+		for ( uint32_t c = 0; c < 3; c++ )
+		{
+			// Same channel arithmetic as StepVoxel
+			const uint32_t sub = cls < 6 ? params.colVal[cls][c] : 0;
+			const uint32_t bg = params.bgCol[c];
+			for ( uint32_t v = 0; v < 256; v++ )
+			{
+				uint32_t x = v - sub;
+				m_jump[cls][c][0][v] = static_cast< uint8_t >( x < 0xff ? x : 0xff );
+			}
+			for ( uint32_t k = 1; k < JumpLevels; k++ )
+				for ( uint32_t v = 0; v < 256; v++ )
+					m_jump[cls][c][k][v] = m_jump[cls][c][k - 1][m_jump[cls][c][k - 1][v]];
+
+			for ( uint32_t v = 0; v < 256; v++ )
+			{
+				// Walk the orbit of v until it repeats; index of each value in the walk
+				int16_t seen[256];
+				for ( int i = 0; i < 256; i++ ) seen[i] = -1;
+				uint32_t x = v;
+				int16_t step = 0;
+				while ( seen[x] < 0 )
+				{
+					seen[x] = step++;
+					x = m_jump[cls][c][0][x];
+				}
+				const int16_t tail = seen[x];
+				const uint16_t cycle = static_cast< uint16_t >( step - tail );
+				m_cycleLength[cls][c][v] = cycle;
+
+				// Only the value bgCol + colVal produces a hit, at most once per orbit
+				HitTimes hits = { 0, 0 };
+				uint32_t hitValue = bg + sub;
+				if ( hitValue < 256 && seen[hitValue] >= 0 )
+				{
+					hits.first = static_cast< uint64_t >( seen[hitValue] ) + 1;
+					hits.period = seen[hitValue] >= tail ? cycle : 0;
+				}
+				m_hits[cls][c][v] = hits;
+			}
+		}
+
+	// Color a voxel restarts from when it enters phase w
+	for ( uint32_t w = 0; w < 6; w++ )
+		for ( uint32_t c = 0; c < 3; c++ )
+		{
+			uint32_t col = 255 * params.colVal[w][c] + params.bgCol[c];
+			m_reset[w][c] = static_cast< uint8_t >( col < 0xff ? col : 0xff );
+		}
+
+	m_cycle = 0;
+	for ( uint32_t w = 0; w < 6; w++ )
+	{
+		m_duration[w] = FirstHit( w, m_reset[w] );
+		m_cycle = ( m_cycle == NoHit || m_duration[w] == NoHit ) ? NoHit : m_cycle + m_duration[w];
+	}
+}
+
+VolumeSeek::HitTimes VolumeSeek::Intersect( HitTimes a, HitTimes b )
+{
+	const HitTimes none = { 0, 0 };
+	if ( a.first == 0 || b.first == 0 ) return none;
+	// Channels that stay on bgCol hit at every step, the common case for colVal == 0
+	if ( a.first == 1 && a.period == 1 ) return b;
+	if ( b.first == 1 && b.period == 1 ) return a;
+	if ( a.period == 0 && b.period == 0 ) return a.first == b.first ? a : none;
+	if ( a.period == 0 ) return a.first >= b.first && ( a.first - b.first ) % b.period == 0 ? a : none;
+	if ( b.period == 0 ) return Intersect( b, a );
+
+	// t = a.first + k * a.period with t = b.first (mod b.period)
+	int64_t p1 = static_cast< int64_t >( a.period );
+	int64_t p2 = static_cast< int64_t >( b.period );
+	int64_t g = Gcd( p1, p2 );
+	int64_t diff = ( static_cast< int64_t >( b.first ) - static_cast< int64_t >( a.first ) ) % p2;
+	if ( diff < 0 ) diff += p2;
+	if ( diff % g ) return none;
+	int64_t m = p2 / g;
+	int64_t k = ( diff / g ) % m * InverseMod( ( p1 / g ) % m, m ) % m;
+
+	HitTimes result;
+	result.period = static_cast< uint64_t >( p1 / g * p2 );
+	result.first = a.first + static_cast< uint64_t >( k * p1 );
+	if ( result.first < b.first )
+		result.first += ( b.first - result.first + result.period - 1 ) / result.period * result.period;
+	return result;
+}
+
+uint64_t VolumeSeek::FirstHit( uint32_t cls, const uint8_t rgb[3] ) const
+{
+	HitTimes hits = Intersect( Intersect( m_hits[cls][0][rgb[0]], m_hits[cls][1][rgb[1]] ), m_hits[cls][2][rgb[2]] );
+	return hits.first ? hits.first : NoHit;
+}
+
+uint8_t VolumeSeek::Advance( uint32_t cls, uint32_t c, uint8_t v, uint64_t steps ) const
+{
+	// Every orbit is on its cycle after 255 steps
+	if ( steps >= 256 )
+		steps = 256 + ( steps - 256 ) % m_cycleLength[cls][c][v];
+	for ( uint32_t k = 0; steps; k++, steps >>= 1 )
+		if ( steps & 1 ) v = m_jump[cls][c][k][v];
+	return v;
+}
+
+uint32_t VolumeSeek::Evolve( uint32_t w, const uint8_t rgb[3], uint64_t frame ) const
+{
+	const uint32_t cls = Class( w );
+	uint64_t first = FirstHit( cls, rgb );
+	if ( first == NoHit || frame < first )
+	{
+		return Advance( cls, 0, rgb[0], frame ) | ( Advance( cls, 1, rgb[1], frame ) << 8 ) |
+			( Advance( cls, 2, rgb[2], frame ) << 16 ) | ( w << 24 );
+	}
+
+	// From here on the voxel follows the shared phase cycle
+	uint64_t remaining = frame - first;
+	uint32_t phase = ( w + 1 ) % 6;
+	if ( m_cycle != NoHit ) remaining %= m_cycle;
+	while ( m_duration[phase] != NoHit && remaining >= m_duration[phase] )
+	{
+		remaining -= m_duration[phase];
+		phase = ( phase + 1 ) % 6;
+	}
+	const uint8_t* reset = m_reset[phase];
+	return Advance( phase, 0, reset[0], remaining ) | ( Advance( phase, 1, reset[1], remaining ) << 8 ) |
+		( Advance( phase, 2, reset[2], remaining ) << 16 ) | ( phase << 24 );
+}
+
+uint32_t VolumeSeek::SeekVoxel( uint32_t initial, uint64_t frame ) const
+{
+	const uint8_t rgb[3] = {
+		static_cast< uint8_t >( initial ), static_cast< uint8_t >( initial >> 8 ), static_cast< uint8_t >( initial >> 16 ) };
+	return Evolve( initial >> 24, rgb, frame );
+}
+
+void VolumeSeek::SeekVoxels( const uint32_t* initial, uint32_t* result, size_t count, uint64_t frame ) const
+{
+	// The result only depends on the voxel value and generated volumes hold few
+	// distinct values, so remember recent ones in a small direct mapped cache.
+	const uint32_t CacheBits = 12;
+	uint32_t keys[1u << CacheBits];
+	uint32_t values[1u << CacheBits];
+	bool valid[1u << CacheBits] = {};
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint32_t v = initial[i];
+		uint32_t slot = ( v * 2654435761u ) >> ( 32 - CacheBits );
+		if ( !valid[slot] || keys[slot] != v )
+		{
+			keys[slot] = v;
+			values[slot] = SeekVoxel( v, frame );
+			valid[slot] = true;
+		}
+		result[i] = values[slot];
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+// Closed form evaluation of N csmain steps.
+//
+// Every channel of a voxel evolves independently under f(v) = min(v - colVal[w], 255)
+// until all three hit bgCol at the same step, then the voxel restarts from a fixed
+// reset color in the next phase. f is a map on 256 values, so its orbits are tabulated
+// once per VolumeParams: the hit times of a channel are either a single step or an
+// arithmetic progression, and the phase change of the voxel is the first common
+// element of its three channels. After the first phase change all voxels run the
+// same 6 phase cycle, which reduces any frame index to at most one partial cycle.
+
+#include "VolumeStep.h"
+
+#include <cstddef>
+
+class VolumeSeek
+{
+public:
+	explicit VolumeSeek( const VolumeParams& params );
+
+	// Voxel after frame csmain steps starting from initial
+	uint32_t SeekVoxel( uint32_t initial, uint64_t frame ) const;
+	void SeekVoxels( const uint32_t* initial, uint32_t* result, size_t count, uint64_t frame ) const;
+
+	// Steps from entering phase w until the next phase change, NoHit if it never ends
+	uint64_t GetPhaseDuration( uint32_t w ) const { return m_duration[w]; }
+	// Length of the full 6 phase cycle, NoHit if some phase never ends
+	uint64_t GetCycleLength() const { return m_cycle; }
+
+	static const uint64_t NoHit = ~0ull;
+
+private:
+	// Hit times of one channel: first + k * period, only first if period is zero,
+	// never if first is zero.
+	struct HitTimes
+	{
+		uint64_t first;
+		uint64_t period;
+	};
+
+	// Channel maps are shared by phases with the same colVal, phases >= 6 read zero
+	static uint32_t Class( uint32_t w ) { return w < 6 ? w : 6; }
+
+	uint8_t Advance( uint32_t cls, uint32_t c, uint8_t v, uint64_t steps ) const;
+	uint64_t FirstHit( uint32_t cls, const uint8_t rgb[3] ) const;
+	uint32_t Evolve( uint32_t w, const uint8_t rgb[3], uint64_t frame ) const;
+
+	static HitTimes Intersect( HitTimes a, HitTimes b );
+
+	static const uint32_t ClassCount = 7;
+	static const uint32_t JumpLevels = 9;
+
+	// m_jump[cls][c][k][v] = f^(2^k)(v)
+	uint8_t m_jump[ClassCount][3][JumpLevels][256];
+	// Length of the cycle v finally runs into, for reducing large step counts
+	uint16_t m_cycleLength[ClassCount][3][256];
+	HitTimes m_hits[ClassCount][3][256];
+
+	uint8_t m_reset[6][3];
+	uint64_t m_duration[6];
+	uint64_t m_cycle;
+};
@@ -0,0 +1,455 @@
+#include "VolumeSnapshot.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+	const char Magic[8] = { 'V', 'O', 'L', 'S', 'N', 'A', 'P', 0 };
+
+	// memset( 64 ) of the LoadAssets staging buffer, what padding voxels hold
+	const uint32_t Background = 0x40404040;
+
+	// Bricks encoded or decoded per batch, at least one slab of them
+	const uint32_t BatchBricks = 4096;
+
+	bool SeekFile( FILE* file, uint64_t offset )
+	{
+#ifdef _WIN32
+		return _fseeki64( file, static_cast< __int64 >( offset ), SEEK_SET ) == 0;
+#else
+		return fseeko( file, static_cast< off_t >( offset ), SEEK_SET ) == 0;
+#endif
+	}
+
+	// Run length tokens shared by SnapshotRuns (words) and SnapshotPlanes (bytes): a
+	// byte 0x80 | ( n - 1 ) and one element for n equal ones, or a byte n - 1 and n
+	// literal elements, n up to 128. Returns the bytes written, 0 past limit.
+	template<class T>
+	size_t EncodeRuns( const T* v, uint32_t count, uint8_t* out, size_t limit )
+	{
+		size_t n = 0;
+		for ( uint32_t i = 0; i < count; )
+		{
+			uint32_t run = 1;
+			while ( i + run < count && run < 128 && v[i + run] == v[i] ) run++;
+			if ( run >= 2 )
+			{
+				if ( n + 1 + sizeof( T ) > limit ) return 0;
+				out[n++] = static_cast< uint8_t >( 0x80 | ( run - 1 ) );
+				memcpy( out + n, &v[i], sizeof( T ) );
+				n += sizeof( T );
+				i += run;
+				continue;
+			}
+			// Literals up to the next pair of equal elements
+			uint32_t literal = 1;
+			while ( i + literal < count && literal < 128 && !( i + literal + 1 < count && v[i + literal] == v[i + literal + 1] ) )
+				literal++;
+			if ( n + 1 + literal * sizeof( T ) > limit ) return 0;
+			out[n++] = static_cast< uint8_t >( literal - 1 );
+			memcpy( out + n, &v[i], literal * sizeof( T ) );
+			n += literal * sizeof( T );
+			i += literal;
+		}
+		return n;
+	}
+
+	// count elements from data, returns the bytes used, 0 if data runs out or overflows
+	template<class T>
+	size_t DecodeRuns( const uint8_t* data, size_t size, T* v, uint32_t count )
+	{
+		size_t n = 0;
+		for ( uint32_t i = 0; i < count; )
+		{
+			if ( n >= size ) return 0;
+			const uint8_t token = data[n++];
+			const uint32_t length = ( token & 0x7f ) + 1u;
+			if ( i + length > count ) return 0;
+			if ( token & 0x80 )
+			{
+				if ( n + sizeof( T ) > size ) return 0;
+				T value;
+				memcpy( &value, data + n, sizeof( T ) );
+				n += sizeof( T );
+				std::fill( v + i, v + i + length, value );
+			}
+			else
+			{
+				if ( n + length * sizeof( T ) > size ) return 0;
+				memcpy( v + i, data + n, length * sizeof( T ) );
+				n += length * sizeof( T );
+			}
+			i += length;
+		}
+		return n;
+	}
+
+	uint32_t PaletteBits( uint32_t count )
+	{
+		return count <= 2 ? 1 : count <= 4 ? 2 : count <= 16 ? 4 : 8;
+	}
+
+	// A byte count - 1, the palette and the packed indices, low bits first
+	size_t EncodePalette( const uint32_t* v, uint8_t* out, size_t limit )
+	{
+		uint32_t palette[256];
+		uint8_t index[VOLUME_BRICK_VOXELS];
+		// Open addressed palette index + 1 by voxel hash, 0 for free
+		uint16_t table[1024] = {};
+		uint32_t count = 0, last = 0;
+		for ( uint32_t i = 0; i < VOLUME_BRICK_VOXELS; i++ )
+		{
+			if ( count == 0 || palette[last] != v[i] )
+			{
+				uint32_t slot = ( v[i] * 2654435761u ) >> 22;
+				while ( table[slot] && palette[table[slot] - 1] != v[i] ) slot = ( slot + 1 ) & 1023;
+				if ( !table[slot] )
+				{
+					if ( count == 256 ) return 0;
+					palette[count++] = v[i];
+					table[slot] = static_cast< uint16_t >( count );
+				}
+				last = table[slot] - 1u;
+			}
+			index[i] = static_cast< uint8_t >( last );
+		}
+		const uint32_t bits = PaletteBits( count );
+		const size_t size = 1 + count * sizeof( uint32_t ) + VOLUME_BRICK_VOXELS * bits / 8;
+		if ( size > limit ) return 0;
+		out[0] = static_cast< uint8_t >( count - 1 );
+		memcpy( out + 1, palette, count * sizeof( uint32_t ) );
+		uint8_t* packed = out + 1 + count * sizeof( uint32_t );
+		memset( packed, 0, VOLUME_BRICK_VOXELS * bits / 8 );
+		for ( uint32_t i = 0; i < VOLUME_BRICK_VOXELS; i++ )
+			packed[i * bits / 8] |= static_cast< uint8_t >( index[i] << ( i * bits % 8 ) );
+		return size;
+	}
+
+	bool DecodePalette( const uint8_t* data, size_t size, uint32_t* v )
+	{
+		if ( size < 1 ) return false;
+		const uint32_t count = data[0] + 1u;
+		const uint32_t bits = PaletteBits( count );
+		if ( size != 1 + count * sizeof( uint32_t ) + VOLUME_BRICK_VOXELS * bits / 8 ) return false;
+		uint32_t palette[256];
+		memcpy( palette, data + 1, count * sizeof( uint32_t ) );
+		const uint8_t* packed = data + 1 + count * sizeof( uint32_t );
+		const uint32_t mask = ( 1u << bits ) - 1;
+		for ( uint32_t i = 0; i < VOLUME_BRICK_VOXELS; i++ )
+		{
+			uint32_t index = ( packed[i * bits / 8] >> ( i * bits % 8 ) ) & mask;
+			if ( index >= count ) return false;
+			v[i] = palette[index];
+		}
+		return true;
+	}
+
+	// Every byte plane, lowest first, as differences to the previous byte of the plane
+	size_t EncodePlanes( const uint32_t* v, uint8_t* out, size_t limit )
+	{
+		size_t n = 0;
+		for ( int c = 0; c < 4; c++ )
+		{
+			uint8_t plane[VOLUME_BRICK_VOXELS];
+			uint8_t previous = 0;
+			for ( uint32_t i = 0; i < VOLUME_BRICK_VOXELS; i++ )
+			{
+				uint8_t b = static_cast< uint8_t >( v[i] >> ( c * 8 ) );
+				plane[i] = static_cast< uint8_t >( b - previous );
+				previous = b;
+			}
+			size_t m = EncodeRuns( plane, VOLUME_BRICK_VOXELS, out + n, limit - n );
+			if ( !m ) return 0;
+			n += m;
+		}
+		return n;
+	}
+
+	bool DecodePlanes( const uint8_t* data, size_t size, uint32_t* v )
+	{
+		size_t n = 0;
+		memset( v, 0, VOLUME_BRICK_VOXELS * sizeof( uint32_t ) );
+		for ( int c = 0; c < 4; c++ )
+		{
+			uint8_t plane[VOLUME_BRICK_VOXELS];
+			size_t m = DecodeRuns( data + n, size - n, plane, VOLUME_BRICK_VOXELS );
+			if ( !m ) return false;
+			n += m;
+			uint8_t previous = 0;
+			for ( uint32_t i = 0; i < VOLUME_BRICK_VOXELS; i++ )
+			{
+				previous = static_cast< uint8_t >( previous + plane[i] );
+				v[i] |= static_cast< uint32_t >( previous ) << ( c * 8 );
+			}
+		}
+		return n == size;
+	}
+
+	// Voxel extent of brick along each axis, less than a brick at the far borders
+	void BrickExtent( uint32_t brick, uint32_t width, uint32_t height, uint32_t depth, uint32_t origin[3], uint32_t size[3] )
+	{
+		const uint32_t bricksX = VolumeBrickCount( width );
+		const uint32_t bricksY = VolumeBrickCount( height );
+		origin[0] = brick % bricksX * VOLUME_BRICK_SIZE;
+		origin[1] = brick / bricksX % bricksY * VOLUME_BRICK_SIZE;
+		origin[2] = brick / bricksX / bricksY * VOLUME_BRICK_SIZE;
+		size[0] = std::min<uint32_t>( VOLUME_BRICK_SIZE, width - origin[0] );
+		size[1] = std::min<uint32_t>( VOLUME_BRICK_SIZE, height - origin[1] );
+		size[2] = std::min<uint32_t>( VOLUME_BRICK_SIZE, depth - origin[2] );
+	}
+}
+
+void GatherVolumeBrick( const VolumeView& volume, uint32_t brick, uint32_t* voxels )
+{
+	if ( volume.layout == VOLUME_LAYOUT_BRICKED )
+	{
+		memcpy( voxels, volume.voxels + static_cast< size_t >( brick ) * VOLUME_BRICK_VOXELS,
+				VOLUME_BRICK_VOXELS * sizeof( uint32_t ) );
+		return;
+	}
+	uint32_t origin[3], size[3];
+	BrickExtent( brick, volume.width, volume.height, volume.depth, origin, size );
+	if ( size[0] < VOLUME_BRICK_SIZE || size[1] < VOLUME_BRICK_SIZE || size[2] < VOLUME_BRICK_SIZE )
+		std::fill( voxels, voxels + VOLUME_BRICK_VOXELS, Background );
+	for ( uint32_t z = 0; z < size[2]; z++ )
+		for ( uint32_t y = 0; y < size[1]; y++ )
+		{
+			uint32_t* row = voxels + ( z * VOLUME_BRICK_SIZE + y ) * VOLUME_BRICK_SIZE;
+			if ( volume.layout == VOLUME_LAYOUT_LINEAR )
+			{
+				memcpy( row, volume.voxels + LinearVoxelIndex( origin[0], origin[1] + y, origin[2] + z, volume.width,
+															  volume.height ), size[0] * sizeof( uint32_t ) );
+				continue;
+			}
+			for ( uint32_t x = 0; x < size[0]; x++ )
+				row[x] = volume.voxels[VolumeVoxelIndex( volume.layout, origin[0] + x, origin[1] + y, origin[2] + z,
+														 volume.width, volume.height )];
+		}
+}
+
+void ScatterVolumeBrick( const uint32_t* voxels, uint32_t brick, uint32_t layout, uint32_t width, uint32_t height,
+						 uint32_t depth, uint32_t* dst )
+{
+	uint32_t origin[3], size[3];
+	BrickExtent( brick, width, height, depth, origin, size );
+	for ( uint32_t z = 0; z < size[2]; z++ )
+		for ( uint32_t y = 0; y < size[1]; y++ )
+		{
+			const uint32_t* row = voxels + ( z * VOLUME_BRICK_SIZE + y ) * VOLUME_BRICK_SIZE;
+			if ( layout != VOLUME_LAYOUT_MORTON )
+			{
+				// Rows are contiguous in the linear and the bricked layout
+				memcpy( dst + VolumeVoxelIndex( layout, origin[0], origin[1] + y, origin[2] + z, width, height ), row,
+						size[0] * sizeof( uint32_t ) );
+				continue;
+			}
+			for ( uint32_t x = 0; x < size[0]; x++ )
+				dst[MortonVoxelIndex( origin[0] + x, origin[1] + y, origin[2] + z )] = row[x];
+		}
+}
+
+uint32_t GetSnapshotBatchBricks( uint32_t width, uint32_t height )
+{
+	const uint32_t slabBricks = VolumeBrickCount( width ) * VolumeBrickCount( height );
+	return std::max( BatchBricks / slabBricks, 1u ) * slabBricks;
+}
+
+const char* GetSnapshotCodecName( SnapshotCodec codec )
+{
+	static const char* names[SnapshotCodecCount] = { "raw", "runs", "palette", "planes" };
+	return codec < SnapshotCodecCount ? names[codec] : "unknown";
+}
+
+size_t EncodeSnapshotBrick( const uint32_t* voxels, uint8_t* out )
+{
+	// Every codec has to beat the best so far, raw to begin with
+	out[0] = SnapshotRaw;
+	memcpy( out + 1, voxels, VOLUME_BRICK_VOXELS * sizeof( uint32_t ) );
+	size_t best = SnapshotMaxBrickBytes;
+	uint8_t scratch[SnapshotMaxBrickBytes];
+	for ( int codec = SnapshotRuns; codec < SnapshotCodecCount; codec++ )
+	{
+		const size_t limit = best - 2;
+		size_t size = 0;
+		switch ( codec )
+		{
+		case SnapshotRuns: size = EncodeRuns( voxels, VOLUME_BRICK_VOXELS, scratch, limit ); break;
+		case SnapshotPalette: size = EncodePalette( voxels, scratch, limit ); break;
+		case SnapshotPlanes: size = EncodePlanes( voxels, scratch, limit ); break;
+		}
+		if ( !size ) continue;
+		out[0] = static_cast< uint8_t >( codec );
+		memcpy( out + 1, scratch, size );
+		best = size + 1;
+	}
+	return best;
+}
+
+bool DecodeSnapshotBrick( const uint8_t* data, size_t size, uint32_t* voxels )
+{
+	if ( size < 1 ) return false;
+	switch ( data[0] )
+	{
+	case SnapshotRaw:
+		if ( size != SnapshotMaxBrickBytes ) return false;
+		memcpy( voxels, data + 1, VOLUME_BRICK_VOXELS * sizeof( uint32_t ) );
+		return true;
+	case SnapshotRuns:
+		return DecodeRuns( data + 1, size - 1, voxels, VOLUME_BRICK_VOXELS ) == size - 1;
+	case SnapshotPalette:
+		return DecodePalette( data + 1, size - 1, voxels );
+	case SnapshotPlanes:
+		return DecodePlanes( data + 1, size - 1, voxels );
+	default:
+		return false;
+	}
+}
+
+bool WriteSnapshot( const char* path, const VolumeView& volume, TaskPool* pool, SnapshotStats* stats )
+{
+	SnapshotHeader header = {};
+	memcpy( header.magic, Magic, sizeof( Magic ) );
+	header.version = SnapshotHeader::Version;
+	header.width = volume.width;
+	header.height = volume.height;
+	header.depth = volume.depth;
+	header.brickCount = VolumeBrickCount( volume.width ) * VolumeBrickCount( volume.height ) * VolumeBrickCount( volume.depth );
+
+	FILE* file = nullptr;
+#ifdef _WIN32
+	fopen_s( &file, path, "wb" );
+#else
+	file = fopen( path, "wb" );
+#endif
+	if ( !file ) return false;
+	// The header is written again once the directory offset is known
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+	SnapshotStats local = {};
+	std::vector<uint64_t> directory( header.brickCount + 1 );
+	directory[0] = sizeof( header );
+	const uint32_t batch = GetSnapshotBatchBricks( volume.width, volume.height );
+	std::vector<uint8_t> encoded( static_cast< size_t >( batch ) * SnapshotMaxBrickBytes );
+	std::vector<uint32_t> sizes( batch );
+	for ( uint32_t first = 0; first < header.brickCount && ok; first += batch )
+	{
+		const uint32_t count = std::min( batch, header.brickCount - first );
+		auto encode = [&]( uint32_t begin, uint32_t end )
+		{
+			uint32_t voxels[VOLUME_BRICK_VOXELS];
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				GatherVolumeBrick( volume, first + i, voxels );
+				sizes[i] = static_cast< uint32_t >( EncodeSnapshotBrick( voxels, &encoded[i * SnapshotMaxBrickBytes] ) );
+			}
+		};
+		if ( pool ) pool->ParallelFor( count, 16, encode );
+		else encode( 0, count );
+
+		for ( uint32_t i = 0; i < count && ok; i++ )
+		{
+			ok = fwrite( &encoded[i * SnapshotMaxBrickBytes], 1, sizes[i], file ) == sizes[i];
+			directory[first + i + 1] = directory[first + i] + sizes[i];
+			local.encodedBytes += sizes[i];
+			local.codecBricks[encoded[i * SnapshotMaxBrickBytes]]++;
+		}
+	}
+	local.rawBytes = static_cast< uint64_t >( volume.width ) * volume.height * volume.depth * sizeof( uint32_t );
+	if ( stats ) *stats = local;
+
+	header.directoryOffset = directory[header.brickCount];
+	ok = ok && fwrite( directory.data(), sizeof( uint64_t ), directory.size(), file ) == directory.size();
+	ok = ok && SeekFile( file, 0 ) && fwrite( &header, sizeof( header ), 1, file ) == 1;
+	return fclose( file ) == 0 && ok;
+}
+
+SnapshotReader::SnapshotReader( const char* path ) :
+	m_file( nullptr ), m_header()
+{
+	static_assert( sizeof( SnapshotHeader ) == 40, "the header layout is the file format" );
+	FILE* file = nullptr;
+#ifdef _WIN32
+	fopen_s( &file, path, "rb" );
+#else
+	file = fopen( path, "rb" );
+#endif
+	if ( !file ) return;
+	SnapshotHeader& h = m_header;
+	bool ok = fread( &h, sizeof( h ), 1, file ) == 1 && memcmp( h.magic, Magic, sizeof( Magic ) ) == 0 &&
+		h.version == SnapshotHeader::Version && VolumeSizeSupported( VOLUME_LAYOUT_BRICKED, h.width, h.height, h.depth ) &&
+		h.brickCount == VolumeBrickCount( h.width ) * VolumeBrickCount( h.height ) * VolumeBrickCount( h.depth );
+	if ( ok )
+	{
+		m_directory.resize( static_cast< size_t >( h.brickCount ) + 1 );
+		ok = SeekFile( file, h.directoryOffset ) &&
+			fread( m_directory.data(), sizeof( uint64_t ), m_directory.size(), file ) == m_directory.size() &&
+			m_directory[0] == sizeof( h ) && m_directory[h.brickCount] == h.directoryOffset;
+		for ( uint32_t i = 0; i < h.brickCount && ok; i++ )
+			ok = m_directory[i] < m_directory[i + 1] && m_directory[i + 1] - m_directory[i] <= SnapshotMaxBrickBytes;
+	}
+	if ( !ok )
+	{
+		fclose( file );
+		m_directory.clear();
+		return;
+	}
+	m_file = file;
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	if ( m_file ) fclose( m_file );
+}
+
+bool SnapshotReader::ReadBrick( uint32_t brick, uint32_t* voxels )
+{
+	if ( brick >= m_header.brickCount ) return false;
+	uint8_t data[SnapshotMaxBrickBytes];
+	const size_t size = static_cast< size_t >( GetEncodedBrickBytes( brick ) );
+	return ReadBytes( m_directory[brick], size, data ) && DecodeSnapshotBrick( data, size, voxels );
+}
+
+bool SnapshotReader::ReadVolume( uint32_t layout, uint32_t* voxels, TaskPool* pool )
+{
+	// A batch of bricks is one read, then decoded and scattered in parallel
+	const uint32_t batch = GetSnapshotBatchBricks( m_header.width, m_header.height );
+	std::vector<uint8_t> data;
+	bool ok = true;
+	for ( uint32_t first = 0; first < m_header.brickCount && ok; first += batch )
+	{
+		const uint32_t count = std::min( batch, m_header.brickCount - first );
+		const uint64_t base = m_directory[first];
+		data.resize( static_cast< size_t >( m_directory[first + count] - base ) );
+		if ( !ReadBytes( base, data.size(), data.data() ) ) return false;
+
+		std::atomic<bool> valid( true );
+		auto decode = [&]( uint32_t begin, uint32_t end )
+		{
+			uint32_t brick[VOLUME_BRICK_VOXELS];
+			for ( uint32_t i = begin; i < end; i++ )
+			{
+				const uint32_t index = first + i;
+				if ( !DecodeSnapshotBrick( &data[static_cast< size_t >( m_directory[index] - base )],
+										   static_cast< size_t >( GetEncodedBrickBytes( index ) ), brick ) )
+				{
+					valid = false;
+					continue;
+				}
+				ScatterVolumeBrick( brick, index, layout, m_header.width, m_header.height, m_header.depth, voxels );
+			}
+		};
+		if ( pool ) pool->ParallelFor( count, 16, decode );
+		else decode( 0, count );
+		ok = valid;
+	}
+	return ok;
+}
+
+bool SnapshotReader::ReadBytes( uint64_t offset, size_t size, uint8_t* data )
+{
+	std::lock_guard<std::mutex> lock( m_fileMutex );
+	return m_file && SeekFile( m_file, offset ) && fread( data, 1, size, m_file ) == size;
+}
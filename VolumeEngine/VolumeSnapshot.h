@@ -0,0 +1,116 @@
+#pragma once
+// Compressed volume checkpoints. A snapshot stores the volume brick by brick, each
+// brick (8x8x8 voxels in VOLUME_LAYOUT_BRICKED order, padding included) compressed
+// on its own with whichever codec makes it smallest:
+//
+// SnapshotRuns     runs of one voxel and literal stretches, so uniform bricks and
+//                  the background around the shapes take a few bytes
+// SnapshotPalette  up to 256 distinct voxels as indices of 1, 2, 4 or 8 bits, the
+//                  six phase colours at a handful of levels mostly
+// SnapshotPlanes   the general fallback: the voxels split into four byte planes,
+//                  each delta coded along the brick and run length coded, which
+//                  catches constant channels and smooth ramps
+// SnapshotRaw      the 2 KiB as they are when nothing else helps
+//
+// A directory of brick offsets follows the data, so single bricks can be read and
+// decoded without touching the rest. Bricks are encoded and decoded in parallel on
+// a TaskPool, a batch of slabs at a time. Integers are little endian.
+
+#include "VolumeRaymarch.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+class TaskPool;
+
+enum SnapshotCodec
+{
+	SnapshotRaw,
+	SnapshotRuns,
+	SnapshotPalette,
+	SnapshotPlanes,
+	SnapshotCodecCount
+};
+
+const char* GetSnapshotCodecName( SnapshotCodec codec );
+
+// Largest encoded brick: the codec byte and the raw voxels
+const size_t SnapshotMaxBrickBytes = 1 + VOLUME_BRICK_VOXELS * sizeof( uint32_t );
+
+// Encode the VOLUME_BRICK_VOXELS voxels of one brick into out (SnapshotMaxBrickBytes
+// at least) with the smallest codec, returns the bytes written
+size_t EncodeSnapshotBrick( const uint32_t* voxels, uint8_t* out );
+// Inverse of EncodeSnapshotBrick, false if data is not a valid brick of size bytes
+bool DecodeSnapshotBrick( const uint8_t* data, size_t size, uint32_t* voxels );
+
+// Brick of a volume in any layout as VOLUME_BRICK_VOXELS voxels in bricked order,
+// voxels past the volume are the background
+void GatherVolumeBrick( const VolumeView& volume, uint32_t brick, uint32_t* voxels );
+// The voxels of a gathered brick back into dst, a volume in layout; the padding of
+// the brick is dropped
+void ScatterVolumeBrick( const uint32_t* voxels, uint32_t brick, uint32_t layout, uint32_t width, uint32_t height,
+						 uint32_t depth, uint32_t* dst );
+// Bricks coded per parallel batch: whole slabs, about 4096 bricks
+uint32_t GetSnapshotBatchBricks( uint32_t width, uint32_t height );
+
+struct SnapshotStats
+{
+	// Voxel bytes in and encoded bytes out, directory and header left out
+	uint64_t rawBytes;
+	uint64_t encodedBytes;
+	uint32_t codecBricks[SnapshotCodecCount];
+};
+
+struct SnapshotHeader
+{
+	// "VOLSNAP" and a zero
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t brickCount;
+	uint32_t reserved;
+	// brickCount + 1 offsets, brick i is the bytes from entry i to entry i + 1
+	uint64_t directoryOffset;
+
+	static const uint32_t Version = 1;
+};
+
+// Write volume (any layout) as a snapshot, encoding on pool or the calling thread if
+// null. stats, if not null, receives the codec statistics. False on I/O errors.
+bool WriteSnapshot( const char* path, const VolumeView& volume, TaskPool* pool, SnapshotStats* stats = nullptr );
+
+class SnapshotReader
+{
+public:
+	// Not open if the file is missing or not a snapshot
+	explicit SnapshotReader( const char* path );
+	~SnapshotReader();
+
+	SnapshotReader( SnapshotReader const& ) = delete;
+	SnapshotReader& operator=( SnapshotReader const& ) = delete;
+
+	bool IsOpen() const { return m_file != nullptr; }
+	const SnapshotHeader& GetHeader() const { return m_header; }
+	uint32_t GetBrickCount() const { return m_header.brickCount; }
+	uint64_t GetEncodedBrickBytes( uint32_t brick ) const { return m_directory[brick + 1] - m_directory[brick]; }
+
+	// Random access: decode one brick, VolumeBrickIndex() order, into VOLUME_BRICK_VOXELS
+	// voxels. Safe to call from several threads.
+	bool ReadBrick( uint32_t brick, uint32_t* voxels );
+	// Decode the whole volume into voxels, VolumeStorageCount( layout, ... ) of them
+	// in layout. Decoding runs on pool (or the calling thread if null), padding voxels
+	// of the layout are left alone.
+	bool ReadVolume( uint32_t layout, uint32_t* voxels, TaskPool* pool );
+
+private:
+	bool ReadBytes( uint64_t offset, size_t size, uint8_t* data );
+
+	FILE* m_file;
+	SnapshotHeader m_header;
+	std::vector<uint64_t> m_directory;
+	std::mutex m_fileMutex;
+};
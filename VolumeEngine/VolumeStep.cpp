@@ -0,0 +1,120 @@
+#include "VolumeStep.h"
+
+#include <cstring>
+
+VolumeParams VolumeParams::Default()
+{
+	VolumeParams params = {};
+	const uint32_t colVal[6][4] = {
+		{ 1, 0, 0, 0 },
+		{ 0, 1, 0, 1 },
+		{ 0, 0, 1, 2 },
+		{ 1, 1, 0, 3 },
+		{ 1, 0, 1, 4 },
+		{ 0, 1, 1, 5 },
+	};
+	memcpy( params.colVal, colVal, sizeof( colVal ) );
+	for ( int i = 0; i < 4; i++ ) params.bgCol[i] = 64;
+	return params;
+}
+
+StepTables StepTables::Build( const VolumeParams& params )
+{
+	StepTables tables = {};
+	tables.params = params;
+
+	// The SIMD kernels saturate an underflowing channel to 0xff, which must never
+	// compare equal to bgCol, hence bgCol < 255.
+	tables.byteRange = true;
+	for ( int c = 0; c < 3; c++ )
+	{
+		for ( int w = 0; w < 6; w++ )
+			tables.byteRange &= params.colVal[w][c] <= 0xff;
+		tables.byteRange &= params.bgCol[c] < 0xff;
+	}
+
+	tables.bg = ( params.bgCol[0] & 0xff ) | ( ( params.bgCol[1] & 0xff ) << 8 ) | ( ( params.bgCol[2] & 0xff ) << 16 );
+	for ( uint32_t w = 0; w < 16; w++ )
+	{
+		if ( w < 6 )
+			tables.sub[w] = ( params.colVal[w][0] & 0xff ) | ( ( params.colVal[w][1] & 0xff ) << 8 ) | ( ( params.colVal[w][2] & 0xff ) << 16 );
+
+		// Same as the phase change branch of StepVoxel
+		uint32_t next = ( w + 1 ) % 6;
+		tables.reset[w] = next << 24;
+		for ( int c = 0; c < 3; c++ )
+		{
+			uint32_t col = 255 * params.colVal[next][c] + params.bgCol[c];
+			tables.reset[w] |= ( col < 0xff ? col : 0xff ) << ( 8 * c );
+		}
+	}
+	return tables;
+}
+
+void StepKernel_Scalar( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed )
+{
+	const VolumeParams& params = tables.params;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint32_t v = StepVoxel( voxels[i], params );
+		if ( changed && v != voxels[i] ) changed[i / StepChangeGroup] = 1;
+		voxels[i] = v;
+	}
+}
+
+bool IsStepKernelSupported( StepKernelType type )
+{
+	const CpuFeatures& cpu = CpuFeatures::Get();
+	switch ( type )
+	{
+	case StepKernelScalar:
+		return true;
+#if VE_X86
+	case StepKernelSSE4:
+		return cpu.sse41;
+	case StepKernelAVX2:
+		return cpu.avx2;
+#endif
+#if VE_HAS_AVX512
+	case StepKernelAVX512:
+		return cpu.avx512f && cpu.avx512bw;
+#endif
+	default:
+		( void ) cpu;
+		return false;
+	}
+}
+
+StepKernelType GetBestStepKernel()
+{
+	for ( int type = StepKernelCount - 1; type > StepKernelScalar; type-- )
+		if ( IsStepKernelSupported( static_cast< StepKernelType >( type ) ) )
+			return static_cast< StepKernelType >( type );
+	return StepKernelScalar;
+}
+
+const char* GetStepKernelName( StepKernelType type )
+{
+	static const char* names[StepKernelCount] = { "scalar", "sse4", "avx2", "avx512" };
+	return type < StepKernelCount ? names[type] : "unknown";
+}
+
+StepKernelFunc GetStepKernelFunc( StepKernelType type )
+{
+	if ( !IsStepKernelSupported( type ) ) return StepKernel_Scalar;
+	switch ( type )
+	{
+#if VE_X86
+	case StepKernelSSE4:
+		return StepKernel_SSE4;
+	case StepKernelAVX2:
+		return StepKernel_AVX2;
+#endif
+#if VE_HAS_AVX512
+	case StepKernelAVX512:
+		return StepKernel_AVX512;
+#endif
+	default:
+		return StepKernel_Scalar;
+	}
+}
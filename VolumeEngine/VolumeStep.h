@@ -0,0 +1,93 @@
+#pragma once
+// csmain on the CPU. StepVoxel is the reference for a single voxel; the step
+// kernels apply it to a contiguous run of packed voxels. The SIMD kernels produce
+// the same bytes and are picked at startup from the CPU features.
+
+#include "CpuFeatures.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Same values as VolumetricAnimation::ConstantBuffer::colVal/bgCol. The shader reads
+// them as uint4 so all arithmetic below is done on uint32_t.
+struct VolumeParams
+{
+	uint32_t colVal[6][4];
+	uint32_t bgCol[4];
+
+	// The constants set up in the VolumetricAnimation constructor
+	static VolumeParams Default();
+};
+
+// One csmain invocation on a single voxel. Phases past 5 subtract zero, csmain
+// checks col.w < 6 the same way.
+inline uint32_t StepVoxel( uint32_t packed, const VolumeParams& params )
+{
+	static const uint32_t zero[4] = { 0, 0, 0, 0 };
+	uint32_t w = packed >> 24;
+	const uint32_t* sub = w < 6 ? params.colVal[w] : zero;
+	uint32_t x = ( packed & 0xff ) - sub[0];
+	uint32_t y = ( ( packed >> 8 ) & 0xff ) - sub[1];
+	uint32_t z = ( ( packed >> 16 ) & 0xff ) - sub[2];
+	if ( x == params.bgCol[0] && y == params.bgCol[1] && z == params.bgCol[2] )
+	{
+		w = ( w + 1 ) % 6;
+		x = 255 * params.colVal[w][0] + params.bgCol[0]; // Let it overflow, it doesn't matter
+		y = 255 * params.colVal[w][1] + params.bgCol[1];
+		z = 255 * params.colVal[w][2] + params.bgCol[2];
+	}
+	// D3DX_UINT4_to_R8G8B8A8_UINT clamps every channel to 255
+	x = x < 0xff ? x : 0xff;
+	y = y < 0xff ? y : 0xff;
+	z = z < 0xff ? z : 0xff;
+	w = w < 0xff ? w : 0xff;
+	return x | ( y << 8 ) | ( z << 16 ) | ( w << 24 );
+}
+
+enum StepKernelType
+{
+	StepKernelScalar = 0,
+	StepKernelSSE4,
+	StepKernelAVX2,
+	StepKernelAVX512,
+	StepKernelCount
+};
+
+// Per phase lookup tables derived from VolumeParams. The SIMD kernels work on
+// bytes and index these by the phase in the w channel.
+struct StepTables
+{
+	// colVal[w].xyz packed into one voxel word, zero for w >= 6
+	uint32_t sub[16];
+	// Voxel written when phase w finishes: next phase and its reset color
+	uint32_t reset[16];
+	// bgCol.xyz packed, w byte zero
+	uint32_t bg;
+	// All colVal/bgCol channels fit into a byte, required by the SIMD kernels
+	bool byteRange;
+	VolumeParams params;
+
+	static StepTables Build( const VolumeParams& params );
+};
+
+// changed, when not null, receives one flag per StepChangeGroup voxels that is set
+// (never cleared) when the step altered any of them. The flags are used to retire
+// bricks that reached a fixed point, a group is one brick row.
+static const size_t StepChangeGroup = 8;
+typedef void( *StepKernelFunc )( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed );
+
+bool IsStepKernelSupported( StepKernelType type );
+StepKernelType GetBestStepKernel();
+const char* GetStepKernelName( StepKernelType type );
+
+// Returns the scalar kernel when type is unsupported on this CPU
+StepKernelFunc GetStepKernelFunc( StepKernelType type );
+
+void StepKernel_Scalar( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed = nullptr );
+#if VE_X86
+void StepKernel_SSE4( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed = nullptr );
+void StepKernel_AVX2( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed = nullptr );
+#endif
+#if VE_HAS_AVX512
+void StepKernel_AVX512( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed = nullptr );
+#endif
@@ -0,0 +1,53 @@
+#include "VolumeStep.h"
+#include "CpuFeatures.h"
+
+#if VE_X86
+#include <immintrin.h>
+
+// 8 voxels per iteration. The phase tables are looked up with vpermd, so any
+// vector holding a phase >= 8 (never produced by csmain) is handed to StepVoxel.
+VE_TARGET( "avx2" )
+void StepKernel_AVX2( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed )
+{
+	if ( !tables.byteRange )
+	{
+		StepKernel_Scalar( voxels, count, tables, changed );
+		return;
+	}
+
+	const __m256i subTable = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( tables.sub ) );
+	const __m256i resetTable = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( tables.reset ) );
+	const __m256i bg = _mm256_set1_epi32( static_cast< int >( tables.bg ) );
+	const __m256i rgbMask = _mm256_set1_epi32( 0x00ffffff );
+	const __m256i maxPhase = _mm256_set1_epi32( 7 );
+	const __m256i ones = _mm256_set1_epi32( -1 );
+
+	size_t i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m256i* p = reinterpret_cast< __m256i* >( voxels + i );
+		__m256i v = _mm256_loadu_si256( p );
+		__m256i w = _mm256_srli_epi32( v, 24 );
+		if ( !_mm256_testz_si256( _mm256_cmpgt_epi32( w, maxPhase ), ones ) )
+		{
+			StepKernel_Scalar( voxels + i, 8, tables, changed ? changed + i / StepChangeGroup : nullptr );
+			continue;
+		}
+
+		// col.xyz -= colVal[col.w].xyz, a negative result ends up as 255 after packing
+		__m256i sub = _mm256_permutevar8x32_epi32( subTable, w );
+		__m256i diff = _mm256_subs_epu8( v, sub );
+		__m256i noBorrow = _mm256_cmpeq_epi8( _mm256_max_epu8( v, sub ), v );
+		__m256i col = _mm256_or_si256( diff, _mm256_andnot_si256( noBorrow, ones ) );
+
+		// Phase finished where col.xyz == bgCol.xyz
+		__m256i hit = _mm256_cmpeq_epi32( _mm256_and_si256( col, rgbMask ), bg );
+		__m256i reset = _mm256_permutevar8x32_epi32( resetTable, w );
+		__m256i result = _mm256_blendv_epi8( col, reset, hit );
+		_mm256_storeu_si256( p, result );
+		if ( changed && _mm256_movemask_epi8( _mm256_cmpeq_epi32( result, v ) ) != -1 )
+			changed[i / StepChangeGroup] = 1;
+	}
+	StepKernel_Scalar( voxels + i, count - i, tables, changed ? changed + i / StepChangeGroup : nullptr );
+}
+#endif
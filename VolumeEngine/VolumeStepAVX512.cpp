@@ -0,0 +1,53 @@
+#include "VolumeStep.h"
+#include "CpuFeatures.h"
+
+#if VE_HAS_AVX512
+#include <immintrin.h>
+
+// 16 voxels per iteration, the 16 entry phase tables fit one vpermd on zmm.
+VE_TARGET( "avx512f,avx512bw" )
+void StepKernel_AVX512( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed )
+{
+	if ( !tables.byteRange )
+	{
+		StepKernel_Scalar( voxels, count, tables, changed );
+		return;
+	}
+
+	const __m512i subTable = _mm512_loadu_si512( tables.sub );
+	const __m512i resetTable = _mm512_loadu_si512( tables.reset );
+	const __m512i bg = _mm512_set1_epi32( static_cast< int >( tables.bg ) );
+	const __m512i rgbMask = _mm512_set1_epi32( 0x00ffffff );
+	const __m512i maxPhase = _mm512_set1_epi32( 15 );
+	const __m512i ones = _mm512_set1_epi32( -1 );
+
+	size_t i = 0;
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		uint32_t* p = voxels + i;
+		__m512i v = _mm512_loadu_si512( p );
+		__m512i w = _mm512_srli_epi32( v, 24 );
+		if ( _mm512_cmpgt_epu32_mask( w, maxPhase ) )
+		{
+			StepKernel_Scalar( p, 16, tables, changed ? changed + i / StepChangeGroup : nullptr );
+			continue;
+		}
+
+		__m512i sub = _mm512_permutexvar_epi32( w, subTable );
+		__mmask64 noBorrow = _mm512_cmpge_epu8_mask( v, sub );
+		__m512i col = _mm512_mask_subs_epu8( ones, noBorrow, v, sub );
+
+		__mmask16 hit = _mm512_cmpeq_epi32_mask( _mm512_and_si512( col, rgbMask ), bg );
+		__m512i reset = _mm512_permutexvar_epi32( w, resetTable );
+		__m512i result = _mm512_mask_mov_epi32( col, hit, reset );
+		_mm512_storeu_si512( p, result );
+		if ( changed )
+		{
+			__mmask16 diff = _mm512_cmpneq_epi32_mask( result, v );
+			if ( diff & 0xff ) changed[i / StepChangeGroup] = 1;
+			if ( diff >> 8 ) changed[i / StepChangeGroup + 1] = 1;
+		}
+	}
+	StepKernel_Scalar( voxels + i, count - i, tables, changed ? changed + i / StepChangeGroup : nullptr );
+}
+#endif
@@ -0,0 +1,67 @@
+#include "VolumeStep.h"
+#include "CpuFeatures.h"
+
+#if VE_X86
+#include <smmintrin.h>
+
+// 8 voxels (two vectors, one change group) per iteration. Without a dword permute the phase tables are split in
+// two 16 byte halves (phase 0-3 and 4-7) looked up with pshufb, so vectors holding
+// a phase >= 8 go through StepVoxel.
+VE_TARGET( "sse4.1" )
+void StepKernel_SSE4( uint32_t* voxels, size_t count, const StepTables& tables, uint8_t* changed )
+{
+	if ( !tables.byteRange )
+	{
+		StepKernel_Scalar( voxels, count, tables, changed );
+		return;
+	}
+
+	const __m128i subLo = _mm_loadu_si128( reinterpret_cast< const __m128i* >( tables.sub ) );
+	const __m128i subHi = _mm_loadu_si128( reinterpret_cast< const __m128i* >( tables.sub + 4 ) );
+	const __m128i resetLo = _mm_loadu_si128( reinterpret_cast< const __m128i* >( tables.reset ) );
+	const __m128i resetHi = _mm_loadu_si128( reinterpret_cast< const __m128i* >( tables.reset + 4 ) );
+	const __m128i bg = _mm_set1_epi32( static_cast< int >( tables.bg ) );
+	const __m128i rgbMask = _mm_set1_epi32( 0x00ffffff );
+	const __m128i maxPhase = _mm_set1_epi32( 7 );
+	const __m128i lowPhase = _mm_set1_epi32( 3 );
+	const __m128i ones = _mm_set1_epi32( -1 );
+	// Splat the low byte of each dword and add the byte position inside the voxel
+	const __m128i splatLow = _mm_setr_epi8( 0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12 );
+	const __m128i bytePos = _mm_setr_epi8( 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 );
+
+	size_t i = 0;
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		__m128i* p = reinterpret_cast< __m128i* >( voxels + i );
+		__m128i v[2] = { _mm_loadu_si128( p ), _mm_loadu_si128( p + 1 ) };
+		__m128i w[2] = { _mm_srli_epi32( v[0], 24 ), _mm_srli_epi32( v[1], 24 ) };
+		if ( !_mm_testz_si128( _mm_or_si128( _mm_cmpgt_epi32( w[0], maxPhase ), _mm_cmpgt_epi32( w[1], maxPhase ) ), ones ) )
+		{
+			StepKernel_Scalar( voxels + i, 8, tables, changed ? changed + i / StepChangeGroup : nullptr );
+			continue;
+		}
+
+		__m128i same = ones;
+		for ( int k = 0; k < 2; k++ )
+		{
+			// Byte index (w * 4 + k) & 15 into the low or the high half of the tables
+			__m128i index = _mm_add_epi8( _mm_shuffle_epi8( _mm_slli_epi32( w[k], 2 ), splatLow ), bytePos );
+			__m128i high = _mm_cmpgt_epi32( w[k], lowPhase );
+
+			__m128i sub = _mm_blendv_epi8( _mm_shuffle_epi8( subLo, index ), _mm_shuffle_epi8( subHi, index ), high );
+			__m128i diff = _mm_subs_epu8( v[k], sub );
+			__m128i noBorrow = _mm_cmpeq_epi8( _mm_max_epu8( v[k], sub ), v[k] );
+			__m128i col = _mm_or_si128( diff, _mm_andnot_si128( noBorrow, ones ) );
+
+			__m128i hit = _mm_cmpeq_epi32( _mm_and_si128( col, rgbMask ), bg );
+			__m128i reset = _mm_blendv_epi8( _mm_shuffle_epi8( resetLo, index ), _mm_shuffle_epi8( resetHi, index ), high );
+			__m128i result = _mm_blendv_epi8( col, reset, hit );
+			_mm_storeu_si128( p + k, result );
+			same = _mm_and_si128( same, _mm_cmpeq_epi32( result, v[k] ) );
+		}
+		if ( changed && !_mm_test_all_ones( same ) )
+			changed[i / StepChangeGroup] = 1;
+	}
+	StepKernel_Scalar( voxels + i, count - i, tables, changed ? changed + i / StepChangeGroup : nullptr );
+}
+#endif
@@ -1,13 +1,74 @@
 
 #include "stdafx.h"
 #include "VolumetricAnimation.h"
+#include "FrameCapture.h"
+#include "TaskPool.h"
+#include "VolumeEngine.h"
+#include "VolumeFile.h"
+#include "VolumeMip.h"
+#include "VolumeRaymarch.h"
+#include "VolumeScene.h"
 
 VolumetricAnimation::VolumetricAnimation( UINT width, UINT height, std::wstring name ) :
 	DX12Framework( width, height, name ), m_frameIndex( 0 ), m_viewport(), m_scissorRect(), m_rtvDescriptorSize( 0 )
 {
+	// Any size, -volume N or -volume WxHxD on the command line
 	m_volumeWidth = 256;
 	m_volumeHeight = 256;
 	m_volumeDepth = 256;
+	// VOLUME_LAYOUT_BRICKED keeps every csmain thread group in one contiguous block,
+	// VOLUME_LAYOUT_MORTON too and keeps neighbouring bricks close for psmain
+	m_volumeLayout = VOLUME_LAYOUT_LINEAR;
+	// Recording a frame only waits for the one this many frames back
+	m_framesInFlight = 3;
+	m_contextIndex = 0;
+	m_computeFenceValue = 1;
+	m_volumeIndex = 0;
+	m_volumeFenceValue[0] = m_volumeFenceValue[1] = 0;
+	m_stepRate = 60;
+	m_pendingSteps = 0;
+	m_droppedSteps = 0;
+	m_stepTotal = 0;
+	for ( UINT i = 0; i < FrameCount; i++ )
+	{
+		m_frames[i].pCbvData = nullptr;
+		m_frames[i].cbvAddress = 0;
+		m_frames[i].fenceValue = 0;
+		m_frames[i].steps = 0;
+		m_frames[i].renderBegin = m_frames[i].renderEnd = 0.0;
+	}
+	// SceneShells is the original concentric shells, the other BuiltinScene values give
+	// volumes of very different occupancy for load tests
+	m_scene = SceneShells;
+	m_sampleCounters = false;
+	m_emptySpaceSkipping = true;
+	// CompositeFrontToBack adds early ray termination
+	m_compositing = CompositeAdditive;
+	// At most MaxMipLevels, 0 turns the mip chain off
+	m_mipLevels = 4;
+	// -volumefile replaces size and layout with those of the file
+	ParseVolumeArgs();
+	// At most 1024^3, see VOLUME_MAX_SIZE
+	m_volumeStorageCount = static_cast< UINT >( VolumeStorageCount( m_volumeLayout, m_volumeWidth, m_volumeHeight, m_volumeDepth ) );
+	m_brickCount = VolumeBrickCount( m_volumeWidth ) * VolumeBrickCount( m_volumeHeight ) * VolumeBrickCount( m_volumeDepth );
+	m_cellCount = VolumeCellCount( m_volumeWidth ) * VolumeCellCount( m_volumeHeight ) * VolumeCellCount( m_volumeDepth );
+	m_steppedBrickTotal = 0;
+	m_sampleTotal = 0;
+	m_skippedSampleTotal = 0;
+	m_rayTotal = 0;
+	m_mipStorageCount = 0;
+	for ( UINT level = 1; level <= m_mipLevels; level++ )
+	{
+		// The chain ends at a single voxel, as VolumeMipChain's does
+		if ( ( 1u << ( level - 1 ) ) >= max( m_volumeWidth, max( m_volumeHeight, m_volumeDepth ) ) )
+		{
+			m_mipLevels = level - 1;
+			break;
+		}
+		UINT round = ( 1u << level ) - 1;
+		m_mipStorageCount += ( ( m_volumeWidth + round ) >> level ) * ( ( m_volumeHeight + round ) >> level ) *
+							 ( ( m_volumeDepth + round ) >> level );
+	}
 
 	ZeroMemory( &m_constantBufferData, sizeof( m_constantBufferData ) );
 
@@ -20,12 +81,144 @@ VolumetricAnimation::VolumetricAnimation( UINT width, UINT height, std::wstring
 	m_constantBufferData.bgCol = XMINT4( 64, 64, 64, 64 );
 }
 
+VolumetricAnimation::~VolumetricAnimation()
+{
+}
+
+// -volume N for an N^3 volume or -volume WxHxD, the default size stays otherwise.
+// -volumefile path maps a prebuilt volume file (see VolumeFile.h) as the start volume.
+// -capture path writes the presented frames, a PPM or PNG sequence or a Y4M stream by
+// the extension (see FrameCapture.h). -inflight N lets N frames queue up for the GPU.
+// -steprate N steps the volume N times a second, independent of the frame rate.
+// -scene name generates the start volume from a scene of VolumeScene.h.
+// -samplecounters counts the samples psmain takes per ray for the frame stats.
+// -skipping 0|1 turns empty space skipping off or on, -compositing 0|1 picks additive
+// or front to back compositing and -mips N the levels of the mip chain, 0 to
+// MaxMipLevels.
+void VolumetricAnimation::ParseVolumeArgs()
+{
+	int argc;
+	LPWSTR* argv = CommandLineToArgvW( GetCommandLineW(), &argc );
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( _wcsicmp( argv[i], L"-samplecounters" ) == 0 || _wcsicmp( argv[i], L"/samplecounters" ) == 0 )
+		{
+			m_sampleCounters = true;
+			continue;
+		}
+		// The rest take a value
+		if ( i + 1 == argc ) break;
+		if ( _wcsicmp( argv[i], L"-volumefile" ) == 0 || _wcsicmp( argv[i], L"/volumefile" ) == 0 )
+		{
+			char path[MAX_PATH];
+			WideCharToMultiByte( CP_ACP, 0, argv[i + 1], -1, path, MAX_PATH, nullptr, nullptr );
+			m_volumeFile.reset( new MappedVolumeFile( path, MappedVolumeFile::ReadOnly ) );
+			if ( !m_volumeFile->IsOpen() )
+			{
+				PRINTWARN( L"%s is not a volume file, generating the start volume", argv[i + 1] );
+				m_volumeFile.reset();
+			}
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-capture" ) == 0 || _wcsicmp( argv[i], L"/capture" ) == 0 )
+		{
+			char path[MAX_PATH];
+			WideCharToMultiByte( CP_ACP, 0, argv[i + 1], -1, path, MAX_PATH, nullptr, nullptr );
+			m_capturePath = path;
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-inflight" ) == 0 || _wcsicmp( argv[i], L"/inflight" ) == 0 )
+		{
+			UINT count = _wtoi( argv[i + 1] );
+			if ( count >= 1 && count <= FrameCount ) m_framesInFlight = count;
+			else PRINTWARN( L"-inflight takes 1 to %u, keeping %u", FrameCount, m_framesInFlight );
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-steprate" ) == 0 || _wcsicmp( argv[i], L"/steprate" ) == 0 )
+		{
+			UINT rate = _wtoi( argv[i + 1] );
+			if ( rate ) m_stepRate = rate;
+			else PRINTWARN( L"-steprate takes a step count per second, keeping %u", m_stepRate );
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-skipping" ) == 0 || _wcsicmp( argv[i], L"/skipping" ) == 0 )
+		{
+			m_emptySpaceSkipping = _wtoi( argv[i + 1] ) != 0;
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-compositing" ) == 0 || _wcsicmp( argv[i], L"/compositing" ) == 0 )
+		{
+			UINT compositing = _wtoi( argv[i + 1] );
+			if ( compositing < CompositeCount ) m_compositing = compositing;
+			else PRINTWARN( L"-compositing takes 0 to %u, keeping %u", CompositeCount - 1, m_compositing );
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-mips" ) == 0 || _wcsicmp( argv[i], L"/mips" ) == 0 )
+		{
+			UINT levels = _wtoi( argv[i + 1] );
+			if ( levels <= MaxMipLevels ) m_mipLevels = levels;
+			else PRINTWARN( L"-mips takes 0 to %u, keeping %u", MaxMipLevels, m_mipLevels );
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-scene" ) == 0 || _wcsicmp( argv[i], L"/scene" ) == 0 )
+		{
+			char name[64];
+			WideCharToMultiByte( CP_ACP, 0, argv[i + 1], -1, name, sizeof( name ), nullptr, nullptr );
+			name[sizeof( name ) - 1] = 0;
+			int scene = FindScene( name );
+			if ( scene >= 0 ) m_scene = scene;
+			else PRINTWARN( L"-scene %s is not a known scene, keeping %S", argv[i + 1], GetScene( m_scene ).name );
+			continue;
+		}
+		if ( _wcsicmp( argv[i], L"-volume" ) != 0 && _wcsicmp( argv[i], L"/volume" ) != 0 ) continue;
+		UINT size[3] = {};
+		int count = swscanf_s( argv[i + 1], L"%ux%ux%u", &size[0], &size[1], &size[2] );
+		if ( count == 1 ) size[1] = size[2] = size[0];
+		if ( ( count == 1 || count == 3 ) && VolumeSizeSupported( m_volumeLayout, size[0], size[1], size[2] ) )
+		{
+			m_volumeWidth = size[0];
+			m_volumeHeight = size[1];
+			m_volumeDepth = size[2];
+		}
+		else PRINTWARN( L"-volume takes N or WxHxD, 1 to %u per axis, keeping %ux%ux%u", VOLUME_MAX_SIZE, m_volumeWidth,
+						m_volumeHeight, m_volumeDepth );
+	}
+	LocalFree( argv );
+	if ( m_volumeFile )
+	{
+		const VolumeFileHeader& header = m_volumeFile->GetHeader();
+		m_volumeWidth = header.width;
+		m_volumeHeight = header.height;
+		m_volumeDepth = header.depth;
+		m_volumeLayout = header.layout;
+	}
+}
+
+// Largest volume dimension over 256, the camera distance and far plane scale with it
+float VolumetricAnimation::GetVolumeExtentScale() const
+{
+	return max( m_volumeWidth, max( m_volumeHeight, m_volumeDepth ) ) / 256.f;
+}
+
 HRESULT VolumetricAnimation::OnInit()
 {
 	HRESULT hr;
+	if ( m_headless )
+	{
+		m_timer.SetFixedTimeStep( true );
+		m_timer.SetTargetElapsedSeconds( m_fixedTimeStep );
+		m_timer.SetManualClock( true );
+	}
+	m_simTimer.SetFixedTimeStep( true );
+	m_simTimer.SetTargetElapsedSeconds( 1.0 / m_stepRate );
+	// Headless frames are -timestep apart, so m_stepRate * m_fixedTimeStep steps fall
+	// due per frame, batched or skipped as in a windowed run
+	if ( m_headless ) m_simTimer.SetManualClock( true, StepTimer::SecondsToTicks( m_fixedTimeStep ) );
 	VRET( LoadPipeline() );
 	VRET( LoadAssets() );
 	VRET( LoadSizeDependentResource() );
+	// Loading is not owed as steps
+	m_simTimer.ResetElapsedTime();
 	return S_OK;
 }
 
@@ -92,28 +285,31 @@ HRESULT VolumetricAnimation::LoadPipeline()
 	VRET( m_device->CreateCommandQueue( &queueDesc, IID_PPV_ARGS( &m_computeCmdQueue ) ) );
 	DXDebugName( m_computeCmdQueue );
 
-	// Describe and create the swap chain.
-	DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
-	swapChainDesc.BufferCount = FrameCount;
-	swapChainDesc.BufferDesc.Width = m_width;
-	swapChainDesc.BufferDesc.Height = m_height;
-	swapChainDesc.BufferDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
-	swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-	swapChainDesc.OutputWindow = m_hwnd;
-	swapChainDesc.SampleDesc.Count = 1;
-	swapChainDesc.Windowed = TRUE;
-
-	ComPtr<IDXGISwapChain> swapChain;
-	// Swap chain needs the queue so that it can force a flush on it.
-	VRET( factory->CreateSwapChain( m_graphicCmdQueue.Get(), &swapChainDesc, &swapChain ) );
-	VRET( swapChain.As( &m_swapChain ) );
-	DXDebugName( m_swapChain );
-
-	// This sample does not support fullscreen transitions.
-	VRET( factory->MakeWindowAssociation( m_hwnd, DXGI_MWA_NO_ALT_ENTER ) );
-
-	m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	// Describe and create the swap chain, headless runs render offscreen.
+	if ( !m_headless )
+	{
+		DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
+		swapChainDesc.BufferCount = FrameCount;
+		swapChainDesc.BufferDesc.Width = m_width;
+		swapChainDesc.BufferDesc.Height = m_height;
+		swapChainDesc.BufferDesc.Format = BackBufferFormat;
+		swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+		swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		swapChainDesc.OutputWindow = m_hwnd;
+		swapChainDesc.SampleDesc.Count = 1;
+		swapChainDesc.Windowed = TRUE;
+
+		ComPtr<IDXGISwapChain> swapChain;
+		// Swap chain needs the queue so that it can force a flush on it.
+		VRET( factory->CreateSwapChain( m_graphicCmdQueue.Get(), &swapChainDesc, &swapChain ) );
+		VRET( swapChain.As( &m_swapChain ) );
+		DXDebugName( m_swapChain );
+
+		// This sample does not support fullscreen transitions.
+		VRET( factory->MakeWindowAssociation( m_hwnd, DXGI_MWA_NO_ALT_ENTER ) );
+
+		m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	}
 
 	// Create descriptor heaps.
 	{
@@ -131,7 +327,8 @@ HRESULT VolumetricAnimation::LoadPipeline()
 		// Flags indicate that this descriptor heap can be bound to the pipeline
 		// and that descriptors contained in it can be reference by a root table
 		D3D12_DESCRIPTOR_HEAP_DESC cbvsrvuavHeapDesc = {};
-		cbvsrvuavHeapDesc.NumDescriptors = 3; // One for SRV two for CBV (gfx and compute)
+		// See VolumeSRVSlot and UAVTableSlot
+		cbvsrvuavHeapDesc.NumDescriptors = UAVTableSlot + 2 * UAVTableSize;
 		cbvsrvuavHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 		cbvsrvuavHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 		VRET( m_device->CreateDescriptorHeap( &cbvsrvuavHeapDesc, IID_PPV_ARGS( &m_cbvsrvuavHeap ) ) );
@@ -148,11 +345,22 @@ HRESULT VolumetricAnimation::LoadPipeline()
 		DXDebugName( m_dsvHeap );
 	}
 
-	VRET( m_device->CreateCommandAllocator( D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS( &m_graphicCmdAllocator ) ) );
-	DXDebugName( m_graphicCmdAllocator );
-	
-	VRET( m_device->CreateCommandAllocator( D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS( &m_computeCmdAllocator ) ) );
-	DXDebugName( m_computeCmdAllocator );
+	// Every frame in flight records into allocators of its own
+	for ( UINT i = 0; i < m_framesInFlight; i++ )
+	{
+		VRET( m_device->CreateCommandAllocator( D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS( &m_frames[i].graphicCmdAllocator ) ) );
+		DXDebugName( m_frames[i].graphicCmdAllocator );
+
+		VRET( m_device->CreateCommandAllocator( D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS( &m_frames[i].computeCmdAllocator ) ) );
+		DXDebugName( m_frames[i].computeCmdAllocator );
+	}
+
+	// Begin and end of the step and of the graphics work of every frame context
+	D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+	queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDesc.Count = TimestampsPerFrame * FrameCount;
+	VRET( m_device->CreateQueryHeap( &queryHeapDesc, IID_PPV_ARGS( &m_timestampHeap ) ) );
+	DXDebugName( m_timestampHeap );
 
 	return S_OK;
 }
@@ -164,15 +372,15 @@ HRESULT VolumetricAnimation::LoadAssets()
 
 	// Create a root signature consisting of a descriptor table with a CBV SRV and a sampler.
 	{
-		CD3DX12_DESCRIPTOR_RANGE ranges[3];
+		CD3DX12_DESCRIPTOR_RANGE ranges[2];
 		CD3DX12_ROOT_PARAMETER rootParameters[3];
 
-		ranges[0].Init( D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0 );
-		ranges[1].Init( D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0 );
-		ranges[2].Init( D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0 );
-		rootParameters[RootParameterCBV].InitAsDescriptorTable( 1, &ranges[0], D3D12_SHADER_VISIBILITY_ALL );
-		rootParameters[RootParameterSRV].InitAsDescriptorTable( 1, &ranges[1], D3D12_SHADER_VISIBILITY_PIXEL );
-		rootParameters[RootParameterUAV].InitAsDescriptorTable( 1, &ranges[2], D3D12_SHADER_VISIBILITY_ALL );
+		ranges[0].Init( D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0 );
+		ranges[1].Init( D3D12_DESCRIPTOR_RANGE_TYPE_UAV, UAVTableSize, 0 );
+		// A root CBV, every frame in flight points it at its own slice of the constant buffer
+		rootParameters[RootParameterCBV].InitAsConstantBufferView( 0, 0, D3D12_SHADER_VISIBILITY_ALL );
+		rootParameters[RootParameterSRV].InitAsDescriptorTable( 1, &ranges[0], D3D12_SHADER_VISIBILITY_PIXEL );
+		rootParameters[RootParameterUAV].InitAsDescriptorTable( 1, &ranges[1], D3D12_SHADER_VISIBILITY_ALL );
 
 		D3D12_STATIC_SAMPLER_DESC sampler = {};
 		sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_POINT;
@@ -221,12 +429,32 @@ HRESULT VolumetricAnimation::LoadAssets()
 		ComPtr<ID3DBlob> vertexShader;
 		ComPtr<ID3DBlob> pixelShader;
 		ComPtr<ID3DBlob> computeShader;
+		ComPtr<ID3DBlob> rangeComputeShader;
 
 		UINT compileFlags = 0;
 
-		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "vsmain", "vs_5_0", compileFlags, 0, &vertexShader ) );
-		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "psmain", "ps_5_0", compileFlags, 0, &pixelShader ) );
-		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "csmain", "cs_5_0", compileFlags, 0, &computeShader ) );
+		char layout[16];
+		sprintf_s( layout, "%u", m_volumeLayout );
+		char compositing[16];
+		sprintf_s( compositing, "%u", m_compositing );
+		char mipLevels[16];
+		sprintf_s( mipLevels, "%u", m_mipLevels );
+		char volumeSize[3][16];
+		sprintf_s( volumeSize[0], "%u", m_volumeWidth );
+		sprintf_s( volumeSize[1], "%u", m_volumeHeight );
+		sprintf_s( volumeSize[2], "%u", m_volumeDepth );
+		D3D_SHADER_MACRO macros[] = { { "VOLUME_WIDTH", volumeSize[0] }, { "VOLUME_HEIGHT", volumeSize[1] },
+									  { "VOLUME_DEPTH", volumeSize[2] },
+									  { "VOLUME_LAYOUT", layout }, { "EMPTY_SPACE_SKIPPING", m_emptySpaceSkipping ? "1" : "0" },
+									  { "COMPOSITING", compositing },
+									  { "MIP_LEVELS", mipLevels }, { "SAMPLE_COUNTERS", m_sampleCounters ? "1" : "0" },
+									  { nullptr, nullptr } };
+
+		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "vsmain", "vs_5_0", compileFlags, 0, &vertexShader ) );
+		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "psmain", "ps_5_0", compileFlags, 0, &pixelShader ) );
+		VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "csmain", "cs_5_0", compileFlags, 0, &computeShader ) );
+		if ( m_emptySpaceSkipping )
+			VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "csrange", "cs_5_0", compileFlags, 0, &rangeComputeShader ) );
 		// Define the vertex input layout.
 		D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
 		{
@@ -264,16 +492,40 @@ HRESULT VolumetricAnimation::LoadAssets()
 
 		VRET( m_device->CreateComputePipelineState( &computePsoDesc, IID_PPV_ARGS( &m_computeState ) ) );
 		DXDebugName( m_computeState );
+
+		if ( m_emptySpaceSkipping )
+		{
+			computePsoDesc.CS = { reinterpret_cast< UINT8* >( rangeComputeShader->GetBufferPointer() ), rangeComputeShader->GetBufferSize() };
+			VRET( m_device->CreateComputePipelineState( &computePsoDesc, IID_PPV_ARGS( &m_rangeComputeState ) ) );
+			DXDebugName( m_rangeComputeState );
+		}
+
+		// csmip reads the level above the one it builds, MIP_LEVEL picks it
+		for ( UINT level = 1; level <= m_mipLevels; level++ )
+		{
+			char mipLevel[16];
+			sprintf_s( mipLevel, "%u", level );
+			D3D_SHADER_MACRO mipMacros[_countof( macros ) + 1];
+			memcpy( mipMacros, macros, sizeof( macros ) );
+			mipMacros[_countof( macros ) - 1] = { "MIP_LEVEL", mipLevel };
+			mipMacros[_countof( macros )] = { nullptr, nullptr };
+
+			ComPtr<ID3DBlob> mipComputeShader;
+			VRET( CompileShaderFromFile( GetAssetFullPath( _T( "VolumetricAnimation_shader.hlsl" ) ).c_str(), mipMacros, D3D_COMPILE_STANDARD_FILE_INCLUDE, "csmip", "cs_5_0", compileFlags, 0, &mipComputeShader ) );
+			computePsoDesc.CS = { reinterpret_cast< UINT8* >( mipComputeShader->GetBufferPointer() ), mipComputeShader->GetBufferSize() };
+			VRET( m_device->CreateComputePipelineState( &computePsoDesc, IID_PPV_ARGS( &m_mipComputeState[level - 1] ) ) );
+			DXDebugName( m_mipComputeState[level - 1] );
+		}
 	}
 
 	// Create the compute command list.
-	VRET( m_device->CreateCommandList( 0, D3D12_COMMAND_LIST_TYPE_COMPUTE, m_computeCmdAllocator.Get(),m_computeState.Get(), IID_PPV_ARGS( &m_computeCmdList ) ) );
+	VRET( m_device->CreateCommandList( 0, D3D12_COMMAND_LIST_TYPE_COMPUTE, m_frames[0].computeCmdAllocator.Get(),m_computeState.Get(), IID_PPV_ARGS( &m_computeCmdList ) ) );
 	DXDebugName( m_computeCmdList );
 
 	VRET( m_computeCmdList->Close() );
 
 	// Create the graphics command list.
-	VRET( m_device->CreateCommandList( 0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_graphicCmdAllocator.Get(), m_pipelineState.Get(), IID_PPV_ARGS( &m_graphicCmdList ) ) );
+	VRET( m_device->CreateCommandList( 0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_frames[0].graphicCmdAllocator.Get(), m_pipelineState.Get(), IID_PPV_ARGS( &m_graphicCmdList ) ) );
 	DXDebugName( m_graphicCmdList );
 
 	// Note: ComPtr's are CPU objects but this resource needs to stay in scope until
@@ -282,17 +534,38 @@ HRESULT VolumetricAnimation::LoadAssets()
 	// prematurely destroyed.
 	ComPtr<ID3D12Resource> volumeBufferUploadHeap;
 
+	// One structured buffer view addresses at most 2^27 voxels, 512^3 in the linear
+	// layout, and past that the buffer would also outgrow the 2GB a resource may take.
+	// The CPU engine has no such limit.
+	if ( m_volumeStorageCount > ( 1u << D3D12_REQ_BUFFER_RESOURCE_TEXEL_COUNT_2_TO_EXP ) )
+	{
+		PRINTERROR( L"%ux%ux%u voxels (%u stored) do not fit one buffer view", m_volumeWidth, m_volumeHeight,
+					m_volumeDepth, m_volumeStorageCount );
+		return E_INVALIDARG;
+	}
+
+	// Per channel minimum and maximum of every brick, then of every cell, as in
+	// g_bufBrickRange. Filled from the initial volume below.
+	UINT rangeCount = m_brickCount + m_cellCount;
+	UINT* brickRange = ( UINT* ) malloc( rangeCount * 2 * sizeof( UINT ) );
+	// The levels of g_bufVolumeMips, averaged from the initial volume below as csmip does
+	UINT* volumeMips = ( UINT* ) malloc( max( m_mipStorageCount, 1u ) * sizeof( UINT ) );
+
 	// Create the volumeBuffer.
 	{
-		UINT volumeBufferSize = m_volumeDepth*m_volumeHeight*m_volumeWidth * 4 * sizeof( UINT8 );
+		UINT64 volumeBufferSize = static_cast< UINT64 >( m_volumeStorageCount ) * 4 * sizeof( UINT8 );
 
 		D3D12_RESOURCE_DESC bufferDesc = CD3DX12_RESOURCE_DESC::Buffer( volumeBufferSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS );
 		D3D12_RESOURCE_DESC uploadBufferDesc = CD3DX12_RESOURCE_DESC::Buffer( volumeBufferSize );
 
-		VRET( m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ),D3D12_HEAP_FLAG_NONE,
-												 &bufferDesc,D3D12_RESOURCE_STATE_COPY_DEST,nullptr,IID_PPV_ARGS( &m_volumeBuffer ) ) );
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+													 &bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS( &m_volumeBuffer[i] ) ) );
+			DXDebugName( m_volumeBuffer[i] );
+		}
 
-		const UINT64 uploadBufferSize = GetRequiredIntermediateSize( m_volumeBuffer.Get(), 0, 1 );
+		const UINT64 uploadBufferSize = GetRequiredIntermediateSize( m_volumeBuffer[0].Get(), 0, 1 );
 
 		// Create the GPU upload buffer.
 		VRET( m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ),D3D12_HEAP_FLAG_NONE,
@@ -301,39 +574,68 @@ HRESULT VolumetricAnimation::LoadAssets()
 
 		// Copy data to the intermediate upload heap and then schedule a copy 
 		// from the upload heap to the Texture2D.
-		UINT8* volumeBuffer = ( UINT8* ) malloc( volumeBufferSize );
-		memset( volumeBuffer, 64, volumeBufferSize );
-		//float radius = m_volumeHeight / 2.f;
-		float a = m_volumeWidth / 2.f;
-		float b = m_volumeHeight / 2.f;
-		float c = m_volumeDepth / 2.f;
-		float radius = sqrt( a*a + b*b + c*c );
-
-		for ( UINT z = 0; z < m_volumeDepth; z++ )
-			for ( UINT y = 0; y < m_volumeHeight; y++ )
-				for ( UINT x = 0; x < m_volumeWidth; x++ )
-				{
-					float _x = x - m_volumeWidth / 2.f;
-					float _y = y - m_volumeHeight / 2.f;
-					float _z = z - m_volumeDepth / 2.f;
-					//float currentRaidus =abs(_x)+abs(_y)+abs(_z);
-					float currentRaidus = sqrt( _x*_x + _y*_y + _z*_z );
-					float scale = currentRaidus *3.f / radius;
-					UINT idx = 4 - (UINT)floor( scale );
-					UINT interm = ( UINT ) ( 192 * scale +0.5f );
-					UINT8 col = interm % 192+1;
-					volumeBuffer[( x + y*m_volumeWidth + z*m_volumeHeight*m_volumeWidth ) * 4 + 0] += col * m_constantBufferData.colVal[idx].x;
-					volumeBuffer[( x + y*m_volumeWidth + z*m_volumeHeight*m_volumeWidth ) * 4 + 1] += col * m_constantBufferData.colVal[idx].y;
-					volumeBuffer[( x + y*m_volumeWidth + z*m_volumeHeight*m_volumeWidth ) * 4 + 2] += col * m_constantBufferData.colVal[idx].z;
-					volumeBuffer[( x + y*m_volumeWidth + z*m_volumeHeight*m_volumeWidth ) * 4 + 3] = m_constantBufferData.colVal[idx].w;
-				}
+		// The start volume, filled in parallel, see VolumeScene.h
+		VolumeParams params;
+		for ( UINT i = 0; i < 6; i++ )
+		{
+			params.colVal[i][0] = m_constantBufferData.colVal[i].x;
+			params.colVal[i][1] = m_constantBufferData.colVal[i].y;
+			params.colVal[i][2] = m_constantBufferData.colVal[i].z;
+			params.colVal[i][3] = m_constantBufferData.colVal[i].w;
+		}
+		params.bgCol[0] = m_constantBufferData.bgCol.x;
+		params.bgCol[1] = m_constantBufferData.bgCol.y;
+		params.bgCol[2] = m_constantBufferData.bgCol.z;
+		params.bgCol[3] = m_constantBufferData.bgCol.w;
+		// A volume file is read in place, its pages come in from the file cache as the
+		// range and mip builds below and the upload touch them
+		std::vector<UINT> volume;
+		const UINT* volumeVoxels = m_volumeFile ? m_volumeFile->GetVoxels() : nullptr;
+		TaskPool pool;
+		if ( !volumeVoxels )
+		{
+			volume.resize( m_volumeStorageCount );
+			GenerateScene( m_scene, SceneParams::Default(), params, m_volumeLayout, m_volumeWidth, m_volumeHeight, m_volumeDepth,
+						   volume.data(), &pool );
+			volumeVoxels = volume.data();
+		}
+		const UINT8* volumeBuffer = reinterpret_cast< const UINT8* >( volumeVoxels );
+
+		VolumeView view = { volumeVoxels, m_volumeWidth, m_volumeHeight, m_volumeDepth, m_volumeLayout };
+		BuildBrickRanges( view, brickRange, pool );
+		BuildCellRanges( m_volumeWidth, m_volumeHeight, m_volumeDepth, brickRange, nullptr, true, brickRange + m_brickCount * 2 );
+		if ( m_mipLevels )
+		{
+			// The levels one after the other, as in g_bufVolumeMips
+			VolumeMipChain mips( m_volumeWidth, m_volumeHeight, m_volumeDepth, m_mipLevels );
+			mips.Update( view, nullptr, pool );
+			UINT* mip = volumeMips;
+			for ( UINT level = 1; level <= mips.GetLevelCount(); level++ )
+			{
+				UINT count = mips.GetWidth( level ) * mips.GetHeight( level ) * mips.GetDepth( level );
+				memcpy( mip, mips.GetVoxels( level ), count * sizeof( UINT ) );
+				mip += count;
+			}
+		}
 		D3D12_SUBRESOURCE_DATA volumeBufferData = {};
 		volumeBufferData.pData = &volumeBuffer[0];
 		volumeBufferData.RowPitch = volumeBufferSize;
 		volumeBufferData.SlicePitch = volumeBufferData.RowPitch;
 
-		UpdateSubresources( m_graphicCmdList.Get(), m_volumeBuffer.Get(), volumeBufferUploadHeap.Get(), 0, 0, 1, &volumeBufferData );
-		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+		UpdateSubresources( m_graphicCmdList.Get(), m_volumeBuffer[0].Get(), volumeBufferUploadHeap.Get(), 0, 0, 1, &volumeBufferData );
+		// UpdateSubresources copied the voxels into the upload heap already
+		m_volumeFile.reset();
+		// The other buffer starts out the same
+		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer[0].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COPY_SOURCE ) );
+		m_graphicCmdList->CopyResource( m_volumeBuffer[1].Get(), m_volumeBuffer[0].Get() );
+		// Both are left in the common state. Each queue promotes them to the states it
+		// uses and they decay back at the end of every ExecuteCommandLists, so psmain
+		// and csmain may read one buffer at once and no queue transitions them.
+		D3D12_RESOURCE_BARRIER commonBarriers[] = {
+			CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer[0].Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON ),
+			CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer[1].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON )
+		};
+		m_graphicCmdList->ResourceBarrier( 2, commonBarriers );
 
 		// Describe and create a SRV for the volumeBuffer.
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
@@ -341,26 +643,206 @@ HRESULT VolumetricAnimation::LoadAssets()
 		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
 		srvDesc.Buffer.FirstElement = 0;
-		srvDesc.Buffer.NumElements = m_volumeDepth*m_volumeHeight*m_volumeWidth;
+		srvDesc.Buffer.NumElements = m_volumeStorageCount;
 		srvDesc.Buffer.StructureByteStride = 4 * sizeof( UINT8 );
 		srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
 
-		CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), RootParameterSRV, m_cbvsrvuavDescriptorSize );
-		m_device->CreateShaderResourceView( m_volumeBuffer.Get(), &srvDesc, srvHandle );
-
 		// Describe and create a UAV for the volumeBuffer.
 		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
 		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
 		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
 		uavDesc.Buffer.FirstElement = 0;
-		uavDesc.Buffer.NumElements = m_volumeWidth*m_volumeHeight*m_volumeDepth;
+		uavDesc.Buffer.NumElements = m_volumeStorageCount;
 		uavDesc.Buffer.StructureByteStride = 4 * sizeof( UINT8 );
 		uavDesc.Buffer.CounterOffsetInBytes = 0;
 		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
-		CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), RootParameterUAV, m_cbvsrvuavDescriptorSize );
-		m_device->CreateUnorderedAccessView( m_volumeBuffer.Get(), nullptr, &uavDesc, uavHandle );
-		free( volumeBuffer );
+		// A SRV and a UAV table per buffer
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), VolumeSRVSlot + i, m_cbvsrvuavDescriptorSize );
+			m_device->CreateShaderResourceView( m_volumeBuffer[i].Get(), &srvDesc, srvHandle );
+			CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), UAVTableSlot + i * UAVTableSize, m_cbvsrvuavDescriptorSize );
+			m_device->CreateUnorderedAccessView( m_volumeBuffer[i].Get(), nullptr, &uavDesc, uavHandle );
+		}
+	}
+
+	// Create the brick state buffer, every brick starts active (BRICK_CHANGED) and the
+	// counter at zero.
+	ComPtr<ID3D12Resource> brickStateUploadHeap;
+	{
+		UINT brickStateSize = ( m_brickCount + 1 ) * sizeof( UINT );
+
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( brickStateSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS ),
+												 D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS( &m_brickStateBuffer ) ) );
+		DXDebugName( m_brickStateBuffer );
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( brickStateSize ), D3D12_RESOURCE_STATE_GENERIC_READ,
+												 nullptr, IID_PPV_ARGS( &brickStateUploadHeap ) ) );
+		for ( UINT i = 0; i < m_framesInFlight; i++ )
+		{
+			VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_READBACK ), D3D12_HEAP_FLAG_NONE,
+													 &CD3DX12_RESOURCE_DESC::Buffer( CounterBytes + TimestampsPerFrame * sizeof( UINT64 ) ),
+													 D3D12_RESOURCE_STATE_COPY_DEST,
+													 nullptr, IID_PPV_ARGS( &m_frames[i].counterReadback ) ) );
+			DXDebugName( m_frames[i].counterReadback );
+		}
+
+		UINT* brickState = ( UINT* ) malloc( brickStateSize );
+		for ( UINT i = 0; i < m_brickCount; i++ ) brickState[i] = 1;
+		brickState[m_brickCount] = 0;
+		D3D12_SUBRESOURCE_DATA brickStateData = {};
+		brickStateData.pData = brickState;
+		brickStateData.RowPitch = brickStateSize;
+		brickStateData.SlicePitch = brickStateSize;
+
+		UpdateSubresources<1>( m_graphicCmdList.Get(), m_brickStateBuffer.Get(), brickStateUploadHeap.Get(), 0, 0, 1, &brickStateData );
+		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_brickStateBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = m_brickCount + 1;
+		uavDesc.Buffer.StructureByteStride = sizeof( UINT );
+		uavDesc.Buffer.CounterOffsetInBytes = 0;
+		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), UAVTableSlot + i * UAVTableSize + 1, m_cbvsrvuavDescriptorSize );
+			m_device->CreateUnorderedAccessView( m_brickStateBuffer.Get(), nullptr, &uavDesc, uavHandle );
+		}
+		free( brickState );
+	}
+
+	// Create the render counter buffer, psmain's counters start at zero.
+	ComPtr<ID3D12Resource> renderCounterUploadHeap;
+	{
+		const UINT renderCounters[3] = {};
+		const UINT renderCounterSize = sizeof( renderCounters );
+
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( renderCounterSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS ),
+												 D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS( &m_renderCounterBuffer ) ) );
+		DXDebugName( m_renderCounterBuffer );
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( renderCounterSize ), D3D12_RESOURCE_STATE_GENERIC_READ,
+												 nullptr, IID_PPV_ARGS( &renderCounterUploadHeap ) ) );
+
+		D3D12_SUBRESOURCE_DATA renderCounterData = {};
+		renderCounterData.pData = renderCounters;
+		renderCounterData.RowPitch = renderCounterSize;
+		renderCounterData.SlicePitch = renderCounterSize;
+
+		UpdateSubresources<1>( m_graphicCmdList.Get(), m_renderCounterBuffer.Get(), renderCounterUploadHeap.Get(), 0, 0, 1, &renderCounterData );
+		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderCounterBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = _countof( renderCounters );
+		uavDesc.Buffer.StructureByteStride = sizeof( UINT );
+		uavDesc.Buffer.CounterOffsetInBytes = 0;
+		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), UAVTableSlot + i * UAVTableSize + 4, m_cbvsrvuavDescriptorSize );
+			m_device->CreateUnorderedAccessView( m_renderCounterBuffer.Get(), nullptr, &uavDesc, uavHandle );
+		}
+	}
+
+	// Create the brick range buffers, csmain and csrange keep them up to date afterwards.
+	// Both are filled through one upload heap, with the same data.
+	ComPtr<ID3D12Resource> brickRangeUploadHeap;
+	{
+		UINT brickRangeSize = rangeCount * 2 * sizeof( UINT );
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+													 &CD3DX12_RESOURCE_DESC::Buffer( brickRangeSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS ),
+													 D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS( &m_brickRangeBuffer[i] ) ) );
+			DXDebugName( m_brickRangeBuffer[i] );
+		}
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( brickRangeSize ), D3D12_RESOURCE_STATE_GENERIC_READ,
+												 nullptr, IID_PPV_ARGS( &brickRangeUploadHeap ) ) );
+
+		D3D12_SUBRESOURCE_DATA brickRangeData = {};
+		brickRangeData.pData = brickRange;
+		brickRangeData.RowPitch = brickRangeSize;
+		brickRangeData.SlicePitch = brickRangeSize;
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			UpdateSubresources<1>( m_graphicCmdList.Get(), m_brickRangeBuffer[i].Get(), brickRangeUploadHeap.Get(), 0, 0, 1, &brickRangeData );
+			m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_brickRangeBuffer[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+		}
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = rangeCount;
+		uavDesc.Buffer.StructureByteStride = 2 * sizeof( UINT );
+		uavDesc.Buffer.CounterOffsetInBytes = 0;
+		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), UAVTableSlot + i * UAVTableSize + 2, m_cbvsrvuavDescriptorSize );
+			m_device->CreateUnorderedAccessView( m_brickRangeBuffer[i].Get(), nullptr, &uavDesc, uavHandle );
+		}
+		free( brickRange );
+	}
+
+	// Create the mip buffers, csmip keeps them up to date afterwards. Without mip levels
+	// their descriptors stay null views.
+	ComPtr<ID3D12Resource> volumeMipUploadHeap;
+	{
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = m_mipStorageCount;
+		uavDesc.Buffer.StructureByteStride = sizeof( UINT );
+		uavDesc.Buffer.CounterOffsetInBytes = 0;
+		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+		if ( m_mipStorageCount )
+		{
+			UINT volumeMipSize = m_mipStorageCount * sizeof( UINT );
+
+			VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ), D3D12_HEAP_FLAG_NONE,
+													 &CD3DX12_RESOURCE_DESC::Buffer( volumeMipSize ), D3D12_RESOURCE_STATE_GENERIC_READ,
+													 nullptr, IID_PPV_ARGS( &volumeMipUploadHeap ) ) );
+
+			D3D12_SUBRESOURCE_DATA volumeMipData = {};
+			volumeMipData.pData = volumeMips;
+			volumeMipData.RowPitch = volumeMipSize;
+			volumeMipData.SlicePitch = volumeMipSize;
+
+			for ( UINT i = 0; i < 2; i++ )
+			{
+				VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_DEFAULT ), D3D12_HEAP_FLAG_NONE,
+														 &CD3DX12_RESOURCE_DESC::Buffer( volumeMipSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS ),
+														 D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS( &m_volumeMipBuffer[i] ) ) );
+				DXDebugName( m_volumeMipBuffer[i] );
+				UpdateSubresources<1>( m_graphicCmdList.Get(), m_volumeMipBuffer[i].Get(), volumeMipUploadHeap.Get(), 0, 0, 1, &volumeMipData );
+				m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_volumeMipBuffer[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+			}
+		}
+
+		for ( UINT i = 0; i < 2; i++ )
+		{
+			CD3DX12_CPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart(), UAVTableSlot + i * UAVTableSize + 3, m_cbvsrvuavDescriptorSize );
+			m_device->CreateUnorderedAccessView( m_volumeMipBuffer[i].Get(), nullptr, &uavDesc, uavHandle );
+		}
+		free( volumeMips );
 	}
 
 	// Create the vertex buffer.
@@ -371,17 +853,20 @@ HRESULT VolumetricAnimation::LoadAssets()
 	// prematurely destroyed.
 	ComPtr<ID3D12Resource> vertexBufferUpload;
 	{
-		// Define the geometry for a triangle.
+		// The proxy box of psmain, the volume centred on the origin at one unit per voxel
+		const float x = m_volumeWidth * 0.5f;
+		const float y = m_volumeHeight * 0.5f;
+		const float z = m_volumeDepth * 0.5f;
 		Vertex cubeVertices[] =
 		{
-			{ XMFLOAT3( -128.f, -128.f, -128.f ) },
-			{ XMFLOAT3( -128.f, -128.f,  128.f ) },
-			{ XMFLOAT3( -128.f,  128.f, -128.f ) },
-			{ XMFLOAT3( -128.f,  128.f,  128.f ) },
-			{ XMFLOAT3( 128.f, -128.f, -128.f )},
-			{ XMFLOAT3( 128.f, -128.f,  128.f )},
-			{ XMFLOAT3( 128.f,  128.f, -128.f )},
-			{ XMFLOAT3( 128.f,  128.f,  128.f )},
+			{ XMFLOAT3( -x, -y, -z ) },
+			{ XMFLOAT3( -x, -y,  z ) },
+			{ XMFLOAT3( -x,  y, -z ) },
+			{ XMFLOAT3( -x,  y,  z ) },
+			{ XMFLOAT3( x, -y, -z )},
+			{ XMFLOAT3( x, -y,  z )},
+			{ XMFLOAT3( x,  y, -z )},
+			{ XMFLOAT3( x,  y,  z )},
 		};
 
 		const UINT vertexBufferSize = sizeof( cubeVertices );
@@ -453,17 +938,20 @@ HRESULT VolumetricAnimation::LoadAssets()
 												 nullptr, IID_PPV_ARGS( &m_constantBuffer ) ) );
 		DXDebugName( m_constantBuffer );
 
-		// Describe and create a constant buffer view.
-		D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-		cbvDesc.BufferLocation = m_constantBuffer->GetGPUVirtualAddress();
-		cbvDesc.SizeInBytes = ( sizeof( ConstantBuffer ) + 255 ) & ~255;	// CB size is required to be 256-byte aligned.
-		m_device->CreateConstantBufferView( &cbvDesc, m_cbvsrvuavHeap->GetCPUDescriptorHandleForHeapStart() );
-
 		// Initialize and map the constant buffers. We don't unmap this until the
 		// app closes. Keeping things mapped for the lifetime of the resource is okay.
+		UINT8* pCbvDataBegin;
 		CD3DX12_RANGE readRange( 0, 0 );		// We do not intend to read from this resource on the CPU.
-		VRET( m_constantBuffer->Map( 0, &readRange, reinterpret_cast< void** >( &m_pCbvDataBegin ) ) );
-		memcpy( m_pCbvDataBegin, &m_constantBufferData, sizeof( m_constantBufferData ) );
+		VRET( m_constantBuffer->Map( 0, &readRange, reinterpret_cast< void** >( &pCbvDataBegin ) ) );
+
+		// A slice per frame in flight, CB size is required to be 256-byte aligned.
+		const UINT sliceSize = ( sizeof( ConstantBuffer ) + 255 ) & ~255;
+		for ( UINT i = 0; i < m_framesInFlight; i++ )
+		{
+			m_frames[i].pCbvData = pCbvDataBegin + i * sliceSize;
+			m_frames[i].cbvAddress = m_constantBuffer->GetGPUVirtualAddress() + i * sliceSize;
+			memcpy( m_frames[i].pCbvData, &m_constantBufferData, sizeof( m_constantBufferData ) );
+		}
 	}
 
 	// Close the command list and execute it to begin the initial GPU setup.
@@ -476,6 +964,8 @@ HRESULT VolumetricAnimation::LoadAssets()
 		VRET( m_device->CreateFence( 0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS( &m_fence ) ) );
 		DXDebugName( m_fence );
 		m_fenceValue = 1;
+		VRET( m_device->CreateFence( 0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS( &m_computeFence ) ) );
+		DXDebugName( m_computeFence );
 
 		// Create an event handle to use for frame synchronization.
 		m_fenceEvent = CreateEvent( nullptr, FALSE, FALSE, nullptr );
@@ -490,8 +980,22 @@ HRESULT VolumetricAnimation::LoadAssets()
 		WaitForGraphicsCmd();
 	}
 
+	// Relate the timestamps of both queues to the CPU clock once, for the overlap of
+	// the step with the graphics work in ReadFrameCounters
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency( &frequency );
+		m_cpuFrequency = frequency.QuadPart;
+		VRET( m_computeCmdQueue->GetTimestampFrequency( &m_computeClock.frequency ) );
+		VRET( m_computeCmdQueue->GetClockCalibration( &m_computeClock.gpuTimestamp, &m_computeClock.cpuTimestamp ) );
+		VRET( m_graphicCmdQueue->GetTimestampFrequency( &m_graphicsClock.frequency ) );
+		VRET( m_graphicCmdQueue->GetClockCalibration( &m_graphicsClock.gpuTimestamp, &m_graphicsClock.cpuTimestamp ) );
+	}
+
 
-	XMVECTORF32 vecEye = { 500.0f, 500.0f, -500.0f };
+	// The view of a 256^3 volume, farther out for larger ones
+	const float extent = GetVolumeExtentScale();
+	XMVECTORF32 vecEye = { 500.0f * extent, 500.0f * extent, -500.0f * extent };
 	XMVECTORF32 vecAt = { 0.0f, 0.0f, 0.0f };
 	m_camera.SetViewParams( vecEye, vecAt );
 	m_camera.SetEnablePositionMovement( true );
@@ -508,7 +1012,7 @@ HRESULT VolumetricAnimation::LoadSizeDependentResource()
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle( m_rtvHeap->GetCPUDescriptorHandleForHeapStart() );
 	for ( UINT i = 0; i < FrameCount; i++ )
 	{
-		VRET( m_swapChain->GetBuffer( i, IID_PPV_ARGS( &m_renderTargets[i] ) ) );
+		VRET( CreateBackBuffer( m_device.Get(), m_swapChain.Get(), i, BackBufferFormat, &m_renderTargets[i] ) );
 		DXDebugName( m_renderTargets[i] );
 		m_device->CreateRenderTargetView( m_renderTargets[i].Get(), nullptr, rtvHandle );
 		rtvHandle.Offset( 1, m_rtvDescriptorSize );
@@ -541,11 +1045,69 @@ HRESULT VolumetricAnimation::LoadSizeDependentResource()
 	m_scissorRect.bottom = static_cast< LONG >( m_height );
 
 	float fAspectRatio = m_width / ( FLOAT ) m_height;
-	m_camera.SetProjParams( XM_PI / 4, fAspectRatio, 0.01f, 1250.0f );
+	m_camera.SetProjParams( XM_PI / 4, fAspectRatio, 0.01f, 1250.0f * GetVolumeExtentScale() );
+	m_constantBufferData.lodScale = 2.f * tanf( XM_PI / 8 ) / m_height;
 	m_camera.SetWindow( m_width, m_height );
+
+	if ( !m_capturePath.empty() ) VRET( CreateCapture() );
+	return S_OK;
+}
+
+// Readback buffers for the back buffer at the current size, one per frame in flight.
+// A Y4M stream cannot change size, a resize ends the capture there; sequences go on
+// at the new size. The frames in flight are retired before.
+HRESULT VolumetricAnimation::CreateCapture()
+{
+	HRESULT hr;
+	const CaptureFormat format = GetCaptureFormatFromPath( m_capturePath.c_str() );
+	for ( UINT i = 0; i < m_framesInFlight; i++ )
+		m_frames[i].captureReadback.Reset();
+	if ( m_capture && format == CaptureY4M )
+	{
+		PRINTWARN( L"window resized, capture stopped" );
+		m_capture.reset();
+		m_capturePath.clear();
+		return S_OK;
+	}
+	m_capture.reset();
+
+	D3D12_RESOURCE_DESC desc = m_renderTargets[0]->GetDesc();
+	UINT64 bytes;
+	m_device->GetCopyableFootprints( &desc, 0, 1, 0, &m_captureFootprint, nullptr, nullptr, &bytes );
+	for ( UINT i = 0; i < m_framesInFlight; i++ )
+	{
+		VRET( m_device->CreateCommittedResource( &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_READBACK ), D3D12_HEAP_FLAG_NONE,
+												 &CD3DX12_RESOURCE_DESC::Buffer( bytes ), D3D12_RESOURCE_STATE_COPY_DEST,
+												 nullptr, IID_PPV_ARGS( &m_frames[i].captureReadback ) ) );
+		DXDebugName( m_frames[i].captureReadback );
+	}
+
+	const CapturePixelFormat pixelFormat =
+		desc.Format == DXGI_FORMAT_R16G16B16A16_FLOAT ? CapturePixelRGBA16Float : CapturePixelRGBA8;
+	m_capture.reset( new FrameCapture( m_capturePath.c_str(), format, pixelFormat, static_cast< uint32_t >( desc.Width ),
+									   desc.Height ) );
+	if ( !m_capture->IsOpen() )
+	{
+		PRINTWARN( L"cannot create the capture file, not capturing" );
+		m_capture.reset();
+		for ( UINT i = 0; i < m_framesInFlight; i++ )
+			m_frames[i].captureReadback.Reset();
+	}
 	return S_OK;
 }
 
+// The copy of a frame is complete once RetireFrame waited for it
+void VolumetricAnimation::CaptureFrame( FrameContext& frame )
+{
+	HRESULT hr;
+	UINT8* pData;
+	CD3DX12_RANGE readRange( 0, static_cast< SIZE_T >( m_captureFootprint.Footprint.RowPitch ) * m_captureFootprint.Footprint.Height );
+	V( frame.captureReadback->Map( 0, &readRange, reinterpret_cast< void** >( &pData ) ) );
+	m_capture->Submit( pData + m_captureFootprint.Offset, m_captureFootprint.Footprint.RowPitch );
+	CD3DX12_RANGE writeRange( 0, 0 );
+	frame.captureReadback->Unmap( 0, &writeRange );
+}
+
 // Update frame-based values.
 void VolumetricAnimation::OnUpdate()
 {
@@ -554,33 +1116,76 @@ void VolumetricAnimation::OnUpdate()
 	float frameChange = 2.0f * frameTime;
 
 	m_camera.FrameMove( frameTime );
+
+	// The steps that fell due since the last frame: several when the frame took longer
+	// than a step, none when it came before the next one
+	UINT32 stepCount = m_simTimer.GetFrameCount();
+	m_simTimer.Tick( NULL );
+	m_pendingSteps = m_simTimer.GetFrameCount() - stepCount;
+	if ( m_pendingSteps > MaxStepsPerFrame )
+	{
+		m_droppedSteps += m_pendingSteps - MaxStepsPerFrame;
+		m_pendingSteps = MaxStepsPerFrame;
+	}
+	m_stepTotal += m_pendingSteps;
 }
 
-// Render the scene.
+// Render the scene. The CPU waits only for the frame m_framesInFlight back, whose
+// context it reuses; the queues order themselves on the GPU: csmain waits for psmain
+// of the frame before last to be done with the volume buffer it writes, psmain for
+// csmain of its frame. The step of a frame so runs alongside psmain of the one before.
+// A frame runs the steps OnUpdate found due in one compute list, or none and renders
+// the last step again.
 void VolumetricAnimation::OnRender()
 {
 	HRESULT hr;
-	PopulateComputeCommandList();
-	ID3D12CommandList* ppComputeCommandLists[] = { m_computeCmdList.Get() };
-	m_computeCmdQueue->ExecuteCommandLists( _countof( ppComputeCommandLists ), ppComputeCommandLists );
+	FrameContext& frame = m_frames[m_contextIndex];
+	RetireFrame( frame );
 
-	WaitForComputeCmd();
+	XMMATRIX view = m_camera.GetViewMatrix();
+	XMMATRIX proj = m_camera.GetProjMatrix();
+
+	XMMATRIX world = XMMatrixRotationY( static_cast< float >( m_timer.GetTotalSeconds() ) );
+	m_constantBufferData.wvp = XMMatrixMultiply( view, proj );
+	//m_constantBufferData.wvp = XMMatrixMultiply( XMMatrixMultiply( world, view ), proj );
+	XMStoreFloat4( &m_constantBufferData.viewPos, m_camera.GetEyePt() );
+	
+	memcpy( frame.pCbvData, &m_constantBufferData, sizeof( m_constantBufferData ) );
+
+	frame.steps = m_pendingSteps;
+	if ( frame.steps )
+	{
+		// A batch of two or more steps writes both volume buffers, so it also waits for
+		// psmain of the frame before
+		UINT64 volumeFenceValue = m_volumeFenceValue[m_volumeIndex ^ 1];
+		if ( frame.steps > 1 ) volumeFenceValue = max( volumeFenceValue, m_volumeFenceValue[m_volumeIndex] );
+		PopulateComputeCommandList( frame );
+		V( m_computeCmdQueue->Wait( m_fence.Get(), volumeFenceValue ) );
+		ID3D12CommandList* ppComputeCommandLists[] = { m_computeCmdList.Get() };
+		m_computeCmdQueue->ExecuteCommandLists( _countof( ppComputeCommandLists ), ppComputeCommandLists );
+		V( m_computeCmdQueue->Signal( m_computeFence.Get(), m_computeFenceValue ) );
+		V( m_graphicCmdQueue->Wait( m_computeFence.Get(), m_computeFenceValue ) );
+		m_computeFenceValue++;
+	}
 
 	// Record all the commands we need to render the scene into the command list.
-	PopulateGraphicsCommandList();
+	PopulateGraphicsCommandList( frame );
 
 	// Execute the command list.
 	ID3D12CommandList* ppGraphicsCommandLists[] = { m_graphicCmdList.Get() };
 	m_graphicCmdQueue->ExecuteCommandLists( _countof( ppGraphicsCommandLists ), ppGraphicsCommandLists );
 
 	// Present the frame.
-	V( m_swapChain->Present( 0, 0 ) );
+	if ( m_swapChain ) V( m_swapChain->Present( 0, 0 ) );
 	m_frameIndex = (m_frameIndex+1)% FrameCount;
 	//m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
 
-	WaitForGraphicsCmd();
-
-
+	V( m_graphicCmdQueue->Signal( m_fence.Get(), m_fenceValue ) );
+	m_volumeFenceValue[m_volumeIndex] = m_fenceValue;
+	frame.fenceValue = m_fenceValue++;
+	m_contextIndex = ( m_contextIndex + 1 ) % m_framesInFlight;
+	// Ends the run loop, headless runs exit with an error
+	if ( FAILED( m_device->GetDeviceRemovedReason() ) ) _error = true;
 }
 
 HRESULT VolumetricAnimation::OnSizeChanged()
@@ -614,10 +1219,44 @@ HRESULT VolumetricAnimation::OnSizeChanged()
 
 void VolumetricAnimation::OnDestroy()
 {
-	// Wait for the GPU to be done with all resources.
+	// Wait for the GPU to be done with all resources, this captures the frames in
+	// flight yet
 	WaitForGraphicsCmd();
+	// Writes the frames still queued
+	m_capture.reset();
 
 	CloseHandle( m_fenceEvent );
+	if ( m_headless && !CheckHeadlessSteps() ) _error = true;
+}
+
+// The steps a headless run recorded and dropped against those its frame count and
+// -timestep / -steprate ratio give, counted per frame from the total step time
+// rather than by replaying m_simTimer
+bool VolumetricAnimation::CheckHeadlessSteps()
+{
+	UINT64 frameTicks = StepTimer::SecondsToTicks( m_fixedTimeStep );
+	UINT64 stepTicks = StepTimer::SecondsToTicks( 1.0 / m_stepRate );
+	// StepTimer takes a frame within 1/4 ms of the step for exactly one step
+	if ( ( frameTicks > stepTicks ? frameTicks - stepTicks : stepTicks - frameTicks ) < StepTimer::TicksPerSecond / 4000 )
+		frameTicks = stepTicks;
+	UINT frames = m_timer.GetFrameCount();
+	UINT expectedSteps = 0;
+	UINT expectedDropped = 0;
+	for ( UINT64 f = 1; f <= frames; f++ )
+	{
+		UINT due = static_cast< UINT >( f * frameTicks / stepTicks - ( f - 1 ) * frameTicks / stepTicks );
+		expectedSteps += min( due, MaxStepsPerFrame );
+		expectedDropped += due > MaxStepsPerFrame ? due - MaxStepsPerFrame : 0;
+	}
+	if ( m_stepTotal == expectedSteps && m_droppedSteps == expectedDropped )
+	{
+		PRINTINFO( L"%u frames of %.2f ms at %u steps/s: %u steps, %u dropped", frames, m_fixedTimeStep * 1000.0,
+				   m_stepRate, m_stepTotal, m_droppedSteps );
+		return true;
+	}
+	PRINTERROR( L"%u frames of %.2f ms at %u steps/s: %u steps and %u dropped, expected %u and %u", frames,
+				m_fixedTimeStep * 1000.0, m_stepRate, m_stepTotal, m_droppedSteps, expectedSteps, expectedDropped );
+	return false;
 }
 
 bool VolumetricAnimation::OnEvent( MSG msg )
@@ -626,28 +1265,18 @@ bool VolumetricAnimation::OnEvent( MSG msg )
 	return false;
 }
 
-void VolumetricAnimation::PopulateGraphicsCommandList()
+void VolumetricAnimation::PopulateGraphicsCommandList( FrameContext& frame )
 {
 	HRESULT hr;
 	// Command list allocators can only be reset when the associated 
 	// command lists have finished execution on the GPU; apps should use 
 	// fences to determine GPU execution progress.
-	V( m_graphicCmdAllocator->Reset() );
+	V( frame.graphicCmdAllocator->Reset() );
 
 	// However, when ExecuteCommandList() is called on a particular command 
 	// list, that command list can then be reset at any time and must be before 
 	// re-recording.
-	V( m_graphicCmdList->Reset( m_graphicCmdAllocator.Get(), m_pipelineState.Get() ) );
-
-	XMMATRIX view = m_camera.GetViewMatrix();
-	XMMATRIX proj = m_camera.GetProjMatrix();
-
-	XMMATRIX world = XMMatrixRotationY( static_cast< float >( m_timer.GetTotalSeconds() ) );
-	m_constantBufferData.wvp = XMMatrixMultiply( view, proj );
-	//m_constantBufferData.wvp = XMMatrixMultiply( XMMatrixMultiply( world, view ), proj );
-	XMStoreFloat4( &m_constantBufferData.viewPos, m_camera.GetEyePt() );
-	
-	memcpy( m_pCbvDataBegin, &m_constantBufferData, sizeof( m_constantBufferData ) );
+	V( m_graphicCmdList->Reset( frame.graphicCmdAllocator.Get(), m_pipelineState.Get() ) );
 
 	// Set necessary state.
 	m_graphicCmdList->SetGraphicsRootSignature( m_graphicsRootSignature.Get() );
@@ -655,21 +1284,22 @@ void VolumetricAnimation::PopulateGraphicsCommandList()
 	ID3D12DescriptorHeap* ppHeaps[] = { m_cbvsrvuavHeap.Get() };
 	m_graphicCmdList->SetDescriptorHeaps( _countof( ppHeaps ), ppHeaps );
 
-	CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), RootParameterCBV, m_cbvsrvuavDescriptorSize );
-	CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), RootParameterSRV, m_cbvsrvuavDescriptorSize );
+	// The volume buffer of the last step, with its ranges and mips
+	CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), VolumeSRVSlot + m_volumeIndex, m_cbvsrvuavDescriptorSize );
+	CD3DX12_GPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), UAVTableSlot + m_volumeIndex * UAVTableSize, m_cbvsrvuavDescriptorSize );
+	const UINT query = static_cast< UINT >( &frame - m_frames ) * TimestampsPerFrame;
+	m_graphicCmdList->EndQuery( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query + 2 );
 
-	m_graphicCmdList->SetGraphicsRootDescriptorTable( RootParameterCBV, cbvHandle );
+	m_graphicCmdList->SetGraphicsRootConstantBufferView( RootParameterCBV, frame.cbvAddress );
 	m_graphicCmdList->SetGraphicsRootDescriptorTable( RootParameterSRV, srvHandle );
+	// psmain reads the brick ranges and counts its samples
+	m_graphicCmdList->SetGraphicsRootDescriptorTable( RootParameterUAV, uavHandle );
 
 	m_graphicCmdList->RSSetViewports( 1, &m_viewport );
 	m_graphicCmdList->RSSetScissorRects( 1, &m_scissorRect );
 
 	// Indicate that the back buffer will be used as a render target.
-	D3D12_RESOURCE_BARRIER resourceBarriersBefore[] = {
-		CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET ),
-		CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE )
-	};
-	m_graphicCmdList->ResourceBarrier( 2, resourceBarriersBefore );
+	m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET ) );
 
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle( m_rtvHeap->GetCPUDescriptorHandleForHeapStart(), m_frameIndex, m_rtvDescriptorSize );
 	m_graphicCmdList->OMSetRenderTargets( 1, &rtvHandle, FALSE, &m_dsvHeap->GetCPUDescriptorHandleForHeapStart() );
@@ -684,65 +1314,193 @@ void VolumetricAnimation::PopulateGraphicsCommandList()
 	m_graphicCmdList->DrawIndexedInstanced( 36, 1, 0, 0, 0 );
 
 	// Indicate that the back buffer will now be used to present.
-	D3D12_RESOURCE_BARRIER resourceBarriersAfter[] = {
-		CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT ),
-		CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer.Get(), D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS )
-	};
-	m_graphicCmdList->ResourceBarrier( 2, resourceBarriersAfter );
+	m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT ) );
+
+	// Copy the frame out for CaptureFrame
+	if ( m_capture )
+	{
+		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_SOURCE ) );
+		CD3DX12_TEXTURE_COPY_LOCATION dst( frame.captureReadback.Get(), m_captureFootprint );
+		CD3DX12_TEXTURE_COPY_LOCATION src( m_renderTargets[m_frameIndex].Get(), 0 );
+		m_graphicCmdList->CopyTextureRegion( &dst, 0, 0, 0, &src, nullptr );
+		m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PRESENT ) );
+	}
+
+	// Copy psmain's sample and ray counters and the timestamps out for ReadFrameCounters
+	m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderCounterBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE ) );
+	m_graphicCmdList->CopyBufferRegion( frame.counterReadback.Get(), sizeof( UINT ), m_renderCounterBuffer.Get(), 0, 3 * sizeof( UINT ) );
+	m_graphicCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_renderCounterBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+	m_graphicCmdList->EndQuery( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query + 3 );
+	m_graphicCmdList->ResolveQueryData( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query + 2, 2, frame.counterReadback.Get(),
+										CounterBytes + 2 * sizeof( UINT64 ) );
 	V( m_graphicCmdList->Close() );
 }
 
-void VolumetricAnimation::PopulateComputeCommandList()
+void VolumetricAnimation::PopulateComputeCommandList( FrameContext& frame )
 {
 	HRESULT hr;
-	V( m_computeCmdAllocator->Reset() );
-	V( m_computeCmdList->Reset( m_computeCmdAllocator.Get(), m_computeState.Get() ) );
-	m_computeCmdList->SetPipelineState( m_computeState.Get() );
+	V( frame.computeCmdAllocator->Reset() );
+	V( m_computeCmdList->Reset( frame.computeCmdAllocator.Get(), m_computeState.Get() ) );
 	m_computeCmdList->SetComputeRootSignature( m_computeRootSignature.Get() );
 	ID3D12DescriptorHeap* ppHeaps[] = { m_cbvsrvuavHeap.Get() };
 	m_computeCmdList->SetDescriptorHeaps( _countof( ppHeaps ), ppHeaps );
-	CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), RootParameterCBV, m_cbvsrvuavDescriptorSize );
-	CD3DX12_GPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), RootParameterUAV, m_cbvsrvuavDescriptorSize );
+	const UINT query = static_cast< UINT >( &frame - m_frames ) * TimestampsPerFrame;
+	m_computeCmdList->EndQuery( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query );
+	m_computeCmdList->SetComputeRootConstantBufferView( RootParameterCBV, frame.cbvAddress );
+
+	for ( UINT step = 0; step < frame.steps; step++ )
+	{
+		// csmain reads the last volume buffer and writes the other one and its set
+		const UINT read = m_volumeIndex;
+		const UINT write = m_volumeIndex ^ 1;
+		if ( step )
+		{
+			// The step before wrote what this one reads and read what it writes. Both
+			// buffers decay to the common state again once the list has run.
+			D3D12_RESOURCE_BARRIER swapBarriers[] = {
+				CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer[read].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE ),
+				CD3DX12_RESOURCE_BARRIER::Transition( m_volumeBuffer[write].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ),
+				CD3DX12_RESOURCE_BARRIER::UAV( m_brickStateBuffer.Get() )
+			};
+			m_computeCmdList->ResourceBarrier( 3, swapBarriers );
+		}
+		CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), VolumeSRVSlot + read, m_cbvsrvuavDescriptorSize );
+		CD3DX12_GPU_DESCRIPTOR_HANDLE uavHandle( m_cbvsrvuavHeap->GetGPUDescriptorHandleForHeapStart(), UAVTableSlot + write * UAVTableSize, m_cbvsrvuavDescriptorSize );
+		m_computeCmdList->SetPipelineState( m_computeState.Get() );
+		m_computeCmdList->SetComputeRootDescriptorTable( RootParameterSRV, srvHandle );
+		m_computeCmdList->SetComputeRootDescriptorTable( RootParameterUAV, uavHandle );
+		m_computeCmdList->Dispatch( VolumeBrickCount( m_volumeWidth ), VolumeBrickCount( m_volumeHeight ), VolumeBrickCount( m_volumeDepth ) );
+
+		// Bring the ranges of the cells holding stepped bricks up to date
+		if ( m_emptySpaceSkipping )
+		{
+			D3D12_RESOURCE_BARRIER uavBarriers[] = {
+				CD3DX12_RESOURCE_BARRIER::UAV( m_brickStateBuffer.Get() ),
+				CD3DX12_RESOURCE_BARRIER::UAV( m_brickRangeBuffer[write].Get() )
+			};
+			m_computeCmdList->ResourceBarrier( 2, uavBarriers );
+			m_computeCmdList->SetPipelineState( m_rangeComputeState.Get() );
+			m_computeCmdList->Dispatch( VolumeCellCount( m_volumeWidth ), VolumeCellCount( m_volumeHeight ), VolumeCellCount( m_volumeDepth ) );
+		}
 
-	m_computeCmdList->SetComputeRootDescriptorTable( RootParameterCBV, cbvHandle );
-	m_computeCmdList->SetComputeRootDescriptorTable( RootParameterUAV, uavHandle );
-	m_computeCmdList->Dispatch( m_volumeWidth / 8, m_volumeHeight/ 8, m_volumeDepth/ 8);
+		// Rebuild the mip bricks over the bricks csmain stepped, a level after the one above it
+		for ( UINT level = 1; level <= m_mipLevels; level++ )
+		{
+			D3D12_RESOURCE_BARRIER uavBarriers[] = {
+				CD3DX12_RESOURCE_BARRIER::UAV( m_volumeBuffer[write].Get() ),
+				CD3DX12_RESOURCE_BARRIER::UAV( m_brickStateBuffer.Get() ),
+				CD3DX12_RESOURCE_BARRIER::UAV( m_volumeMipBuffer[write].Get() )
+			};
+			m_computeCmdList->ResourceBarrier( 3, uavBarriers );
+			m_computeCmdList->SetPipelineState( m_mipComputeState[level - 1].Get() );
+			UINT round = ( 1u << level ) - 1;
+			m_computeCmdList->Dispatch( VolumeBrickCount( ( m_volumeWidth + round ) >> level ), VolumeBrickCount( ( m_volumeHeight + round ) >> level ),
+										VolumeBrickCount( ( m_volumeDepth + round ) >> level ) );
+		}
+		m_volumeIndex = write;
+	}
+
+	// Copy the stepped brick counter out for ReadFrameCounters
+	m_computeCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_brickStateBuffer.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE ) );
+	m_computeCmdList->CopyBufferRegion( frame.counterReadback.Get(), 0, m_brickStateBuffer.Get(), m_brickCount * sizeof( UINT ), sizeof( UINT ) );
+	m_computeCmdList->ResourceBarrier( 1, &CD3DX12_RESOURCE_BARRIER::Transition( m_brickStateBuffer.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS ) );
+	m_computeCmdList->EndQuery( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query + 1 );
+	m_computeCmdList->ResolveQueryData( m_timestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query, 2, frame.counterReadback.Get(), CounterBytes );
 	m_computeCmdList->Close();
 }
 
-void VolumetricAnimation::WaitForGraphicsCmd()
+// The counters only grow, the difference to the last read is the number of bricks
+// csmain did not skip and the samples and rays of psmain in the frame. Frames are
+// read as they retire, up to m_framesInFlight behind the one recorded. The steps are
+// overlapped as far as they ran alongside the graphics work of the frame recorded
+// before, the only one they can: csmain waits for that of the frame before last and
+// psmain of the frame for csmain. That frame's context comes before this one and was
+// read before it, its render window stays until its context is read again. A frame
+// without steps left the stepped brick counter and its step timestamps alone.
+void VolumetricAnimation::ReadFrameCounters( FrameContext& frame )
 {
 	HRESULT hr;
-	// WAITING FOR THE FRAME TO COMPLETE BEFORE CONTINUING IS NOT BEST PRACTICE.
-	// This is code implemented as such for simplicity. More advanced samples 
-	// illustrate how to use fences for efficient resource usage.
-
-	// Signal and increment the fence value.
-	const UINT64 fence = m_fenceValue;
-	V( m_graphicCmdQueue->Signal( m_fence.Get(), fence ) );
-	m_fenceValue++;
-
-	// Wait until the previous frame is finished.
-	if ( m_fence->GetCompletedValue() < fence )
+	UINT8* pData;
+	CD3DX12_RANGE readRange( 0, CounterBytes + TimestampsPerFrame * sizeof( UINT64 ) );
+	V( frame.counterReadback->Map( 0, &readRange, reinterpret_cast< void** >( &pData ) ) );
+	const UINT* pCounter = reinterpret_cast< const UINT* >( pData );
+	const UINT64* pTimestamp = reinterpret_cast< const UINT64* >( pData + CounterBytes );
+	UINT total = frame.steps ? pCounter[0] : m_steppedBrickTotal;
+	UINT samples = pCounter[1] - m_sampleTotal;
+	UINT skipped = pCounter[2] - m_skippedSampleTotal;
+	UINT rays = pCounter[3] - m_rayTotal;
+	m_sampleTotal = pCounter[1];
+	m_skippedSampleTotal = pCounter[2];
+	m_rayTotal = pCounter[3];
+	double stepBegin = QueueSeconds( m_computeClock, pTimestamp[0] );
+	double stepEnd = QueueSeconds( m_computeClock, pTimestamp[1] );
+	double renderBegin = QueueSeconds( m_graphicsClock, pTimestamp[2] );
+	double renderEnd = QueueSeconds( m_graphicsClock, pTimestamp[3] );
+	CD3DX12_RANGE writeRange( 0, 0 );
+	frame.counterReadback->Unmap( 0, &writeRange );
+
+	if ( !frame.steps ) stepBegin = stepEnd = 0.0;
+
+	// Per step of the frame
+	UINT activeBricks = frame.steps ? ( total - m_steppedBrickTotal ) / frame.steps : 0;
+	m_steppedBrickTotal = total;
+	const UINT index = static_cast< UINT >( &frame - m_frames );
+	const FrameContext& before = m_frames[( index + m_framesInFlight - 1 ) % m_framesInFlight];
+	double overlap = max( 0.0, min( stepEnd, before.renderEnd ) - max( stepBegin, before.renderBegin ) );
+	frame.renderBegin = renderBegin;
+	frame.renderEnd = renderEnd;
+
+	wchar_t buffer[256];
+	int length = swprintf( buffer, 256, L"%S%s, %u mips, %u/%u bricks active",
+						   GetCompositingName( static_cast< RaymarchCompositing >( m_compositing ) ),
+						   m_emptySpaceSkipping ? L", skipping" : L"", m_mipLevels, activeBricks, m_brickCount );
+	if ( m_sampleCounters )
+		length += swprintf( buffer + length, 256 - length, L", %.1f samples/ray", rays ? static_cast< double >( samples ) / rays : 0.0 );
+	if ( m_sampleCounters && m_emptySpaceSkipping )
+		length += swprintf( buffer + length, 256 - length, L", %.1f%% samples skipped", samples ? 100.0 * skipped / samples : 0.0 );
+	length += swprintf( buffer + length, 256 - length, L", %u in flight", m_framesInFlight );
+	length += swprintf( buffer + length, 256 - length, L", %u steps %.2f ms %.0f%% overlapped", frame.steps,
+						( stepEnd - stepBegin ) * 1000.0, stepEnd > stepBegin ? 100.0 * overlap / ( stepEnd - stepBegin ) : 0.0 );
+	if ( m_droppedSteps ) swprintf( buffer + length, 256 - length, L", %u steps dropped", m_droppedSteps );
+	m_frameStats = buffer;
+	if ( m_capture )
 	{
-		V( m_fence->SetEventOnCompletion( fence, m_fenceEvent ) );
-		WaitForSingleObject( m_fenceEvent, INFINITE );
+		CaptureStats stats = m_capture->GetStats();
+		swprintf( buffer, 256, L", captured %llu dropped %llu queued %u", stats.written, stats.dropped, stats.queueDepth );
+		m_frameStats += buffer;
 	}
 }
 
-void VolumetricAnimation::WaitForComputeCmd()
+// A timestamp of the queue clock belongs to in seconds on the QueryPerformanceCounter
+// clock, so those of both queues compare
+double VolumetricAnimation::QueueSeconds( const QueueClock& clock, UINT64 timestamp ) const
+{
+	INT64 ticks = static_cast< INT64 >( timestamp - clock.gpuTimestamp );
+	return static_cast< double >( clock.cpuTimestamp ) / m_cpuFrequency + static_cast< double >( ticks ) / clock.frequency;
+}
+
+// Flushes both queues, graphics waits for compute, and retires the frames in flight
+// oldest first
+void VolumetricAnimation::WaitForGraphicsCmd()
 {
 	HRESULT hr;
 
 	// Signal and increment the fence value.
 	const UINT64 fence = m_fenceValue;
-	V( m_computeCmdQueue->Signal( m_fence.Get(), fence ) );
+	V( m_graphicCmdQueue->Signal( m_fence.Get(), fence ) );
 	m_fenceValue++;
 
-	// Wait until the previous frame is finished.
-	if ( m_fence->GetCompletedValue() < fence )
-	{
-		V( m_fence->SetEventOnCompletion( fence, m_fenceEvent ) );
-		WaitForSingleObject( m_fenceEvent, INFINITE );
-	}
+	WaitForFence( m_fence.Get(), fence, m_fenceEvent );
+	for ( UINT i = 0; i < m_framesInFlight; i++ )
+		RetireFrame( m_frames[( m_contextIndex + i ) % m_framesInFlight] );
+}
+
+// Waits for the frame if it is still in flight, then reads its counters and capture
+void VolumetricAnimation::RetireFrame( FrameContext& frame )
+{
+	if ( !frame.fenceValue ) return;
+	WaitForFence( m_fence.Get(), frame.fenceValue, m_fenceEvent );
+	frame.fenceValue = 0;
+	ReadFrameCounters( frame );
+	if ( m_capture && frame.captureReadback ) CaptureFrame( frame );
 }
\ No newline at end of file
@@ -3,6 +3,13 @@
 #include "DX12Framework.h"
 #include "Camera.h"
 #include "StepTimer.h"
+#include "VolumeLayout.h"
+
+#include <memory>
+#include <string>
+
+class FrameCapture;
+class MappedVolumeFile;
 
 using namespace DirectX;
 using namespace Microsoft::WRL;
@@ -12,6 +19,7 @@ class VolumetricAnimation : public DX12Framework
 {
 public:
 	VolumetricAnimation( UINT width, UINT height, std::wstring name );
+	~VolumetricAnimation();
 
 protected:
 	virtual HRESULT OnInit();
@@ -23,6 +31,20 @@ protected:
 
 private:
 	static const UINT FrameCount = 5;
+	static const UINT MaxMipLevels = 8;
+	// Steps one frame batches at most when it fell behind m_stepRate, the rest drop
+	static const UINT MaxStepsPerFrame = 8;
+	// Of the swap chain and of the offscreen targets of headless runs
+	static const DXGI_FORMAT BackBufferFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	// Descriptor heap slots: the first unused (the constants are a root CBV), the SRVs
+	// of both volume buffers, then the UAVs u0 to u4 of each volume buffer's set. Both
+	// sets view the same brick state and render counter buffers.
+	static const UINT VolumeSRVSlot = 1;
+	static const UINT UAVTableSlot = 3;
+	static const UINT UAVTableSize = 5;
+	// Counters then timestamps in the counterReadback of a frame
+	static const UINT CounterBytes = 4 * sizeof( UINT );
+	static const UINT TimestampsPerFrame = 4;
 
 	struct Vertex
 	{
@@ -35,6 +57,38 @@ private:
 		XMFLOAT4 viewPos;
 		XMINT4 colVal[6];
 		XMINT4 bgCol;
+		float lodScale;
+	};
+
+	// What a frame in flight holds on to until the graphics queue reaches fenceValue.
+	// OnRender takes them round robin and waits only for the one it reuses.
+	struct FrameContext
+	{
+		ComPtr<ID3D12CommandAllocator> graphicCmdAllocator;
+		ComPtr<ID3D12CommandAllocator> computeCmdAllocator;
+		// Slice of m_constantBuffer, mapped and as the root CBV
+		UINT8* pCbvData;
+		D3D12_GPU_VIRTUAL_ADDRESS cbvAddress;
+		// The stepped brick, sample, skipped sample and ray counters of the frame, then
+		// the begin and end timestamps of its step and of its graphics work
+		ComPtr<ID3D12Resource> counterReadback;
+		// -capture: the frame's back buffer
+		ComPtr<ID3D12Resource> captureReadback;
+		// 0 once the frame is retired, see RetireFrame
+		UINT64 fenceValue;
+		// Volume steps the frame ran, 0 if it only rendered
+		UINT steps;
+		// Its graphics work in seconds on the CPU clock, once ReadFrameCounters read it
+		double renderBegin;
+		double renderEnd;
+	};
+
+	// A queue's timestamp and the QueryPerformanceCounter value at the same moment
+	struct QueueClock
+	{
+		UINT64 gpuTimestamp;
+		UINT64 cpuTimestamp;
+		UINT64 frequency;
 	};
 
 	// Pipeline objects.
@@ -43,23 +97,26 @@ private:
 	ComPtr<IDXGISwapChain3> m_swapChain;
 	ComPtr<ID3D12Device> m_device;
 	ComPtr<ID3D12Resource> m_renderTargets[FrameCount];
-	ComPtr<ID3D12CommandAllocator> m_graphicCmdAllocator;
 	ComPtr<ID3D12GraphicsCommandList> m_graphicCmdList;
 	ComPtr<ID3D12CommandQueue> m_graphicCmdQueue;
 	ComPtr<ID3D12RootSignature> m_graphicsRootSignature;
 	ComPtr<ID3D12DescriptorHeap> m_rtvHeap;
 	ComPtr<ID3D12DescriptorHeap> m_dsvHeap;
 	ComPtr<ID3D12DescriptorHeap> m_cbvsrvuavHeap;
+	// TimestampsPerFrame per frame context
+	ComPtr<ID3D12QueryHeap> m_timestampHeap;
 	ComPtr<ID3D12PipelineState> m_pipelineState;
 	UINT m_rtvDescriptorSize;
 	UINT m_cbvsrvuavDescriptorSize;
 
 	// Compute objects.
 	ComPtr<ID3D12RootSignature> m_computeRootSignature;
-	ComPtr<ID3D12CommandAllocator> m_computeCmdAllocator;
 	ComPtr<ID3D12CommandQueue> m_computeCmdQueue;
 	ComPtr<ID3D12GraphicsCommandList> m_computeCmdList;
 	ComPtr<ID3D12PipelineState> m_computeState;
+	ComPtr<ID3D12PipelineState> m_rangeComputeState;
+	// csmip of every mip level
+	ComPtr<ID3D12PipelineState> m_mipComputeState[MaxMipLevels];
 
 	// App resources.
 	ComPtr<ID3D12Resource> m_depthBuffer;
@@ -68,22 +125,92 @@ private:
 	D3D12_VERTEX_BUFFER_VIEW m_vertexBufferView;
 	ComPtr<ID3D12Resource> m_indexBuffer;
 	D3D12_INDEX_BUFFER_VIEW m_indexBufferView;
-	ComPtr<ID3D12Resource> m_volumeBuffer;
+	// Double buffered, a step reads one and writes the other while psmain of the
+	// frame before reads the first. The brick ranges and mips come in a set per buffer.
+	ComPtr<ID3D12Resource> m_volumeBuffer[2];
+	// Per brick states followed by the stepped brick counter, see csmain
+	ComPtr<ID3D12Resource> m_brickStateBuffer;
+	// Per brick then per cell value ranges for empty space skipping, see csrange
+	ComPtr<ID3D12Resource> m_brickRangeBuffer[2];
+	// Mip levels of the volume back to back, see csmip
+	ComPtr<ID3D12Resource> m_volumeMipBuffer[2];
+	// psmain's sample, skipped sample and ray counters, graphics queue only
+	ComPtr<ID3D12Resource> m_renderCounterBuffer;
 
 	CModelViewerCamera m_camera;
 	StepTimer m_timer;
+	// Fixed timestep of the volume, m_stepRate steps a second whatever the frame rate;
+	// headless runs advance it by -timestep every frame
+	StepTimer m_simTimer;
+	// -steprate N, volume steps per second
+	UINT m_stepRate;
+	// Steps OnUpdate found due for the frame to record
+	UINT m_pendingSteps;
+	// Steps dropped beyond MaxStepsPerFrame since startup
+	UINT m_droppedSteps;
+	// Steps recorded since startup
+	UINT m_stepTotal;
 	ConstantBuffer m_constantBufferData;
-	UINT8* m_pCbvDataBegin;
 
 	// Synchronization objects.
 	UINT m_frameIndex;
 	HANDLE m_fenceEvent;
+	// Signaled by the graphics queue, m_computeFence by the compute queue
 	ComPtr<ID3D12Fence> m_fence;
 	UINT64 m_fenceValue;
+	ComPtr<ID3D12Fence> m_computeFence;
+	UINT64 m_computeFenceValue;
+	FrameContext m_frames[FrameCount];
+	// -inflight N: frames queued ahead of the GPU at most, 1 to FrameCount
+	UINT m_framesInFlight;
+	// m_frames index of the frame being recorded
+	UINT m_contextIndex;
+	// The volume buffer holding the last step, psmain reads it and the next step
+	// writes the other one
+	UINT m_volumeIndex;
+	// m_fence value of the last frame that read each volume buffer, the step writing
+	// it waits for that on the GPU
+	UINT64 m_volumeFenceValue[2];
+	// Timestamps of both queues on the CPU clock, see QueueSeconds
+	UINT64 m_cpuFrequency;
+	QueueClock m_computeClock;
+	QueueClock m_graphicsClock;
 
+	// Any size, not only multiples of the brick size; the shaders get them as
+	// VOLUME_WIDTH, VOLUME_HEIGHT and VOLUME_DEPTH
 	UINT m_volumeWidth;
 	UINT m_volumeHeight;
 	UINT m_volumeDepth;
+	// VOLUME_LAYOUT_* of m_volumeBuffer, see VolumeLayout.h
+	UINT m_volumeLayout;
+	UINT m_volumeStorageCount;
+	// Start volume, an index into the scene registry of VolumeScene.h
+	UINT m_scene;
+	// -volumefile: prebuilt start volume uploaded straight from the mapping instead of
+	// m_scene, released once the upload is recorded
+	std::unique_ptr<MappedVolumeFile> m_volumeFile;
+	// -capture: every presented frame is copied to the captureReadback of its frame
+	// context and handed to m_capture once retired, which writes it on its own thread;
+	// frames drop rather than stall
+	std::string m_capturePath;
+	std::unique_ptr<FrameCapture> m_capture;
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT m_captureFootprint;
+
+	UINT m_brickCount;
+	UINT m_cellCount;
+	UINT m_steppedBrickTotal;
+	UINT m_sampleTotal;
+	UINT m_skippedSampleTotal;
+	UINT m_rayTotal;
+	// SAMPLE_COUNTERS of the shaders, the samples/ray of the frame stats
+	bool m_sampleCounters;
+	// EMPTY_SPACE_SKIPPING of the shaders
+	bool m_emptySpaceSkipping;
+	// COMPOSITING of the shaders, RaymarchCompositing in VolumeRaymarch.h
+	UINT m_compositing;
+	// MIP_LEVELS of the shaders, 0 always marches the volume itself
+	UINT m_mipLevels;
+	UINT m_mipStorageCount;
 
 	// Indices in the root parameter table.
 	enum RootParameters : UINT32
@@ -94,11 +221,18 @@ private:
 		RootParametersCount
 	};
 
+	void ParseVolumeArgs();
+	float GetVolumeExtentScale() const;
 	HRESULT LoadPipeline();
 	HRESULT LoadAssets();
 	HRESULT LoadSizeDependentResource();
-	void PopulateGraphicsCommandList();
-	void PopulateComputeCommandList();
+	void PopulateGraphicsCommandList( FrameContext& frame );
+	void PopulateComputeCommandList( FrameContext& frame );
 	void WaitForGraphicsCmd();
-	void WaitForComputeCmd();
+	void RetireFrame( FrameContext& frame );
+	void ReadFrameCounters( FrameContext& frame );
+	bool CheckHeadlessSteps();
+	double QueueSeconds( const QueueClock& clock, UINT64 timestamp ) const;
+	HRESULT CreateCapture();
+	void CaptureFrame( FrameContext& frame );
 };
@@ -1,7 +1,69 @@
 #include"D3DX_DXGIFormatConvert.inl"// this file provide utility funcs for format conversion
+#include "VolumeLayout.h"// voxel addressing shared with the C++ side
+
+// Set by VolumetricAnimation::LoadAssets. The volume can have any size, bricks and
+// cells along its far faces are partial then.
+#ifndef VOLUME_WIDTH
+#define VOLUME_WIDTH 256
+#endif
+#ifndef VOLUME_HEIGHT
+#define VOLUME_HEIGHT 256
+#endif
+#ifndef VOLUME_DEPTH
+#define VOLUME_DEPTH 256
+#endif
+#ifndef VOLUME_LAYOUT
+#define VOLUME_LAYOUT VOLUME_LAYOUT_LINEAR
+#endif
+// Jump over runs of uniform bricks and cells in psmain
+#ifndef EMPTY_SPACE_SKIPPING
+#define EMPTY_SPACE_SKIPPING 1
+#endif
+// How psmain combines its samples, the RaymarchCompositing values of VolumeRaymarch.h
+#define COMPOSITING_ADDITIVE 0
+#define COMPOSITING_FRONT_TO_BACK 1
+#ifndef COMPOSITING
+#define COMPOSITING COMPOSITING_ADDITIVE
+#endif
+// Count the rays psmain casts and the samples it takes in g_bufRenderCounters. Every
+// pixel adds to the same counters, so they are off unless -samplecounters asks for them.
+#ifndef SAMPLE_COUNTERS
+#define SAMPLE_COUNTERS 0
+#endif
+// Levels of the mip chain in g_bufVolumeMips, psmain marches distant rays on them.
+// csmip is compiled once per level with MIP_LEVEL set.
+#ifndef MIP_LEVELS
+#define MIP_LEVELS 0
+#endif
+#ifndef MIP_LEVEL
+#define MIP_LEVEL 1
+#endif
 SamplerState samRaycast : register( s0 );
+// The volume is double buffered: csmain reads the last step through the SRV and writes
+// the next one through the UAV, while psmain marches the last one. Brick ranges and
+// mips come in a set per volume buffer too.
 StructuredBuffer<uint> g_bufVolumeSRV : register( t0 );
 RWStructuredBuffer<uint> g_bufVolumeUAV : register( u0 );
+// One state per 8x8x8 brick (csmain thread group): BRICK_CHANGED while the brick is
+// active, BRICK_SETTLED for the one step in which it was stepped without changing,
+// then BRICK_IDLE. The element after the last brick counts the bricks stepped since
+// startup.
+RWStructuredBuffer<uint> g_bufBrickState : register( u1 );
+// Per channel minimum (x) and maximum (y) of every brick, followed by those of every
+// 32x32x32 cell. A brick or cell whose minimum equals its maximum holds one value.
+RWStructuredBuffer<uint2> g_bufBrickRange : register( u2 );
+#if MIP_LEVELS
+// Levels 1 to MIP_LEVELS of the volume back to back in the linear layout, each voxel
+// the rounded 2x2x2 average of the level above. Same as VolumeMipChain in VolumeMip.h.
+RWStructuredBuffer<uint> g_bufVolumeMips : register( u3 );
+#endif
+// The samples psmain took since startup, how many of them it jumped over and its rays.
+// Only the graphics queue writes it, so psmain may run while csmain does.
+RWStructuredBuffer<uint> g_bufRenderCounters : register( u4 );
+
+#define BRICK_IDLE 0
+#define BRICK_CHANGED 1
+#define BRICK_SETTLED 2
 
 cbuffer cbChangesEveryFrame : register( b0 )
 {
@@ -12,6 +74,8 @@ cbuffer cbChangesEveryFrame : register( b0 )
 	// will increase the frametime from 5.5ms to 21ms!!
 	uint4 colVal[6];
 	uint4 bgCol;
+	// Size of a pixel in voxels at distance 1 from the eye, RaymarchParams::lodScale
+	float lodScale;
 };
 
 // Comment out the uint4 colVal1[6]; uint4 bgCol1; two lines and uncomment this block will
@@ -27,12 +91,21 @@ cbuffer cbChangesEveryFrame : register( b0 )
 //static uint4 bgCol = uint4( 64, 64, 64, 64 );
 
 // TSDF related variable
-static const float3 voxelResolution = float3( 256, 256, 256 );// float3( VOLUME_SIZE, VOLUME_SIZE, VOLUME_SIZE );
+static const float3 voxelResolution = float3( VOLUME_WIDTH, VOLUME_HEIGHT, VOLUME_DEPTH );
 static const float3 boxMin = float3( -1.0, -1.0, -1.0 )*voxelResolution / 2.0f;
 static const float3 boxMax = float3( 1.0, 1.0, 1.0 )*voxelResolution / 2.0f;
 static const float3 reversedWidthHeightDepth = 1.0f / ( voxelResolution );
+static const uint3 volumeSize = uint3( voxelResolution );
+// VolumeBrickCount and VolumeCellCount of every axis
+static const uint3 brickResolution = ( volumeSize + VOLUME_BRICK_SIZE - 1 ) / VOLUME_BRICK_SIZE;
+static const uint brickCount = brickResolution.x * brickResolution.y * brickResolution.z;
+static const uint3 cellResolution = ( volumeSize + VOLUME_CELL_SIZE - 1 ) / VOLUME_CELL_SIZE;
 
 static const float density = 0.01;
+// Front to back compositing: opacity of a sample whose brightest channel is 1, and
+// the accumulated opacity at which a ray ends
+static const float opacity = 0.5;
+static const float terminationOpacity = 0.99;
 
 //--------------------------------------------------------------------------------------
 // Structures
@@ -71,6 +144,138 @@ bool IntersectBox( Ray r, float3 boxmin, float3 boxmax, out float tnear, out flo
 	return tnear <= tfar;
 }
 
+#if EMPTY_SPACE_SKIPPING
+// A block the ray crosses in less than two steps costs more to jump than to
+// sample, so with steps over half a brick only cells are jumped, see JumpCellsOnly
+bool JumpCellsOnly( float stepSize )
+{
+	return stepSize * 2 > VOLUME_BRICK_SIZE;
+}
+
+// Range of the cell or brick holding voxel idx
+uint2 BlockRange( uint3 idx, bool cell )
+{
+	return g_bufBrickRange[cell ? brickCount + VolumeCellIndex( idx.x, idx.y, idx.z, cellResolution.x, cellResolution.y )
+								: VolumeBrickIndex( idx.x, idx.y, idx.z, brickResolution.x, brickResolution.y )];
+}
+
+// Value of the uniform block holding voxel idx, false if it is not uniform. The
+// block is the brick or, with JumpCellsOnly, the cell.
+bool UniformValue( uint3 idx, float stepSize, out uint value )
+{
+	uint2 range = BlockRange( idx, JumpCellsOnly( stepSize ) );
+	value = range.x;
+	return range.x == range.y;
+}
+
+// Samples a ray at voxel space position p with step s takes before it leaves the
+// edge sized block holding voxel idx or passes tfar, at least one
+float BlockSteps( float3 p, float3 invS, uint3 idx, uint edge, float t, float tfar, float invStepSize )
+{
+	float n = floor( ( tfar - t ) * invStepSize ) + 1;
+	float3 lo = idx & ~( edge - 1 );
+	float3 hi = min( lo + edge, voxelResolution );
+	float3 k = invS > 0 ? ceil( ( hi - p ) * invS ) : floor( ( lo - p ) * invS ) + 1;
+	n = min( n, min( k.x, min( k.y, k.z ) ) );
+	return max( n, 1 );
+}
+
+// Samples a ray at p, in a block UniformValue found to hold value only, takes
+// before it leaves the run of blocks holding value only, the same walk as
+// UniformRunSteps in VolumeRaymarch.inl
+float UniformRunSteps( uint value, float3 p, float3 s, float3 invS, uint3 idx, float t, float tfar, float stepSize )
+{
+	bool cellsOnly = JumpCellsOnly( stepSize );
+	float steps = 0;
+	float3 q = p;
+	[loop]
+	for ( ;; )
+	{
+		uint edge = cellsOnly || all( BlockRange( idx, true ) == value ) ? VOLUME_CELL_SIZE : VOLUME_BRICK_SIZE;
+		steps += BlockSteps( q, invS, idx, edge, t + stepSize * steps, tfar, 1.f / stepSize );
+		if ( t + stepSize * steps > tfar ) break;
+		q = p + s * steps;
+		idx = ( uint3 )( int3 )q;
+		if ( any( idx >= volumeSize ) || any( BlockRange( idx, cellsOnly ) != value ) ) break;
+	}
+	return steps;
+}
+#endif
+
+#if MIP_LEVELS
+// Voxels of the mip level along each axis, level 0 is the volume
+uint3 MipSize( uint level )
+{
+	return ( volumeSize + ( 1u << level ) - 1 ) >> level;
+}
+
+// First element of the mip level in g_bufVolumeMips
+uint MipOffset( uint level )
+{
+	uint offset = 0;
+	for ( uint l = 1; l < level; l++ )
+	{
+		uint3 size = MipSize( l );
+		offset += size.x * size.y * size.z;
+	}
+	return offset;
+}
+
+// Mip level for a ray entering the box at tnear, the coarsest one whose voxels are no
+// larger than the pixel there. Same as SelectLod in VolumeRaymarch.cpp.
+uint SelectLod( float tnear )
+{
+	float footprint = max( tnear, 0 ) * lodScale;
+	uint level = 0;
+	[loop]
+	while ( level < MIP_LEVELS && ( float )( 2u << level ) <= footprint ) level++;
+	return level;
+}
+
+// psmain on a mip level at the same steps, without skipping
+float4 MarchMip( Ray eyeray, float tnear, float tfar, float stepSize, uint level, out uint samples )
+{
+	float4 output = float4( 0, 0, 0, 0 );
+	float scale = 1.f / ( 1u << level );
+	uint3 size = MipSize( level );
+	uint offset = MipOffset( level );
+	samples = 0;
+	[loop]
+	for ( float t = tnear; t <= tfar; t += stepSize )
+	{
+		samples++;
+		int3 idx = ( eyeray.o.xyz + eyeray.d.xyz * t ) * scale + ( float3 )size * 0.5;
+		if ( any( ( uint3 )idx >= size ) ) continue;
+		float4 value = D3DX_R8G8B8A8_UINT_to_UINT4( g_bufVolumeMips[offset + VolumeVoxelIndex( VOLUME_LAYOUT_LINEAR, idx.x, idx.y, idx.z, size.x, size.y )] ) / 256.f;
+#if COMPOSITING == COMPOSITING_FRONT_TO_BACK
+		float a = min( opacity * max( value.r, max( value.g, value.b ) ), 1 );
+		float w = ( 1 - output.a ) * a;
+		output.rgb += w * value.rgb;
+		output.a += w;
+		if ( output.a >= terminationOpacity ) break;
+#else
+		output += value * density;
+#endif
+	}
+	return output;
+}
+#endif
+
+#if COMPOSITING == COMPOSITING_FRONT_TO_BACK
+// Weight of steps equal samples of opacity a behind accumulated opacity alpha, a run
+// is cut at the sample that reaches terminationOpacity. Same as CompositeWeight in
+// VolumeRaymarch.inl.
+float CompositeWeight( float a, float alpha, inout float steps )
+{
+	float transparency = 1 - alpha;
+	if ( a <= 0 ) return 0;
+	if ( steps == 1 ) return transparency * a;
+	float keep = 1 - a;
+	steps = min( steps, max( ceil( log( ( 1 - terminationOpacity ) / transparency ) / log( keep ) ), 1 ) );
+	return transparency * ( 1 - pow( keep, steps ) );
+}
+#endif
+
 //--------------------------------------------------------------------------------------
 // Vertex Shader
 //--------------------------------------------------------------------------------------
@@ -115,31 +320,228 @@ float4 psmain( VSOutput input ) : SV_TARGET
 
 	float3 currentPixPos;
 
+#if MIP_LEVELS
+	// Rays whose pixel covers several voxels where they enter take a coarser level
+	uint level = SelectLod( tnear );
+	if ( level > 0 )
+	{
+		uint mipSamples;
+		output = MarchMip( eyeray, tnear, tfar, tSmallStep, level, mipSamples );
+#if SAMPLE_COUNTERS
+		InterlockedAdd( g_bufRenderCounters[0], mipSamples );
+		InterlockedAdd( g_bufRenderCounters[2], 1 );
+#endif
+		return output;
+	}
+#endif
+
+#if EMPTY_SPACE_SKIPPING
+	float3 invStep = 1.f / PsmallStep;
+#endif
+#if SAMPLE_COUNTERS
+	uint samples = 0;
+	uint skipped = 0;
+#endif
 	while ( t <= tfar ) {
 		int3 idx = P + voxelResolution * 0.5;
-		float4 value = D3DX_R8G8B8A8_UINT_to_UINT4( g_bufVolumeSRV[idx.x + idx.y*voxelResolution.x + idx.z*voxelResolution.y * voxelResolution.x] ) / 256.f;
+		// A sample rounded onto the far faces adds nothing, like MarchRay
+		bool inside = all( ( uint3 )idx < volumeSize );
+		float4 value = inside ? D3DX_R8G8B8A8_UINT_to_UINT4( g_bufVolumeSRV[VolumeVoxelIndex( VOLUME_LAYOUT, idx.x, idx.y, idx.z, volumeSize.x, volumeSize.y )] ) / 256.f : 0;
 
-		output += value * density;
+		// A run of uniform bricks adds the same value at every sample, take them at once
+		float steps = 1;
+#if EMPTY_SPACE_SKIPPING
+		uint uniformValue;
+		if ( inside && UniformValue( idx, tSmallStep, uniformValue ) )
+			steps = UniformRunSteps( uniformValue, P + voxelResolution * 0.5, PsmallStep, invStep, idx, t, tfar, tSmallStep );
+#endif
+
+#if COMPOSITING == COMPOSITING_FRONT_TO_BACK
+		float a = min( opacity * max( value.r, max( value.g, value.b ) ), 1 );
+		float w = CompositeWeight( a, output.a, steps );
+		output.rgb += w * value.rgb;
+		output.a += w;
+#else
+		output += value * density * steps;
+#endif
+#if SAMPLE_COUNTERS
+		samples += ( uint )steps;
+		skipped += ( uint )steps - 1;
+#endif
 
-		P += PsmallStep;
-		t += tSmallStep;
+		P += PsmallStep * steps;
+		t += tSmallStep * steps;
+#if COMPOSITING == COMPOSITING_FRONT_TO_BACK
+		// Early ray termination, nothing behind an opaque sample shows
+		if ( output.a >= terminationOpacity ) break;
+#endif
 	}
+#if SAMPLE_COUNTERS
+	InterlockedAdd( g_bufRenderCounters[0], samples );
+	InterlockedAdd( g_bufRenderCounters[1], skipped );
+	InterlockedAdd( g_bufRenderCounters[2], 1 );
+#endif
 	return output;
 }
 
 //--------------------------------------------------------------------------------------
 // Compute Shader
 //--------------------------------------------------------------------------------------
+groupshared uint gs_brickChanged;
+groupshared uint gs_rangeMin[4];
+groupshared uint gs_rangeMax[4];
+
+// A brick whose voxels all stayed the same is a fixed point of this shader, so it is
+// settled and later dispatches skip it. Same rule as VolumeEngine::Step. An active
+// brick writes all its voxels and its range in g_bufBrickRange, so the step that
+// settles it leaves both volume buffers and both range sets the same.
 [numthreads( 8, 8, 8 )]
-void csmain( uint3 DTid: SV_DispatchThreadID, uint Tid : SV_GroupIndex )
+void csmain( uint3 DTid: SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint Tid : SV_GroupIndex )
+{
+	uint brickIdx = Gid.x + Gid.y*brickResolution.x + Gid.z*brickResolution.x*brickResolution.y;
+	uint state = g_bufBrickState[brickIdx];
+	bool active = state == BRICK_CHANGED;
+	// Threads of a partial brick past the far faces have no voxel
+	bool inside = all( DTid < volumeSize );
+	if ( Tid == 0 ) gs_brickChanged = 0;
+	if ( Tid < 4 )
+	{
+		gs_rangeMin[Tid] = 255;
+		gs_rangeMax[Tid] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( active && inside )
+	{
+		// With the bricked layout this is brickIdx * VOLUME_BRICK_VOXELS + Tid
+		uint idx = VolumeVoxelIndex( VOLUME_LAYOUT, DTid.x, DTid.y, DTid.z, volumeSize.x, volumeSize.y );
+		uint packed = g_bufVolumeSRV[idx];
+		uint4 col = D3DX_R8G8B8A8_UINT_to_UINT4( packed );
+		// Phases past 5 are not animated, colVal[col.w] would read bgCol and lodScale
+		if ( col.w < 6 ) col.xyz -= colVal[col.w].xyz;
+		if ( !any( col.xyz - bgCol.xyz ) )
+		{
+			col.w = ( col.w + 1 ) % 6;
+			col.xyz = 255 * colVal[col.w].xyz + bgCol.xyz; // Let it overflow, it doesn't matter
+		}
+		uint result = D3DX_UINT4_to_R8G8B8A8_UINT( col );
+		g_bufVolumeUAV[idx] = result;
+		if ( result != packed ) gs_brickChanged = 1;
+#if EMPTY_SPACE_SKIPPING
+		col = D3DX_R8G8B8A8_UINT_to_UINT4( result );
+		[unroll] for ( uint c = 0; c < 4; c++ )
+		{
+			InterlockedMin( gs_rangeMin[c], col[c] );
+			InterlockedMax( gs_rangeMax[c], col[c] );
+		}
+#endif
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( Tid == 0 && active )
+	{
+		g_bufBrickState[brickIdx] = gs_brickChanged ? BRICK_CHANGED : BRICK_SETTLED;
+		InterlockedAdd( g_bufBrickState[brickCount], 1 );
+#if EMPTY_SPACE_SKIPPING
+		g_bufBrickRange[brickIdx] = uint2(
+			D3DX_UINT4_to_R8G8B8A8_UINT( uint4( gs_rangeMin[0], gs_rangeMin[1], gs_rangeMin[2], gs_rangeMin[3] ) ),
+			D3DX_UINT4_to_R8G8B8A8_UINT( uint4( gs_rangeMax[0], gs_rangeMax[1], gs_rangeMax[2], gs_rangeMax[3] ) ) );
+#endif
+	}
+	else if ( Tid == 0 && state == BRICK_SETTLED ) g_bufBrickState[brickIdx] = BRICK_IDLE;
+}
+
+#if EMPTY_SPACE_SKIPPING
+groupshared uint gs_cellChanged;
+
+// Runs after csmain, one thread group per cell and one thread per brick in it. A cell
+// holding a brick csmain stepped gets its range rebuilt from the brick ranges.
+[numthreads( 4, 4, 4 )]
+void csrange( uint3 DTid: SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint Tid : SV_GroupIndex )
 {
-	uint4 col = D3DX_R8G8B8A8_UINT_to_UINT4( g_bufVolumeUAV[DTid.x + DTid.y*voxelResolution.x + DTid.z*voxelResolution.x*voxelResolution.y] );
-	col.xyz -= colVal[col.w].xyz;
-	if ( !any( col.xyz - bgCol.xyz ) )
+	uint brickIdx = DTid.x + DTid.y*brickResolution.x + DTid.z*brickResolution.x*brickResolution.y;
+	if ( Tid == 0 ) gs_cellChanged = 0;
+	if ( Tid < 4 )
+	{
+		gs_rangeMin[Tid] = 255;
+		gs_rangeMax[Tid] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// After csmain the state of a brick is non zero only if it was stepped. A partial
+	// cell has threads past the last brick.
+	if ( all( DTid < brickResolution ) )
+	{
+		if ( g_bufBrickState[brickIdx] != 0 ) gs_cellChanged = 1;
+		uint2 range = g_bufBrickRange[brickIdx];
+		uint4 lo = D3DX_R8G8B8A8_UINT_to_UINT4( range.x );
+		uint4 hi = D3DX_R8G8B8A8_UINT_to_UINT4( range.y );
+		[unroll] for ( uint c = 0; c < 4; c++ )
+		{
+			InterlockedMin( gs_rangeMin[c], lo[c] );
+			InterlockedMax( gs_rangeMax[c], hi[c] );
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( Tid == 0 && gs_cellChanged )
+	{
+		uint cellIdx = Gid.x + Gid.y*cellResolution.x + Gid.z*cellResolution.x*cellResolution.y;
+		g_bufBrickRange[brickCount + cellIdx] = uint2(
+			D3DX_UINT4_to_R8G8B8A8_UINT( uint4( gs_rangeMin[0], gs_rangeMin[1], gs_rangeMin[2], gs_rangeMin[3] ) ),
+			D3DX_UINT4_to_R8G8B8A8_UINT( uint4( gs_rangeMax[0], gs_rangeMax[1], gs_rangeMax[2], gs_rangeMax[3] ) ) );
+	}
+}
+#endif
+
+#if MIP_LEVELS
+groupshared uint gs_mipChanged;
+
+// Voxel p of the level above MIP_LEVEL
+uint LoadMipParent( uint3 p, uint3 parentSize )
+{
+#if MIP_LEVEL == 1
+	return g_bufVolumeUAV[VolumeVoxelIndex( VOLUME_LAYOUT, p.x, p.y, p.z, volumeSize.x, volumeSize.y )];
+#else
+	return g_bufVolumeMips[MipOffset( MIP_LEVEL - 1 ) + VolumeVoxelIndex( VOLUME_LAYOUT_LINEAR, p.x, p.y, p.z, parentSize.x, parentSize.y )];
+#endif
+}
+
+// Runs after csmain and csrange once per level, level 1 first, one thread group per
+// brick of MIP_LEVEL. A brick over a volume brick csmain stepped is rebuilt, the rule
+// of VolumeMipChain::Update plus the step that settles a brick, for the other set.
+[numthreads( 8, 8, 8 )]
+void csmip( uint3 DTid: SV_DispatchThreadID, uint3 Gid : SV_GroupID, uint Tid : SV_GroupIndex )
+{
+	// Volume bricks under the group along each axis
+	const uint span = 1u << MIP_LEVEL;
+	if ( Tid == 0 ) gs_mipChanged = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	for ( uint i = Tid; i < span * span * span; i += 512 )
+	{
+		uint3 brick = Gid * span + uint3( i % span, ( i / span ) % span, i / ( span * span ) );
+		if ( all( brick < brickResolution ) &&
+			 g_bufBrickState[brick.x + ( brick.y + brick.z * brickResolution.y ) * brickResolution.x] != 0 )
+			gs_mipChanged = 1;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	uint3 size = MipSize( MIP_LEVEL );
+	if ( !gs_mipChanged || any( DTid >= size ) ) return;
+
+	// An odd sized level above repeats its last voxel
+	uint3 parentSize = MipSize( MIP_LEVEL - 1 );
+	uint3 lo = DTid * 2;
+	uint3 hi = min( lo + 1, parentSize - 1 );
+	uint4 sum = 4;
+	[unroll] for ( uint c = 0; c < 8; c++ )
 	{
-		col.w = ( col.w + 1 ) % 6;
-		col.xyz = 255 * colVal[col.w].xyz + bgCol.xyz; // Let it overflow, it doesn't matter
+		uint3 p = uint3( c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 4 ? hi.z : lo.z );
+		sum += D3DX_R8G8B8A8_UINT_to_UINT4( LoadMipParent( p, parentSize ) );
 	}
-	g_bufVolumeUAV[DTid.x + DTid.y*voxelResolution.x + DTid.z*voxelResolution.x*voxelResolution.y] = D3DX_UINT4_to_R8G8B8A8_UINT( col );
+	g_bufVolumeMips[MipOffset( MIP_LEVEL ) + VolumeVoxelIndex( VOLUME_LAYOUT_LINEAR, DTid.x, DTid.y, DTid.z, size.x, size.y )] =
+		D3DX_UINT4_to_R8G8B8A8_UINT( sum >> 3 );
 }
+#endif
 